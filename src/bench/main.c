@@ -0,0 +1,578 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * headless benchmark of the pixelpipe.
+ *
+ * runs the export pipe on the given images (or on a synthetic one) at fixed sizes, with opencl
+ * off, and reports wall time per module, throughput, peak memory and cache hit rates as json.
+ * with --iop every module's process() is timed on its own, on the synthetic image.
+ */
+
+#include "common/darktable.h"
+#include "common/cache_stats.h"
+#include "common/exif.h"
+#include "common/file_location.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/mipmap_cache.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <libintl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_SIZES 16
+
+typedef struct bench_image_t
+{
+  const char *filename;
+  const char *xmp_filename; // may be NULL
+  int32_t id;
+} bench_image_t;
+
+// times of one module, summed up over all runs
+typedef struct bench_module_t
+{
+  const char *op;
+  const char *multi_name;
+  double seconds;
+} bench_module_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [<input file> [<xmp file>]]... [--size <max edge>[,<max edge>...]] [--runs <n>] "
+                  "[--synthetic <width>x<height>] [--iop] [--only <op>[,<op>...]] [--output <json file>] "
+                  "[--core <darktable options>]\n",
+          progname);
+  fprintf(stderr, "  exports every image at each size (0 is full size) and reports the times as json.\n"
+                  "  without input files a synthetic image is used. --iop times the process() of each\n"
+                  "  module on its own on the synthetic image, --only limits that to the given modules.\n");
+}
+
+static int _cmp_double(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+// sorts the times, the fastest ends up first
+static double _median(double *t, const int n)
+{
+  qsort(t, n, sizeof(double), _cmp_double);
+  return n & 1 ? t[n / 2] : 0.5 * (t[n / 2 - 1] + t[n / 2]);
+}
+
+static void _json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; s && *s; s++)
+  {
+    if(*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+// smooth gradients with some noise on top, so that modules looking at local contrast have work to do.
+// the same for every run, so results can be compared.
+static void _synthetic_fill(float *buf, const int width, const int height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      uint32_t h = (uint32_t)((size_t)j * width + i) * 2654435761u;
+      h ^= h >> 15;
+      const float noise = 0.05f * ((h & 0xffff) / 65535.0f - 0.5f);
+      float *px = buf + 4 * ((size_t)j * width + i);
+      px[0] = CLAMP(i / (float)width + noise, 0.0f, 1.0f);
+      px[1] = CLAMP(j / (float)height + noise, 0.0f, 1.0f);
+      px[2] = CLAMP(0.5f * (px[0] + 1.0f - px[1]) + noise, 0.0f, 1.0f);
+      px[3] = 0.0f;
+    }
+}
+
+// writes the synthetic image as pfm, which goes through the same import as any other file
+static int _synthetic_write(const char *filename, const int width, const int height)
+{
+  float *buf = (float *)dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!buf) return 1;
+  _synthetic_fill(buf, width, height);
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    dt_free_align(buf);
+    return 1;
+  }
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  int err = 0;
+  for(int j = height - 1; j >= 0 && !err; j--)
+    for(int i = 0; i < width && !err; i++)
+      err = fwrite(buf + 4 * ((size_t)j * width + i), sizeof(float), 3, f) != 3;
+  fclose(f);
+  dt_free_align(buf);
+  return err;
+}
+
+static int32_t _import(const char *filename, const char *xmp_filename)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int32_t id = dt_image_import(filmid, filename, TRUE);
+  if(!id) return 0;
+  if(xmp_filename)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, xmp_filename, 1);
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+  return id;
+}
+
+// exports the image runs times with its longest edge at size (0 for full size)
+static int _bench_export(FILE *f, const bench_image_t *img, const int size, const int runs)
+{
+  double *times = (double *)calloc(runs, sizeof(double));
+  bench_module_t *modules = NULL;
+  int num_modules = 0;
+  int width = 0, height = 0, out_width = 0, out_height = 0;
+  double load = 0.0;
+  long int hits = 0, misses = 0;
+  int res = 0;
+
+  for(int r = 0; r < runs; r++)
+  {
+    dt_develop_t dev;
+    dt_dev_init(&dev, 0);
+    dt_mipmap_buffer_t buf;
+    const double load_start = dt_get_wtime();
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, img->id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+    // only the first run has to decode, the others find it in the cache
+    if(r == 0) load = dt_get_wtime() - load_start;
+    dt_dev_load_image(&dev, img->id);
+    width = dev.image_storage.width;
+    height = dev.image_storage.height;
+
+    dt_dev_pixelpipe_t pipe;
+    if(!buf.buf || !dt_dev_pixelpipe_init_export(&pipe, IMAGEIO_INT8))
+    {
+      fprintf(stderr, "[darktable-bench] could not load `%s'\n", img->filename);
+      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      dt_dev_cleanup(&dev);
+      res = 1;
+      break;
+    }
+    dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+    dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+    dt_dev_pixelpipe_synch_all(&pipe, &dev);
+    dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                    &pipe.processed_height);
+    const double scale
+        = size > 0 ? fmin(1.0, size / (double)MAX(pipe.processed_width, pipe.processed_height)) : 1.0;
+    out_width = scale * pipe.processed_width + .5f;
+    out_height = scale * pipe.processed_height + .5f;
+    // not part of the timing, like the cache lines of the other pipes
+    dt_dev_pixelpipe_alloc_export(&pipe, 0);
+
+    const double start = dt_get_wtime();
+    res = dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, out_width, out_height, scale);
+    times[r] = dt_get_wtime() - start;
+
+    if(!modules)
+    {
+      num_modules = g_list_length(pipe.nodes);
+      modules = (bench_module_t *)calloc(num_modules, sizeof(bench_module_t));
+    }
+    int k = 0;
+    for(GList *nodes = pipe.nodes; nodes && k < num_modules; nodes = g_list_next(nodes), k++)
+    {
+      dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+      modules[k].op = piece->module->op;
+      modules[k].multi_name = piece->module->multi_name;
+      modules[k].seconds += piece->enabled ? piece->process_time : 0.0;
+    }
+    hits += pipe.cache.stats.hits;
+    misses += pipe.cache.stats.misses;
+
+    // the names live in the modules of dev, which go away now
+    for(k = 0; k < num_modules; k++)
+    {
+      modules[k].op = g_intern_string(modules[k].op);
+      modules[k].multi_name = g_intern_string(modules[k].multi_name);
+    }
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    if(res)
+    {
+      fprintf(stderr, "[darktable-bench] processing `%s' failed\n", img->filename);
+      break;
+    }
+  }
+
+  fprintf(f, "    {\"image\": ");
+  _json_string(f, img->filename);
+  fprintf(f, ", \"xmp\": ");
+  if(img->xmp_filename)
+    _json_string(f, img->xmp_filename);
+  else
+    fprintf(f, "null");
+  if(res)
+    fprintf(f, ", \"size\": %d, \"failed\": true}", size);
+  else
+  {
+    const double median = _median(times, runs);
+    const double fastest = times[0];
+    fprintf(f, ",\n     \"width\": %d, \"height\": %d, \"size\": %d, \"out_width\": %d, "
+               "\"out_height\": %d,\n",
+            width, height, size, out_width, out_height);
+    // throughput in megapixels of the input image, so that all sizes can be compared
+    const double mp_per_s = median > 0.0 ? width * (double)height * 1e-6 / median : 0.0;
+    fprintf(f, "     \"runs\": %d, \"load_ms\": %.3f, \"ms\": %.3f, \"min_ms\": %.3f, \"mp_per_s\": %.3f,\n",
+            runs, 1e3 * load, 1e3 * median, 1e3 * fastest, mp_per_s);
+    fprintf(f, "     \"pixelpipe_cache\": {\"hits\": %ld, \"misses\": %ld},\n", hits, misses);
+    fprintf(f, "     \"modules\": [");
+    int first = 1;
+    for(int k = 0; k < num_modules; k++)
+    {
+      if(modules[k].seconds <= 0.0) continue;
+      fprintf(f, "%s\n       {\"op\": ", first ? "" : ",");
+      _json_string(f, modules[k].op);
+      if(modules[k].multi_name && modules[k].multi_name[0])
+      {
+        fprintf(f, ", \"instance\": ");
+        _json_string(f, modules[k].multi_name);
+      }
+      fprintf(f, ", \"ms\": %.3f}", 1e3 * modules[k].seconds / runs);
+      first = 0;
+    }
+    fprintf(f, "]}");
+  }
+  free(modules);
+  free(times);
+  return res;
+}
+
+static int _bench_wanted(gchar **only, const char *op)
+{
+  if(!only) return 1;
+  for(gchar **o = only; *o; o++)
+    if(!strcmp(*o, op)) return 1;
+  return 0;
+}
+
+// times the process() of every module which can run on the synthetic image, without the rest of the pipe
+static int _bench_iop(FILE *f, const int32_t id, const int runs, gchar **only)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  dt_dev_load_image(&dev, id);
+  const int width = dev.image_storage.width, height = dev.image_storage.height;
+
+  dt_dev_pixelpipe_t pipe;
+  if(!buf.buf || !dt_dev_pixelpipe_init_dummy(&pipe, width, height))
+  {
+    fprintf(stderr, "[darktable-bench] could not load the synthetic image\n");
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+
+  // switch on everything which makes sense for this image, with default parameters. modules which
+  // are off and can't be switched on only work on raw data.
+  for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    if(piece->enabled || module->hide_enable_button || !_bench_wanted(only, module->op)) continue;
+    piece->enabled = 1;
+    dt_iop_commit_params(module, module->default_params, module->default_blendop_params, &pipe, piece);
+  }
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  const dt_iop_roi_t roi_out = { 0, 0, width, height, 1.0f };
+  double *times = (double *)calloc(runs, sizeof(double));
+  int first = 1;
+  for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    // commit_params may have switched it off again, if there is nothing to do with default parameters
+    if(!piece->enabled || !_bench_wanted(only, module->op)) continue;
+    // gamma and the like, they don't write floats
+    if(module->output_bpp(module, &pipe, piece) != 4 * sizeof(float)) continue;
+
+    dt_iop_roi_t roi_in = roi_out;
+    module->modify_roi_in(module, piece, &roi_out, &roi_in);
+    float *in = (float *)dt_alloc_align(64, sizeof(float) * 4 * roi_in.width * roi_in.height);
+    float *out = (float *)dt_alloc_align(64, sizeof(float) * 4 * roi_out.width * roi_out.height);
+    if(!in || !out)
+    {
+      fprintf(stderr, "[darktable-bench] not enough memory to run `%s'\n", module->op);
+      dt_free_align(in);
+      dt_free_align(out);
+      continue;
+    }
+    _synthetic_fill(in, roi_in.width, roi_in.height);
+
+    // once to warm up lookup tables and caches, then for real
+    for(int r = -1; r < runs; r++)
+    {
+      for(int k = 0; k < 3; k++) pipe.processed_maximum[k] = 1.0f;
+      const double start = dt_get_wtime();
+      module->process(module, piece, in, out, &roi_in, &roi_out);
+      if(r >= 0) times[r] = dt_get_wtime() - start;
+    }
+    const double median = _median(times, runs);
+    const double fastest = times[0];
+    fprintf(f, "%s\n    {\"op\": ", first ? "" : ",");
+    _json_string(f, module->op);
+    fprintf(f, ", \"width\": %d, \"height\": %d, \"ms\": %.3f, \"min_ms\": %.3f, \"mp_per_s\": %.3f}",
+            roi_out.width, roi_out.height, 1e3 * median, 1e3 * fastest,
+            median > 0.0 ? roi_out.width * (double)roi_out.height * 1e-6 / median : 0.0);
+    first = 0;
+    fflush(f);
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+  free(times);
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return 0;
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+
+  gtk_init_check(&argc, &arg);
+
+  GList *images = NULL;
+  int sizes[BENCH_MAX_SIZES] = { 1024, 2048 };
+  int num_sizes = 2;
+  int runs = 3;
+  int synthetic_width = 3000, synthetic_height = 2000;
+  int iop = 0;
+  gchar **only = NULL;
+  const char *output_filename = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--size") && k + 1 < argc)
+      {
+        gchar **tokens = g_strsplit(arg[++k], ",", BENCH_MAX_SIZES);
+        for(num_sizes = 0; tokens[num_sizes]; num_sizes++) sizes[num_sizes] = MAX(atoi(tokens[num_sizes]), 0);
+        g_strfreev(tokens);
+      }
+      else if(!strcmp(arg[k], "--runs") && k + 1 < argc)
+        runs = MAX(atoi(arg[++k]), 1);
+      else if(!strcmp(arg[k], "--synthetic") && k + 1 < argc)
+      {
+        if(sscanf(arg[++k], "%dx%d", &synthetic_width, &synthetic_height) != 2 || synthetic_width < 16
+           || synthetic_height < 16)
+        {
+          fprintf(stderr, "[darktable-bench] invalid size for --synthetic: %s\n", arg[k]);
+          exit(1);
+        }
+      }
+      else if(!strcmp(arg[k], "--iop"))
+        iop = 1;
+      else if(!strcmp(arg[k], "--only") && k + 1 < argc)
+      {
+        g_strfreev(only);
+        only = g_strsplit(arg[++k], ",", -1);
+      }
+      else if(!strcmp(arg[k], "--output") && k + 1 < argc)
+        output_filename = arg[++k];
+      else if(!strcmp(arg[k], "--core"))
+      {
+        // everything from here on should be passed to the core
+        k++;
+        break;
+      }
+      else
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+    }
+    else
+    {
+      const char *ext = strrchr(arg[k], '.');
+      if(ext && !g_ascii_strcasecmp(ext, ".xmp") && images
+         && !((bench_image_t *)g_list_last(images)->data)->xmp_filename)
+        ((bench_image_t *)g_list_last(images)->data)->xmp_filename = arg[k];
+      else
+      {
+        bench_image_t *img = (bench_image_t *)calloc(1, sizeof(bench_image_t));
+        img->filename = arg[k];
+        images = g_list_append(images, img);
+      }
+    }
+  }
+
+  // measure the cpu path only, and leave no traces in the user's library
+  int m_argc = 0;
+  char *m_arg[8 + argc - k];
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  m_arg[m_argc++] = "--disable-opencl";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  if(dt_init(m_argc, m_arg, 0, NULL)) exit(1);
+
+  for(GList *i = images; i; i = g_list_next(i))
+  {
+    bench_image_t *img = (bench_image_t *)i->data;
+    img->id = _import(img->filename, img->xmp_filename);
+    if(!img->id)
+    {
+      fprintf(stderr, "[darktable-bench] can't open file %s\n", img->filename);
+      exit(1);
+    }
+  }
+
+  // the synthetic image is needed without any input files, and for --iop
+  char synthetic[PATH_MAX] = { 0 };
+  int32_t synthetic_id = 0;
+  if(!images || iop)
+  {
+    char tmpdir[PATH_MAX] = { 0 };
+    dt_loc_get_tmp_dir(tmpdir, sizeof(tmpdir));
+    snprintf(synthetic, sizeof(synthetic), "%s/darktable-bench-%dx%d.pfm", tmpdir, synthetic_width,
+             synthetic_height);
+    if(_synthetic_write(synthetic, synthetic_width, synthetic_height)
+       || !(synthetic_id = _import(synthetic, NULL)))
+    {
+      fprintf(stderr, "[darktable-bench] could not create the synthetic image `%s'\n", synthetic);
+      exit(1);
+    }
+  }
+  if(!images)
+  {
+    bench_image_t *img = (bench_image_t *)calloc(1, sizeof(bench_image_t));
+    img->filename = synthetic;
+    img->id = synthetic_id;
+    images = g_list_append(images, img);
+  }
+
+  FILE *f = output_filename ? fopen(output_filename, "wb") : stdout;
+  if(!f)
+  {
+    fprintf(stderr, "[darktable-bench] could not write `%s'\n", output_filename);
+    exit(1);
+  }
+
+  int res = 0;
+  fprintf(f, "{\"version\": ");
+  _json_string(f, PACKAGE_VERSION);
+  fprintf(f, ", \"threads\": %d,\n  \"exports\": [", darktable.num_openmp_threads);
+  int first = 1;
+  for(GList *i = images; i; i = g_list_next(i))
+    for(int s = 0; s < num_sizes; s++)
+    {
+      fprintf(f, "%s\n", first ? "" : ",");
+      res |= _bench_export(f, (bench_image_t *)i->data, sizes[s], runs);
+      first = 0;
+      fflush(f);
+    }
+  fprintf(f, "]");
+
+  if(iop)
+  {
+    fprintf(f, ",\n  \"iop\": [");
+    res |= _bench_iop(f, synthetic_id, runs, only);
+    fprintf(f, "]");
+  }
+
+  dt_cache_stats_report_t reports[DT_CACHE_STATS_MAX_REPORTS];
+  const int cnt = dt_cache_stats_collect(reports, DT_CACHE_STATS_MAX_REPORTS);
+  fprintf(f, ",\n  \"caches\": [");
+  for(int c = 0; c < cnt; c++)
+  {
+    const dt_cache_stats_t *st = &reports[c].stats;
+    const long int queries = st->hits + st->misses;
+    fprintf(f, "%s\n    {\"name\": ", c ? "," : "");
+    _json_string(f, reports[c].name);
+    fprintf(f, ", \"hits\": %ld, \"misses\": %ld, \"hit_rate\": %.4f, \"evictions\": %ld}", st->hits,
+            st->misses, queries ? st->hits / (double)queries : 0.0, st->evictions);
+  }
+  fprintf(f, "]");
+
+  // ru_maxrss is in kilobytes on linux, but in bytes on os x
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  const long int peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+  const long int peak_rss_kb = usage.ru_maxrss;
+#endif
+  fprintf(f, ",\n  \"peak_rss_kb\": %ld}\n", peak_rss_kb);
+  if(f != stdout) fclose(f);
+
+  if(synthetic[0]) g_unlink(synthetic);
+  g_list_free_full(images, free);
+  g_strfreev(only);
+  dt_cleanup();
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
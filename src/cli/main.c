@@ -36,6 +36,11 @@
 #include "common/imageio_module.h"
 #include "common/exif.h"
 #include "common/history.h"
+#include "control/conf.h"
+#include "control/jobs/control_jobs.h"
+#ifdef HAVE_GLIBJSON
+#include "cli/server.h"
+#endif
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -47,6 +52,128 @@ static void usage(const char *progname)
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max "
                   "height>,--bpp <bpp>,--hq <0|1|true|false>,--verbose] [--core <darktable options>]\n",
           progname);
+  fprintf(stderr, "       %s --batch <list file|directory> <output pattern> [options] [--core <darktable "
+                  "options>]\n",
+          progname);
+  fprintf(stderr, "       %s --server [--socket <path>] [options] [--core <darktable options>]\n", progname);
+}
+
+// imports one image and attaches the xmp, if there is one. returns the image id or 0.
+static int _import(const char *image_filename, const char *xmp_filename, const gboolean verbose)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(image_filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int id = dt_image_import(filmid, image_filename, TRUE);
+  if(!id)
+  {
+    fprintf(stderr, _("error: can't open file %s"), image_filename);
+    fprintf(stderr, "\n");
+    return 0;
+  }
+
+  // attach xmp, if requested:
+  if(xmp_filename)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, xmp_filename, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+
+  // print the history stack
+  if(verbose)
+  {
+    gchar *history = dt_history_get_items_as_string(id);
+    if(history)
+      printf("%s:\n%s\n", image_filename, history);
+    else
+      printf("%s: [%s]\n", image_filename, _("empty history stack"));
+    g_free(history);
+  }
+  return id;
+}
+
+static gint _compare_names(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0((const char *)a, (const char *)b);
+}
+
+// all supported images in a directory (their sidecars are picked up by the import), or all lines of a list
+// file: "<input file>[<tab><xmp file>]", empty lines and lines starting with # are skipped. images which
+// can't be imported are reported and left out, the number of them is returned.
+static int _import_batch(const char *source, GList **images, const gboolean verbose)
+{
+  int failed = 0;
+  GList *inputs = NULL, *xmps = NULL;
+  if(g_file_test(source, G_FILE_TEST_IS_DIR))
+  {
+    GDir *dir = g_dir_open(source, 0, NULL);
+    if(!dir)
+    {
+      fprintf(stderr, _("error: can't open directory %s"), source);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      gchar *filename = g_build_filename(source, name, NULL);
+      if(dt_supported_image(name) && g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+        inputs = g_list_prepend(inputs, filename);
+      else
+        g_free(filename);
+    }
+    g_dir_close(dir);
+    // keep $(SEQUENCE) reproducible, readdir returns the files in any order
+    inputs = g_list_sort(inputs, _compare_names);
+    for(GList *i = inputs; i; i = g_list_next(i)) xmps = g_list_prepend(xmps, NULL);
+  }
+  else
+  {
+    gchar *contents = NULL;
+    if(!g_file_get_contents(source, &contents, NULL, NULL))
+    {
+      fprintf(stderr, _("error: can't open file %s"), source);
+      fprintf(stderr, "\n");
+      return 1;
+    }
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    for(gchar **line = lines; *line; line++)
+    {
+      g_strstrip(*line);
+      if(**line == '\0' || **line == '#') continue;
+      gchar *tab = strchr(*line, '\t');
+      gchar *xmp = NULL;
+      if(tab)
+      {
+        *tab = '\0';
+        g_strchomp(*line);
+        xmp = g_strdup(g_strchug(tab + 1));
+      }
+      inputs = g_list_prepend(inputs, g_strdup(*line));
+      xmps = g_list_prepend(xmps, xmp);
+    }
+    g_strfreev(lines);
+    inputs = g_list_reverse(inputs);
+  }
+  xmps = g_list_reverse(xmps);
+
+  for(GList *i = inputs, *x = xmps; i && x; i = g_list_next(i), x = g_list_next(x))
+  {
+    const int id = _import((const char *)i->data, (const char *)x->data, verbose);
+    if(id)
+      *images = g_list_append(*images, GINT_TO_POINTER(id));
+    else
+      failed++;
+  }
+  g_list_free_full(inputs, g_free);
+  g_list_free_full(xmps, g_free);
+  return failed;
 }
 
 int main(int argc, char *arg[])
@@ -61,6 +188,9 @@ int main(int argc, char *arg[])
   char *image_filename = NULL;
   char *xmp_filename = NULL;
   char *output_filename = NULL;
+  char *batch_source = NULL;
+  char *socket_path = NULL;
+  gboolean server = FALSE;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
   gboolean verbose = FALSE, high_quality = TRUE;
@@ -80,6 +210,21 @@ int main(int argc, char *arg[])
         printf("this is darktable-cli\ncopyright (c) 2012-2014 johannes hanika, tobias ellinghaus\n");
         exit(1);
       }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_source = arg[k];
+      }
+      else if(!strcmp(arg[k], "--server"))
+      {
+        server = TRUE;
+      }
+      else if(!strcmp(arg[k], "--socket") && argc > k + 1)
+      {
+        k++;
+        socket_path = arg[k];
+        server = TRUE;
+      }
       else if(!strcmp(arg[k], "--width"))
       {
         k++;
@@ -146,7 +291,36 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
-  if(file_counter < 2 || file_counter > 3)
+  if(server)
+  {
+    // jobs bring their own files
+    if(file_counter != 0 || batch_source)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+#ifdef HAVE_GLIBJSON
+    if(dt_init(m_argc, m_arg, 0, NULL)) exit(1);
+    const int res = dt_cli_server(socket_path, width, height, high_quality);
+    dt_cleanup();
+    return res;
+#else
+    fprintf(stderr, "%s\n", _("this darktable-cli was built without json-glib, the server is not available"));
+    exit(1);
+#endif
+  }
+  else if(batch_source)
+  {
+    // the only file name is the output pattern
+    if(file_counter != 1)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    output_filename = image_filename;
+    image_filename = NULL;
+  }
+  else if(file_counter < 2 || file_counter > 3)
   {
     usage(arg[0]);
     exit(1);
@@ -159,53 +333,19 @@ int main(int argc, char *arg[])
   }
 
   // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  if(!batch_source && g_file_test(output_filename, G_FILE_TEST_EXISTS))
   {
     fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
   }
 
-  // init dt without gui:
-  if(dt_init(m_argc, m_arg, 0, NULL)) exit(1);
-
-  dt_film_t film;
-  int id = 0;
-  int filmid = 0;
-
-  gchar *directory = g_path_get_dirname(image_filename);
-  filmid = dt_film_new(&film, directory);
-  id = dt_image_import(filmid, image_filename, TRUE);
-  if(!id)
+  // try to find out the export format from the output_filename
+  char *ext = output_filename + strlen(output_filename);
+  while(ext > output_filename && *ext != '.' && *ext != '/') ext--;
+  if(*ext != '.')
   {
-    fprintf(stderr, _("error: can't open file %s"), image_filename);
-    fprintf(stderr, "\n");
+    fprintf(stderr, "%s\n", _("the output file needs an extension to pick the format, like .jpg"));
     exit(1);
   }
-  g_free(directory);
-
-  // attach xmp, if requested:
-  if(xmp_filename)
-  {
-    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
-    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
-    dt_exif_xmp_read(image, xmp_filename, 1);
-    // don't write new xmp:
-    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
-    dt_image_cache_read_release(darktable.image_cache, image);
-  }
-
-  // print the history stack
-  if(verbose)
-  {
-    gchar *history = dt_history_get_items_as_string(id);
-    if(history)
-      printf("%s\n", history);
-    else
-      printf("[%s]\n", _("empty history stack"));
-  }
-
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
   *ext = '\0';
   ext++;
 
@@ -213,10 +353,32 @@ int main(int argc, char *arg[])
 
   if(!strcmp(ext, "tif")) ext = "tiff";
 
+  // init dt without gui. everything from here on (modules, profiles, lens data) is loaded once, no
+  // matter how many images there are.
+  if(dt_init(m_argc, m_arg, 0, NULL)) exit(1);
+
+  GList *images = NULL;
+  int failed = 0;
+  if(batch_source)
+  {
+    failed = _import_batch(batch_source, &images, verbose);
+    if(!images)
+    {
+      fprintf(stderr, "%s\n", _("no images to export"));
+      exit(1);
+    }
+  }
+  else
+  {
+    const int id = _import(image_filename, xmp_filename, verbose);
+    if(!id) exit(1);
+    images = g_list_append(images, GINT_TO_POINTER(id));
+  }
+
   // init the export data structures
   dt_imageio_module_format_t *format;
   dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
+  dt_imageio_module_data_t *sdata;
 
   storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
   if(storage == NULL)
@@ -247,51 +409,31 @@ int main(int argc, char *arg[])
     exit(1);
   }
 
-  fdata = format->get_params(format);
-  if(fdata == NULL)
-  {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
-    exit(1);
-  }
-
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, &sw, &sh);
-  format->dimension(format, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-  fdata->style[0] = '\0';
-  fdata->style_append = 0;
-
-  if(storage->initialize_store)
-  {
-    GList *single_image = g_list_append(NULL, GINT_TO_POINTER(id));
-    storage->initialize_store(storage, sdata, format, fdata, &single_image, high_quality);
-    g_list_free(single_image);
-  }
   // TODO: add a callback to set the bpp without going through the config
 
-  storage->store(storage, sdata, id, format, fdata, 1, 1, high_quality);
+  // the same export as the gui runs, so a batch develops parallel_export images at a time while the next
+  // ones load and the finished ones are written.
+  dt_control_export_t settings = { 0 };
+  settings.max_width = width;
+  settings.max_height = height;
+  settings.format_index = dt_imageio_get_index_of_format(format);
+  settings.storage_index = dt_imageio_get_index_of_storage(storage);
+  settings.sdata = sdata;
+  settings.high_quality = high_quality;
+  settings.style[0] = '\0';
+  settings.style_append = FALSE;
+  const guint total = g_list_length(images) + failed;
+  const double start = dt_get_wtime();
+  failed += dt_control_export_images(images, &settings, NULL);
+  if(batch_source)
+    printf("[darktable-cli] exported %u of %u images in %.3fs\n", total - failed, total,
+           dt_get_wtime() - start);
 
   // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
   storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
 
   dt_cleanup();
+  return failed ? 1 : 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
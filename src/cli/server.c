@@ -0,0 +1,446 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cli/server.h"
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/grealpath.h"
+#include "common/history.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/styles.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+typedef struct _server_t
+{
+  int width, height;
+  gboolean high_quality;
+  // image id -> the xmp its history came from, "" for the one read on import
+  GHashTable *history;
+  // .dtstyle file -> name of the style imported from it
+  GHashTable *styles;
+} _server_t;
+
+// can't be the name of a file, marks a history in an unknown state
+#define HISTORY_UNKNOWN "\n"
+
+static const char *_get_string(JsonObject *o, const char *name)
+{
+  if(!json_object_has_member(o, name)) return NULL;
+  JsonNode *n = json_object_get_member(o, name);
+  if(!JSON_NODE_HOLDS_VALUE(n) || json_node_get_value_type(n) != G_TYPE_STRING) return NULL;
+  return json_node_get_string(n);
+}
+
+static int _get_int(JsonObject *o, const char *name, const int fallback)
+{
+  if(!json_object_has_member(o, name)) return fallback;
+  JsonNode *n = json_object_get_member(o, name);
+  if(!JSON_NODE_HOLDS_VALUE(n)) return fallback;
+  if(json_node_get_value_type(n) == G_TYPE_INT64) return json_node_get_int(n);
+  if(json_node_get_value_type(n) == G_TYPE_DOUBLE) return (int)json_node_get_double(n);
+  return fallback;
+}
+
+static gboolean _get_bool(JsonObject *o, const char *name, const gboolean fallback)
+{
+  if(!json_object_has_member(o, name)) return fallback;
+  JsonNode *n = json_object_get_member(o, name);
+  if(!JSON_NODE_HOLDS_VALUE(n) || json_node_get_value_type(n) != G_TYPE_BOOLEAN) return fallback;
+  return json_node_get_boolean(n);
+}
+
+// imports the image once, later jobs find it in the library. returns the id or 0.
+static int _import(const char *input)
+{
+  // one film roll per directory, no matter how the client spells the path
+  gchar *path = g_realpath(input);
+  if(!path) return 0;
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(path);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int id = dt_image_import(filmid, path, TRUE);
+  g_free(path);
+  return id;
+}
+
+// gives the image the history of xmp, or of its own sidecar if xmp is NULL. the database is only touched
+// if that's not the one it already has, so the same image with the same edits is developed straight away.
+static int _apply_history(_server_t *s, const int id, const char *input, const char *xmp)
+{
+  const gchar *have = (const gchar *)g_hash_table_lookup(s->history, GINT_TO_POINTER(id));
+  if(have ? !strcmp(have, xmp ? xmp : "") : !xmp) return 0;
+
+  int err = 0;
+  dt_history_delete_on_image(id);
+  char sidecar[PATH_MAX] = { 0 };
+  const char *filename = xmp;
+  if(!filename)
+  {
+    snprintf(sidecar, sizeof(sidecar), "%s.xmp", input);
+    if(g_file_test(sidecar, G_FILE_TEST_IS_REGULAR)) filename = sidecar;
+  }
+  if(filename)
+  {
+    if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+      err = 1;
+    else
+    {
+      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+      dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+      err = dt_exif_xmp_read(image, filename, 1);
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      dt_image_cache_read_release(darktable.image_cache, image);
+    }
+  }
+  g_hash_table_insert(s->history, GINT_TO_POINTER(id), g_strdup(err ? HISTORY_UNKNOWN : xmp ? xmp : ""));
+  return err;
+}
+
+// returns the name of the style to apply, importing .dtstyle files the first time they are asked for.
+static const char *_get_style(_server_t *s, const char *style)
+{
+  if(!g_file_test(style, G_FILE_TEST_IS_REGULAR)) return dt_styles_exists(style) ? style : NULL;
+
+  const char *name = (const char *)g_hash_table_lookup(s->styles, style);
+  if(!name)
+  {
+    // darktable writes styles to <name>.dtstyle
+    gchar *base = g_path_get_basename(style);
+    if(g_str_has_suffix(base, ".dtstyle")) base[strlen(base) - strlen(".dtstyle")] = '\0';
+    if(!dt_styles_exists(base)) dt_styles_import_from_file(style);
+    g_hash_table_insert(s->styles, g_strdup(style), base);
+    name = base;
+  }
+  return dt_styles_exists(name) ? name : NULL;
+}
+
+static dt_imageio_module_format_t *_get_format(const char *name)
+{
+  if(!strcmp(name, "jpg")) name = "jpeg";
+  if(!strcmp(name, "tif")) name = "tiff";
+  return dt_imageio_get_format_by_name(name);
+}
+
+// sets up one output of a job from o, which is the job itself or one of its outputs. returns NULL on
+// success or what went wrong.
+static const char *_get_target(_server_t *s, JsonObject *job, JsonObject *o, const char *style,
+                               dt_imageio_export_target_t *t)
+{
+  const char *out = _get_string(o, "output");
+  if(!out) return _("output is required");
+
+  // the format comes from the request or the extension of the output, which is added if missing
+  const char *base = strrchr(out, '/');
+  const char *ext = strrchr(base ? base : out, '.');
+  const char *format_name = _get_string(o, "format");
+  dt_imageio_module_format_t *format = NULL;
+  if(format_name)
+    format = _get_format(format_name);
+  else if(ext)
+    format = _get_format(ext + 1);
+  if(!format) return _("unknown format");
+
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!fdata) return _("failed to get parameters from format module");
+  t->format = format;
+  t->format_params = fdata;
+  if(ext && (!format_name || _get_format(ext + 1) == format))
+    t->filename = g_strdup(out);
+  else
+    t->filename = g_strdup_printf("%s.%s", out, format->extension(fdata));
+
+  uint32_t fw = 0, fh = 0;
+  format->dimension(format, &fw, &fh);
+  fdata->max_width = _get_int(o, "width", _get_int(job, "width", s->width));
+  fdata->max_height = _get_int(o, "height", _get_int(job, "height", s->height));
+  fdata->max_width = (fw != 0 && fdata->max_width > fw) ? fw : fdata->max_width;
+  fdata->max_height = (fh != 0 && fdata->max_height > fh) ? fh : fdata->max_height;
+  g_strlcpy(fdata->style, style ? style : "", sizeof(fdata->style));
+  fdata->style_append = FALSE;
+
+  gchar *directory = g_path_get_dirname(t->filename);
+  const int err = g_mkdir_with_parents(directory, 0755);
+  g_free(directory);
+  return err ? _("could not create the output directory") : NULL;
+}
+
+// runs one job, adding the files it writes to outputs. returns NULL on success or what went wrong.
+static const char *_render(_server_t *s, JsonObject *o, GPtrArray *outputs, double *import_ms,
+                           double *export_ms)
+{
+  const char *input = _get_string(o, "input");
+  if(!input) return _("input is required");
+  // several outputs of the same image are developed only once
+  JsonArray *list = NULL;
+  if(json_object_has_member(o, "outputs"))
+  {
+    if(!JSON_NODE_HOLDS_ARRAY(json_object_get_member(o, "outputs"))) return _("outputs has to be a list");
+    list = json_object_get_array_member(o, "outputs");
+  }
+  const int count = list ? json_array_get_length(list) : 1;
+  if(count <= 0) return _("outputs is empty");
+  const char *style = NULL;
+  if(_get_string(o, "style") && !(style = _get_style(s, _get_string(o, "style")))) return _("unknown style");
+
+  const double start = dt_get_wtime();
+  const int id = _import(input);
+  if(!id) return _("can't open the input file");
+  if(_apply_history(s, id, input, _get_string(o, "xmp"))) return _("can't read the xmp file");
+  *import_ms = 1000.0 * (dt_get_wtime() - start);
+
+  const char *err = NULL;
+  dt_imageio_export_target_t *targets
+      = (dt_imageio_export_target_t *)calloc(count, sizeof(dt_imageio_export_target_t));
+  for(int k = 0; k < count && !err; k++)
+  {
+    JsonNode *n = list ? json_array_get_element(list, k) : NULL;
+    if(n && !JSON_NODE_HOLDS_OBJECT(n))
+      err = _("outputs has to be a list of objects");
+    else
+      err = _get_target(s, o, n ? json_node_get_object(n) : o, style, targets + k);
+    if(targets[k].filename) g_ptr_array_add(outputs, g_strdup(targets[k].filename));
+  }
+
+  if(!err)
+  {
+    const gboolean high_quality = _get_bool(o, "hq", s->high_quality);
+    if(!list)
+    {
+      if(dt_imageio_export(id, targets[0].filename, targets[0].format, targets[0].format_params, high_quality,
+                           TRUE, NULL, NULL))
+        err = _("could not export the image");
+    }
+    else if(dt_imageio_export_multi(id, targets, count, high_quality, TRUE))
+      err = _("could not export the image");
+  }
+
+  for(int k = 0; k < count; k++)
+  {
+    if(targets[k].format) targets[k].format->free_params(targets[k].format, targets[k].format_params);
+    g_free((gchar *)targets[k].filename);
+  }
+  free(targets);
+  *export_ms = 1000.0 * (dt_get_wtime() - start) - *import_ms;
+  return err;
+}
+
+// answers one line of input with one line of json. sets quit if asked to stop.
+static gchar *_handle(_server_t *s, const char *line, gboolean *quit)
+{
+  const double start = dt_get_wtime();
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+
+  GError *error = NULL;
+  JsonParser *parser = json_parser_new();
+  if(!json_parser_load_from_data(parser, line, -1, &error)
+     || !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+  {
+    json_builder_set_member_name(builder, "ok");
+    json_builder_add_boolean_value(builder, FALSE);
+    json_builder_set_member_name(builder, "error");
+    json_builder_add_string_value(builder, error ? error->message : _("expected a json object"));
+    if(error) g_error_free(error);
+  }
+  else
+  {
+    JsonObject *o = json_node_get_object(json_parser_get_root(parser));
+    // whatever the client uses to tell its jobs apart goes back as it came
+    if(json_object_has_member(o, "id"))
+    {
+      json_builder_set_member_name(builder, "id");
+      json_builder_add_value(builder, json_node_copy(json_object_get_member(o, "id")));
+    }
+    if(_get_bool(o, "quit", FALSE))
+    {
+      *quit = TRUE;
+      json_builder_set_member_name(builder, "ok");
+      json_builder_add_boolean_value(builder, TRUE);
+    }
+    else
+    {
+      GPtrArray *outputs = g_ptr_array_new_with_free_func(g_free);
+      double import_ms = 0.0, export_ms = 0.0;
+      const char *err = _render(s, o, outputs, &import_ms, &export_ms);
+      json_builder_set_member_name(builder, "ok");
+      json_builder_add_boolean_value(builder, err == NULL);
+      if(err)
+      {
+        json_builder_set_member_name(builder, "error");
+        json_builder_add_string_value(builder, err);
+      }
+      // one output, or the list of them if the job asked for a list
+      if(json_object_has_member(o, "outputs"))
+      {
+        json_builder_set_member_name(builder, "outputs");
+        json_builder_begin_array(builder);
+        for(guint k = 0; k < outputs->len; k++)
+          json_builder_add_string_value(builder, (const char *)g_ptr_array_index(outputs, k));
+        json_builder_end_array(builder);
+      }
+      else if(outputs->len)
+      {
+        json_builder_set_member_name(builder, "output");
+        json_builder_add_string_value(builder, (const char *)g_ptr_array_index(outputs, 0));
+      }
+      json_builder_set_member_name(builder, "import_ms");
+      json_builder_add_double_value(builder, import_ms);
+      json_builder_set_member_name(builder, "export_ms");
+      json_builder_add_double_value(builder, export_ms);
+      g_ptr_array_free(outputs, TRUE);
+    }
+  }
+  json_builder_set_member_name(builder, "total_ms");
+  json_builder_add_double_value(builder, 1000.0 * (dt_get_wtime() - start));
+  json_builder_end_object(builder);
+
+  JsonNode *root = json_builder_get_root(builder);
+  JsonGenerator *generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  gchar *reply = json_generator_to_data(generator, NULL);
+  g_object_unref(generator);
+  json_node_free(root);
+  g_object_unref(builder);
+  g_object_unref(parser);
+  return reply;
+}
+
+// returns TRUE if the client asked to quit
+static gboolean _serve(_server_t *s, FILE *in, FILE *out)
+{
+  gboolean quit = FALSE;
+  char *line = NULL;
+  size_t len = 0;
+  while(!quit && getline(&line, &len, in) != -1)
+  {
+    g_strstrip(line);
+    if(!*line) continue;
+    gchar *reply = _handle(s, line, &quit);
+    fprintf(out, "%s\n", reply);
+    fflush(out);
+    g_free(reply);
+  }
+  free(line);
+  return quit;
+}
+
+static int _serve_socket(_server_t *s, const char *socket_path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "[darktable-cli] socket path too long: `%s'\n", socket_path);
+    return 1;
+  }
+  g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+
+  // a socket left behind by a server which didn't shut down cleanly, anything else stays
+  struct stat st;
+  if(!lstat(socket_path, &st) && S_ISSOCK(st.st_mode)) g_unlink(socket_path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8))
+  {
+    fprintf(stderr, "[darktable-cli] can't listen on `%s': %s\n", socket_path, strerror(errno));
+    if(fd >= 0) close(fd);
+    return 1;
+  }
+  fprintf(stderr, "[darktable-cli] listening on `%s'\n", socket_path);
+
+  // clients are served one after the other, every job uses all cores anyways
+  gboolean quit = FALSE;
+  while(!quit)
+  {
+    const int client = accept(fd, NULL, NULL);
+    if(client < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      fprintf(stderr, "[darktable-cli] accept failed: %s\n", strerror(errno));
+      break;
+    }
+    FILE *in = fdopen(client, "r");
+    FILE *out = fdopen(dup(client), "w");
+    if(in && out) quit = _serve(s, in, out);
+    if(in)
+      fclose(in);
+    else
+      close(client);
+    if(out) fclose(out);
+  }
+  close(fd);
+  g_unlink(socket_path);
+  return 0;
+}
+
+int dt_cli_server(const char *socket_path, const int width, const int height, const gboolean high_quality)
+{
+  _server_t s;
+  s.width = width;
+  s.height = height;
+  s.high_quality = high_quality;
+  s.history = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  s.styles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  // a client going away in the middle of a reply is not a reason to die
+  signal(SIGPIPE, SIG_IGN);
+
+  int res = 0;
+  if(socket_path)
+    res = _serve_socket(&s, socket_path);
+  else
+  {
+    // the replies get stdout for themselves, everything else printed there (-d perf and friends) goes to
+    // stderr instead.
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    if(!out)
+      res = 1;
+    else
+    {
+      fflush(stdout);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+      _serve(&s, stdin, out);
+      fclose(out);
+    }
+  }
+
+  g_hash_table_destroy(s.history);
+  g_hash_table_destroy(s.styles);
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
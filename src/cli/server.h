@@ -0,0 +1,50 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_CLI_SERVER_H
+#define DT_CLI_SERVER_H
+
+#include <glib.h>
+
+/**
+ * darktable-cli --server: a long lived renderer. jobs come in as one json object per line, either on
+ * stdin or over a unix domain socket, and every one of them gets a json line back:
+ *
+ *   {"id": 1, "input": "a.cr2", "xmp": "a.cr2.xmp", "style": "web", "width": 2048, "height": 2048,
+ *    "hq": true, "format": "jpeg", "output": "/srv/out/a"}
+ *   {"id": 1, "ok": true, "output": "/srv/out/a.jpg", "import_ms": 3.1, "export_ms": 412.0, ...}
+ *
+ * input and output are required, the format is taken from the extension of output if not given. xmp
+ * defaults to the sidecar next to the input, style is the name of a style or the path of a .dtstyle file.
+ * instead of output there can be a list of outputs, each with its own output, format, width and height:
+ * the image is developed once for all of them and comes back with a list of outputs as well.
+ * {"quit": true} stops the server.
+ *
+ * everything loaded on the way stays: modules with their opencl kernels and profiles, lens data, and the
+ * full size input of recently developed images in the mipmap cache, so asking for another size of the same
+ * image skips the raw decoding.
+ */
+
+/** serves jobs from stdin, or from the socket at socket_path, until the end of input or a quit.
+ * width, height and high_quality are the defaults for jobs which don't specify them. returns 0 on
+ * success. */
+int dt_cli_server(const char *socket_path, const int width, const int height, const gboolean high_quality);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -19,6 +19,12 @@
 #ifndef DT_COMMON_BILATERAL_H
 #define DT_COMMON_BILATERAL_H
 
+#include "common/half.h"
+#include "control/conf.h"
+
+#include <string.h>
+#include <xmmintrin.h>
+
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
 // full precision though, so tiling will help reducing memory footprint
@@ -26,6 +32,17 @@
 #define DT_COMMON_BILATERAL_MAX_RES_S 6000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
 
+/* the grid is kept as half floats if bilateral_grid is set to half in darktablerc. that's half the memory,
+ * and three decimal digits are plenty for the blurred luminance. splatting and blurring still add up in
+ * floats. */
+static inline int dt_bilateral_grid_half()
+{
+  gchar *precision = dt_conf_get_string("bilateral_grid");
+  const int half = precision && !strcmp(precision, "half");
+  g_free(precision);
+  return half;
+}
+
 #ifdef HAVE_OPENCL
 // function definition on opencl path takes precedence
 #include "common/bilateralcl.h"
@@ -42,7 +59,7 @@ size_t dt_bilateral_memory_use(const int width,     // width of input image
   size_t size_y = CLAMPS((int)_y, 4, DT_COMMON_BILATERAL_MAX_RES_S) + 1;
   size_t size_z = CLAMPS((int)_z, 4, DT_COMMON_BILATERAL_MAX_RES_R) + 1;
 
-  return size_x * size_y * size_z * sizeof(float);
+  return size_x * size_y * size_z * (dt_bilateral_grid_half() ? sizeof(uint16_t) : sizeof(float));
 }
 
 
@@ -58,7 +75,7 @@ size_t dt_bilateral_singlebuffer_size(const int width,     // width of input ima
   size_t size_y = CLAMPS((int)_y, 4, DT_COMMON_BILATERAL_MAX_RES_S) + 1;
   size_t size_z = CLAMPS((int)_z, 4, DT_COMMON_BILATERAL_MAX_RES_R) + 1;
 
-  return size_x * size_y * size_z * sizeof(float);
+  return size_x * size_y * size_z * (dt_bilateral_grid_half() ? sizeof(uint16_t) : sizeof(float));
 }
 #endif
 
@@ -68,7 +85,8 @@ typedef struct dt_bilateral_t
   size_t size_x, size_y, size_z;
   int width, height;
   float sigma_s, sigma_r;
-  float *buf;
+  float *buf;          // the grid, x fastest and z slowest
+  uint16_t *buf_half;  // or the same as half floats, then buf is NULL
 } dt_bilateral_t;
 
 static void image_to_grid(const dt_bilateral_t *const b, const int i, const int j, const float L, float *x,
@@ -99,9 +117,20 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->height = height;
   b->sigma_s = MAX(height / (b->size_y - 1.0f), width / (b->size_x - 1.0f));
   b->sigma_r = 100.0f / (b->size_z - 1.0f);
-  b->buf = dt_alloc_align(16, b->size_x * b->size_y * b->size_z * sizeof(float));
-
-  memset(b->buf, 0, b->size_x * b->size_y * b->size_z * sizeof(float));
+  // no need to clear the grid, splatting writes all of it
+  const size_t size = b->size_x * b->size_y * b->size_z;
+  b->buf = NULL;
+  b->buf_half = NULL;
+  if(dt_bilateral_grid_half())
+    b->buf_half = dt_alloc_align(16, size * sizeof(uint16_t));
+  else
+    b->buf = dt_alloc_align(16, size * sizeof(float));
+  if(!b->buf && !b->buf_half)
+  {
+    fprintf(stderr, "[bilateral] failed to allocate the grid!\n");
+    free(b);
+    return NULL;
+  }
 #if 0
   fprintf(stderr, "[bilateral] created grid [%d %d %d]"
           " with sigma (%f %f) (%f %f)\n", b->size_x, b->size_y, b->size_z,
@@ -110,122 +139,185 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
+// the grid row the pixels of image row j are splatted to, along with the one after it
+static inline int grid_row(const dt_bilateral_t *const b, const int j)
+{
+  return MIN((int)CLAMPS(j / b->sigma_s, 0, b->size_y - 1), (int)b->size_y - 2);
+}
+
+/* the image is cut into horizontal bands, one per thread. every band splats into a slab of grid rows of its
+ * own, which are added up afterwards. that's no atomics, and only the rows shared by two bands twice. */
 void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
 {
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
+  const int nbands = MAX(1, MIN(b->height, dt_get_num_threads()));
+  const size_t size_x = b->size_x, size_y = b->size_y, size_z = b->size_z;
+  float *slab[nbands];
+  int slab_y[nbands], slab_rows[nbands];
+  int err = 0;
+  for(int t = 0; t < nbands; t++)
+  {
+    const int j0 = (size_t)b->height * t / nbands, j1 = (size_t)b->height * (t + 1) / nbands;
+    slab_y[t] = grid_row(b, j0);
+    slab_rows[t] = grid_row(b, j1 - 1) + 2 - slab_y[t];
+    slab[t] = dt_alloc_align(16, size_x * slab_rows[t] * size_z * sizeof(float));
+    if(!slab[t]) err = 1;
+  }
+  if(err) fprintf(stderr, "[bilateral] failed to allocate the splat buffers!\n");
+
 // splat into downsampled grid
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
+#pragma omp parallel for default(none) shared(b, slab, slab_y, slab_rows) \
+  firstprivate(in, err, nbands, size_x, size_y, size_z) schedule(static, 1)
 #endif
-  for(int j = 0; j < b->height; j++)
+  for(int t = 0; t < nbands * !err; t++)
   {
-    size_t index = 4 * j * b->width;
-    for(int i = 0; i < b->width; i++)
+    const int j0 = (size_t)b->height * t / nbands, j1 = (size_t)b->height * (t + 1) / nbands;
+    float *const buf = slab[t];
+    const int ox = 1;
+    const int oy = size_x;
+    const int oz = size_x * slab_rows[t];
+    const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+    memset(buf, 0, sizeof(float) * size_x * slab_rows[t] * size_z);
+    for(int j = j0; j < j1; j++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
-      // sum up payload here, doesn't have to be same as edge stopping data
-      // for cross bilateral applications.
-      // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
-      // should not cause clipping here.
-      for(int k = 0; k < 8; k++)
+      size_t index = (size_t)4 * j * b->width;
+      for(int i = 0; i < b->width; i++)
       {
-        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
+        float x, y, z;
+        const float L = in[index];
+        image_to_grid(b, i, j, L, &x, &y, &z);
+        const int xi = MIN((int)x, (int)size_x - 2);
+        const int yi = MIN((int)y, (int)size_y - 2);
+        const int zi = MIN((int)z, (int)size_z - 2);
+        const float xf = x - xi;
+        const float yf = y - yi;
+        const float zf = z - zi;
+        // nearest neighbour splatting:
+        const size_t grid_index = xi + size_x * ((yi - slab_y[t]) + slab_rows[t] * zi);
+        // sum up payload here, doesn't have to be same as edge stopping data
+        // for cross bilateral applications.
+        // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
+        // should not cause clipping here.
+        for(int k = 0; k < 8; k++)
+        {
+          const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
+          const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                                * ((k & 4) ? zf : (1.0f - zf)) * norm;
+          buf[ii] += contrib;
+        }
+        index += 4;
+      }
+    }
+  }
+
+// add up the slabs, every line of the grid on its own
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for default(none) shared(b, slab, slab_y, slab_rows) \
+  firstprivate(err, nbands, size_x, size_y, size_z) schedule(static)
 #endif
-        b->buf[ii] += contrib;
-      }
-      index += 4;
+  for(int l = 0; l < (int)(size_y * size_z); l++)
+  {
+    const int y = l % size_y, z = l / size_y;
+    float line[size_x];
+    memset(line, 0, sizeof(float) * size_x);
+    for(int t = 0; !err && t < nbands; t++)
+    {
+      if(y < slab_y[t] || y >= slab_y[t] + slab_rows[t]) continue;
+      const float *const row = slab[t] + size_x * ((y - slab_y[t]) + (size_t)slab_rows[t] * z);
+      for(size_t i = 0; i < size_x; i++) line[i] += row[i];
     }
+    if(b->buf)
+      memcpy(b->buf + size_x * l, line, sizeof(float) * size_x);
+    else
+      for(size_t i = 0; i < size_x; i++) b->buf_half[size_x * l + i] = dt_float_to_half(line[i]);
   }
+
+  for(int t = 0; t < nbands; t++) dt_free_align(slab[t]);
 }
 
-static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
-                        const int size2, const int size3)
+// -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x), along one line of the grid
+static inline void blur_line_z_1d(float *buf, const size_t offset3, const int size3)
 {
   const float w1 = 4.f / 16.f;
   const float w2 = 2.f / 16.f;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(buf)
-#endif
-  for(int k = 0; k < size1; k++)
+  size_t index = 0;
+  float tmp1 = buf[index];
+  buf[index] = w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
+  index += offset3;
+  float tmp2 = buf[index];
+  buf[index] = w1 * (buf[index + offset3] - tmp1) + w2 * buf[index + 2 * offset3];
+  index += offset3;
+  for(int i = 2; i < size3 - 2; i++)
   {
-    size_t index = (size_t)k * offset1;
-    for(int j = 0; j < size2; j++)
-    {
-      float tmp1 = buf[index];
-      buf[index] = w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
-      {
-        const float tmp3 = buf[index];
-        buf[index] = +w1 * (buf[index + offset3] - tmp2) + w2 * (buf[index + 2 * offset3] - tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
-      }
-      const float tmp3 = buf[index];
-      buf[index] = w1 * (buf[index + offset3] - tmp2) - w2 * tmp1;
-      index += offset3;
-      buf[index] = -w1 * tmp3 - w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
-    }
+    const float tmp3 = buf[index];
+    buf[index] = +w1 * (buf[index + offset3] - tmp2) + w2 * (buf[index + 2 * offset3] - tmp1);
+    index += offset3;
+    tmp1 = tmp2;
+    tmp2 = tmp3;
   }
+  const float tmp3 = buf[index];
+  buf[index] = w1 * (buf[index + offset3] - tmp2) - w2 * tmp1;
+  index += offset3;
+  buf[index] = -w1 * tmp3 - w2 * tmp2;
 }
 
-static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
-                      const int size2, const int size3)
+// gaussian up to 3 sigma, along one line of the grid
+static inline void blur_line_1d(float *buf, const size_t offset3, const int size3)
 {
   const float w0 = 6.f / 16.f;
   const float w1 = 4.f / 16.f;
   const float w2 = 1.f / 16.f;
+  size_t index = 0;
+  float tmp1 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
+  index += offset3;
+  float tmp2 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp1) + w2 * buf[index + 2 * offset3];
+  index += offset3;
+  for(int i = 2; i < size3 - 2; i++)
+  {
+    const float tmp3 = buf[index];
+    buf[index]
+        = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * (buf[index + 2 * offset3] + tmp1);
+    index += offset3;
+    tmp1 = tmp2;
+    tmp2 = tmp3;
+  }
+  const float tmp3 = buf[index];
+  buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * tmp1;
+  index += offset3;
+  buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
+}
+
+// blurs all the lines of the grid along offset3. half float grids are blurred a line at a time in floats.
+static void blur_line(dt_bilateral_t *b, const int offset1, const int offset2, const int offset3,
+                      const int size1, const int size2, const int size3, const int derivative)
+{
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(buf)
+#pragma omp parallel for default(none) shared(b) \
+  firstprivate(offset1, offset2, offset3, size1, size2, size3, derivative) schedule(static)
 #endif
   for(int k = 0; k < size1; k++)
   {
-    size_t index = (size_t)k * offset1;
+    float line[size3];
     for(int j = 0; j < size2; j++)
     {
-      float tmp1 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * buf[index + offset3] + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp1) + w2 * buf[index + 2 * offset3];
-      index += offset3;
-      for(int i = 2; i < size3 - 2; i++)
+      const size_t index = (size_t)k * offset1 + (size_t)j * offset2;
+      if(b->buf)
       {
-        const float tmp3 = buf[index];
-        buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2)
-                     + w2 * (buf[index + 2 * offset3] + tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
+        if(derivative)
+          blur_line_z_1d(b->buf + index, offset3, size3);
+        else
+          blur_line_1d(b->buf + index, offset3, size3);
+        continue;
       }
-      const float tmp3 = buf[index];
-      buf[index] = buf[index] * w0 + w1 * (buf[index + offset3] + tmp2) + w2 * tmp1;
-      index += offset3;
-      buf[index] = buf[index] * w0 + w1 * tmp3 + w2 * tmp2;
-      index += offset3;
-      index += offset2 - offset3 * size3;
+      uint16_t *const half = b->buf_half + index;
+      for(int i = 0; i < size3; i++) line[i] = dt_half_to_float(half[(size_t)i * offset3]);
+      if(derivative)
+        blur_line_z_1d(line, 1, size3);
+      else
+        blur_line_1d(line, 1, size3);
+      for(int i = 0; i < size3; i++) half[(size_t)i * offset3] = dt_float_to_half(line[i]);
     }
   }
 }
@@ -234,11 +326,43 @@ static void blur_line(float *buf, const int offset1, const int offset2, const in
 void dt_bilateral_blur(dt_bilateral_t *b)
 {
   // gaussian up to 3 sigma
-  blur_line(b->buf, b->size_x * b->size_y, b->size_x, 1, b->size_z, b->size_y, b->size_x);
+  blur_line(b, b->size_x * b->size_y, b->size_x, 1, b->size_z, b->size_y, b->size_x, 0);
   // gaussian up to 3 sigma
-  blur_line(b->buf, b->size_x * b->size_y, 1, b->size_x, b->size_z, b->size_x, b->size_y);
+  blur_line(b, b->size_x * b->size_y, 1, b->size_x, b->size_z, b->size_x, b->size_y, 0);
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
-  blur_line_z(b->buf, 1, b->size_x, b->size_x * b->size_y, b->size_x, b->size_y, b->size_z);
+  blur_line(b, 1, b->size_x, b->size_x * b->size_y, b->size_x, b->size_y, b->size_z, 1);
+}
+
+// trilinear lookup of the grid around gi, four corners at a time
+static inline float grid_lookup(const dt_bilateral_t *const b, const size_t gi, const float xf,
+                                const float yf, const float zf)
+{
+  const size_t oy = b->size_x;
+  const size_t oz = b->size_y * b->size_x;
+  __m128 lo, hi; // (x0 y0, x1 y0, x0 y1, x1 y1) at z0 and z1
+  if(b->buf)
+  {
+    lo = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(b->buf + gi)),
+                      (const __m64 *)(b->buf + gi + oy));
+    hi = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(b->buf + gi + oz)),
+                      (const __m64 *)(b->buf + gi + oy + oz));
+  }
+  else
+  {
+    const uint16_t *h = b->buf_half + gi;
+    lo = _mm_set_ps(dt_half_to_float(h[oy + 1]), dt_half_to_float(h[oy]), dt_half_to_float(h[1]),
+                    dt_half_to_float(h[0]));
+    h += oz;
+    hi = _mm_set_ps(dt_half_to_float(h[oy + 1]), dt_half_to_float(h[oy]), dt_half_to_float(h[1]),
+                    dt_half_to_float(h[0]));
+  }
+  const __m128 wx = _mm_set_ps(xf, 1.0f - xf, xf, 1.0f - xf);
+  const __m128 wxy = _mm_mul_ps(wx, _mm_set_ps(yf, yf, 1.0f - yf, 1.0f - yf));
+  __m128 sum = _mm_add_ps(_mm_mul_ps(lo, _mm_mul_ps(wxy, _mm_set1_ps(1.0f - zf))),
+                          _mm_mul_ps(hi, _mm_mul_ps(wxy, _mm_set1_ps(zf))));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(sum);
 }
 
 
@@ -246,11 +370,8 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
+#pragma omp parallel for default(none) shared(out) firstprivate(b, in, norm)
 #endif
   for(int j = 0; j < b->height; j++)
   {
@@ -261,21 +382,14 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
       const float L = in[index];
       image_to_grid(b, i, j, L, &x, &y, &z);
       // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
+      const int xi = MIN((int)x, (int)b->size_x - 2);
+      const int yi = MIN((int)y, (int)b->size_y - 2);
+      const int zi = MIN((int)z, (int)b->size_z - 2);
       const float xf = x - xi;
       const float yf = y - yi;
       const float zf = z - zi;
       const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = L
-                         + norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)+b->buf[gi + ox + oz]
-                                     * (xf) * (1.0f - yf) * (zf)+b->buf[gi + oy + oz] * (1.0f - xf) * (yf)
-                                     * (zf)+b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = L + norm * grid_lookup(b, gi, xf, yf, zf);
       out[index] = MAX(0.0f, Lout);
       // and copy color and mask
       out[index + 1] = in[index + 1];
@@ -291,11 +405,8 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
+#pragma omp parallel for default(none) shared(out) firstprivate(b, in, norm)
 #endif
   for(int j = 0; j < b->height; j++)
   {
@@ -306,20 +417,14 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
       const float L = in[index];
       image_to_grid(b, i, j, L, &x, &y, &z);
       // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
+      const int xi = MIN((int)x, (int)b->size_x - 2);
+      const int yi = MIN((int)y, (int)b->size_y - 2);
+      const int zi = MIN((int)z, (int)b->size_z - 2);
       const float xf = x - xi;
       const float yf = y - yi;
       const float zf = z - zi;
       const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)+b->buf[gi + ox + oz]
-                                   * (xf) * (1.0f - yf) * (zf)+b->buf[gi + oy + oz] * (1.0f - xf) * (yf)
-                                   * (zf)+b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = norm * grid_lookup(b, gi, xf, yf, zf);
       out[index] = MAX(0.0f, out[index] + Lout);
       index += 4;
     }
@@ -329,7 +434,8 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 void dt_bilateral_free(dt_bilateral_t *b)
 {
   if(!b) return;
-  dt_free_align(b->buf);
+  if(b->buf) dt_free_align(b->buf);
+  if(b->buf_half) dt_free_align(b->buf_half);
   free(b);
 }
 
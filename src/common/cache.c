@@ -24,15 +24,20 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <sched.h>
+#ifdef DT_UNIT_TEST
+#include <unistd.h>
+#endif
 
-// this implements a concurrent LRU cache using
-// a concurrent doubly linked list
-// and a hopscotch hashmap, source following the paper and
+// this implements a concurrent cache using
+// a hopscotch hashmap, source following the paper and
 // the additional material (GPLv2+ c++ concurrency package source)
 // `Hopscotch Hashing' by Maurice Herlihy, Nir Shavit and Moran Tzafrir
+// and a CLOCK approximation of LRU for garbage collection, so read hits
+// never have to take a global lock.
 
 #define DT_CACHE_NULL_DELTA SHRT_MIN
 #define DT_CACHE_EMPTY_HASH -1
@@ -46,8 +51,7 @@ typedef struct dt_cache_bucket_t
   int16_t next_delta;
   int16_t read;  // number of readers
   int16_t write; // number of writers (0 or 1)
-  int32_t lru;   // for garbage collection: lru list
-  int32_t mru;
+  int32_t referenced; // for garbage collection: used since the clock hand last passed
   size_t cost;   // cost associated with this entry (such as byte size)
   uint32_t hash; // hash of the element
   uint32_t key;  // key of the element
@@ -79,6 +83,21 @@ static inline void dt_cache_unlock(uint32_t *lock)
   __sync_val_compare_and_swap(lock, 1, 0);
 }
 
+// same as dt_cache_lock(), but counts how often and how long the lock was held by someone else.
+static inline void dt_cache_lock_contended(dt_cache_t *cache, uint32_t *lock, long int *contended)
+{
+  if(!__sync_val_compare_and_swap(lock, 0, 1)) return;
+  const double t0 = dt_cache_stats_time();
+  __sync_fetch_and_add(contended, 1);
+  dt_cache_lock(lock);
+  dt_cache_stats_lock_wait(&cache->stats, t0);
+}
+
+static inline void dt_cache_lock_segment(dt_cache_t *cache, dt_cache_segment_t *segment)
+{
+  dt_cache_lock_contended(cache, &segment->lock, &cache->contended_segment);
+}
+
 static uint32_t nearest_power_of_two(const uint32_t value)
 {
   uint32_t rc = 1;
@@ -88,7 +107,11 @@ static uint32_t nearest_power_of_two(const uint32_t value)
 
 static void dt_cache_sleep_ms(uint32_t ms)
 {
+#ifdef DT_UNIT_TEST
+  usleep(ms * 1000u);
+#else
   g_usleep(ms * 1000u);
+#endif
 }
 
 #if 0
@@ -137,6 +160,7 @@ static void remove_key(dt_cache_t *cache, dt_cache_segment_t *segment, dt_cache_
   // key_bucket->data = DT_CACHE_EMPTY_DATA;
   key_bucket->hash = DT_CACHE_EMPTY_HASH;
   key_bucket->key = DT_CACHE_EMPTY_KEY;
+  key_bucket->referenced = 0;
 
   // keep track of cost
   sub_cost(cache, key_bucket->cost);
@@ -207,17 +231,21 @@ static void add_key_to_beginning_of_list(dt_cache_t *cache, dt_cache_bucket_t *c
                                          const uint32_t key)
 {
   size_t cost = 1;
+  dt_cache_stats_miss(&cache->stats);
   if(cache->allocate)
   {
+    const double t0 = dt_cache_stats_time();
     // upgrade to a write lock in case the user requests it:
     if(cache->allocate(cache->allocate_data, key, &cost, &free_bucket->data))
       dt_cache_bucket_write_lock(free_bucket);
+    dt_cache_stats_alloc(&cache->stats, t0);
   }
   add_cost(cache, cost);
 
   free_bucket->key = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 1;
 
   if(keys_bucket->first_delta == 0)
   {
@@ -242,16 +270,20 @@ static void add_key_to_end_of_list(dt_cache_t *cache, dt_cache_bucket_t *const k
                                    const uint32_t key, dt_cache_bucket_t *const last_bucket)
 {
   size_t cost = 1;
+  dt_cache_stats_miss(&cache->stats);
   if(cache->allocate)
   {
+    const double t0 = dt_cache_stats_time();
     if(cache->allocate(cache->allocate_data, key, &cost, &free_bucket->data))
       dt_cache_bucket_write_lock(free_bucket);
+    dt_cache_stats_alloc(&cache->stats, t0);
   }
   add_cost(cache, cost);
 
   free_bucket->key = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 1;
   free_bucket->next_delta = DT_CACHE_NULL_DELTA;
 
   if(last_bucket == NULL)
@@ -316,7 +348,7 @@ void dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_
                    size_t cache_line_size, size_t cost_quota)
 {
   const uint32_t adj_num_threads = nearest_power_of_two(num_threads);
-  // FIXME: if switching this on, lru lists need to move, too! (because they work by bucket and not by key)
+  // FIXME: if switching this on, the referenced flag needs to move with the keys, too!
   cache->optimize_cacheline = 0; // 1;
   // No cache_mask offsetting required when not optimizing for cachelines --RAM
   cache->cache_mask = cache->optimize_cacheline ? cache_line_size / sizeof(dt_cache_bucket_t) - 1 : 0;
@@ -344,7 +376,15 @@ void dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_
 
   cache->cost = 0;
   cache->cost_quota = cost_quota;
-  cache->lru_lock = 0;
+  cache->clock_hand = 0;
+  cache->insert_lock = 0;
+  cache->gc_lock = 0;
+  cache->contended_segment = 0;
+  cache->contended_insert = 0;
+  cache->contended_gc = 0;
+  cache->waits_read = 0;
+  cache->waits_write = 0;
+  memset(&cache->stats, 0, sizeof(cache->stats));
   cache->allocate = NULL;
   cache->allocate_data = NULL;
   cache->cleanup = NULL;
@@ -364,10 +404,8 @@ void dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_
     cache->table[k].data = DT_CACHE_EMPTY_DATA;
     cache->table[k].read = 0;
     cache->table[k].write = 0;
-    cache->table[k].lru = -2;
-    cache->table[k].mru = -2;
+    cache->table[k].referenced = 0;
   }
-  cache->lru = cache->mru = -1;
 #ifndef DT_UNIT_TEST
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
@@ -459,115 +497,40 @@ dt_cache_percent_keys_in_cache_line(const dt_cache_t *const cache)
 }
 #endif
 
-// rip out at entry from the lru list.
-// must already hold the lock!
-void lru_remove(dt_cache_t *cache, dt_cache_bucket_t *bucket)
-{
-  if(bucket->mru >= -1 && bucket->lru >= -1)
-  {
-    if(bucket->lru == -1)
-      cache->lru = bucket->mru;
-    else
-      cache->table[bucket->lru].mru = bucket->mru;
-    if(bucket->mru == -1)
-      cache->mru = bucket->lru;
-    else
-      cache->table[bucket->mru].lru = bucket->lru;
-  }
-  // mark as not in the list:
-  bucket->mru = bucket->lru = -2;
-}
-
-// insert an entry, must already hold the lock!
-void lru_insert(dt_cache_t *cache, dt_cache_bucket_t *bucket)
-{
-  // could use the segment locks for better scalability.
-  // would need to roll back changes in proximity after all (up to) three locks have been obtained.
-  const int idx = bucket - cache->table;
-
-  // only if it's not in front already:
-  if(cache->mru != idx)
-  {
-    // rip out bucket from lru list, if it's still in there:
-    lru_remove(cache, bucket);
-
-    // re-attach to most recently used end:
-    bucket->mru = -1;
-    bucket->lru = cache->mru;
-    if(cache->mru >= 0) cache->table[cache->mru].mru = idx;
-    cache->mru = idx;
-    // be consistent if cache was empty before:
-    if(cache->lru == -1) cache->lru = idx;
-  }
-}
-
-void lru_remove_locked(dt_cache_t *cache, dt_cache_bucket_t *bucket)
-{
-  dt_cache_lock(&cache->lru_lock);
-  lru_remove(cache, bucket);
-  dt_cache_unlock(&cache->lru_lock);
-}
-
-void lru_insert_locked(dt_cache_t *cache, dt_cache_bucket_t *bucket)
-{
-  dt_cache_lock(&cache->lru_lock);
-  lru_insert(cache, bucket);
-  dt_cache_unlock(&cache->lru_lock);
-}
-
 int dt_cache_for_all(dt_cache_t *cache, int (*process)(const uint32_t key, const void *data, void *user_data),
                      void *user_data)
 {
   // this is not thread safe.
-  // dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->mru;
-  while(curr >= 0)
+  for(uint32_t k = 0; k <= cache->bucket_mask; k++)
   {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY)
+    if(cache->table[k].key != DT_CACHE_EMPTY_KEY)
     {
-      const int err = process(cache->table[curr].key, cache->table[curr].data, user_data);
+      const int err = process(cache->table[k].key, cache->table[k].data, user_data);
       if(err) return err;
     }
-    if(curr == cache->lru) break;
-    int32_t next = cache->table[curr].lru;
-    assert(cache->table[next].mru == curr);
-    curr = next;
   }
-  // dt_cache_unlock(&cache->lru_lock);
   return 0;
 }
 
-// does a consistency check of the lru list.
-// returns how many entries it finds.
-// hangs infinitely if the list has cycles.
-int32_t lru_check_consistency(dt_cache_t *cache)
+// does a consistency check of the hopscotch lists.
+// returns how many entries it finds, to be compared to dt_cache_size().
+int32_t hash_check_consistency(dt_cache_t *cache)
 {
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  int32_t cnt = 1;
-  while(curr >= 0 && curr != cache->mru)
-  {
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-    cnt++;
-  }
-  dt_cache_unlock(&cache->lru_lock);
-  return cnt;
-}
-int32_t lru_check_consistency_reverse(dt_cache_t *cache)
-{
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->mru;
-  int32_t cnt = 1;
-  while(curr >= 0 && curr != cache->lru)
+  int32_t cnt = 0;
+  for(uint32_t k = 0; k <= cache->bucket_mask; k++)
   {
-    int32_t next = cache->table[curr].lru;
-    assert(cache->table[next].mru == curr);
-    curr = next;
-    cnt++;
+    const dt_cache_bucket_t *curr_bucket = cache->table + k;
+    int16_t next_delta = curr_bucket->first_delta;
+    while(next_delta != DT_CACHE_NULL_DELTA)
+    {
+      curr_bucket += next_delta;
+      // every key is in the list of the bucket its hash points to:
+      assert(curr_bucket->hash != DT_CACHE_EMPTY_HASH);
+      assert((curr_bucket->hash & cache->bucket_mask) == k);
+      cnt++;
+      next_delta = curr_bucket->next_delta;
+    }
   }
-  dt_cache_unlock(&cache->lru_lock);
   return cnt;
 }
 
@@ -580,7 +543,11 @@ void *dt_cache_read_testget(dt_cache_t *cache, const uint32_t key)
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
 
-  if(dt_cache_testlock(&segment->lock)) return NULL;
+  if(dt_cache_testlock(&segment->lock))
+  {
+    __sync_fetch_and_add(&cache->contended_segment, 1);
+    return NULL;
+  }
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *compare_bucket = start_bucket;
@@ -592,15 +559,17 @@ void *dt_cache_read_testget(dt_cache_t *cache, const uint32_t key)
     {
       void *rc = compare_bucket->data;
       int err = dt_cache_bucket_read_testlock(compare_bucket);
+      // give it a second chance in garbage collection:
+      if(!err) compare_bucket->referenced = 1;
       dt_cache_unlock(&segment->lock);
       if(err) return NULL;
-      // move this to the  most recently used slot, too:
-      lru_insert_locked(cache, compare_bucket);
+      dt_cache_stats_hit(&cache->stats);
       return rc;
     }
     next_delta = compare_bucket->next_delta;
   }
   dt_cache_unlock(&segment->lock);
+  dt_cache_stats_miss(&cache->stats);
   return NULL;
 }
 
@@ -626,7 +595,7 @@ retry_cache_full:
   while(1)
   {
     // block and try our luck
-    dt_cache_lock(&segment->lock);
+    dt_cache_lock_segment(cache, segment);
 
     last_bucket = NULL;
     compare_bucket = start_bucket;
@@ -638,12 +607,13 @@ retry_cache_full:
       {
         void *rc = compare_bucket->data;
         int err = dt_cache_bucket_read_testlock(compare_bucket);
+        // give it a second chance in garbage collection:
+        if(!err) compare_bucket->referenced = 1;
         dt_cache_unlock(&segment->lock);
         // actually all good, just we couldn't get a lock on the bucket.
         if(err) goto wait;
-        // move this to the  most recently used slot, too:
-        lru_insert_locked(cache, compare_bucket);
         // found and locked:
+        dt_cache_stats_hit(&cache->stats);
         return rc;
       }
       last_bucket = compare_bucket;
@@ -653,6 +623,8 @@ retry_cache_full:
     break;
   wait:
     ;
+    __sync_fetch_and_add(&cache->waits_read, 1);
+    __sync_fetch_and_add(&cache->stats.lock_wait_us, 5000);
     // try again in 5 milliseconds
     dt_cache_sleep_ms(5);
   }
@@ -682,7 +654,6 @@ retry_cache_full:
         add_key_to_beginning_of_list(cache, start_bucket, free_bucket, hash, key);
         void *data = free_bucket->data;
         dt_cache_unlock(&segment->lock);
-        lru_insert_locked(cache, free_bucket);
         return data;
       }
       ++free_bucket;
@@ -699,7 +670,7 @@ retry_cache_full:
   {
     if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
     {
-      dt_cache_lock(&cache->lru_lock);
+      dt_cache_lock_contended(cache, &cache->insert_lock, &cache->contended_insert);
       if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
       {
         // try that again if it's still empty
@@ -707,14 +678,13 @@ retry_cache_full:
         add_key_to_end_of_list(cache, start_bucket, free_max_bucket, hash, key, last_bucket);
         void *data = free_max_bucket->data;
         dt_cache_unlock(&segment->lock);
-        lru_insert(cache, free_max_bucket);
-        dt_cache_unlock(&cache->lru_lock);
+        dt_cache_unlock(&cache->insert_lock);
         return data;
       }
-      dt_cache_unlock(&cache->lru_lock);
+      dt_cache_unlock(&cache->insert_lock);
     }
     // this could walk outside the range where the segment lock is valid.
-    // that's why we abuse the lru lock above to shield grabbing a new bucket
+    // that's why we need the insert lock above to shield grabbing a new bucket
     // at this stage.
     ++free_max_bucket;
   }
@@ -727,18 +697,17 @@ retry_cache_full:
   {
     if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
     {
-      dt_cache_lock(&cache->lru_lock);
+      dt_cache_lock_contended(cache, &cache->insert_lock, &cache->contended_insert);
       if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
       {
         dt_cache_bucket_read_lock(free_min_bucket);
         add_key_to_end_of_list(cache, start_bucket, free_min_bucket, hash, key, last_bucket);
         void *data = free_min_bucket->data;
         dt_cache_unlock(&segment->lock);
-        lru_insert(cache, free_min_bucket);
-        dt_cache_unlock(&cache->lru_lock);
+        dt_cache_unlock(&cache->insert_lock);
         return data;
       }
-      dt_cache_unlock(&cache->lru_lock);
+      dt_cache_unlock(&cache->insert_lock);
     }
     --free_min_bucket;
   }
@@ -753,7 +722,7 @@ int dt_cache_remove_bucket(dt_cache_t *cache, const uint32_t num)
 {
   const uint32_t hash = num;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  dt_cache_lock_segment(cache, segment);
 
   dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
   const uint32_t key = curr_bucket->key;
@@ -769,53 +738,7 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
 {
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
-
-  dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
-  dt_cache_bucket_t *last_bucket = NULL;
-  dt_cache_bucket_t *curr_bucket = start_bucket;
-  int16_t next_delta = curr_bucket->first_delta;
-  while(1)
-  {
-    if(next_delta == DT_CACHE_NULL_DELTA)
-    {
-      // fprintf(stderr, "[cache remove] key not found %u!\n", key);
-      dt_cache_unlock(&segment->lock);
-      return 1;
-    }
-    curr_bucket += next_delta;
-
-    if(hash == curr_bucket->hash && key == curr_bucket->key)
-    {
-      if(curr_bucket->read || curr_bucket->write)
-      {
-        // fprintf(stderr, "[cache remove] key still in use %u!\n", key);
-        dt_cache_unlock(&segment->lock);
-        return 1;
-      }
-      remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
-      if(cache->optimize_cacheline) optimize_cacheline_use(cache, segment, curr_bucket);
-      // put back into unused part of the cache: remove from lru list.
-      dt_cache_unlock(&segment->lock);
-      lru_remove_locked(cache, curr_bucket);
-      // fprintf(stderr, "[cache remove] freeing %d for %u\n", cost, key);
-      return 0;
-    }
-    last_bucket = curr_bucket;
-    next_delta = curr_bucket->next_delta;
-  }
-  dt_cache_unlock(&segment->lock);
-  return 1;
-}
-
-#define DT_CACHE_BFL
-#ifdef DT_CACHE_BFL
-// debug helper functions, in case we want a big fat lock for dt_cache_gc():
-static int dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
-{
-  const uint32_t hash = key;
-  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  dt_cache_lock_segment(cache, segment);
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *last_bucket = NULL;
@@ -841,9 +764,7 @@ static int dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
       }
       remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
       if(cache->optimize_cacheline) optimize_cacheline_use(cache, segment, curr_bucket);
-      // put back into unused part of the cache: remove from lru list.
       dt_cache_unlock(&segment->lock);
-      lru_remove(cache, curr_bucket);
       // fprintf(stderr, "[cache remove] freeing %d for %u\n", cost, key);
       return 0;
     }
@@ -854,114 +775,44 @@ static int dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
   return 1;
 }
 
-static int dt_cache_remove_bucket_no_lru_lock(dt_cache_t *cache, const uint32_t num)
-{
-  // dt_cache_remove works on key, not bucket number, so translate that:
-  const uint32_t hash = num;
-  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
-
-  dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
-  const uint32_t key = curr_bucket->key;
-  dt_cache_unlock(&segment->lock);
-  // actually remove by key
-  if(key != DT_CACHE_EMPTY_KEY)
-    return dt_cache_remove_no_lru_lock(cache, key);
-  else
-    return 2;
-}
-#endif
-
 int32_t dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-#if 0
-  if(1)//cache->bucket_mask <= 4)
-  {
-    const int fwd = lru_check_consistency(cache);
-    const int bwd = lru_check_consistency_reverse(cache);
-    const int cnt = dt_cache_size(cache);
-    fprintf(stderr, "[cache gc] pre consistency: %d %d %d\n", fwd, bwd, cnt);
-    dt_cache_print_locked(cache);
-    fprintf(stderr, "[cache gc] current cost: %u/%u\n", cache->cost, cache->cost_quota);
-  }
-#endif
-#ifdef DT_CACHE_BFL
-  // sorry, bfl
-  dt_cache_lock(&cache->lru_lock);
-#endif
-  int32_t curr;
-// get least recently used bucket
-#ifdef DT_CACHE_BFL
-  curr = cache->lru;
-#else
-  dt_cache_lock(&cache->lru_lock);
-  curr = cache->lru;
-  dt_cache_unlock(&cache->lru_lock);
-#endif
-  int i = 0;
-  // while still too full:
+  // one sweep at a time. whoever waited for it will most likely find
+  // the cache below the fill ratio afterwards, and return right away.
+  dt_cache_lock_contended(cache, &cache->gc_lock, &cache->contended_gc);
+
+  // CLOCK: move the hand over the buckets, evict the ones which have not been
+  // referenced since it last passed, and clear the flag on all others.
+  // two full rounds are enough to see every bucket without a flag,
+  // if we still can't free enough it's all locked.
+  const uint32_t max_steps = 2 * (cache->bucket_mask + 1);
+  uint32_t i = 0;
   while(cache->cost > fill_ratio * cache->cost_quota)
   {
-    // this i has to be > parallel threads * sane amount to work on for start up times to work
-    // we want to allow at least that many entries in the cache before we start cleaning up
-    if(curr < 0 || i > (1 << cache->segment_shift))
+    if(i++ >= max_steps)
     {
-      // damn, we walked the whole list and not enough free space,
-      // can you believe this? yell out:
-      if(cache->cost > fill_ratio * cache->cost_quota)
-      {
-// dt_cache_unlock(&cache->lru_lock);
-// fprintf(stderr, "[cache gc] failed to free space!\n");
-// dt_cache_print_locked(cache);
-#ifdef DT_CACHE_BFL
-        dt_cache_unlock(&cache->lru_lock);
-#endif
-        return 1;
-      }
-      break;
+      // damn, we walked the whole table and not enough free space,
+      // can you believe this?
+      // fprintf(stderr, "[cache gc] failed to free space!\n");
+      // dt_cache_print_locked(cache);
+      dt_cache_unlock(&cache->gc_lock);
+      return 1;
     }
-// fprintf(stderr, "[cache gc] from %u to %u\n", cache->cost, (uint32_t)(0.8*cache->cost_quota));
-
-// remove it. takes care of lru, cost, user cleanup, and hashtable
-// this could run into keys being concurrently removed, and will not remove these,
-// nor alter the lru list in that case (could be interleaved with the other thread
-// who is currently doing that)
-//
-// in the very unlikely case the bucket in question got just removed,
-// and the lru not cleaned up yet, but another image already occupies that slot...
-// it will be read locked and we go on. very worst case we clean up the wrong image.
-#ifdef DT_CACHE_BFL
-    const int err = dt_cache_remove_bucket_no_lru_lock(cache, curr);
-#else
-    const int err = dt_cache_remove_bucket(cache, curr);
-#endif
-    if(err)
+    const uint32_t curr = cache->clock_hand;
+    cache->clock_hand = (curr + 1) & cache->bucket_mask;
+    dt_cache_bucket_t *bucket = cache->table + curr;
+    // these are read without the segment lock, removal will check again.
+    if(bucket->hash == DT_CACHE_EMPTY_HASH) continue;
+    if(bucket->referenced)
     {
-// fprintf(stderr, "[cache gc] remove failed %d\n", err);
-// in case we failed, try next entry
-#ifdef DT_CACHE_BFL
-      curr = cache->table[curr].mru;
-#else
-      dt_cache_lock(&cache->lru_lock);
-      curr = cache->table[curr].mru;
-      dt_cache_unlock(&cache->lru_lock);
-#endif
+      bucket->referenced = 0;
+      continue;
     }
-    i++;
-  }
-#ifdef DT_CACHE_BFL
-  dt_cache_unlock(&cache->lru_lock);
-#endif
-#if 0
-  if(cache->bucket_mask <= 4)
-  {
-    const int fwd = lru_check_consistency(cache);
-    const int bwd = lru_check_consistency_reverse(cache);
-    const int cnt = dt_cache_size(cache);
-    fprintf(stderr, "[cache gc] consistency: %d %d %d\n", fwd, bwd, cnt);
-    dt_cache_print(cache);
+    // remove it. takes care of cost, user cleanup, and hashtable.
+    // this could run into keys being concurrently removed or locked, and will not remove these.
+    if(!dt_cache_remove_bucket(cache, curr)) dt_cache_stats_eviction(&cache->stats);
   }
-#endif
+  dt_cache_unlock(&cache->gc_lock);
   return 0;
 }
 
@@ -971,7 +822,7 @@ void dt_cache_read_release(dt_cache_t *cache, const uint32_t key)
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
 
-  dt_cache_lock(&segment->lock);
+  dt_cache_lock_segment(cache, segment);
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *compare_bucket = start_bucket;
@@ -1003,7 +854,7 @@ void *dt_cache_write_get(dt_cache_t *cache, const uint32_t key)
 
   while(1)
   {
-    dt_cache_lock(&segment->lock);
+    dt_cache_lock_segment(cache, segment);
 
     dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
     dt_cache_bucket_t *compare_bucket = start_bucket;
@@ -1025,6 +876,8 @@ void *dt_cache_write_get(dt_cache_t *cache, const uint32_t key)
     break;
   wait:
     ;
+    __sync_fetch_and_add(&cache->waits_write, 1);
+    __sync_fetch_and_add(&cache->stats.lock_wait_us, 5000);
     // try again in 5 milliseconds
     dt_cache_sleep_ms(5);
   }
@@ -1040,7 +893,7 @@ void dt_cache_realloc(dt_cache_t *cache, const uint32_t key, const size_t cost,
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
 
-  dt_cache_lock(&segment->lock);
+  dt_cache_lock_segment(cache, segment);
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *compare_bucket = start_bucket;
@@ -1077,7 +930,7 @@ void dt_cache_write_release(dt_cache_t *cache, const uint32_t key)
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
 
-  dt_cache_lock(&segment->lock);
+  dt_cache_lock_segment(cache, segment);
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *compare_bucket = start_bucket;
@@ -1103,55 +956,32 @@ void dt_cache_print(dt_cache_t *cache)
   for(uint32_t k = 0; k <= cache->bucket_mask; k++)
   {
     if(cache->table[k].key != DT_CACHE_EMPTY_KEY)
-      fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n", k,
-              (cache->table[k].key & 0x1fffffff) + 1, cache->table[k].read, cache->table[k].write);
+      fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d%s\n", k,
+              (cache->table[k].key & 0x1fffffff) + 1, cache->table[k].read, cache->table[k].write,
+              cache->table[k].referenced ? " (referenced)" : "");
     else
       fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n", k, cache->table[k].read,
               cache->table[k].write);
   }
-  fprintf(stderr, "[cache] lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  while(curr >= 0)
-  {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY)
-      fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n", curr,
-              (cache->table[curr].key & 0x1fffffff) + 1, cache->table[curr].read, cache->table[curr].write);
-    else
-    {
-      fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n", curr, cache->table[curr].read,
-              cache->table[curr].write);
-      // this list should only ever contain valid buffers.
-      assert(0);
-    }
-    if(curr == cache->mru) break;
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-  }
-  dt_cache_unlock(&cache->lru_lock);
+  fprintf(stderr, "[cache] contention: segment locks %ld, insert lock %ld, gc lock %ld\n",
+          cache->contended_segment, cache->contended_insert, cache->contended_gc);
+  fprintf(stderr, "[cache] waits for bucket locks: read %ld, write %ld\n", cache->waits_read,
+          cache->waits_write);
+  fprintf(stderr, "[cache] hits %ld, misses %ld, evictions %ld, lock wait %.3f s\n", cache->stats.hits,
+          cache->stats.misses, cache->stats.evictions, cache->stats.lock_wait_us * 1e-6);
 }
 
 void dt_cache_print_locked(dt_cache_t *cache)
 {
-  fprintf(stderr, "[cache] locked lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
-  int32_t curr = cache->lru;
-  int32_t i = 0;
-  while(curr >= 0)
+  fprintf(stderr, "[cache] locked entries:\n");
+  for(uint32_t k = 0; k <= cache->bucket_mask; k++)
   {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY && (cache->table[curr].read || cache->table[curr].write))
+    if(cache->table[k].key != DT_CACHE_EMPTY_KEY && (cache->table[k].read || cache->table[k].write))
     {
-      fprintf(stderr, "[cache] bucket[%d|%d] holds key %u with locks r %d w %d\n", i, curr,
-              (cache->table[curr].key & 0x1fffffff) + 1, cache->table[curr].read, cache->table[curr].write);
+      fprintf(stderr, "[cache] bucket[%d] holds key %u with locks r %d w %d\n", k,
+              (cache->table[k].key & 0x1fffffff) + 1, cache->table[k].read, cache->table[k].write);
     }
-    if(curr == cache->mru) break;
-    int32_t next = cache->table[curr].mru;
-    assert(cache->table[next].lru == curr);
-    curr = next;
-    i++;
   }
-  dt_cache_unlock(&cache->lru_lock);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
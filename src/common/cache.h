@@ -19,6 +19,8 @@
 #ifndef DT_COMMON_CACHE_H
 #define DT_COMMON_CACHE_H
 
+#include "common/cache_stats.h"
+
 #include <inttypes.h>
 #include <stddef.h>
 
@@ -33,13 +35,29 @@ typedef struct dt_cache_t
   struct dt_cache_segment_t *segments;
   struct dt_cache_bucket_t *table;
 
-  int32_t lru, mru;
   int cache_mask;
   int optimize_cacheline;
   size_t cost;
   size_t cost_quota;
-  // one fat lru lock, no use locking segments and possibly rolling back changes.
-  uint32_t lru_lock;
+  // garbage collection is a clock sweep over the buckets. read hits only set the
+  // referenced flag of their bucket, under the segment lock they hold anyways,
+  // so they never touch any global state.
+  uint32_t clock_hand;
+  // shields grabbing a free bucket outside the segment of the key.
+  uint32_t insert_lock;
+  // only one thread sweeps at a time.
+  uint32_t gc_lock;
+
+  // contention counters, see dt_cache_print().
+  // long int to give 32-bits on old archs, so __sync* calls will work.
+  long int contended_segment; // segment lock was held by another thread
+  long int contended_insert;  // same for the insert lock
+  long int contended_gc;      // had to wait for another gc sweep
+  long int waits_read;        // bucket was write locked, had to sleep for a read lock
+  long int waits_write;       // bucket had other readers, had to sleep for a write lock
+
+  // hits, misses, evictions and latencies, see common/cache_stats.h
+  dt_cache_stats_t stats;
 
   // callback functions for cache misses/garbage collection
   // allocate should return != 0 if a write lock on alloc is needed.
@@ -88,8 +106,8 @@ void *dt_cache_read_testget(dt_cache_t *cache, const uint32_t key);
 int32_t dt_cache_contains(const dt_cache_t *const cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the end of the lru list, until the fill ratio
-// of the hashtable goes below the given parameter, in terms
+// evicts entries which have not been used recently (CLOCK sweep), until
+// the fill ratio of the hashtable goes below the given parameter, in terms
 // of the user defined cost measure.
 int32_t dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
@@ -103,7 +121,7 @@ static inline uint32_t dt_cache_capacity(dt_cache_t *cache)
   return cache->bucket_mask + 1;
 }
 
-// very verbose dump of the cache contents
+// very verbose dump of the cache contents, followed by the contention counters
 void dt_cache_print(dt_cache_t *cache);
 // only print currently locked buckets:
 void dt_cache_print_locked(dt_cache_t *cache);
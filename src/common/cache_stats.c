@@ -0,0 +1,167 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+// the periodic dump on -d cache
+static pthread_t _dump_thread;
+static pthread_mutex_t _dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _dump_cond = PTHREAD_COND_INITIALIZER;
+static int _dump_running = 0;
+
+uint64_t dt_cache_stats_alloc_quantile(const dt_cache_stats_t *stats, const float quantile)
+{
+  uint64_t cnt = 0;
+  for(int k = 0; k < DT_CACHE_STATS_BINS; k++) cnt += stats->alloc_hist[k];
+  if(!cnt) return 0;
+  uint64_t sum = 0;
+  for(int k = 0; k < DT_CACHE_STATS_BINS; k++)
+  {
+    sum += stats->alloc_hist[k];
+    if(sum >= quantile * cnt) return 1ull << k;
+  }
+  return 1ull << (DT_CACHE_STATS_BINS - 1);
+}
+
+static void _report_cache(dt_cache_stats_report_t *report, const char *name, dt_cache_t *cache)
+{
+  report->name = name;
+  report->stats = cache->stats;
+  report->resident = cache->cost;
+  report->quota = cache->cost_quota;
+  report->entries = dt_cache_size(cache);
+}
+
+static void _report_pipe(dt_cache_stats_report_t *report, const char *name, dt_dev_pixelpipe_t *pipe)
+{
+  // the darkroom changes and flushes the cache lines with busy_mutex held, so do we to look at them.
+  // it is only ever taken for short stretches of the pipe, not for the processing of whole modules.
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  const dt_dev_pixelpipe_cache_t *cache = &pipe->cache;
+  report->name = name;
+  report->stats = cache->stats;
+  report->resident = report->quota = dt_dev_pixelpipe_cache_resident(cache);
+  report->entries = cache->entries;
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
+int dt_cache_stats_collect(dt_cache_stats_report_t *reports, const int max)
+{
+  static const char *mip_names[]
+      = { "mipmap i0", "mipmap i1", "mipmap i2", "mipmap i3", "mipmap f", "mipmap full" };
+  int cnt = 0;
+  if(darktable.image_cache && cnt < max) _report_cache(reports + cnt++, "image", &darktable.image_cache->cache);
+  if(darktable.mipmap_cache)
+  {
+    dt_mipmap_cache_t *mipmap_cache = darktable.mipmap_cache;
+    for(int k = 0; k < (int)DT_MIPMAP_NONE && cnt < max; k++)
+      _report_cache(reports + cnt++, mip_names[k], &mipmap_cache->mip[k].cache);
+    if(mipmap_cache->compression_type && cnt < max)
+      _report_cache(reports + cnt++, "mipmap scratch", &mipmap_cache->scratchmem.cache);
+  }
+  // only the darkroom pipes live long enough to be worth reporting. they are allocated along with the
+  // darkroom and freed after dt_cache_stats_cleanup() stopped the dump thread.
+  dt_develop_t *dev = darktable.develop;
+  if(dev && dev->pipe && cnt < max) _report_pipe(reports + cnt++, "pixelpipe full", dev->pipe);
+  if(dev && dev->preview_pipe && cnt < max)
+    _report_pipe(reports + cnt++, "pixelpipe preview", dev->preview_pipe);
+  return cnt;
+}
+
+void dt_cache_stats_print()
+{
+  dt_cache_stats_report_t reports[DT_CACHE_STATS_MAX_REPORTS];
+  const int cnt = dt_cache_stats_collect(reports, DT_CACHE_STATS_MAX_REPORTS);
+  printf("[cache_stats] cache             |     hits |   misses | hit rate | evictions |   resident/quota MB"
+         " | lock wait | alloc p50/p99 us\n");
+  for(int k = 0; k < cnt; k++)
+  {
+    const dt_cache_stats_t *s = &reports[k].stats;
+    const long int queries = s->hits + s->misses;
+    printf("[cache_stats] %-17s | %8ld | %8ld | %7.2f%% | %9ld | %8.2f/%9.2f | %8.3fs | %7" PRIu64 "/%" PRIu64
+           "\n",
+           reports[k].name, s->hits, s->misses, queries ? 100.0 * s->hits / (double)queries : 0.0,
+           s->evictions, reports[k].resident / (1024.0 * 1024.0), reports[k].quota / (1024.0 * 1024.0),
+           s->lock_wait_us * 1e-6, dt_cache_stats_alloc_quantile(s, 0.5f),
+           dt_cache_stats_alloc_quantile(s, 0.99f));
+  }
+  fflush(stdout);
+}
+
+static void *_dump_thread_run(void *data)
+{
+  const int interval = GPOINTER_TO_INT(data);
+  pthread_mutex_lock(&_dump_mutex);
+  while(_dump_running)
+  {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += interval;
+    while(_dump_running && pthread_cond_timedwait(&_dump_cond, &_dump_mutex, &until) != ETIMEDOUT)
+      ;
+    if(!_dump_running) break;
+    pthread_mutex_unlock(&_dump_mutex);
+    dt_cache_stats_print();
+    pthread_mutex_lock(&_dump_mutex);
+  }
+  pthread_mutex_unlock(&_dump_mutex);
+  return NULL;
+}
+
+void dt_cache_stats_init()
+{
+  if(!(darktable.unmuted & DT_DEBUG_CACHE)) return;
+  // 0 means to only print once, on shutdown.
+  const int interval = dt_conf_get_int("cache_stats_interval");
+  if(interval <= 0) return;
+  _dump_running = 1;
+  if(pthread_create(&_dump_thread, NULL, _dump_thread_run, GINT_TO_POINTER(interval)))
+  {
+    fprintf(stderr, "[cache_stats] could not start periodic dump\n");
+    _dump_running = 0;
+  }
+}
+
+void dt_cache_stats_cleanup()
+{
+  if(!(darktable.unmuted & DT_DEBUG_CACHE)) return;
+  if(_dump_running)
+  {
+    pthread_mutex_lock(&_dump_mutex);
+    _dump_running = 0;
+    pthread_cond_signal(&_dump_cond);
+    pthread_mutex_unlock(&_dump_mutex);
+    pthread_join(_dump_thread, NULL);
+  }
+  // final numbers for the whole session
+  dt_cache_stats_print();
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,114 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_CACHE_STATS_H
+#define DT_COMMON_CACHE_STATS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+// allocation latencies are binned logarithmically: bin k counts allocations
+// which took less than 2^k microseconds (and more than the bin before).
+// the last bin collects everything slower than that.
+#define DT_CACHE_STATS_BINS 24
+
+// maximum number of caches reported by dt_cache_stats_collect()
+#define DT_CACHE_STATS_MAX_REPORTS 16
+
+// counters every cache keeps about itself. all of them are updated with
+// __sync* atomics, so no lock is needed to update or read them.
+typedef struct dt_cache_stats_t
+{
+  // long int to give 32-bits on old archs, so __sync* calls will work.
+  long int hits;         // lookups which found the key
+  long int misses;       // lookups which did not find the key (and possibly allocated it)
+  long int evictions;    // entries thrown out to make room for others
+  long int lock_wait_us; // time spent waiting for locks held by others
+  long int alloc_hist[DT_CACHE_STATS_BINS];
+} dt_cache_stats_t;
+
+// snapshot of one cache, see dt_cache_stats_collect().
+typedef struct dt_cache_stats_report_t
+{
+  const char *name;
+  dt_cache_stats_t stats;
+  size_t resident; // cost of what is in the cache now, bytes for all but the float mipmaps
+  size_t quota;    // the same, maximum
+  uint32_t entries;
+} dt_cache_stats_report_t;
+
+static inline double dt_cache_stats_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + (1.0 / 1000000.0) * time.tv_usec;
+}
+
+static inline void dt_cache_stats_hit(dt_cache_stats_t *stats)
+{
+  __sync_fetch_and_add(&stats->hits, 1);
+}
+
+static inline void dt_cache_stats_miss(dt_cache_stats_t *stats)
+{
+  __sync_fetch_and_add(&stats->misses, 1);
+}
+
+static inline void dt_cache_stats_eviction(dt_cache_stats_t *stats)
+{
+  __sync_fetch_and_add(&stats->evictions, 1);
+}
+
+// account for time spent waiting, starting at t0 (as returned by dt_cache_stats_time())
+static inline void dt_cache_stats_lock_wait(dt_cache_stats_t *stats, const double t0)
+{
+  const long int us = (long int)(1e6 * (dt_cache_stats_time() - t0));
+  if(us > 0) __sync_fetch_and_add(&stats->lock_wait_us, us);
+}
+
+// sort the time spent allocating an entry, starting at t0, into the histogram
+static inline void dt_cache_stats_alloc(dt_cache_stats_t *stats, const double t0)
+{
+  uint64_t us = (uint64_t)(1e6 * (dt_cache_stats_time() - t0));
+  int bin = 0;
+  while(us && bin < DT_CACHE_STATS_BINS - 1)
+  {
+    us >>= 1;
+    bin++;
+  }
+  __sync_fetch_and_add(stats->alloc_hist + bin, 1);
+}
+
+// returns the upper bound of the histogram bin holding the given quantile (0..1) of
+// all allocations, in microseconds, or 0 if nothing was allocated so far.
+uint64_t dt_cache_stats_alloc_quantile(const dt_cache_stats_t *stats, const float quantile);
+
+// fills a report for each cache currently alive into the given array, returns how many.
+int dt_cache_stats_collect(dt_cache_stats_report_t *reports, const int max);
+
+// print all reports to stdout.
+void dt_cache_stats_print();
+
+// with -d cache, starts a thread printing the stats every cache_stats_interval seconds.
+void dt_cache_stats_init();
+void dt_cache_stats_cleanup();
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
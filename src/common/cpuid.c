@@ -52,11 +52,19 @@ dt_cpu_flags_t dt_detect_cpu_features()
                  "pop %%" R_BX "\n"                                                                          \
                  : "=a"(ax), "=c"(cx), "=d"(dx)                                                              \
                  : "0"(cmd))
+// the same for the leaves which have sub leaves, and which report in ebx
+#define cpuid_count(cmd, sub) \
+  __asm volatile("push %%" R_BX "\n"                                                                         \
+                 "cpuid\n"                                                                                   \
+                 "mov %%ebx, %%esi\n"                                                                        \
+                 "pop %%" R_BX "\n"                                                                          \
+                 : "=a"(ax), "=S"(bx), "=c"(cx), "=d"(dx)                                                    \
+                 : "0"(cmd), "2"(sub))
 
 #ifdef __x86_64__
-  guint64 ax, cx, dx, tmp;
+  guint64 ax, bx, cx, dx, tmp;
 #else
-  guint32 ax, cx, dx, tmp;
+  guint32 ax, bx, cx, dx, tmp;
 #endif
 
   static dt_cpu_flags_t cpuflags = -1;
@@ -91,6 +99,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
     {
       /* Get the standard level */
       cpuid(0x00000000);
+      const guint32 max_level = ax;
 
       if(ax)
       {
@@ -106,6 +115,33 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+
+        /* AVX is only usable if the OS saves the ymm (and for AVX-512 the zmm and mask) registers on
+           context switches: OSXSAVE, and the state bits in XCR0 */
+        int os_avx = 0, os_avx512 = 0;
+        if((cx & 0x18000000) == 0x18000000)
+        {
+          guint32 xcr0, xcr0_hi;
+          /* xgetbv, spelled out for old assemblers */
+          __asm volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+          os_avx = (xcr0 & 0x06) == 0x06;
+          os_avx512 = (xcr0 & 0xe6) == 0xe6;
+        }
+        if(os_avx)
+        {
+          cpuflags |= CPU_FLAG_AVX;
+          if(cx & 0x00001000) cpuflags |= CPU_FLAG_FMA;
+          if(cx & 0x20000000) cpuflags |= CPU_FLAG_F16C;
+        }
+
+        /* Structured extended features */
+        if(max_level >= 7 && os_avx)
+        {
+          cpuid_count(0x00000007, 0);
+
+          if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+          if(os_avx512 && (bx & 0x00010000)) cpuflags |= CPU_FLAG_AVX512F;
+        }
       }
 
       /* Are there extensions? */
@@ -144,6 +180,10 @@ dt_cpu_flags_t dt_detect_cpu_features()
     report("SSE4.1", CPU_FLAG_SSE4_1);
     report("SSE4.2", CPU_FLAG_SSE4_2);
     report("AVX", CPU_FLAG_AVX);
+    report("FMA", CPU_FLAG_FMA);
+    report("AVX2", CPU_FLAG_AVX2);
+    report("AVX-512F", CPU_FLAG_AVX512F);
+    report("F16C", CPU_FLAG_F16C);
 #undef report
   }
 #endif
@@ -151,6 +191,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
   return cpuflags;
 
 #undef cpuid
+#undef cpuid_count
 }
 #endif /* __i386__ || __x86_64__ */
 
@@ -34,9 +34,14 @@ typedef enum dt_cpu_flags_t
   CPU_FLAG_SSSE3 = 1 << 8,
   CPU_FLAG_SSE4_1 = 1 << 9,
   CPU_FLAG_SSE4_2 = 1 << 10,
-  CPU_FLAG_AVX = 1 << 11
+  CPU_FLAG_AVX = 1 << 11,
+  CPU_FLAG_FMA = 1 << 12,
+  CPU_FLAG_AVX2 = 1 << 13,
+  CPU_FLAG_AVX512F = 1 << 14,
+  CPU_FLAG_F16C = 1 << 15
 } dt_cpu_flags_t;
 
+/** what the cpu can do. the avx flags are only set if the os saves the wider registers, too. */
 dt_cpu_flags_t dt_detect_cpu_features();
 
 #endif
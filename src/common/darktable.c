@@ -31,6 +31,7 @@
 #endif
 
 #include "common/darktable.h"
+#include "common/cache_stats.h"
 #include "common/collection.h"
 #include "common/selection.h"
 #include "common/exif.h"
@@ -40,14 +41,20 @@
 #include "common/camera_control.h"
 #endif
 #include "common/cpuid.h"
+#include "common/eaw.h"
 #include "common/film.h"
 #include "common/grealpath.h"
+#include "common/half.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/interpolation.h"
 #include "common/mipmap_cache.h"
+#include "common/nlmeans.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/simd.h"
+#include "common/trace.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
 #include "libs/lib.h"
@@ -110,7 +117,8 @@ const char dt_supported_extensions[] = "3fr,arw,bay,bmq,cap,cine,cr2,crw,cs1,dc2
 static int usage(const char *argv0)
 {
   printf("usage: %s [-d "
-         "{all,cache,camctl,control,dev,fswatch,input,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql}]"
+         "{all,cache,camctl,control,dev,fswatch,input,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql,"
+         "trace}]"
          " [IMG_1234.{RAW,..}|image_folder/]",
          argv0);
 #ifdef HAVE_OPENCL
@@ -577,6 +585,8 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
           darktable.unmuted |= DT_DEBUG_MASKS; // masks related stuff.
         else if(!strcmp(argv[k + 1], "lua"))
           darktable.unmuted |= DT_DEBUG_LUA; // lua errors are reported on console
+        else if(!strcmp(argv[k + 1], "trace"))
+          darktable.unmuted |= DT_DEBUG_TRACE; // record a trace of the pipelines and jobs
         else
           return usage(argv[0]);
         k++;
@@ -788,6 +798,13 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
   dt_opencl_init(darktable.opencl, argc, argv);
 #endif
 
+  // vector code paths, before the blend ops and the modules pick theirs in init_global()
+  dt_simd_init();
+  dt_half_init();
+  dt_interpolation_init();
+  dt_nlmeans_init();
+  dt_eaw_init();
+
   darktable.blendop = (dt_blendop_t *)calloc(1, sizeof(dt_blendop_t));
   dt_develop_blend_init(darktable.blendop);
 
@@ -802,6 +819,10 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  // periodic dump of cache statistics, if -d cache was given
+  dt_cache_stats_init();
+  // per thread event recording, if -d trace was given
+  dt_trace_init();
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -926,6 +947,8 @@ void dt_cleanup()
 #ifdef USE_LUA
   dt_lua_finalize();
 #endif
+  // before the views go, these still hold the darkroom pipes
+  dt_cache_stats_cleanup();
   dt_view_manager_cleanup(darktable.view_manager);
   free(darktable.view_manager);
   if(init_gui)
@@ -945,6 +968,8 @@ void dt_cleanup()
     free(darktable.control);
     dt_undo_cleanup(darktable.undo);
   }
+  // the workers are gone, and the trace file may come from the config
+  dt_trace_cleanup();
   dt_conf_cleanup(darktable.conf);
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
@@ -137,6 +137,7 @@ static inline int dt_version()
 struct dt_gui_gtk_t;
 struct dt_control_t;
 struct dt_develop_t;
+struct dt_threadpool_t;
 struct dt_mipmap_cache_t;
 struct dt_image_cache_t;
 struct dt_lib_t;
@@ -163,7 +164,8 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_NAN = 1 << 11,
   DT_DEBUG_MASKS = 1 << 12,
   DT_DEBUG_LUA = 1 << 13,
-  DT_DEBUG_INPUT = 1 << 14
+  DT_DEBUG_INPUT = 1 << 14,
+  DT_DEBUG_TRACE = 1 << 15
 } dt_debug_thread_t;
 
 typedef struct darktable_t
@@ -181,6 +183,8 @@ typedef struct darktable_t
   struct dt_lib_t *lib;
   struct dt_view_manager_t *view_manager;
   struct dt_control_t *control;
+  // workers for jobs and parallel loops, see common/threadpool.h
+  struct dt_threadpool_t *threadpool;
   struct dt_control_signal_t *signals;
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
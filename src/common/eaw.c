@@ -0,0 +1,518 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_UNIT_TEST
+#include "common/darktable.h"
+#include "common/threadpool.h"
+#endif
+#include "common/eaw.h"
+#include "common/simd.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <emmintrin.h>
+
+// rows per chunk of the parallel loops
+#define DT_EAW_ROWS 8
+
+static const float _filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+
+// one row of the decomposition: coarse and, if not NULL, detail of row in, from the five rows of the kernel
+typedef void (*_eaw_row_t)(float *coarse, float *detail, const float *in, const float *const *rows,
+                           const int mult, const float sharpen, const int width);
+
+// the code path for one weight: rows of the decomposition, the in place detail and the synthesis
+typedef struct _eaw_kernels_t
+{
+  _eaw_row_t row;
+  dt_threadpool_range_t detail, synthesize;
+} _eaw_kernels_t;
+
+typedef struct _eaw_t
+{
+  float *coarse, *detail;
+  const float *in;
+  int mult, width, height;
+  float sharpen;
+  const _eaw_kernels_t *kernels;
+  // synthesis
+  float *out;
+  float threshold[4], boost[4];
+} _eaw_t;
+
+static inline int _clamp(const int i, const int lo, const int hi)
+{
+  return i < lo ? lo : (i > hi ? hi : i);
+}
+
+typedef union _floatint_t
+{
+  float f;
+  uint32_t i;
+} _floatint_t;
+
+// dt_fast_expf(), rounded as by the sse code
+static inline float _fast_expf(const float x)
+{
+  const float f = (float)0x3f800000u + x * (float)0x00adf880u;
+  _floatint_t k;
+  k.i = f > 0.0f ? lrintf(f) : 0;
+  return k.f;
+}
+
+// fast_mexp2f()
+static inline float _fast_mexp2f(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = i1 + x * (i2 - i1);
+  _floatint_t k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+// the weight of denoiseprofile from the sum of the squared differences, over sigma^2
+static inline float _weight_denoise(const float dot)
+{
+  // FIXME: this should ideally depend on the image before noise stabilizing transforms!
+  const float var = 0.02f;
+  const float off2 = 9.0f; // (3 sigma)^2
+  return _fast_mexp2f(MAX(0, dot * var - off2));
+}
+
+// plain c, for comparing the vector code against
+static inline __attribute__((always_inline)) void _pixel_plain(float *coarse, float *detail, const float *in,
+                                                               const float *const *rows, const int i,
+                                                               const int mult, const dt_eaw_weight_t weight,
+                                                               const float sharpen, const int width)
+{
+  const float *px = in + 4 * i;
+  float sum[4] = { 0.0f }, wgt[4] = { 0.0f };
+  for(int jj = 0; jj < 5; jj++)
+    for(int ii = 0; ii < 5; ii++)
+    {
+      const float *px2 = rows[jj] + 4 * _clamp(i + mult * (ii - 2), 0, width - 1);
+      float d[4], w[4];
+      for(int c = 0; c < 4; c++) d[c] = (px[c] - px2[c]) * (px[c] - px2[c]);
+      if(weight == DT_EAW_WEIGHT_ATROUS)
+      {
+        w[0] = _fast_expf(-sharpen * d[0]);
+        w[1] = w[2] = _fast_expf(-sharpen * (d[1] + d[2]));
+        w[3] = 1.0f;
+      }
+      else
+        w[0] = w[1] = w[2] = w[3] = _weight_denoise((d[0] + d[1] + d[2]) * sharpen);
+      for(int c = 0; c < 4; c++)
+      {
+        const float f = _filter[ii] * _filter[jj] * w[c];
+        sum[c] += f * px2[c];
+        wgt[c] += f;
+      }
+    }
+  for(int c = 0; c < 4; c++)
+  {
+    coarse[4 * i + c] = sum[c] / wgt[c];
+    if(detail) detail[4 * i + c] = px[c] - sum[c] / wgt[c];
+  }
+}
+
+static void _row_atrous_plain(float *coarse, float *detail, const float *in, const float *const *rows,
+                              const int mult, const float sharpen, const int width)
+{
+  for(int i = 0; i < width; i++)
+    _pixel_plain(coarse, detail, in, rows, i, mult, DT_EAW_WEIGHT_ATROUS, sharpen, width);
+}
+
+static void _row_denoise_plain(float *coarse, float *detail, const float *in, const float *const *rows,
+                               const int mult, const float sharpen, const int width)
+{
+  for(int i = 0; i < width; i++)
+    _pixel_plain(coarse, detail, in, rows, i, mult, DT_EAW_WEIGHT_DENOISE, sharpen, width);
+}
+
+static void _detail_rows_plain(void *data, const size_t begin, const size_t end)
+{
+  const _eaw_t *e = (const _eaw_t *)data;
+  for(size_t k = 4 * begin * e->width; k < 4 * end * e->width; k++) e->detail[k] -= e->coarse[k];
+}
+
+static void _synthesize_rows_plain(void *data, const size_t begin, const size_t end)
+{
+  const _eaw_t *e = (const _eaw_t *)data;
+  for(size_t k = begin * e->width; k < end * e->width; k++)
+    for(int c = 0; c < 4; c++)
+    {
+      const float detail = e->detail[4 * k + c];
+      const float amount = copysignf(MAX(0.0f, fabsf(detail) - e->threshold[c]), detail);
+      e->out[4 * k + c] = e->in[4 * k + c] + e->boost[c] * amount;
+    }
+}
+
+/* the weights of the atrous module, (wl, wc, wc, 1) with
+ * wl = exp(-sharpen * (c1[0] - c2[0])^2)
+ * wc = exp(-sharpen * ((c1[1] - c2[1])^2 + (c1[2] - c2[2])^2)) */
+static inline __attribute__((always_inline)) __m128 _weight_atrous_sse(const __m128 c1, const __m128 c2,
+                                                                        const float sharpen)
+{
+  const __m128 diff = _mm_sub_ps(c1, c2);
+  const __m128 square = _mm_mul_ps(diff, diff);                                   // (?, d3, d2, d1)
+  const __m128 square2 = _mm_shuffle_ps(square, square, _MM_SHUFFLE(3, 1, 2, 0)); // (?, d2, d3, d1)
+  const __m128 added = _mm_sub_ss(_mm_add_ps(square, square2), square);           // (?, d2+d3, d2+d3, d1)
+  const __m128 x = _mm_mul_ps(added, _mm_set1_ps(-sharpen));
+  // dt_fast_expf(), four at a time
+  const __m128 f
+      = _mm_add_ps(_mm_set1_ps((float)0x3f800000u), _mm_mul_ps(x, _mm_set1_ps((float)0x00adf880u)));
+  __m128i i = _mm_cvtps_epi32(f);
+  i = _mm_andnot_si128(_mm_srai_epi32(i, 31), i);
+  // (1, wc, wc, wl)
+  const __m128 lanes = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  return _mm_or_ps(_mm_and_ps(lanes, _mm_castsi128_ps(i)), _mm_andnot_ps(lanes, _mm_set1_ps(1.0f)));
+}
+
+// the weights of denoiseprofile: 2^-max(0, 0.02 |c1 - c2|^2 / sigma^2 - 9) for all channels
+static inline __attribute__((always_inline)) __m128 _weight_denoise_sse(const __m128 c1, const __m128 c2,
+                                                                         const float inv_sigma2)
+{
+  const __m128 diff = _mm_sub_ps(c1, c2);
+  float sqr[4] __attribute__((aligned(16)));
+  _mm_store_ps(sqr, _mm_mul_ps(diff, diff));
+  return _mm_set1_ps(_weight_denoise((sqr[0] + sqr[1] + sqr[2]) * inv_sigma2));
+}
+
+// one output pixel, with the kernel clamped to the image if needed
+static inline __attribute__((always_inline)) void _pixel_sse(float *coarse, float *detail, const float *in,
+                                                             const float *const *rows, const int i,
+                                                             const int mult, const dt_eaw_weight_t weight,
+                                                             const float sharpen, const int width)
+{
+  const __m128 px = _mm_load_ps(in + 4 * i);
+  const int inside = i >= 2 * mult && i < width - 2 * mult;
+  __m128 sum = _mm_setzero_ps(), wgt = _mm_setzero_ps();
+  for(int jj = 0; jj < 5; jj++)
+    for(int ii = 0; ii < 5; ii++)
+    {
+      const int x = inside ? i + mult * (ii - 2) : _clamp(i + mult * (ii - 2), 0, width - 1);
+      const __m128 px2 = _mm_load_ps(rows[jj] + 4 * x);
+      const __m128 wp = weight == DT_EAW_WEIGHT_ATROUS ? _weight_atrous_sse(px, px2, sharpen)
+                                                       : _weight_denoise_sse(px, px2, sharpen);
+      const __m128 w = _mm_mul_ps(_mm_set1_ps(_filter[ii] * _filter[jj]), wp);
+      sum = _mm_add_ps(sum, _mm_mul_ps(w, px2));
+      wgt = _mm_add_ps(wgt, w);
+    }
+  sum = _mm_div_ps(sum, wgt);
+  _mm_stream_ps(coarse + 4 * i, sum);
+  if(detail) _mm_stream_ps(detail + 4 * i, _mm_sub_ps(px, sum));
+}
+
+static void _row_atrous_sse(float *coarse, float *detail, const float *in, const float *const *rows,
+                            const int mult, const float sharpen, const int width)
+{
+  for(int i = 0; i < width; i++)
+    _pixel_sse(coarse, detail, in, rows, i, mult, DT_EAW_WEIGHT_ATROUS, sharpen, width);
+}
+
+static void _row_denoise_sse(float *coarse, float *detail, const float *in, const float *const *rows,
+                             const int mult, const float sharpen, const int width)
+{
+  for(int i = 0; i < width; i++)
+    _pixel_sse(coarse, detail, in, rows, i, mult, DT_EAW_WEIGHT_DENOISE, sharpen, width);
+}
+
+#ifdef DT_SIMD_HAVE_AVX2
+// two pixels at a time, one in each half of the registers
+DT_SIMD_TARGET_AVX2 static inline __m256 _weight_atrous_avx2(const __m256 c1, const __m256 c2,
+                                                             const float sharpen)
+{
+  const __m256 diff = _mm256_sub_ps(c1, c2);
+  const __m256 square = _mm256_mul_ps(diff, diff);
+  const __m256 square2 = _mm256_shuffle_ps(square, square, _MM_SHUFFLE(3, 1, 2, 0));
+  const __m256 added = _mm256_blend_ps(_mm256_add_ps(square, square2), square, 0x11);
+  const __m256 x = _mm256_mul_ps(added, _mm256_set1_ps(-sharpen));
+  const __m256 f = _mm256_add_ps(_mm256_set1_ps((float)0x3f800000u),
+                                 _mm256_mul_ps(x, _mm256_set1_ps((float)0x00adf880u)));
+  __m256i i = _mm256_cvtps_epi32(f);
+  i = _mm256_andnot_si256(_mm256_srai_epi32(i, 31), i);
+  return _mm256_blend_ps(_mm256_castsi256_ps(i), _mm256_set1_ps(1.0f), 0x88);
+}
+
+DT_SIMD_TARGET_AVX2 static inline __m256 _weight_denoise_avx2(const __m256 c1, const __m256 c2,
+                                                              const float inv_sigma2)
+{
+  const __m256 diff = _mm256_sub_ps(c1, c2);
+  const __m256 square = _mm256_blend_ps(_mm256_mul_ps(diff, diff), _mm256_setzero_ps(), 0x88);
+  // sum of the three channels in all four lanes of each half
+  __m256 dot = _mm256_hadd_ps(square, square);
+  dot = _mm256_hadd_ps(dot, dot);
+  dot = _mm256_mul_ps(dot, _mm256_set1_ps(inv_sigma2));
+  const __m256 x
+      = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_mul_ps(dot, _mm256_set1_ps(0.02f)),
+                                                         _mm256_set1_ps(9.0f)));
+  const __m256 i1 = _mm256_set1_ps((float)0x3f800000u);
+  const __m256 i2 = _mm256_set1_ps((float)0x3f000000u);
+  const __m256 k0 = _mm256_add_ps(i1, _mm256_mul_ps(x, _mm256_sub_ps(i2, i1)));
+  const __m256 denormal = _mm256_cmp_ps(k0, _mm256_set1_ps((float)0x800000u), _CMP_LT_OQ);
+  return _mm256_andnot_ps(denormal, _mm256_castsi256_ps(_mm256_cvttps_epi32(k0)));
+}
+
+DT_SIMD_TARGET_AVX2 static inline __attribute__((always_inline)) void
+_row_avx2(float *coarse, float *detail, const float *in, const float *const *rows, const int mult,
+          const dt_eaw_weight_t weight, const float sharpen, const int width)
+{
+  // the borders one by one, the inside in pairs
+  int i = 0;
+  for(; i < MIN(2 * mult, width); i++) _pixel_sse(coarse, detail, in, rows, i, mult, weight, sharpen, width);
+  for(; i + 1 < width - 2 * mult; i += 2)
+  {
+    const __m256 px = _mm256_loadu_ps(in + 4 * i);
+    __m256 sum = _mm256_setzero_ps(), wgt = _mm256_setzero_ps();
+    for(int jj = 0; jj < 5; jj++)
+    {
+      const float *row = rows[jj] + 4 * (i - 2 * mult);
+      for(int ii = 0; ii < 5; ii++, row += 4 * mult)
+      {
+        const __m256 px2 = _mm256_loadu_ps(row);
+        const __m256 wp = weight == DT_EAW_WEIGHT_ATROUS ? _weight_atrous_avx2(px, px2, sharpen)
+                                                         : _weight_denoise_avx2(px, px2, sharpen);
+        const __m256 w = _mm256_mul_ps(_mm256_set1_ps(_filter[ii] * _filter[jj]), wp);
+        sum = _mm256_fmadd_ps(w, px2, sum);
+        wgt = _mm256_add_ps(wgt, w);
+      }
+    }
+    sum = _mm256_div_ps(sum, wgt);
+    const __m256 d = _mm256_sub_ps(px, sum);
+    // rows may start at odd pixels, so these are only 16 byte aligned
+    _mm_stream_ps(coarse + 4 * i, _mm256_castps256_ps128(sum));
+    _mm_stream_ps(coarse + 4 * i + 4, _mm256_extractf128_ps(sum, 1));
+    if(detail)
+    {
+      _mm_stream_ps(detail + 4 * i, _mm256_castps256_ps128(d));
+      _mm_stream_ps(detail + 4 * i + 4, _mm256_extractf128_ps(d, 1));
+    }
+  }
+  for(; i < width; i++) _pixel_sse(coarse, detail, in, rows, i, mult, weight, sharpen, width);
+}
+
+DT_SIMD_TARGET_AVX2 static void _row_atrous_avx2(float *coarse, float *detail, const float *in,
+                                                 const float *const *rows, const int mult,
+                                                 const float sharpen, const int width)
+{
+  _row_avx2(coarse, detail, in, rows, mult, DT_EAW_WEIGHT_ATROUS, sharpen, width);
+}
+
+DT_SIMD_TARGET_AVX2 static void _row_denoise_avx2(float *coarse, float *detail, const float *in,
+                                                  const float *const *rows, const int mult,
+                                                  const float sharpen, const int width)
+{
+  _row_avx2(coarse, detail, in, rows, mult, DT_EAW_WEIGHT_DENOISE, sharpen, width);
+}
+#endif
+
+#ifdef DT_SIMD_HAVE_AVX512
+// four pixels at a time, one in each quarter of the registers
+DT_SIMD_TARGET_AVX512 static inline __m512 _weight_atrous_avx512(const __m512 c1, const __m512 c2,
+                                                                 const float sharpen)
+{
+  const __m512 diff = _mm512_sub_ps(c1, c2);
+  const __m512 square = _mm512_mul_ps(diff, diff);
+  const __m512 square2 = _mm512_shuffle_ps(square, square, _MM_SHUFFLE(3, 1, 2, 0));
+  const __m512 added = _mm512_mask_blend_ps(0x1111, _mm512_add_ps(square, square2), square);
+  const __m512 x = _mm512_mul_ps(added, _mm512_set1_ps(-sharpen));
+  const __m512 f = _mm512_add_ps(_mm512_set1_ps((float)0x3f800000u),
+                                 _mm512_mul_ps(x, _mm512_set1_ps((float)0x00adf880u)));
+  __m512i i = _mm512_cvtps_epi32(f);
+  i = _mm512_andnot_si512(_mm512_srai_epi32(i, 31), i);
+  return _mm512_mask_blend_ps(0x8888, _mm512_castsi512_ps(i), _mm512_set1_ps(1.0f));
+}
+
+DT_SIMD_TARGET_AVX512 static inline __m512 _weight_denoise_avx512(const __m512 c1, const __m512 c2,
+                                                                  const float inv_sigma2)
+{
+  const __m512 diff = _mm512_sub_ps(c1, c2);
+  const __m512 square = _mm512_maskz_mul_ps(0x7777, diff, diff);
+  // sum of the three channels in all four lanes of each quarter
+  __m512 dot = _mm512_add_ps(square, _mm512_shuffle_ps(square, square, _MM_SHUFFLE(2, 3, 0, 1)));
+  dot = _mm512_add_ps(dot, _mm512_shuffle_ps(dot, dot, _MM_SHUFFLE(1, 0, 3, 2)));
+  dot = _mm512_mul_ps(dot, _mm512_set1_ps(inv_sigma2));
+  const __m512 x
+      = _mm512_max_ps(_mm512_setzero_ps(), _mm512_sub_ps(_mm512_mul_ps(dot, _mm512_set1_ps(0.02f)),
+                                                         _mm512_set1_ps(9.0f)));
+  const __m512 i1 = _mm512_set1_ps((float)0x3f800000u);
+  const __m512 i2 = _mm512_set1_ps((float)0x3f000000u);
+  const __m512 k0 = _mm512_add_ps(i1, _mm512_mul_ps(x, _mm512_sub_ps(i2, i1)));
+  const __mmask16 normal = _mm512_cmp_ps_mask(k0, _mm512_set1_ps((float)0x800000u), _CMP_NLT_UQ);
+  return _mm512_maskz_mov_ps(normal, _mm512_castsi512_ps(_mm512_cvttps_epi32(k0)));
+}
+
+// rows may start at odd pixels, so the stores go by quarter
+DT_SIMD_TARGET_AVX512 static inline void _stream_avx512(float *out, const __m512 v)
+{
+  _mm_stream_ps(out, _mm512_castps512_ps128(v));
+  _mm_stream_ps(out + 4, _mm512_extractf32x4_ps(v, 1));
+  _mm_stream_ps(out + 8, _mm512_extractf32x4_ps(v, 2));
+  _mm_stream_ps(out + 12, _mm512_extractf32x4_ps(v, 3));
+}
+
+DT_SIMD_TARGET_AVX512 static inline __attribute__((always_inline)) void
+_row_avx512(float *coarse, float *detail, const float *in, const float *const *rows, const int mult,
+            const dt_eaw_weight_t weight, const float sharpen, const int width)
+{
+  int i = 0;
+  for(; i < MIN(2 * mult, width); i++) _pixel_sse(coarse, detail, in, rows, i, mult, weight, sharpen, width);
+  for(; i + 3 < width - 2 * mult; i += 4)
+  {
+    const __m512 px = _mm512_loadu_ps(in + 4 * i);
+    __m512 sum = _mm512_setzero_ps(), wgt = _mm512_setzero_ps();
+    for(int jj = 0; jj < 5; jj++)
+    {
+      const float *row = rows[jj] + 4 * (i - 2 * mult);
+      for(int ii = 0; ii < 5; ii++, row += 4 * mult)
+      {
+        const __m512 px2 = _mm512_loadu_ps(row);
+        const __m512 wp = weight == DT_EAW_WEIGHT_ATROUS ? _weight_atrous_avx512(px, px2, sharpen)
+                                                         : _weight_denoise_avx512(px, px2, sharpen);
+        const __m512 w = _mm512_mul_ps(_mm512_set1_ps(_filter[ii] * _filter[jj]), wp);
+        sum = _mm512_fmadd_ps(w, px2, sum);
+        wgt = _mm512_add_ps(wgt, w);
+      }
+    }
+    sum = _mm512_div_ps(sum, wgt);
+    _stream_avx512(coarse + 4 * i, sum);
+    if(detail) _stream_avx512(detail + 4 * i, _mm512_sub_ps(px, sum));
+  }
+  for(; i < width; i++) _pixel_sse(coarse, detail, in, rows, i, mult, weight, sharpen, width);
+}
+
+DT_SIMD_TARGET_AVX512 static void _row_atrous_avx512(float *coarse, float *detail, const float *in,
+                                                     const float *const *rows, const int mult,
+                                                     const float sharpen, const int width)
+{
+  _row_avx512(coarse, detail, in, rows, mult, DT_EAW_WEIGHT_ATROUS, sharpen, width);
+}
+
+DT_SIMD_TARGET_AVX512 static void _row_denoise_avx512(float *coarse, float *detail, const float *in,
+                                                      const float *const *rows, const int mult,
+                                                      const float sharpen, const int width)
+{
+  _row_avx512(coarse, detail, in, rows, mult, DT_EAW_WEIGHT_DENOISE, sharpen, width);
+}
+#endif
+
+static void _decompose_rows(void *data, const size_t begin, const size_t end)
+{
+  const _eaw_t *e = (const _eaw_t *)data;
+  const size_t width = e->width;
+  // in place, the detail is written once all the rows of the kernel are done
+  float *detail = e->detail == e->in ? NULL : e->detail;
+  for(size_t j = begin; j < end; j++)
+  {
+    const float *rows[5];
+    for(int jj = 0; jj < 5; jj++)
+      rows[jj] = e->in + 4 * width * _clamp((int)j + e->mult * (jj - 2), 0, e->height - 1);
+    e->kernels->row(e->coarse + 4 * width * j, detail ? detail + 4 * width * j : NULL, e->in + 4 * width * j,
+                    rows, e->mult, e->sharpen, e->width);
+  }
+  _mm_sfence();
+}
+
+static void _detail_rows_sse(void *data, const size_t begin, const size_t end)
+{
+  const _eaw_t *e = (const _eaw_t *)data;
+  for(size_t k = begin * e->width; k < end * e->width; k++)
+  {
+    float *d = e->detail + 4 * k;
+    _mm_store_ps(d, _mm_sub_ps(_mm_load_ps(d), _mm_load_ps(e->coarse + 4 * k)));
+  }
+}
+
+static void _synthesize_rows_sse(void *data, const size_t begin, const size_t end)
+{
+  const _eaw_t *e = (const _eaw_t *)data;
+  const __m128 threshold = _mm_loadu_ps(e->threshold);
+  const __m128 boost = _mm_loadu_ps(e->boost);
+  const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000u));
+  for(size_t k = begin * e->width; k < end * e->width; k++)
+  {
+    const __m128 detail = _mm_load_ps(e->detail + 4 * k);
+    const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(sign, detail), threshold));
+    const __m128 amount = _mm_or_ps(_mm_and_ps(detail, sign), absamt);
+    _mm_stream_ps(e->out + 4 * k, _mm_add_ps(_mm_load_ps(e->in + 4 * k), _mm_mul_ps(boost, amount)));
+  }
+  _mm_sfence();
+}
+
+// by weight
+static const _eaw_kernels_t _plain[2]
+    = { { _row_atrous_plain, _detail_rows_plain, _synthesize_rows_plain },
+        { _row_denoise_plain, _detail_rows_plain, _synthesize_rows_plain } };
+static const _eaw_kernels_t _sse[2] = { { _row_atrous_sse, _detail_rows_sse, _synthesize_rows_sse },
+                                        { _row_denoise_sse, _detail_rows_sse, _synthesize_rows_sse } };
+#ifdef DT_SIMD_HAVE_AVX2
+static const _eaw_kernels_t _avx2[2] = { { _row_atrous_avx2, _detail_rows_sse, _synthesize_rows_sse },
+                                         { _row_denoise_avx2, _detail_rows_sse, _synthesize_rows_sse } };
+#endif
+#ifdef DT_SIMD_HAVE_AVX512
+static const _eaw_kernels_t _avx512[2] = { { _row_atrous_avx512, _detail_rows_sse, _synthesize_rows_sse },
+                                           { _row_denoise_avx512, _detail_rows_sse, _synthesize_rows_sse } };
+#endif
+
+// the ones for the simd level in use, sse until dt_eaw_init() knows better
+static const _eaw_kernels_t *_kernels = _sse;
+
+void dt_eaw_init()
+{
+  _kernels = (const _eaw_kernels_t *)dt_simd_select(_plain, _sse, DT_SIMD_AVX2_FN(_avx2),
+                                                     DT_SIMD_AVX512_FN(_avx512));
+}
+
+void dt_eaw_decompose(float *const coarse, float *const detail, const float *const in, const int scale,
+                      const dt_eaw_weight_t weight, const float sharpen, const int width, const int height)
+{
+  _eaw_t e = { 0 };
+  e.coarse = coarse;
+  e.detail = detail;
+  e.in = in;
+  e.mult = 1 << scale;
+  e.width = width;
+  e.height = height;
+  e.sharpen = sharpen;
+  e.kernels = _kernels + weight;
+
+  dt_parallel_for(0, height, DT_EAW_ROWS, _decompose_rows, &e);
+  if(detail == in) dt_parallel_for(0, height, DT_EAW_ROWS, e.kernels->detail, &e);
+}
+
+void dt_eaw_synthesize(float *const out, const float *const in, const float *const detail,
+                       const float *const threshold, const float *const boost, const int width,
+                       const int height)
+{
+  _eaw_t e = { 0 };
+  e.out = out;
+  e.in = in;
+  e.detail = (float *)detail;
+  e.width = width;
+  e.height = height;
+  for(int c = 0; c < 4; c++)
+  {
+    e.threshold[c] = threshold[c];
+    e.boost[c] = boost[c];
+  }
+  dt_parallel_for(0, height, DT_EAW_ROWS, _kernels->synthesize, &e);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
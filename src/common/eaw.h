@@ -0,0 +1,58 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_EAW_H
+#define DT_COMMON_EAW_H
+
+/**
+ * edge-avoiding a-trous wavelets on 4 channel buffers, as used by the equalizer (atrous) and the wavelet
+ * mode of denoiseprofile.
+ *
+ * the pyramid can be built in place, with one buffer per scale and the input or the output for the finest
+ * detail:
+ *
+ *   dt_eaw_decompose(buf[1], out, in, 0, ...);          // detail 0 into out
+ *   for(s = 1; s < n; s++)
+ *     dt_eaw_decompose(buf[s + 1], buf[s], buf[s], s, ...); // coarse s becomes detail s
+ *   for(s = n - 1; s > 0; s--)
+ *     dt_eaw_synthesize(buf[s], buf[s + 1], buf[s], ...);
+ *   dt_eaw_synthesize(out, buf[1], out, ...);
+ */
+
+typedef enum dt_eaw_weight_t
+{
+  DT_EAW_WEIGHT_ATROUS = 0, // luma and chroma edges apart, exp(-sharpen * diff^2), alpha unweighted
+  DT_EAW_WEIGHT_DENOISE = 1 // one weight from the rgb distance, for noise stabilised input
+} dt_eaw_weight_t;
+
+/** picks the code path for the simd level, called once by dt_init() after dt_simd_init(). */
+void dt_eaw_init();
+
+/** one scale of the decomposition, with the 5x5 b-spline spaced 2^scale pixels apart. coarse gets the
+ * smoothed image and detail in - coarse. detail may be in, but coarse has to be a buffer of its own. */
+void dt_eaw_decompose(float *const coarse, float *const detail, const float *const in, const int scale,
+                      const dt_eaw_weight_t weight, const float sharpen, const int width, const int height);
+
+/** out = in + boost * the detail shrunk by threshold, per channel. out may be in or detail. */
+void dt_eaw_synthesize(float *const out, const float *const in, const float *const detail,
+                       const float *const threshold, const float *const boost, const int width,
+                       const int height);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -25,6 +25,7 @@
 #include "common/dtpthread.h"
 #include "common/collection.h"
 #include "common/image_cache.h"
+#include "common/mipmap_cache.h"
 #include "common/debug.h"
 #include "views/view.h"
 
@@ -337,6 +338,174 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+/* an import is a graph of jobs: the images are imported one after the other, which keeps the
+   grouping deterministic, and each one fans out to a job generating its thumbnail while the next
+   file is read already. a last job waits for the chain to finish up. cancelling the progress
+   cancels the chain from the next image on. */
+typedef struct _film_import_t
+{
+  dt_film_t *film; // the one we got called with, we hold a reference
+  GList *films;    // film rolls created for subdirectories
+  dt_progress_t *progress;
+  dt_mipmap_size_t mip; // thumbnails to prefetch, or DT_MIPMAP_NONE
+  guint total, done;
+  // the next job of the chain which didn't start yet, for the cancel button
+  dt_pthread_mutex_t mutex;
+  dt_job_t *next;
+} _film_import_t;
+
+typedef struct _film_import_image_t
+{
+  _film_import_t *import; // only for the import job, the thumbnail job may outlive it
+  int32_t film_id;
+  gchar *filename;
+  uint32_t imgid;
+  dt_mipmap_size_t mip; // thumbnail to generate
+  dt_job_t *next; // next image, or the final job
+  int32_t ref;    // import and thumbnail job
+} _film_import_image_t;
+
+static void _film_import_cancel(dt_progress_t *progress, void *data)
+{
+  _film_import_t *import = (_film_import_t *)data;
+  dt_pthread_mutex_lock(&import->mutex);
+  if(import->next) dt_control_job_cancel(import->next);
+  dt_pthread_mutex_unlock(&import->mutex);
+}
+
+static void _film_import_advance(_film_import_t *import, dt_job_t *next)
+{
+  dt_pthread_mutex_lock(&import->mutex);
+  import->next = next;
+  dt_pthread_mutex_unlock(&import->mutex);
+}
+
+static void _film_import_image_unref(void *data)
+{
+  _film_import_image_t *image = (_film_import_image_t *)data;
+  if(__sync_sub_and_fetch(&image->ref, 1) > 0) return;
+  g_free(image->filename);
+  free(image);
+}
+
+// cleanup of an import which got cancelled: hand over to the next one
+static void _film_import_image_skip(void *data)
+{
+  _film_import_image_t *image = (_film_import_image_t *)data;
+  _film_import_advance(image->import, image->next);
+  _film_import_image_unref(image);
+}
+
+static int32_t _film_import_image_run(dt_job_t *job)
+{
+  _film_import_image_t *image = dt_control_job_get_params(job);
+  _film_import_t *import = image->import;
+  _film_import_advance(import, image->next);
+
+  image->imgid = dt_image_import(image->film_id, image->filename, FALSE);
+
+  const guint done = __sync_add_and_fetch(&import->done, 1);
+  dt_control_progress_set_progress(darktable.control, import->progress, done / (double)import->total);
+  _film_import_image_unref(image);
+  // files we can't read are no reason to stop the others
+  return 0;
+}
+
+static int32_t _film_import_thumbnail_run(dt_job_t *job)
+{
+  _film_import_image_t *image = dt_control_job_get_params(job);
+  if(image->imgid)
+  {
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, image->imgid, image->mip, DT_MIPMAP_BLOCKING);
+    if(buf.buf) dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  }
+  _film_import_image_unref(image);
+  return 0;
+}
+
+static void _film_import_gpx(dt_film_t *film)
+{
+  if(!film->dir) return;
+  /* check if we can find a gpx data file to be auto applied
+     to images in the just imported filmroll */
+  g_dir_rewind(film->dir);
+  const gchar *dfn = NULL;
+  while((dfn = g_dir_read_name(film->dir)) != NULL)
+  {
+    /* check if we have a gpx to be auto applied to filmroll */
+    size_t len = strlen(dfn);
+    if(len >= 4 && (strcmp(dfn + len - 4, ".gpx") == 0 || strcmp(dfn + len - 4, ".GPX") == 0))
+    {
+      gchar *gpx_file = g_build_path(G_DIR_SEPARATOR_S, film->dirname, dfn, NULL);
+      gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
+      dt_control_gpx_apply(gpx_file, film->id, tz);
+      g_free(gpx_file);
+      g_free(tz);
+    }
+  }
+}
+
+// runs after the last image, or instead of it if the import got cancelled
+static void _film_import_finish(void *data)
+{
+  _film_import_t *import = (_film_import_t *)data;
+  _film_import_advance(import, NULL);
+
+  // only redraw at the end, to not spam the cpu with exposure events
+  dt_control_queue_redraw_center();
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+
+  dt_control_progress_destroy(darktable.control, import->progress);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, import->film->id);
+
+  // every film roll of a recursive import may come with its own track
+  _film_import_gpx(import->film);
+
+  for(GList *iter = import->films; iter; iter = g_list_next(iter))
+  {
+    dt_film_t *cfr = (dt_film_t *)iter->data;
+    _film_import_gpx(cfr);
+    if(dt_film_is_empty(cfr->id)) dt_film_remove(cfr->id);
+    dt_film_cleanup(cfr);
+    g_free(cfr);
+  }
+  g_list_free(import->films);
+
+  dt_film_t *film = import->film;
+  dt_pthread_mutex_lock(&film->images_mutex);
+  const int32_t ref = --film->ref;
+  dt_pthread_mutex_unlock(&film->images_mutex);
+  if(ref <= 0)
+  {
+    if(dt_film_is_empty(film->id)) dt_film_remove(film->id);
+    dt_film_cleanup(film);
+    free(film);
+  }
+
+  dt_pthread_mutex_destroy(&import->mutex);
+  free(import);
+}
+
+static int32_t _film_import_finish_run(dt_job_t *job)
+{
+  _film_import_finish(dt_control_job_get_params(job));
+  return 0;
+}
+
+static _film_import_image_t *_film_import_image_new(_film_import_t *import, const int32_t film_id,
+                                                    gchar *filename)
+{
+  _film_import_image_t *image = (_film_import_image_t *)calloc(1, sizeof(_film_import_image_t));
+  if(!image) return NULL;
+  image->import = import;
+  image->mip = import->mip;
+  image->film_id = film_id;
+  image->filename = filename;
+  image->ref = 1;
+  return image;
+}
+
 void dt_film_import1(dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -353,107 +522,114 @@ void dt_film_import1(dt_film_t *film)
   /* we got ourself a list of images, lets sort and start import */
   images = g_list_sort(images, (GCompareFunc)_film_filename_cmp);
 
-  /* let's start import of images */
-  gchar message[512] = { 0 };
-  double fraction = 0;
-  guint total = g_list_length(images);
-  g_snprintf(message, sizeof(message) - 1, ngettext("importing %d image", "importing %d images", total),
-             total);
-  dt_progress_t *progress = dt_control_progress_create(darktable.control, TRUE, message);
-
-
-  /* loop thru the images and import to current film roll */
-  dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+  _film_import_t *import = (_film_import_t *)calloc(1, sizeof(_film_import_t));
+  if(!import)
+  {
+    g_list_free_full(images, g_free);
+    return;
+  }
+  dt_pthread_mutex_init(&import->mutex, NULL);
+  import->film = film;
+  dt_pthread_mutex_lock(&film->images_mutex);
+  film->ref++;
+  dt_pthread_mutex_unlock(&film->images_mutex);
+  import->total = g_list_length(images);
+  import->mip = DT_MIPMAP_NONE;
+  if(darktable.gui)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+    // the size the lighttable will most likely ask for
+    const int iir = MAX(1, dt_conf_get_int("plugins/lighttable/images_in_row"));
+    const dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+    import->mip = dt_mipmap_cache_get_matching_size(cache, cache->mip[DT_MIPMAP_F - 1].max_width / iir,
+                                                    cache->mip[DT_MIPMAP_F - 1].max_height / iir);
+  }
 
-    /* check if we need to initialize a new filmroll */
-    if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
+  gchar message[512] = { 0 };
+  g_snprintf(message, sizeof(message) - 1,
+             ngettext("importing %d image", "importing %d images", import->total), import->total);
+  import->progress = dt_control_progress_create(darktable.control, TRUE, message);
+
+  /* the film rolls to import to have to exist before the jobs start */
+  GHashTable *films = g_hash_table_new(g_str_hash, g_str_equal);
+  g_hash_table_insert(films, film->dirname, film);
+
+  dt_job_t *finish = dt_control_job_create(&_film_import_finish_run, "import film roll");
+  dt_control_job_set_params(finish, import);
+  dt_control_job_set_params_cleanup(finish, &_film_import_finish);
+
+  /* build the graph: a chain of imports, each with its thumbnail on the side */
+  GList *jobs = NULL, *thumbs = NULL;
+  dt_job_t *prev = NULL;
+  _film_import_image_t *prev_image = NULL;
+  for(GList *iter = images; iter; iter = g_list_next(iter))
+  {
+    gchar *filename = (gchar *)iter->data;
+    gchar *cdn = g_path_get_dirname(filename);
+    dt_film_t *cfr = (dt_film_t *)g_hash_table_lookup(films, cdn);
+    if(!cfr)
     {
-      // FIXME: maybe refactor into function and call it?
-      if(cfr && cfr->dir)
-      {
-        /* check if we can find a gpx data file to be auto applied
-           to images in the jsut imported filmroll */
-        g_dir_rewind(cfr->dir);
-        const gchar *dfn = NULL;
-        while((dfn = g_dir_read_name(cfr->dir)) != NULL)
-        {
-          /* check if we have a gpx to be auto applied to filmroll */
-          size_t len = strlen(dfn);
-          if(strcmp(dfn + len - 4, ".gpx") == 0 || strcmp(dfn + len - 4, ".GPX") == 0)
-          {
-            gchar *gpx_file = g_build_path(G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-            gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
-            dt_control_gpx_apply(gpx_file, cfr->id, tz);
-            g_free(gpx_file);
-            g_free(tz);
-          }
-        }
-      }
-
-      /* cleanup previously imported filmroll*/
-      if(cfr && cfr != film)
-      {
-        if(dt_film_is_empty(cfr->id))
-        {
-          dt_film_remove(cfr->id);
-        }
-        dt_film_cleanup(cfr);
-        g_free(cfr);
-        cfr = NULL;
-      }
-
-      /* initialize and create a new film to import to */
       cfr = g_malloc(sizeof(dt_film_t));
       dt_film_init(cfr);
       dt_film_new(cfr, cdn);
+      import->films = g_list_prepend(import->films, cfr);
+      g_hash_table_insert(films, cfr->dirname, cfr);
     }
-
     g_free(cdn);
 
-    /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
-
-    fraction += 1.0 / total;
-    dt_control_progress_set_progress(darktable.control, progress, fraction);
-
-
-  } while((image = g_list_next(image)) != NULL);
-
-  // only redraw at the end, to not spam the cpu with exposure events
-  dt_control_queue_redraw_center();
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
-
-  dt_control_progress_destroy(darktable.control, progress);
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, film->id);
+    _film_import_image_t *image = _film_import_image_new(import, cfr->id, filename);
+    dt_job_t *job = image ? dt_control_job_create(&_film_import_image_run, "import %s", filename) : NULL;
+    if(!job)
+    {
+      if(image) free(image);
+      g_free(filename);
+      continue;
+    }
+    dt_control_job_set_params(job, image);
+    dt_control_job_set_params_cleanup(job, &_film_import_image_skip);
+    if(prev)
+    {
+      dt_control_job_add_dependency(job, prev);
+      prev_image->next = job;
+    }
+    jobs = g_list_prepend(jobs, job);
 
-  // FIXME: maybe refactor into function and call it?
-  if(cfr && cfr->dir)
-  {
-    /* check if we can find a gpx data file to be auto applied
-       to images in the just imported filmroll */
-    g_dir_rewind(cfr->dir);
-    const gchar *dfn = NULL;
-    while((dfn = g_dir_read_name(cfr->dir)) != NULL)
+    if(import->mip != DT_MIPMAP_NONE)
     {
-      /* check if we have a gpx to be auto applied to filmroll */
-      size_t len = strlen(dfn);
-      if(strcmp(dfn + len - 4, ".gpx") == 0 || strcmp(dfn + len - 4, ".GPX") == 0)
+      dt_job_t *thumb = dt_control_job_create(&_film_import_thumbnail_run, "import thumbnail %s", filename);
+      if(thumb)
       {
-        gchar *gpx_file = g_build_path(G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-        gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
-        dt_control_gpx_apply(gpx_file, cfr->id, tz);
-        g_free(gpx_file);
-        g_free(tz);
+        image->ref++;
+        dt_control_job_set_params(thumb, image);
+        dt_control_job_set_params_cleanup(thumb, &_film_import_image_unref);
+        dt_control_job_add_dependency(thumb, job);
+        thumbs = g_list_prepend(thumbs, thumb);
       }
     }
+    prev = job;
+    prev_image = image;
   }
-}
-
+  g_list_free(images);
+  g_hash_table_destroy(films);
 
+  if(prev)
+  {
+    dt_control_job_add_dependency(finish, prev);
+    prev_image->next = finish;
+  }
+  jobs = g_list_reverse(jobs);
+  _film_import_advance(import, jobs ? (dt_job_t *)jobs->data : finish);
+  dt_control_progress_make_cancellable(darktable.control, import->progress, &_film_import_cancel, import);
+
+  /* and off it goes. thumbnails are speculative, they shouldn't get in the way of the user's jobs. */
+  for(GList *iter = jobs; iter; iter = g_list_next(iter))
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, (dt_job_t *)iter->data);
+  thumbs = g_list_reverse(thumbs);
+  for(GList *iter = thumbs; iter; iter = g_list_next(iter))
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, (dt_job_t *)iter->data);
+  g_list_free(jobs);
+  g_list_free(thumbs);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, finish);
+}
 
 void dt_film_remove_empty()
 {
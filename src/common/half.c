@@ -0,0 +1,89 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/half.h"
+#include "common/simd.h"
+
+typedef void (*_to_half_t)(uint16_t *out, const float *in, const size_t n);
+typedef void (*_to_float_t)(float *out, const uint16_t *in, const size_t n);
+
+static void _float_to_half_buf_plain(uint16_t *out, const float *in, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(out, in)
+#endif
+  for(size_t k = 0; k < n; k++) out[k] = dt_float_to_half(in[k]);
+}
+
+static void _half_to_float_buf_plain(float *out, const uint16_t *in, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(out, in)
+#endif
+  for(size_t k = 0; k < n; k++) out[k] = dt_half_to_float(in[k]);
+}
+
+#ifdef DT_SIMD_HAVE_AVX2
+// every cpu with avx2 has f16c, it converts 8 at a time with the same rounding.
+DT_SIMD_TARGET_AVX2 static void _float_to_half_buf_f16c(uint16_t *out, const float *in, const size_t n)
+{
+  const size_t n8 = n & ~(size_t)7;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(out, in)
+#endif
+  for(size_t k = 0; k < n8; k += 8)
+    _mm_storeu_si128((__m128i *)(out + k), _mm256_cvtps_ph(_mm256_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+  for(size_t k = n8; k < n; k++) out[k] = dt_float_to_half(in[k]);
+}
+
+DT_SIMD_TARGET_AVX2 static void _half_to_float_buf_f16c(float *out, const uint16_t *in, const size_t n)
+{
+  const size_t n8 = n & ~(size_t)7;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(out, in)
+#endif
+  for(size_t k = 0; k < n8; k += 8)
+    _mm256_storeu_ps(out + k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + k))));
+  for(size_t k = n8; k < n; k++) out[k] = dt_half_to_float(in[k]);
+}
+#endif
+
+// plain c until dt_half_init() knows better
+static _to_half_t _to_half = _float_to_half_buf_plain;
+static _to_float_t _to_float = _half_to_float_buf_plain;
+
+void dt_half_init()
+{
+  _to_half = (_to_half_t)dt_simd_select(_float_to_half_buf_plain, _float_to_half_buf_plain,
+                                        DT_SIMD_AVX2_FN(_float_to_half_buf_f16c), NULL);
+  _to_float = (_to_float_t)dt_simd_select(_half_to_float_buf_plain, _half_to_float_buf_plain,
+                                          DT_SIMD_AVX2_FN(_half_to_float_buf_f16c), NULL);
+}
+
+void dt_float_to_half_buf(uint16_t *out, const float *in, const size_t n)
+{
+  _to_half(out, in, n);
+}
+
+void dt_half_to_float_buf(float *out, const uint16_t *in, const size_t n)
+{
+  _to_float(out, in, n);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
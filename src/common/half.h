@@ -0,0 +1,102 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_HALF_H
+#define DT_COMMON_HALF_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// conversion between 32-bit floats and ieee 754 half floats (1 sign, 5 exponent,
+// 10 mantissa bits), with rounding to nearest even as f16c does. values too large
+// for half become inf, nan stays nan.
+
+static inline uint16_t dt_float_to_half(const float f)
+{
+  union
+  {
+    float f;
+    uint32_t i;
+  } u = { f };
+  const uint32_t sign = (u.i >> 16) & 0x8000;
+  const int32_t fexp = (u.i >> 23) & 0xff;
+  uint32_t mant = u.i & 0x7fffff;
+  if(fexp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0); // inf or nan
+  const int32_t exp = fexp - 127 + 15;
+  if(exp >= 31) return sign | 0x7c00; // overflow
+  if(exp <= 0)
+  {
+    // denormal half, or zero
+    if(exp < -10) return sign;
+    mant |= 0x800000;
+    const int shift = 14 - exp;
+    uint32_t h = mant >> shift;
+    const uint32_t rest = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+  // a carry out of the mantissa correctly bumps the exponent
+  uint32_t h = sign | (exp << 10) | (mant >> 13);
+  const uint32_t rest = mant & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+  return h;
+}
+
+static inline float dt_half_to_float(const uint16_t h)
+{
+  union
+  {
+    uint32_t i;
+    float f;
+  } u;
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  int32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if(exp == 0)
+  {
+    if(!mant)
+      u.i = sign;
+    else
+    {
+      // denormal half: normalise for float
+      exp = 127 - 15 + 1;
+      while(!(mant & 0x400))
+      {
+        mant <<= 1;
+        exp--;
+      }
+      u.i = sign | ((uint32_t)exp << 23) | ((mant & 0x3ff) << 13);
+    }
+  }
+  else if(exp == 31)
+    u.i = sign | 0x7f800000 | (mant << 13);
+  else
+    u.i = sign | ((uint32_t)(exp + 127 - 15) << 23) | (mant << 13);
+  return u.f;
+}
+
+/** picks f16c for the buffers if the simd level has it, called once by dt_init() after dt_simd_init(). */
+void dt_half_init();
+
+// convert whole buffers of n floats
+void dt_float_to_half_buf(uint16_t *out, const float *in, const size_t n);
+void dt_half_to_float_buf(float *out, const uint16_t *in, const size_t n);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,139 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_HASH_H
+#define DT_COMMON_HASH_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+// 128-bit non-cryptographic hash, this is MurmurHash3_x64_128 by Austin Appleby
+// (public domain), with the seed extended to the full 128 bits. this way hashes
+// can be chained: the hash of a node is the hash of its data, seeded with the hash
+// of its predecessor.
+typedef struct dt_hash_t
+{
+  uint64_t h1, h2;
+} dt_hash_t;
+
+// used to mark unused slots
+static const dt_hash_t dt_hash_invalid = { UINT64_MAX, UINT64_MAX };
+
+static inline int dt_hash_equal(const dt_hash_t a, const dt_hash_t b)
+{
+  return a.h1 == b.h1 && a.h2 == b.h2;
+}
+
+static inline int dt_hash_is_valid(const dt_hash_t a)
+{
+  return !dt_hash_equal(a, dt_hash_invalid);
+}
+
+// fold to 64 bits, for places which only need to detect changes
+static inline uint64_t dt_hash_fold(const dt_hash_t a)
+{
+  return a.h1 ^ a.h2;
+}
+
+static inline uint64_t _dt_hash_rotl(const uint64_t x, const int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t _dt_hash_fmix(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline dt_hash_t dt_hash(const dt_hash_t seed, const void *data, const size_t len)
+{
+  const uint64_t c1 = 0x87c37b91114253d5ull;
+  const uint64_t c2 = 0x4cf5ad432745937full;
+  const uint8_t *bytes = (const uint8_t *)data;
+  const size_t nblocks = len / 16;
+  uint64_t h1 = seed.h1, h2 = seed.h2;
+
+  for(size_t i = 0; i < nblocks; i++)
+  {
+    uint64_t k1, k2;
+    memcpy(&k1, bytes + 16 * i, sizeof(k1));
+    memcpy(&k2, bytes + 16 * i + 8, sizeof(k2));
+
+    k1 *= c1;
+    k1 = _dt_hash_rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = _dt_hash_rotl(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2;
+    k2 = _dt_hash_rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = _dt_hash_rotl(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  const uint8_t *tail = bytes + 16 * nblocks;
+  uint64_t k1 = 0, k2 = 0;
+  const size_t rest = len & 15;
+  for(size_t i = rest; i > 8; i--) k2 ^= (uint64_t)tail[i - 1] << (8 * (i - 9));
+  if(rest > 8)
+  {
+    k2 *= c2;
+    k2 = _dt_hash_rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+  }
+  for(size_t i = rest < 8 ? rest : 8; i > 0; i--) k1 ^= (uint64_t)tail[i - 1] << (8 * (i - 1));
+  if(rest > 0)
+  {
+    k1 *= c1;
+    k1 = _dt_hash_rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+  }
+
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = _dt_hash_fmix(h1);
+  h2 = _dt_hash_fmix(h2);
+  h1 += h2;
+  h2 += h1;
+  return (dt_hash_t){ h1, h2 };
+}
+
+// seed for a chain of hashes, starting at the given number (such as an image id)
+static inline dt_hash_t dt_hash_seed(const uint64_t seed)
+{
+  return (dt_hash_t){ seed, seed };
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -40,6 +40,7 @@
 #include "common/imageio_gm.h"
 #include "common/imageio_rawspeed.h"
 #include "common/image_compression.h"
+#include "common/interpolation.h"
 #include "common/mipmap_cache.h"
 #include "common/styles.h"
 #include "control/control.h"
@@ -586,6 +587,104 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+static __thread dt_imageio_export_stages_t *_stages = NULL;
+static __thread double _stage_start[DT_IMAGEIO_STAGE_MAX];
+static __thread double _stage_nested; // time the store stage spent in the others
+
+void dt_imageio_export_stages_init(dt_imageio_export_stages_t *stages, const int32_t decode,
+                                   const int32_t develop, const int32_t encode, const int32_t store)
+{
+  memset(stages, 0, sizeof(dt_imageio_export_stages_t));
+  dt_pthread_mutex_init(&stages->mutex, NULL);
+  pthread_cond_init(&stages->cond, NULL);
+  stages->limit[DT_IMAGEIO_STAGE_DECODE] = decode;
+  stages->limit[DT_IMAGEIO_STAGE_DEVELOP] = develop;
+  stages->limit[DT_IMAGEIO_STAGE_ENCODE] = encode;
+  stages->limit[DT_IMAGEIO_STAGE_STORE] = store;
+  stages->start = dt_get_wtime();
+}
+
+void dt_imageio_export_stages_cleanup(dt_imageio_export_stages_t *stages)
+{
+  dt_pthread_mutex_destroy(&stages->mutex);
+  pthread_cond_destroy(&stages->cond);
+}
+
+void dt_imageio_export_stages_attach(dt_imageio_export_stages_t *stages)
+{
+  _stages = stages;
+}
+
+static void _stage_wait_locked(dt_imageio_export_stages_t *stages, const dt_imageio_export_stage_t stage)
+{
+  while(stages->limit[stage] > 0 && stages->busy[stage] >= stages->limit[stage])
+    dt_pthread_cond_wait(&stages->cond, &stages->mutex);
+  stages->busy[stage]++;
+}
+
+static void _stage_leave_locked(dt_imageio_export_stages_t *stages, const dt_imageio_export_stage_t stage,
+                                const double end)
+{
+  double time = end - _stage_start[stage];
+  if(stage == DT_IMAGEIO_STAGE_STORE)
+    time -= _stage_nested;
+  else
+    _stage_nested += time;
+  stages->busy[stage]--;
+  stages->done[stage]++;
+  stages->time[stage] += time;
+  pthread_cond_broadcast(&stages->cond);
+}
+
+void dt_imageio_export_stage_enter(const dt_imageio_export_stage_t stage)
+{
+  dt_imageio_export_stages_t *stages = _stages;
+  if(!stages) return;
+  dt_pthread_mutex_lock(&stages->mutex);
+  _stage_wait_locked(stages, stage);
+  dt_pthread_mutex_unlock(&stages->mutex);
+  if(stage == DT_IMAGEIO_STAGE_STORE) _stage_nested = 0.0;
+  _stage_start[stage] = dt_get_wtime();
+}
+
+void dt_imageio_export_stage_leave(const dt_imageio_export_stage_t stage)
+{
+  dt_imageio_export_stages_t *stages = _stages;
+  if(!stages) return;
+  const double end = dt_get_wtime();
+  dt_pthread_mutex_lock(&stages->mutex);
+  _stage_leave_locked(stages, stage, end);
+  dt_pthread_mutex_unlock(&stages->mutex);
+}
+
+void dt_imageio_export_stage_handoff(const dt_imageio_export_stage_t from, const dt_imageio_export_stage_t to)
+{
+  dt_imageio_export_stages_t *stages = _stages;
+  if(!stages) return;
+  // the work is done now, what follows is waiting in line
+  const double end = dt_get_wtime();
+  dt_pthread_mutex_lock(&stages->mutex);
+  _stage_wait_locked(stages, to);
+  _stage_leave_locked(stages, from, end);
+  dt_pthread_mutex_unlock(&stages->mutex);
+  _stage_start[to] = dt_get_wtime();
+}
+
+void dt_imageio_export_stages_describe(dt_imageio_export_stages_t *stages, char *text, const size_t size)
+{
+  const char *names[DT_IMAGEIO_STAGE_MAX]
+      = { C_("export stage", "decode"), C_("export stage", "develop"), C_("export stage", "encode"),
+          C_("export stage", "store") };
+  dt_pthread_mutex_lock(&stages->mutex);
+  const double elapsed = dt_get_wtime() - stages->start;
+  int len = snprintf(text, size, _("%.2f images/s"),
+                     elapsed > 0.0 ? stages->done[DT_IMAGEIO_STAGE_STORE] / elapsed : 0.0);
+  for(int k = 0; k < DT_IMAGEIO_STAGE_MAX && len >= 0 && (size_t)len < size; k++)
+    if(stages->done[k])
+      len += snprintf(text + len, size - len, ", %s %.2fs", names[k], stages->time[k] / stages->done[k]);
+  dt_pthread_mutex_unlock(&stages->mutex);
+}
+
 int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
                       dt_imageio_module_data_t *format_params, const gboolean high_quality,
                       const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
@@ -599,6 +698,204 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
                                         copy_metadata, storage, storage_params);
 }
 
+// adds the items of a style to the history of dev. returns 1 if that failed.
+static int _export_apply_style(dt_develop_t *dev, const char *style, const gboolean style_append)
+{
+  GList *stls;
+
+  GList *modules = dev->iop;
+  dt_iop_module_t *m = NULL;
+
+  if((stls = dt_styles_get_item_list(style, TRUE, -1)) == 0)
+  {
+    dt_control_log(_("cannot find the style '%s' to apply during export."), style);
+    return 1;
+  }
+
+  //  Add each params
+  while(stls)
+  {
+    dt_style_item_t *s = (dt_style_item_t *)stls->data;
+
+    modules = dev->iop;
+    while(modules)
+    {
+      m = (dt_iop_module_t *)modules->data;
+
+      //  since the name in the style is returned with a possible multi-name, just check the start of the
+      //  name
+      if(strncmp(m->op, s->name, strlen(m->op)) == 0)
+      {
+        dt_dev_history_item_t *h = malloc(sizeof(dt_dev_history_item_t));
+        dt_iop_module_t *sty_module = m;
+
+        if (style_append && !(m->flags() & IOP_FLAGS_ONE_INSTANCE))
+        {
+          sty_module = dt_dev_module_duplicate(m->dev, m, 0);
+          if(!sty_module)
+          {
+            free(h);
+            return 1;
+          }
+        }
+
+        h->params = s->params;
+        h->blend_params = s->blendop_params;
+        h->enabled = s->enabled;
+        h->module = sty_module;
+        h->multi_priority = 1;
+        g_strlcpy(h->multi_name, "<style>", sizeof(h->multi_name));
+
+        if(m->legacy_params && (s->module_version != m->version()))
+        {
+          void *new_params = malloc(m->params_size);
+          m->legacy_params(m, h->params, s->module_version, new_params, labs(m->version()));
+
+          free(h->params);
+          h->params = new_params;
+        }
+
+        dev->history_end++;
+        dev->history = g_list_append(dev->history, h);
+        break;
+      }
+      modules = g_list_next(modules);
+    }
+    stls = g_list_next(stls);
+  }
+  return 0;
+}
+
+// whether the export ends up in sRGB, for the exif data
+static int _export_is_srgb(dt_develop_t *dev)
+{
+  int sRGB = 1;
+  gchar *overprofile = dt_conf_get_string("plugins/lighttable/export/iccprofile");
+  if(overprofile && !strcmp(overprofile, "sRGB"))
+  {
+    sRGB = 1;
+  }
+  else if(!overprofile || !strcmp(overprofile, "image"))
+  {
+    GList *modules = dev->iop;
+    dt_iop_module_t *colorout = NULL;
+    while(modules)
+    {
+      colorout = (dt_iop_module_t *)modules->data;
+      if(colorout->get_p && strcmp(colorout->op, "colorout") == 0)
+      {
+        const char *iccprofile = colorout->get_p(colorout->params, "iccprofile");
+        if(!strcmp(iccprofile, "sRGB"))
+          sRGB = 1;
+        else
+          sRGB = 0;
+      }
+      modules = g_list_next(modules);
+    }
+  }
+  else
+  {
+    sRGB = 0;
+  }
+  g_free(overprofile);
+  return sRGB;
+}
+
+// downscales the full size output of the pipe into out in bands, each one from only the rows of the pipe
+// it needs. returns 0 if there is no memory for a band.
+static int _export_downscale_bands(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, float *out,
+                                   const dt_iop_roi_t *const roi_out, const int band_height)
+{
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  const float scale = roi_out->scale;
+  const int width = pipe->processed_width;
+  // output rows per band, and how far beyond them the filter reaches into the input
+  const int rows = MAX(1, (int)(band_height * scale));
+  const int margin = ceilf(itor->width / scale) + 1;
+  float *buf = (float *)dt_alloc_align(
+      64, (size_t)sizeof(float) * 4 * width * ((int)ceilf(rows / scale) + 2 * margin + 2));
+  if(!buf) return 0;
+  for(int b = 0; b < roi_out->height; b += rows)
+  {
+    const int height = MIN(rows, roi_out->height - b);
+    const int y0 = MAX(0, (int)floorf(b / scale) - margin);
+    const int y1 = MIN(pipe->processed_height, (int)ceilf((b + height) / scale) + margin);
+    if(dt_dev_pixelpipe_process_bands(pipe, dev, buf, 1, 0, y0, width, y1 - y0, 1.0f, y1 - y0)) break;
+    // the filter takes the band for the rows y0..y1 of the whole input, it never reads above y0
+    const dt_iop_roi_t roi_in = { 0, 0, width, y1, 1.0f };
+    const dt_iop_roi_t roi_band = { 0, b, roi_out->width, height, scale };
+    dt_interpolation_resample(itor, out + (size_t)4 * roi_out->width * b, &roi_band,
+                              roi_out->width * 4 * sizeof(float), buf - (size_t)4 * width * y0, &roi_in,
+                              width * 4 * sizeof(float));
+  }
+  dt_free_align(buf);
+  return 1;
+}
+
+// converts float rgba to 8 bits per channel, in place
+static void _export_float_to_8bit(uint8_t *outbuf, const int width, const int height, const int swap)
+{
+  const float *const inbuf = (float *)outbuf;
+  const int r = swap ? 2 : 0, b = swap ? 0 : 2;
+  for(size_t k = 0; k < (size_t)width * height; k++)
+  {
+    // convert in place, this is unfortunately very serial..
+    const uint8_t cr = CLAMP(inbuf[4 * k + r] * 0xff, 0, 0xff);
+    const uint8_t cg = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+    const uint8_t cb = CLAMP(inbuf[4 * k + b] * 0xff, 0, 0xff);
+    outbuf[4 * k + 0] = cr;
+    outbuf[4 * k + 1] = cg;
+    outbuf[4 * k + 2] = cb;
+  }
+}
+
+// converts float rgba to uint16_t per channel, in place
+static void _export_float_to_16bit(uint8_t *outbuf, const int width, const int height)
+{
+  float *buff = (float *)outbuf;
+  uint16_t *buf16 = (uint16_t *)outbuf;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      // convert in place
+      const size_t k = (size_t)width * y + x;
+      for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
+    }
+}
+
+// hands the pixels to the format, with exif data unless told not to, and attaches the xmp afterwards
+static int _export_write(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
+                         dt_imageio_module_data_t *format_params, uint8_t *outbuf, const int32_t ignore_exif,
+                         const int sRGB, const gboolean copy_metadata)
+{
+  int res;
+  if(!ignore_exif)
+  {
+    int length;
+    uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
+    char pathname[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+    // last param is dng mode, it's false here
+    length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, format_params->width,
+                               format_params->height, 0);
+
+    res = format->write_image(format_params, filename, outbuf, exif_profile, length, imgid);
+  }
+  else
+  {
+    res = format->write_image(format_params, filename, outbuf, NULL, 0, imgid);
+  }
+
+  /* now write xmp into that container, if possible */
+  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+  {
+    dt_exif_xmp_attach(imgid, filename);
+    // no need to cancel the export if this fail
+  }
+  return res;
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
@@ -611,11 +908,13 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_mipmap_buffer_t buf;
+  dt_imageio_export_stage_enter(DT_IMAGEIO_STAGE_DECODE);
   if(thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"))
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING);
   else
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
   dt_dev_load_image(&dev, imgid);
+  dt_imageio_export_stage_handoff(DT_IMAGEIO_STAGE_DECODE, DT_IMAGEIO_STAGE_DEVELOP);
   const dt_image_t *img = &dev.image_storage;
   const int wd = img->width;
   const int ht = img->height;
@@ -626,7 +925,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   dt_get_times(&start);
   dt_dev_pixelpipe_t pipe;
   res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+                         : dt_dev_pixelpipe_init_export(&pipe, format->levels(format_params));
   if(!res)
   {
     dt_control_log(
@@ -634,6 +933,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
         thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
     dt_dev_cleanup(&dev);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
     return 1;
   }
 
@@ -641,77 +941,21 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   {
     dt_control_log(_("image `%s' is not available!"), img->filename);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_dev_pixelpipe_cleanup(&pipe);
     dt_dev_cleanup(&dev);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
     return 1;
   }
 
   //  If a style is to be applied during export, add the iop params into the history
-  if(!thumbnail_export && format_params->style[0] != '\0')
+  if(!thumbnail_export && format_params->style[0] != '\0'
+     && _export_apply_style(&dev, format_params->style, format_params->style_append))
   {
-    GList *stls;
-
-    GList *modules = dev.iop;
-    dt_iop_module_t *m = NULL;
-
-    if((stls = dt_styles_get_item_list(format_params->style, TRUE, -1)) == 0)
-    {
-      dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
-      dt_dev_cleanup(&dev);
-      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-      return 1;
-    }
-
-    //  Add each params
-    while(stls)
-    {
-      dt_style_item_t *s = (dt_style_item_t *)stls->data;
-
-      modules = dev.iop;
-      while(modules)
-      {
-        m = (dt_iop_module_t *)modules->data;
-
-        //  since the name in the style is returned with a possible multi-name, just check the start of the
-        //  name
-        if(strncmp(m->op, s->name, strlen(m->op)) == 0)
-        {
-          dt_dev_history_item_t *h = malloc(sizeof(dt_dev_history_item_t));
-          dt_iop_module_t *sty_module = m;
-
-          if (format_params->style_append && !(m->flags() & IOP_FLAGS_ONE_INSTANCE))
-          {
-            sty_module = dt_dev_module_duplicate(m->dev, m, 0);
-            if(!sty_module)
-            {
-              free(h);
-              return 1;
-            }
-          }
-
-          h->params = s->params;
-          h->blend_params = s->blendop_params;
-          h->enabled = s->enabled;
-          h->module = sty_module;
-          h->multi_priority = 1;
-          g_strlcpy(h->multi_name, "<style>", sizeof(h->multi_name));
-
-          if(m->legacy_params && (s->module_version != m->version()))
-          {
-            void *new_params = malloc(m->params_size);
-            m->legacy_params(m, h->params, s->module_version, new_params, labs(m->version()));
-
-            free(h->params);
-            h->params = new_params;
-          }
-
-          dev.history_end++;
-          dev.history = g_list_append(dev.history, h);
-          break;
-        }
-        modules = g_list_next(modules);
-      }
-      stls = g_list_next(stls);
-    }
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
+    return 1;
   }
 
   dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
@@ -727,35 +971,7 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
   // find output color profile for this image:
-  int sRGB = 1;
-  gchar *overprofile = dt_conf_get_string("plugins/lighttable/export/iccprofile");
-  if(overprofile && !strcmp(overprofile, "sRGB"))
-  {
-    sRGB = 1;
-  }
-  else if(!overprofile || !strcmp(overprofile, "image"))
-  {
-    GList *modules = dev.iop;
-    dt_iop_module_t *colorout = NULL;
-    while(modules)
-    {
-      colorout = (dt_iop_module_t *)modules->data;
-      if(colorout->get_p && strcmp(colorout->op, "colorout") == 0)
-      {
-        const char *iccprofile = colorout->get_p(colorout->params, "iccprofile");
-        if(!strcmp(iccprofile, "sRGB"))
-          sRGB = 1;
-        else
-          sRGB = 0;
-      }
-      modules = g_list_next(modules);
-    }
-  }
-  else
-  {
-    sRGB = 0;
-  }
-  g_free(overprofile);
+  const int sRGB = _export_is_srgb(&dev);
 
   // get only once at the beginning, in case the user changes it on the way:
   const gboolean high_quality_processing
@@ -775,10 +991,22 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   // downsampling done last, if high quality processing was requested:
   uint8_t *outbuf = pipe.backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
+  // large exports can be streamed through the pipe in bands, then only the result is in memory in full
+  const int band_height = dt_dev_pixelpipe_band_height(&pipe, &dev, processed_height);
+  if(!thumbnail_export && !dt_dev_pixelpipe_alloc_export(&pipe, band_height))
+  {
+    dt_control_log(
+        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+        C_("noun", "export"));
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
+    return 1;
+  }
   dt_get_times(&start);
   if(high_quality_processing)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     const double scalex = format_params->max_width > 0
                               ? fminf(format_params->max_width / (double)pipe.processed_width, 1.0)
                               : 1.0;
@@ -799,129 +1027,291 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     roi_in.height = pipe.processed_height;
     roi_out.width = processed_width;
     roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width,
-                         pipe.processed_width);
+    // in bands, the full size output never is in memory as a whole
+    if(!band_height || !moutbuf || !_export_downscale_bands(&pipe, &dev, (float *)outbuf, &roi_out,
+                                                             band_height))
+    {
+      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, pipe.processed_width, pipe.processed_height, 1.0f);
+      dt_iop_clip_and_zoom((float *)outbuf, (const float *)pipe.backbuf, &roi_out, &roi_in, processed_width,
+                           pipe.processed_width);
+    }
   }
   else
   {
-    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    // 8-bit output comes out of gamma already
+    const size_t pixel = bpp == 8 ? 4 : 4 * sizeof(float);
+    if(band_height)
+      moutbuf = (uint8_t *)dt_alloc_align(64, pixel * processed_width * processed_height);
+    if(moutbuf)
+    {
+      dt_dev_pixelpipe_process_bands(&pipe, &dev, moutbuf, bpp != 8, 0, 0, processed_width, processed_height,
+                                     scale, band_height);
+      outbuf = moutbuf;
+    }
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    outbuf = pipe.backbuf;
+    {
+      // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
+      if(bpp == 8)
+        dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      else
+        dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      outbuf = pipe.backbuf;
+    }
   }
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
                                          : "[dev_process_export] pixel pipeline processing",
                 NULL);
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
+  // the input isn't needed any more, give the full buffer to the next image while we encode
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+
+  // encoding only needs the output, so the pipe and its cache go before the next image starts developing.
+  // if there is no memory for a copy of the output, we encode straight out of the pipe like before.
+  if(outbuf == pipe.backbuf)
   {
-    if(display_byteorder)
+    const size_t size = (bpp == 8 ? 4 : 4 * sizeof(float)) * (size_t)processed_width * processed_height;
+    moutbuf = (uint8_t *)dt_alloc_align(64, size);
+    if(moutbuf)
     {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
+      memcpy(moutbuf, pipe.backbuf, size);
+      outbuf = moutbuf;
     }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
+  }
+  const int keep_pipe = outbuf == pipe.backbuf;
+  if(!keep_pipe)
+  {
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+  }
+  dt_imageio_export_stage_handoff(DT_IMAGEIO_STAGE_DEVELOP, DT_IMAGEIO_STAGE_ENCODE);
+
+  // downconversion to low-precision formats:
+  if(bpp == 8)
+  {
+    if(high_quality_processing)
+      _export_float_to_8bit(outbuf, processed_width, processed_height, display_byteorder);
+    else if(!display_byteorder)
+    { // processing output was 8-bit already, but in display byte order, need to swap:
+      uint8_t *const buf8 = outbuf;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
 #endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
+      // just flip byte order
+      for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
+      {
+        uint8_t tmp = buf8[4 * k + 0];
+        buf8[4 * k + 0] = buf8[4 * k + 2];
+        buf8[4 * k + 2] = tmp;
       }
     }
   }
   else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
+    _export_float_to_16bit(outbuf, processed_width, processed_height);
   // else output float, no further harm done to the pixels :)
 
   format_params->width = processed_width;
   format_params->height = processed_height;
 
-  if(!ignore_exif)
+  res = _export_write(imgid, filename, format, format_params, outbuf, ignore_exif, sRGB, copy_metadata);
+  if(keep_pipe)
   {
-    int length;
-    uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
-    char pathname[PATH_MAX] = { 0 };
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
-    // last param is dng mode, it's false here
-    length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+  }
+  dt_free_align(moutbuf);
+  dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_ENCODE);
 
-    res = format->write_image(format_params, filename, outbuf, exif_profile, length, imgid);
+
+  if(!thumbnail_export && strcmp(format->mime(format_params), "memory"))
+  {
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, filename, format,
+                            format_params, storage, storage_params);
   }
-  else
+  return res;
+}
+
+
+// how much the pipe output has to shrink to fit max_width x max_height
+static double _export_scale(const dt_imageio_module_data_t *format_params, const int width, const int height)
+{
+  const double scalex
+      = format_params->max_width > 0 ? fminf(format_params->max_width / (double)width, 1.0) : 1.0;
+  const double scaley
+      = format_params->max_height > 0 ? fminf(format_params->max_height / (double)height, 1.0) : 1.0;
+  return fminf(scalex, scaley);
+}
+
+static int _export_is_copy(const dt_imageio_export_target_t *t)
+{
+  return strcmp(t->format->mime(t->format_params), "x-copy") == 0;
+}
+
+int dt_imageio_export_multi(const uint32_t imgid, dt_imageio_export_target_t *targets, const int count,
+                            const gboolean high_quality, const gboolean copy_metadata)
+{
+  // copies don't need the pipe, and the pipe dithers for the most precise of the formats: the others
+  // can't tell the difference after they have been scaled down anyways.
+  int develop = 0, levels = 0, failed = 0;
+  for(int k = 0; k < count; k++)
   {
-    res = format->write_image(format_params, filename, outbuf, NULL, 0, imgid);
+    dt_imageio_export_target_t *t = targets + k;
+    if(_export_is_copy(t))
+    {
+      t->result = t->format->write_image(t->format_params, t->filename, NULL, NULL, 0, imgid);
+      if(t->result) failed++;
+      continue;
+    }
+    t->result = 1;
+    const int l = t->format->levels(t->format_params);
+    if(develop == 0 || (l & IMAGEIO_PREC_MASK) > (levels & IMAGEIO_PREC_MASK)) levels = l;
+    develop++;
+  }
+  if(!develop) return failed;
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_imageio_export_stage_enter(DT_IMAGEIO_STAGE_DECODE);
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  dt_dev_load_image(&dev, imgid);
+  dt_imageio_export_stage_handoff(DT_IMAGEIO_STAGE_DECODE, DT_IMAGEIO_STAGE_DEVELOP);
+  const dt_image_t *img = &dev.image_storage;
+
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, levels))
+  {
+    dt_control_log(
+        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+        C_("noun", "export"));
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
+    return failed + develop;
+  }
+
+  // the style changes the pipe, so there can only be one for all of them
+  const dt_imageio_module_data_t *first = targets[0].format_params;
+  for(int k = 1; k < count && !first->style[0]; k++) first = targets[k].format_params;
+  if(!buf.buf || (first->style[0] && _export_apply_style(&dev, first->style, first->style_append)))
+  {
+    if(!buf.buf) dt_control_log(_("image `%s' is not available!"), img->filename);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
+    return failed + develop;
   }
 
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
+  dt_times_t start;
+  dt_get_times(&start);
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+  const int sRGB = _export_is_srgb(&dev);
+
+  // develop once, for the largest of them. high quality develops the full image, as for a single export.
+  double scale = 0.0;
+  for(int k = 0; k < count; k++)
+    if(!_export_is_copy(targets + k))
+      scale = MAX(scale,
+                  _export_scale(targets[k].format_params, pipe.processed_width, pipe.processed_height));
+  if(high_quality) scale = 1.0;
+  const int width = scale * pipe.processed_width + .5f;
+  const int height = scale * pipe.processed_height + .5f;
+  const int band_height = dt_dev_pixelpipe_band_height(&pipe, &dev, height);
+  if(!dt_dev_pixelpipe_alloc_export(&pipe, band_height))
+  {
+    dt_control_log(
+        _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
+        C_("noun", "export"));
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_DEVELOP);
+    return failed + develop;
+  }
+  float *bandbuf = NULL;
+  if(band_height) bandbuf = (float *)dt_alloc_align(64, (size_t)sizeof(float) * width * height * 4);
+  if(bandbuf)
+    dt_dev_pixelpipe_process_bands(&pipe, &dev, bandbuf, 1, 0, 0, width, height, scale, band_height);
+  else
+    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, width, height, scale);
+  dt_show_times(&start, "[dev_process_export] pixel pipeline processing", NULL);
+
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-  dt_free_align(moutbuf);
-  /* now write xmp into that container, if possible */
-  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+
+  // as above, only the output stays around while the targets are encoded
+  if(!bandbuf)
   {
-    dt_exif_xmp_attach(imgid, filename);
-    // no need to cancel the export if this fail
+    bandbuf = (float *)dt_alloc_align(64, (size_t)sizeof(float) * width * height * 4);
+    if(bandbuf) memcpy(bandbuf, pipe.backbuf, (size_t)sizeof(float) * width * height * 4);
   }
+  const float *pipebuf = bandbuf ? bandbuf : (const float *)pipe.backbuf;
+  const int processed_width = pipe.processed_width, processed_height = pipe.processed_height;
+  if(bandbuf)
+  {
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
+  }
+  dt_imageio_export_stage_handoff(DT_IMAGEIO_STAGE_DEVELOP, DT_IMAGEIO_STAGE_ENCODE);
 
+  // and scale down for every one of them
+  for(int k = 0; k < count; k++)
+  {
+    dt_imageio_export_target_t *t = targets + k;
+    if(_export_is_copy(t)) continue;
+    const double tscale = _export_scale(t->format_params, processed_width, processed_height);
+    const int twidth = MIN(width, (int)(tscale * processed_width + .5f));
+    const int theight = MIN(height, (int)(tscale * processed_height + .5f));
+    uint8_t *outbuf = (uint8_t *)dt_alloc_align(64, (size_t)sizeof(float) * twidth * theight * 4);
+    if(!outbuf)
+    {
+      failed++;
+      continue;
+    }
+    if(twidth == width && theight == height)
+      memcpy(outbuf, pipebuf, (size_t)sizeof(float) * width * height * 4);
+    else
+    {
+      dt_iop_roi_t roi_in, roi_out;
+      roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
+      roi_in.scale = 1.0;
+      roi_out.scale = tscale / scale;
+      roi_in.width = width;
+      roi_in.height = height;
+      roi_out.width = twidth;
+      roi_out.height = theight;
+      dt_iop_clip_and_zoom((float *)outbuf, pipebuf, &roi_out, &roi_in, twidth, width);
+    }
 
-  if(!thumbnail_export && strcmp(format->mime(format_params), "memory"))
+    const int bpp = t->format->bpp(t->format_params);
+    if(bpp == 8)
+      _export_float_to_8bit(outbuf, twidth, theight, 0);
+    else if(bpp == 16)
+      _export_float_to_16bit(outbuf, twidth, theight);
+    t->format_params->width = twidth;
+    t->format_params->height = theight;
+    t->result
+        = _export_write(imgid, t->filename, t->format, t->format_params, outbuf, 0, sRGB, copy_metadata);
+    dt_free_align(outbuf);
+    if(t->result)
+      failed++;
+    else if(strcmp(t->format->mime(t->format_params), "memory"))
+      dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, t->filename,
+                              t->format, t->format_params, NULL, NULL);
+  }
+
+  if(bandbuf)
+    dt_free_align(bandbuf);
+  else
   {
-    dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, filename, format,
-                            format_params, storage, storage_params);
+    dt_dev_pixelpipe_cleanup(&pipe);
+    dt_dev_cleanup(&dev);
   }
-  return res;
+  dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_ENCODE);
+  return failed;
 }
 
 
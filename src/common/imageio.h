@@ -23,8 +23,10 @@
 #include "common/image.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
+#include "common/dtpthread.h"
 
 #include <inttypes.h>
+#include <pthread.h>
 
 typedef enum dt_imageio_levels_t
 {
@@ -69,6 +71,59 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  const gboolean copy_metadata, dt_imageio_module_storage_t *storage,
                                  dt_imageio_module_data_t *storage_params);
 
+/** one of the files dt_imageio_export_multi() writes. */
+typedef struct dt_imageio_export_target_t
+{
+  const char *filename;
+  struct dt_imageio_module_format_t *format;
+  struct dt_imageio_module_data_t *format_params; // max_width and max_height of this one
+  int result;                                     // what format->write_image() returned
+} dt_imageio_export_target_t;
+
+/** exports the image to several files, sizes and formats at once: the pixelpipe runs only once, at the
+ * size of the largest of them, and the others are scaled down from its output. with high_quality it runs
+ * at full size and all of them are scaled down, as dt_imageio_export() does for one. the style of the
+ * first target which has one is applied to all of them. returns the number of files which failed. */
+int dt_imageio_export_multi(const uint32_t imgid, dt_imageio_export_target_t *targets, const int count,
+                            const gboolean high_quality, const gboolean copy_metadata);
+
+/** an export runs as a pipeline of stages, each with its own limit on how many images may be in it at
+ * the same time. an image only leaves a stage once there is room in the next one, so the images waiting
+ * in between are bounded as well, and so is the memory. */
+typedef enum dt_imageio_export_stage_t
+{
+  DT_IMAGEIO_STAGE_DECODE = 0, // loading the raw into the mipmap cache
+  DT_IMAGEIO_STAGE_DEVELOP,    // the pixelpipe
+  DT_IMAGEIO_STAGE_ENCODE,     // conversion to the output format and writing it
+  DT_IMAGEIO_STAGE_STORE,      // whatever the storage does on top of that
+  DT_IMAGEIO_STAGE_MAX
+} dt_imageio_export_stage_t;
+
+typedef struct dt_imageio_export_stages_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int32_t limit[DT_IMAGEIO_STAGE_MAX]; // 0 means no limit
+  int32_t busy[DT_IMAGEIO_STAGE_MAX];
+  int32_t done[DT_IMAGEIO_STAGE_MAX];
+  double time[DT_IMAGEIO_STAGE_MAX]; // seconds spent working in the stage, not waiting to get out
+  double start;
+} dt_imageio_export_stages_t;
+
+void dt_imageio_export_stages_init(dt_imageio_export_stages_t *stages, const int32_t decode,
+                                   const int32_t develop, const int32_t encode, const int32_t store);
+void dt_imageio_export_stages_cleanup(dt_imageio_export_stages_t *stages);
+/** the stages the calling thread works in. dt_imageio_export_with_flags() passes through them, threads
+ * without any (thumbnails, slideshow) don't wait for anything. */
+void dt_imageio_export_stages_attach(dt_imageio_export_stages_t *stages);
+/** waits for room in the stage and enters it. */
+void dt_imageio_export_stage_enter(const dt_imageio_export_stage_t stage);
+void dt_imageio_export_stage_leave(const dt_imageio_export_stage_t stage);
+/** leaves one stage as soon as there is room in the next one. */
+void dt_imageio_export_stage_handoff(const dt_imageio_export_stage_t from, const dt_imageio_export_stage_t to);
+/** throughput so far and the time per image of each stage, for the user. */
+void dt_imageio_export_stages_describe(dt_imageio_export_stages_t *stages, char *text, const size_t size);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
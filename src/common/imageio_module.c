@@ -196,6 +196,12 @@ static int _default_storage_dimension(struct dt_imageio_module_storage_t *self,
 static void _default_storage_nop(struct dt_imageio_module_storage_t *self)
 {
 }
+/** Default implementation of parallel(), storage modules have to say that they can store several
+ * images at the same time */
+static int _default_storage_serial(struct dt_imageio_module_storage_t *self)
+{
+  return 0;
+}
 
 static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, const char *libname,
                                           const char *plugin_name)
@@ -250,6 +256,8 @@ static int dt_imageio_load_module_storage(dt_imageio_module_storage_t *module, c
     module->recommended_dimension = _default_storage_dimension;
   if(!g_module_symbol(module->module, "export_dispatched", (gpointer) & (module->export_dispatched)))
     module->export_dispatched = _default_storage_nop;
+  if(!g_module_symbol(module->module, "parallel", (gpointer) & (module->parallel)))
+    module->parallel = _default_storage_serial;
 #ifdef USE_LUA
   {
     char pseudo_type_name[1024];
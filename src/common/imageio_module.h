@@ -176,6 +176,9 @@ typedef struct dt_imageio_module_storage_t
   int (*set_params)(struct dt_imageio_module_storage_t *self, const void *params, const int size);
 
   void (*export_dispatched)(struct dt_imageio_module_storage_t *self);
+  /* non-zero if store() may run for several images at the same time, on the same self_data. if not
+     implemented, images are stored one after the other. */
+  int (*parallel)(struct dt_imageio_module_storage_t *self);
 
   luaA_Type parameter_lua_type;
 } dt_imageio_module_storage_t;
@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/interpolation.h"
+#include "common/simd.h"
 #include "control/conf.h"
 
 #include <math.h>
@@ -1178,6 +1179,184 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
+/** one output line of dt_interpolation_resample(): vl input lines given by vindex, weighted by vkernel,
+ * and for every output pixel the hlength[] input pixels of hindex, weighted by hkernel. */
+typedef void (*_resample_row_t)(float *out, const int width, const float *const in, const int32_t in_stride,
+                                const int vl, const int *vindex, const float *vkernel, const int *hlength,
+                                const int *hindex, const float *hkernel);
+
+static void _resample_row_plain(float *out, const int width, const float *const in, const int32_t in_stride,
+                                const int vl, const int *vindex, const float *vkernel, const int *hlength,
+                                const int *hindex, const float *hkernel)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    const int hl = *hlength++;
+    float vs[4] = { 0.0f };
+    for(int iy = 0; iy < vl; iy++)
+    {
+      const float *i = (float *)((char *)in + (size_t)in_stride * vindex[iy]);
+      float vhs[4] = { 0.0f };
+      for(int ix = 0; ix < hl; ix++)
+      {
+        const float *p = i + (size_t)hindex[ix] * 4;
+        for(int c = 0; c < 4; c++) vhs[c] += p[c] * hkernel[ix];
+      }
+      for(int c = 0; c < 4; c++) vs[c] += vhs[c] * vkernel[iy];
+    }
+    for(int c = 0; c < 4; c++) out[4 * ox + c] = vs[c];
+    hindex += hl;
+    hkernel += hl;
+  }
+}
+
+static void _resample_row_sse2(float *out, const int width, const float *const in, const int32_t in_stride,
+                               const int vl, const int *vindex, const float *vkernel, const int *hlength,
+                               const int *hindex, const float *hkernel)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    debug_extra("output %p [% 4d]\n", out, ox);
+
+    // This will hold the resulting pixel
+    __m128 vs = _mm_setzero_ps();
+
+    // Number of horizontal samples contributing to the output
+    const int hl = *hlength++;
+
+    for(int iy = 0; iy < vl; iy++)
+    {
+      // This is our input line
+      const float *i = (float *)((char *)in + (size_t)in_stride * vindex[iy]);
+
+      __m128 vhs = _mm_setzero_ps();
+
+      for(int ix = 0; ix < hl; ix++)
+      {
+        // Apply the precomputed filter kernel
+        const size_t baseidx = (size_t)hindex[ix] * 4;
+        const __m128 vhtap = _mm_set_ps1(hkernel[ix]);
+        vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
+      }
+
+      // Accumulate contribution from this line
+      const __m128 vvtap = _mm_set_ps1(vkernel[iy]);
+      vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
+    }
+
+    // Output pixel is ready
+    _mm_stream_ps(out + 4 * ox, vs);
+
+    // Progress in horizontal context
+    hindex += hl;
+    hkernel += hl;
+  }
+}
+
+#ifdef DT_SIMD_HAVE_AVX2
+// two horizontal taps per instruction, one pixel in each half of the register
+DT_SIMD_TARGET_AVX2 static void _resample_row_avx2(float *out, const int width, const float *const in,
+                                                   const int32_t in_stride, const int vl, const int *vindex,
+                                                   const float *vkernel, const int *hlength,
+                                                   const int *hindex, const float *hkernel)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    __m128 vs = _mm_setzero_ps();
+    const int hl = *hlength++;
+
+    for(int iy = 0; iy < vl; iy++)
+    {
+      const float *i = (float *)((char *)in + (size_t)in_stride * vindex[iy]);
+
+      __m256 vhs = _mm256_setzero_ps();
+      int ix = 0;
+      for(; ix + 1 < hl; ix += 2)
+      {
+        const __m128 p0 = _mm_load_ps(i + (size_t)hindex[ix] * 4);
+        const __m128 p1 = _mm_load_ps(i + (size_t)hindex[ix + 1] * 4);
+        const __m256 p = _mm256_insertf128_ps(_mm256_castps128_ps256(p0), p1, 1);
+        const __m256 tap = _mm256_insertf128_ps(_mm256_set1_ps(hkernel[ix]), _mm_set1_ps(hkernel[ix + 1]), 1);
+        vhs = _mm256_fmadd_ps(p, tap, vhs);
+      }
+      if(ix < hl)
+      {
+        const __m128 p0 = _mm_load_ps(i + (size_t)hindex[ix] * 4);
+        const __m256 p = _mm256_insertf128_ps(_mm256_setzero_ps(), p0, 0);
+        vhs = _mm256_fmadd_ps(p, _mm256_set1_ps(hkernel[ix]), vhs);
+      }
+
+      const __m128 h = _mm_add_ps(_mm256_castps256_ps128(vhs), _mm256_extractf128_ps(vhs, 1));
+      vs = _mm_fmadd_ps(h, _mm_set1_ps(vkernel[iy]), vs);
+    }
+
+    _mm_stream_ps(out + 4 * ox, vs);
+
+    hindex += hl;
+    hkernel += hl;
+  }
+}
+#endif
+
+#ifdef DT_SIMD_HAVE_AVX512
+// four horizontal taps per instruction, the rest one by one
+DT_SIMD_TARGET_AVX512 static void _resample_row_avx512(float *out, const int width, const float *const in,
+                                                       const int32_t in_stride, const int vl,
+                                                       const int *vindex, const float *vkernel,
+                                                       const int *hlength, const int *hindex,
+                                                       const float *hkernel)
+{
+  // tap k into the quarter k
+  const __m512i spread = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+  for(int ox = 0; ox < width; ox++)
+  {
+    __m128 vs = _mm_setzero_ps();
+    const int hl = *hlength++;
+
+    for(int iy = 0; iy < vl; iy++)
+    {
+      const float *i = (float *)((char *)in + (size_t)in_stride * vindex[iy]);
+
+      __m512 vhs = _mm512_setzero_ps();
+      int ix = 0;
+      for(; ix + 3 < hl; ix += 4)
+      {
+        const __m128 p0 = _mm_load_ps(i + (size_t)hindex[ix] * 4);
+        const __m128 p1 = _mm_load_ps(i + (size_t)hindex[ix + 1] * 4);
+        const __m128 p2 = _mm_load_ps(i + (size_t)hindex[ix + 2] * 4);
+        const __m128 p3 = _mm_load_ps(i + (size_t)hindex[ix + 3] * 4);
+        const __m512 p01 = _mm512_insertf32x4(_mm512_castps128_ps512(p0), p1, 1);
+        const __m512 p = _mm512_insertf32x4(_mm512_insertf32x4(p01, p2, 2), p3, 3);
+        const __m512 taps = _mm512_castps128_ps512(_mm_loadu_ps(hkernel + ix));
+        const __m512 tap = _mm512_permutexvar_ps(spread, taps);
+        vhs = _mm512_fmadd_ps(p, tap, vhs);
+      }
+
+      __m128 h = _mm_add_ps(_mm_add_ps(_mm512_castps512_ps128(vhs), _mm512_extractf32x4_ps(vhs, 1)),
+                            _mm_add_ps(_mm512_extractf32x4_ps(vhs, 2), _mm512_extractf32x4_ps(vhs, 3)));
+      for(; ix < hl; ix++)
+        h = _mm_fmadd_ps(_mm_load_ps(i + (size_t)hindex[ix] * 4), _mm_set1_ps(hkernel[ix]), h);
+      vs = _mm_fmadd_ps(h, _mm_set1_ps(vkernel[iy]), vs);
+    }
+
+    _mm_stream_ps(out + 4 * ox, vs);
+
+    hindex += hl;
+    hkernel += hl;
+  }
+}
+#endif
+
+// the row for the simd level in use, sse until dt_interpolation_init() knows better
+static _resample_row_t _resample_row = _resample_row_sse2;
+
+void dt_interpolation_init()
+{
+  _resample_row = (_resample_row_t)dt_simd_select(_resample_row_plain, _resample_row_sse2,
+                                                  DT_SIMD_AVX2_FN(_resample_row_avx2),
+                                                  DT_SIMD_AVX512_FN(_resample_row_avx512));
+}
+
 void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
                                const dt_iop_roi_t *const roi_out, const int32_t out_stride,
                                const float *const in, const dt_iop_roi_t *const roi_in,
@@ -1250,78 +1429,22 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
+  // Process each output line
+  const _resample_row_t resample_row = _resample_row;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta) \
+    firstprivate(resample_row, roi_out, in, in_stride, out_stride)
 #endif
   for(int oy = 0; oy < roi_out->height; oy++)
   {
     // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
-    {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
+    const int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
+    const int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
+    const int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
 
-    // Progress in vertical context
-    viidx += vl;
-    vkidx += vl;
+    float *o = (float *)((char *)out + (size_t)oy * out_stride);
+    resample_row(o, roi_out->width, in, in_stride, vlength[vlidx], vindex + viidx, vkernel + vkidx, hlength,
+                 hindex, hkernel);
   }
 
   _mm_sfence();
@@ -106,6 +106,9 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
  */
 const struct dt_interpolation *dt_interpolation_new(enum dt_interpolation_type type);
 
+/** Picks the resampling code path for the simd level, called once by dt_init() after dt_simd_init(). */
+void dt_interpolation_init(void);
+
 /** Image resampler.
  *
  * Resamples the image "in" to "out" according to roi values. Here is the
@@ -17,6 +17,7 @@
 */
 
 #include "common/darktable.h"
+#include "common/debug.h"
 #include "common/exif.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
@@ -24,8 +25,11 @@
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
 #include "common/mipmap_cache.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/jobs.h"
+#include "control/signal.h"
+#include "develop/develop.h"
 #include "libraw/libraw.h"
 #ifdef HAVE_SQUISH
 #include "squish/csquish.h"
@@ -37,6 +41,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <limits.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -44,8 +50,11 @@
 #include <xmmintrin.h>
 
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
-#define DT_MIPMAP_CACHE_FILE_VERSION 23
+#define DT_MIPMAP_CACHE_FILE_VERSION 24
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
+#define DT_MIPMAP_CACHE_DISK_MAGIC 0xD71338
+#define DT_MIPMAP_CACHE_DISK_VERSION 1
+#define DT_MIPMAP_CACHE_DISK_USAGE_FILE_NAME "usage"
 
 #define DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE (1 << 0)
 
@@ -55,9 +64,59 @@ struct dt_mipmap_buffer_dsc
   uint32_t height;
   size_t size;
   uint32_t flags;
+  // hash of the history the thumbnail was rendered with
+  uint64_t hash;
   /* NB: sizeof must be a multiple of 4*sizeof(float) */
 } __attribute__((packed, aligned(16)));
 
+// header of the per-thumbnail files of the disk backend,
+// followed by length bytes of either dxt blocks or jpg data.
+struct dt_mipmap_disk_header
+{
+  int32_t magic;
+  int32_t compression_type;
+  // hash of the history the thumbnail was rendered with
+  uint64_t hash;
+  // settings check, thumbnails are dropped if the mip sizes changed
+  uint32_t max_width;
+  uint32_t max_height;
+  uint32_t width;
+  uint32_t height;
+  int32_t length;
+} __attribute__((packed));
+
+// the thumbnail store written on shutdown holds DT_MIPMAP_0..2 and is mapped
+// read-only on startup. layout is the header, followed by the index sorted by key,
+// followed by the blobs. every blob starts on a page boundary and is preceded
+// by its dt_mipmap_buffer_dsc, so the buffers can be handed out just like cache slots.
+#define DT_MIPMAP_STORE_LEVELS (DT_MIPMAP_2 + 1)
+
+struct dt_mipmap_store_header
+{
+  int32_t magic;
+  int32_t compression_type;
+  uint32_t max_width[DT_MIPMAP_STORE_LEVELS];
+  uint32_t max_height[DT_MIPMAP_STORE_LEVELS];
+  uint32_t page_size;
+  uint32_t num_entries;
+} __attribute__((packed));
+
+typedef enum dt_mipmap_store_state_t
+{
+  DT_MIPMAP_STORE_UNVERIFIED = 0,
+  DT_MIPMAP_STORE_VALID = 1,
+  DT_MIPMAP_STORE_INVALID = 2
+} dt_mipmap_store_state_t;
+
+struct dt_mipmap_store_entry
+{
+  uint32_t key;
+  // only ever changed in our private copy of the index pages
+  int32_t state;
+  uint64_t hash;
+  uint64_t offset;
+} __attribute__((packed));
+
 // last resort mem alloc for dead images. sizeof(dt_mipmap_buffer_dsc) + dead image pixels (8x8)
 // __m128 type for sse alignment.
 static __m128 dt_mipmap_cache_static_dead_image[sizeof(struct dt_mipmap_buffer_dsc) / sizeof(__m128) + 64];
@@ -132,62 +191,6 @@ static inline dt_mipmap_size_t get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 29);
 }
 
-typedef struct _iterate_data_t
-{
-  FILE *f;
-  uint8_t *blob;
-  int compression_type;
-  dt_mipmap_size_t mip;
-} _iterate_data_t;
-
-static int _write_buffer(const uint32_t key, const void *data, void *user_data)
-{
-  if(!data) return 1;
-  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)data;
-  // too small to write. no error, but don't write.
-  if(dsc->width <= 8 && dsc->height <= 8) return 0;
-
-  _iterate_data_t *d = (_iterate_data_t *)user_data;
-  int written = fwrite(&(d->mip), sizeof(dt_mipmap_size_t), 1, d->f);
-  if(written != 1) return 1;
-  written = fwrite(&key, sizeof(uint32_t), 1, d->f);
-  if(written != 1) return 1;
-
-  if(d->compression_type)
-  {
-    // write buffer size, wd, ht and the full blob, as it is in memory.
-    const int32_t length = compressed_buffer_size(d->compression_type, dsc->width, dsc->height);
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->width, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->height, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(dsc + 1, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-  else
-  {
-    dt_mipmap_buffer_t buf;
-    buf.width = dsc->width;
-    buf.height = dsc->height;
-    buf.imgid = get_imgid(key);
-    buf.size = get_size(key);
-    // skip to next 8-byte alignment, for sse buffers.
-    buf.buf = (uint8_t *)(dsc + 1);
-
-    const int cache_quality = dt_conf_get_int("database_cache_quality");
-    const int32_t length
-        = dt_imageio_jpeg_compress(buf.buf, d->blob, buf.width, buf.height, MIN(100, MAX(10, cache_quality)));
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(d->blob, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-
-  return 0;
-}
-
 static int dt_mipmap_cache_get_filename(gchar *mipmapfilename, size_t size)
 {
   int r = -1;
@@ -227,6 +230,461 @@ exit:
   return r;
 }
 
+static uint64_t _history_hash_query(const uint32_t imgid)
+{
+  // djb2 over everything in the history stack that changes the rendered thumbnail.
+  uint64_t hash = 5381;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT operation, op_params, enabled, blendop_params, multi_priority "
+                              "FROM history WHERE imgid = ?1 ORDER BY num",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    for(int k = 0; k < 5; k++)
+    {
+      const uint8_t *data = (const uint8_t *)sqlite3_column_blob(stmt, k);
+      const int length = sqlite3_column_bytes(stmt, k);
+      for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ data[i];
+    }
+  }
+  sqlite3_finalize(stmt);
+  return hash;
+}
+
+// the history hash of imgid, from the database only the first time it is asked for.
+static uint64_t _history_hash(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&cache->history_hash_mutex);
+  const uint64_t *cached
+      = (const uint64_t *)g_hash_table_lookup(cache->history_hash, GUINT_TO_POINTER(imgid));
+  if(cached)
+  {
+    const uint64_t hash = *cached;
+    dt_pthread_mutex_unlock(&cache->history_hash_mutex);
+    return hash;
+  }
+  const uint64_t generation = cache->history_hash_generation;
+  dt_pthread_mutex_unlock(&cache->history_hash_mutex);
+
+  // query without holding the lock, two threads asking at the same time will both get the same answer.
+  uint64_t *hash = (uint64_t *)g_malloc(sizeof(uint64_t));
+  *hash = _history_hash_query(imgid);
+  const uint64_t result = *hash;
+  dt_pthread_mutex_lock(&cache->history_hash_mutex);
+  // don't keep what might have been read before a change of the history came in
+  if(generation == cache->history_hash_generation)
+    g_hash_table_replace(cache->history_hash, GUINT_TO_POINTER(imgid), hash);
+  else
+    g_free(hash);
+  dt_pthread_mutex_unlock(&cache->history_hash_mutex);
+  return result;
+}
+
+static void _history_hash_invalidate(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&cache->history_hash_mutex);
+  g_hash_table_remove(cache->history_hash, GUINT_TO_POINTER(imgid));
+  cache->history_hash_generation++;
+  dt_pthread_mutex_unlock(&cache->history_hash_mutex);
+}
+
+// the darkroom changed the history of the image it is editing. everywhere else the history is
+// changed through dt_mipmap_cache_remove(), which drops the hash as well.
+static void _history_change_callback(gpointer instance, gpointer user_data)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)user_data;
+  if(darktable.develop && darktable.develop->image_storage.id > 0)
+    _history_hash_invalidate(cache, darktable.develop->image_storage.id);
+}
+
+static void _disk_get_filename(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                               const dt_mipmap_size_t mip, char *filename, size_t size)
+{
+  snprintf(filename, size, "%s/%d/%u.dt", cache->cachedir, (int)mip, imgid);
+}
+
+static void _disk_unlink(dt_mipmap_cache_t *cache, const char *filename)
+{
+  struct stat st;
+  if(stat(filename, &st)) return;
+  if(!g_unlink(filename)) __sync_fetch_and_sub(&cache->disk_used, (int64_t)st.st_size);
+}
+
+static void _disk_trim(dt_mipmap_cache_t *cache, const int64_t quota);
+
+// bytes on disk so far. writers add and trims subtract concurrently, so it is only ever touched atomically.
+static int64_t _disk_used(dt_mipmap_cache_t *cache)
+{
+  return __sync_fetch_and_add(&cache->disk_used, 0);
+}
+
+static int32_t _disk_trim_job_run(dt_job_t *job)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)dt_control_job_get_params(job);
+  _disk_trim(cache, cache->disk_quota);
+  __sync_lock_release(&cache->disk_trimming);
+  return 0;
+}
+
+// write a freshly generated 8-bit thumbnail through to disk.
+static void _disk_write(dt_mipmap_cache_t *cache, const struct dt_mipmap_buffer_dsc *dsc,
+                        const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  if(!cache->disk_backend || mip > DT_MIPMAP_3) return;
+  // don't write skulls or failed thumbnails, these have to be retried next time.
+  if(dsc->width <= 8 && dsc->height <= 8) return;
+
+  // uncompressed jpg output is bounded by the size of the rgba input:
+  const size_t max_length = (size_t)4 * dsc->width * dsc->height;
+  struct dt_mipmap_disk_header *head = (struct dt_mipmap_disk_header *)malloc(sizeof(*head) + max_length);
+  if(!head) return;
+
+  int32_t length;
+  if(cache->compression_type)
+  {
+    length = compressed_buffer_size(cache->compression_type, dsc->width, dsc->height);
+    memcpy(head + 1, dsc + 1, length);
+  }
+  else
+  {
+    const int cache_quality = dt_conf_get_int("database_cache_quality");
+    length = dt_imageio_jpeg_compress((const uint8_t *)(dsc + 1), (uint8_t *)(head + 1), dsc->width,
+                                      dsc->height, MIN(100, MAX(10, cache_quality)));
+    if(length <= 1)
+    {
+      free(head);
+      return;
+    }
+  }
+
+  head->magic = DT_MIPMAP_CACHE_DISK_MAGIC + DT_MIPMAP_CACHE_DISK_VERSION;
+  head->compression_type = cache->compression_type;
+  head->hash = dsc->hash;
+  head->max_width = cache->mip[mip].max_width;
+  head->max_height = cache->mip[mip].max_height;
+  head->width = dsc->width;
+  head->height = dsc->height;
+  head->length = length;
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_get_filename(cache, imgid, mip, filename, sizeof(filename));
+  // writes to a temporary file and renames it, so a crash never leaves a half written thumbnail behind.
+  if(g_file_set_contents(filename, (const gchar *)head, sizeof(*head) + length, NULL))
+    __sync_fetch_and_add(&cache->disk_used, (int64_t)(sizeof(*head) + length));
+  else
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] could not write thumbnail `%s'\n", filename);
+
+  free(head);
+
+  // over the quota: evict in a background job, we're holding the write lock of the slot here. the trim
+  // goes down to 90% of the quota, so this happens once every few hundred thumbnails, one job at a time.
+  if(_disk_used(cache) > cache->disk_quota && __sync_bool_compare_and_swap(&cache->disk_trimming, 0, 1))
+  {
+    if(!dt_control_running())
+    {
+      // no workers (darktable-cli), nobody is waiting for the lock either.
+      _disk_trim(cache, cache->disk_quota);
+      __sync_lock_release(&cache->disk_trimming);
+      return;
+    }
+    dt_job_t *job = dt_control_job_create(&_disk_trim_job_run, "trim thumbnail cache");
+    if(job) dt_control_job_set_params(job, cache);
+    if(!job || dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job))
+      __sync_lock_release(&cache->disk_trimming);
+  }
+}
+
+// try to fill a thumbnail slot from disk. returns 0 on success.
+static int _disk_read(dt_mipmap_cache_t *cache, struct dt_mipmap_buffer_dsc *dsc, const uint32_t imgid,
+                      const dt_mipmap_size_t mip)
+{
+  if(!cache->disk_backend || mip > DT_MIPMAP_3) return 1;
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_get_filename(cache, imgid, mip, filename, sizeof(filename));
+  gchar *data = NULL;
+  gsize length = 0;
+  if(!g_file_get_contents(filename, &data, &length, NULL)) return 1;
+
+  const struct dt_mipmap_disk_header *head = (const struct dt_mipmap_disk_header *)data;
+  if(length < sizeof(*head) || head->magic != DT_MIPMAP_CACHE_DISK_MAGIC + DT_MIPMAP_CACHE_DISK_VERSION
+     || head->compression_type != cache->compression_type || head->max_width != cache->mip[mip].max_width
+     || head->max_height != cache->mip[mip].max_height || head->width > head->max_width
+     || head->height > head->max_height || head->length != length - sizeof(*head)
+     || head->hash != _history_hash(cache, imgid))
+    goto stale;
+
+  if(cache->compression_type)
+  {
+    if(head->length != compressed_buffer_size(cache->compression_type, head->width, head->height)) goto stale;
+    memcpy(dsc + 1, head + 1, head->length);
+  }
+  else
+  {
+    dt_imageio_jpeg_t jpg;
+    if(dt_imageio_jpeg_decompress_header(head + 1, head->length, &jpg) || jpg.width != head->width
+       || jpg.height != head->height || dt_imageio_jpeg_decompress(&jpg, (uint8_t *)(dsc + 1)))
+      goto stale;
+  }
+  dsc->width = head->width;
+  dsc->height = head->height;
+  dsc->hash = head->hash;
+  g_free(data);
+  return 0;
+
+stale:
+  // outdated or broken. will be regenerated and written anew.
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] dropping stale thumbnail `%s'\n", filename);
+  _disk_unlink(cache, filename);
+  g_free(data);
+  return 1;
+}
+
+typedef struct _disk_entry_t
+{
+  time_t mtime;
+  int64_t size;
+  gchar *filename;
+} _disk_entry_t;
+
+static gint _disk_entry_cmp(gconstpointer a, gconstpointer b)
+{
+  const _disk_entry_t *ea = (const _disk_entry_t *)a;
+  const _disk_entry_t *eb = (const _disk_entry_t *)b;
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+static void _disk_entry_free(gpointer data)
+{
+  _disk_entry_t *e = (_disk_entry_t *)data;
+  g_free(e->filename);
+  free(e);
+}
+
+// walk all levels on disk and evict the least recently written thumbnails until we fit the quota.
+static void _disk_trim(dt_mipmap_cache_t *cache, const int64_t quota)
+{
+  // writes go on meanwhile. the ones done before the walk may be counted twice, which only makes the
+  // next trim come a bit early.
+  const int64_t before = _disk_used(cache);
+  GList *entries = NULL;
+  int64_t used = 0;
+  for(int k = DT_MIPMAP_0; k <= DT_MIPMAP_3; k++)
+  {
+    char dirname[PATH_MAX] = { 0 };
+    snprintf(dirname, sizeof(dirname), "%s/%d", cache->cachedir, k);
+    GDir *dir = g_dir_open(dirname, 0, NULL);
+    if(!dir) continue;
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      gchar *filename = g_build_filename(dirname, name, NULL);
+      struct stat st;
+      if(stat(filename, &st) || !S_ISREG(st.st_mode))
+      {
+        g_free(filename);
+        continue;
+      }
+      _disk_entry_t *e = (_disk_entry_t *)malloc(sizeof(_disk_entry_t));
+      e->mtime = st.st_mtime;
+      e->size = st.st_size;
+      e->filename = filename;
+      entries = g_list_prepend(entries, e);
+      used += st.st_size;
+    }
+    g_dir_close(dir);
+  }
+
+  if(used > quota)
+  {
+    // leave some headroom, so we don't have to walk the directories again on every shutdown.
+    const int64_t target = quota - quota / 10;
+    entries = g_list_sort(entries, _disk_entry_cmp);
+    for(GList *l = entries; l && used > target; l = g_list_next(l))
+    {
+      _disk_entry_t *e = (_disk_entry_t *)l->data;
+      if(!g_unlink(e->filename)) used -= e->size;
+    }
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] trimmed disk cache `%s' to %.2f MB\n", cache->cachedir,
+             used / (1024.0 * 1024.0));
+  }
+  g_list_free_full(entries, _disk_entry_free);
+  __sync_fetch_and_add(&cache->disk_used, used - before);
+}
+
+// the store and the files of the disk backend share cache_disk_backend_size, the store gets a quarter.
+// without cache_compression the blobs are plain rgba, a DT_MIPMAP_2 thumbnail takes about a megabyte.
+static int64_t _store_quota()
+{
+  return MAX(0, dt_conf_get_int64("cache_disk_backend_size")) / 4;
+}
+
+static void _disk_init(dt_mipmap_cache_t *cache)
+{
+  cache->disk_backend = 0;
+  cache->disk_used = 0;
+  cache->disk_quota = dt_conf_get_int64("cache_disk_backend_size");
+  if(!dt_conf_get_bool("cache_disk_backend") || cache->disk_quota <= 0) return;
+  // the mapped store of DT_MIPMAP_0..2 takes its share of the space
+  cache->disk_quota -= MIN((int64_t)cache->store_size, _store_quota());
+
+  gchar dbfilename[PATH_MAX] = { 0 };
+  if(dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)) || !strcmp(dbfilename, ":memory:")) return;
+
+  snprintf(cache->cachedir, sizeof(cache->cachedir), "%s.d", dbfilename);
+  for(int k = DT_MIPMAP_0; k <= DT_MIPMAP_3; k++)
+  {
+    char dirname[PATH_MAX] = { 0 };
+    snprintf(dirname, sizeof(dirname), "%s/%d", cache->cachedir, k);
+    if(g_mkdir_with_parents(dirname, 0750) == -1)
+    {
+      fprintf(stderr, "[mipmap_cache] could not create directory `%s', disabling disk cache\n", dirname);
+      return;
+    }
+  }
+  cache->disk_backend = 1;
+
+  // image ids of a new database will be reused, so old thumbnails would be mapped to the wrong images:
+  if(dt_database_is_new(darktable.db))
+  {
+    fprintf(stderr, "[mipmap_cache] database is new, dropping old cache `%s'\n", cache->cachedir);
+    _disk_trim(cache, 0);
+  }
+
+  // pick up the usage of the last session. the file is removed while we're running, so after a crash
+  // we'll walk the directories on the first write to get exact numbers again.
+  char usagefilename[PATH_MAX] = { 0 };
+  snprintf(usagefilename, sizeof(usagefilename), "%s/%s", cache->cachedir,
+           DT_MIPMAP_CACHE_DISK_USAGE_FILE_NAME);
+  gchar *usage = NULL;
+  if(g_file_get_contents(usagefilename, &usage, NULL, NULL))
+  {
+    cache->disk_used = g_ascii_strtoll(usage, NULL, 10);
+    g_free(usage);
+    g_unlink(usagefilename);
+  }
+  else
+    cache->disk_used = cache->disk_quota + 1;
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache_init] using disk cache `%s' (%.2f/%.2f MB)\n", cache->cachedir,
+           cache->disk_used / (1024.0 * 1024.0), cache->disk_quota / (1024.0 * 1024.0));
+}
+
+static void _disk_cleanup(dt_mipmap_cache_t *cache)
+{
+  if(!cache->disk_backend) return;
+  if(_disk_used(cache) > cache->disk_quota) _disk_trim(cache, cache->disk_quota);
+
+  char usagefilename[PATH_MAX] = { 0 };
+  snprintf(usagefilename, sizeof(usagefilename), "%s/%s", cache->cachedir,
+           DT_MIPMAP_CACHE_DISK_USAGE_FILE_NAME);
+  gchar *usage = g_strdup_printf("%" G_GINT64_FORMAT, (gint64)_disk_used(cache));
+  g_file_set_contents(usagefilename, usage, -1, NULL);
+  g_free(usage);
+}
+
+static struct dt_mipmap_store_entry *_store_find(const dt_mipmap_cache_t *cache, const uint32_t key)
+{
+  if(!cache->store) return NULL;
+  const struct dt_mipmap_store_header *head = (const struct dt_mipmap_store_header *)cache->store;
+  struct dt_mipmap_store_entry *index = (struct dt_mipmap_store_entry *)(cache->store + sizeof(*head));
+  // binary search, the index is sorted by key:
+  uint32_t lo = 0, hi = head->num_entries;
+  while(lo < hi)
+  {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if(index[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo < head->num_entries && index[lo].key == key) return index + lo;
+  return NULL;
+}
+
+static inline int _store_contains(const dt_mipmap_cache_t *cache, const uint8_t *ptr)
+{
+  return cache->store && ptr >= cache->store && ptr < cache->store + cache->store_size;
+}
+
+// point buf straight into the mapped store. returns 0 on success.
+// these buffers are not locked, they stay valid until the cache is cleaned up.
+static int _store_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const uint32_t imgid,
+                      const dt_mipmap_size_t mip)
+{
+  if(mip > DT_MIPMAP_2) return 1;
+  struct dt_mipmap_store_entry *e = _store_find(cache, get_key(imgid, mip));
+  if(!e || e->state == DT_MIPMAP_STORE_INVALID) return 1;
+  if(e->state == DT_MIPMAP_STORE_UNVERIFIED)
+  {
+    // the history might have been changed by someone else since the store was written.
+    // racing threads will come to the same conclusion, so no need to lock.
+    e->state = (e->hash == _history_hash(cache, imgid)) ? DT_MIPMAP_STORE_VALID : DT_MIPMAP_STORE_INVALID;
+    if(e->state == DT_MIPMAP_STORE_INVALID) return 1;
+  }
+  const struct dt_mipmap_buffer_dsc *dsc = (const struct dt_mipmap_buffer_dsc *)(cache->store + e->offset) - 1;
+  if(dsc->width > cache->mip[mip].max_width || dsc->height > cache->mip[mip].max_height
+     || e->offset + compressed_buffer_size(cache->compression_type, dsc->width, dsc->height) > cache->store_size)
+  {
+    e->state = DT_MIPMAP_STORE_INVALID;
+    return 1;
+  }
+  buf->width = dsc->width;
+  buf->height = dsc->height;
+  buf->imgid = imgid;
+  buf->size = mip;
+  buf->buf = cache->store + e->offset;
+  return 0;
+}
+
+typedef struct _store_item_t
+{
+  uint32_t key;
+  // where it comes from, lower is more recent: 0 - memory, 1 - used from the store, 2 - unused
+  int32_t priority;
+  uint64_t hash;
+  const struct dt_mipmap_buffer_dsc *dsc;
+  uint64_t offset;
+} _store_item_t;
+
+static int _store_collect(const uint32_t key, const void *data, void *user_data)
+{
+  if(!data) return 0;
+  const struct dt_mipmap_buffer_dsc *dsc = (const struct dt_mipmap_buffer_dsc *)data;
+  // not yet initialized, or skulls and other failures, these should be retried next time:
+  if((dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE) || (dsc->width <= 8 && dsc->height <= 8)) return 0;
+  _store_item_t item = { key, 0, dsc->hash, dsc, 0 };
+  g_array_append_val((GArray *)user_data, item);
+  return 0;
+}
+
+static gint _store_item_cmp_priority(gconstpointer a, gconstpointer b)
+{
+  const _store_item_t *ia = (const _store_item_t *)a;
+  const _store_item_t *ib = (const _store_item_t *)b;
+  if(ia->priority != ib->priority) return ia->priority - ib->priority;
+  return (ia->key > ib->key) - (ia->key < ib->key);
+}
+
+// across the levels for the byte budget: most recent first, and of these the small thumbnails
+static gint _store_item_cmp_budget(gconstpointer a, gconstpointer b)
+{
+  const _store_item_t *ia = (const _store_item_t *)a;
+  const _store_item_t *ib = (const _store_item_t *)b;
+  if(ia->priority != ib->priority) return ia->priority - ib->priority;
+  if(get_size(ia->key) != get_size(ib->key)) return (int)get_size(ia->key) - (int)get_size(ib->key);
+  return (ia->key > ib->key) - (ia->key < ib->key);
+}
+
+static gint _store_item_cmp_key(gconstpointer a, gconstpointer b)
+{
+  const _store_item_t *ia = (const _store_item_t *)a;
+  const _store_item_t *ib = (const _store_item_t *)b;
+  return (ia->key > ib->key) - (ia->key < ib->key);
+}
+
 static int dt_mipmap_cache_serialize(dt_mipmap_cache_t *cache)
 {
   gchar dbfilename[PATH_MAX] = { 0 };
@@ -241,61 +699,143 @@ static int dt_mipmap_cache_serialize(dt_mipmap_cache_t *cache)
     return 0;
   }
 
-  // only store smallest thumbs.
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  GArray *items = g_array_new(FALSE, FALSE, sizeof(_store_item_t));
+  for(int k = DT_MIPMAP_0; k < DT_MIPMAP_STORE_LEVELS; k++)
+  {
+    // what is in memory now, plus what has been in the store before. that is served
+    // without ever entering the cache, so it would be lost otherwise.
+    GArray *level = g_array_new(FALSE, FALSE, sizeof(_store_item_t));
+    dt_cache_for_all(&cache->mip[k].cache, _store_collect, level);
+    if(cache->store)
+    {
+      const struct dt_mipmap_store_header *head = (const struct dt_mipmap_store_header *)cache->store;
+      const struct dt_mipmap_store_entry *index
+          = (const struct dt_mipmap_store_entry *)(cache->store + sizeof(*head));
+      for(uint32_t i = 0; i < head->num_entries; i++)
+      {
+        if(get_size(index[i].key) != k || index[i].state == DT_MIPMAP_STORE_INVALID) continue;
+        if(dt_cache_contains(&cache->mip[k].cache, index[i].key)) continue;
+        // entries that were never looked up haven't been checked against the size of the file yet.
+        // a truncated or corrupt store would have us read past the end of the mapping otherwise:
+        const struct dt_mipmap_buffer_dsc *dsc
+            = (const struct dt_mipmap_buffer_dsc *)(cache->store + index[i].offset) - 1;
+        if(dsc->width > cache->mip[k].max_width || dsc->height > cache->mip[k].max_height
+           || index[i].offset + compressed_buffer_size(cache->compression_type, dsc->width, dsc->height)
+                  > cache->store_size)
+          continue;
+        _store_item_t item = { index[i].key, index[i].state == DT_MIPMAP_STORE_VALID ? 1 : 2, index[i].hash,
+                               dsc, 0 };
+        g_array_append_val(level, item);
+      }
+    }
+    // don't let the store grow beyond what the memory cache could hold:
+    g_array_sort(level, _store_item_cmp_priority);
+    const uint32_t max_items = MIN(level->len, dt_cache_capacity(&cache->mip[k].cache));
+    g_array_append_vals(items, level->data, max_items);
+    g_array_free(level, TRUE);
+  }
+
+  // nor beyond its share of the disk space:
+  g_array_sort(items, _store_item_cmp_budget);
+  const int64_t quota = _store_quota();
+  int64_t size = 0;
+  uint32_t fit = 0;
+  for(; fit < items->len; fit++)
+  {
+    const _store_item_t *item = &g_array_index(items, _store_item_t, fit);
+    const int32_t blob = compressed_buffer_size(cache->compression_type, item->dsc->width, item->dsc->height);
+    const size_t length = sizeof(struct dt_mipmap_buffer_dsc) + blob;
+    size += (length + page_size - 1) / page_size * page_size;
+    if(size > quota) break;
+  }
+  if(fit < items->len)
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] store is limited to %.2f MB, leaving out %u thumbnails\n",
+             quota / (1024.0 * 1024.0), items->len - fit);
+    g_array_set_size(items, fit);
+  }
+  g_array_sort(items, _store_item_cmp_key);
+
+  // lay out the blobs on page boundaries, with the descriptor right in front:
+  uint64_t offset = sizeof(struct dt_mipmap_store_header) + items->len * sizeof(struct dt_mipmap_store_entry);
+  for(uint32_t i = 0; i < items->len; i++)
+  {
+    _store_item_t *item = &g_array_index(items, _store_item_t, i);
+    offset = (offset + sizeof(struct dt_mipmap_buffer_dsc) + page_size - 1) / page_size * page_size;
+    item->offset = offset;
+    offset += compressed_buffer_size(cache->compression_type, item->dsc->width, item->dsc->height);
+  }
 
-  _iterate_data_t d;
-  d.f = NULL;
-  d.blob = (uint8_t *)malloc(cache->mip[mip].buffer_size);
-  int written = 0;
-  FILE *f = fopen(dbfilename, "wb");
+  // write to a temporary file and rename it, the old store is still mapped and read from.
+  gchar *tmpfilename = g_strdup_printf("%s.tmp", dbfilename);
+  FILE *f = fopen(tmpfilename, "wb");
   if(!f) goto write_error;
-  d.f = f;
-  // fprintf(stderr, "[mipmap_cache] serializing to `%s'\n", dbfilename);
 
-  // write version info:
-  const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  written = fwrite(&magic, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
+  struct dt_mipmap_store_header head;
+  memset(&head, 0, sizeof(head));
+  head.magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
+  head.compression_type = cache->compression_type;
+  for(int k = DT_MIPMAP_0; k < DT_MIPMAP_STORE_LEVELS; k++)
+  {
+    head.max_width[k] = cache->mip[k].max_width;
+    head.max_height[k] = cache->mip[k].max_height;
+  }
+  head.page_size = page_size;
+  head.num_entries = items->len;
+  if(fwrite(&head, sizeof(head), 1, f) != 1) goto write_error;
 
-  // store compression type
-  written = fwrite(&cache->compression_type, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
+  for(uint32_t i = 0; i < items->len; i++)
+  {
+    const _store_item_t *item = &g_array_index(items, _store_item_t, i);
+    struct dt_mipmap_store_entry e = { item->key, DT_MIPMAP_STORE_UNVERIFIED, item->hash, item->offset };
+    if(fwrite(&e, sizeof(e), 1, f) != 1) goto write_error;
+  }
 
-  for(int i = 0; i <= mip; i++)
+  for(uint32_t i = 0; i < items->len; i++)
   {
-    // print max sizes for this cache
-    written = fwrite(&cache->mip[i].max_width, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
-    written = fwrite(&cache->mip[i].max_height, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
+    const _store_item_t *item = &g_array_index(items, _store_item_t, i);
+    const int32_t length = compressed_buffer_size(cache->compression_type, item->dsc->width, item->dsc->height);
+    struct dt_mipmap_buffer_dsc dsc;
+    memset(&dsc, 0, sizeof(dsc));
+    dsc.width = item->dsc->width;
+    dsc.height = item->dsc->height;
+    dsc.size = sizeof(dsc) + length;
+    dsc.hash = item->hash;
+    // the gaps between the blobs are left as holes:
+    if(fseeko(f, item->offset - sizeof(dsc), SEEK_SET)) goto write_error;
+    if(fwrite(&dsc, sizeof(dsc), 1, f) != 1) goto write_error;
+    if(fwrite(item->dsc + 1, sizeof(uint8_t), length, f) != length) goto write_error;
   }
 
-  for(int i = 0; i <= mip; i++)
+  if(fclose(f))
   {
-    d.mip = (dt_mipmap_size_t)i;
-    d.compression_type = cache->compression_type;
-    if(dt_cache_for_all(&cache->mip[i].cache, _write_buffer, &d)) goto write_error;
+    f = NULL;
+    goto write_error;
   }
+  if(g_rename(tmpfilename, dbfilename)) goto write_error;
 
-  free(d.blob);
-  fclose(f);
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] wrote %u thumbnails to `%s'\n", items->len, dbfilename);
+  g_free(tmpfilename);
+  g_array_free(items, TRUE);
   return 0;
 
 write_error:
   fprintf(stderr, "[mipmap_cache] serialization to `%s' failed!\n", dbfilename);
   if(f) fclose(f);
-  free(d.blob);
+  g_unlink(tmpfilename);
+  g_free(tmpfilename);
+  g_array_free(items, TRUE);
   return 1;
 }
 
+// map the store of the last session. nothing is read here, the kernel will page
+// the thumbnails in when they are first drawn, and share them with other processes.
 static int dt_mipmap_cache_deserialize(dt_mipmap_cache_t *cache)
 {
-  size_t rd = 0;
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
-  uint32_t *blob = NULL;
-  FILE *f = NULL;
-  int file_width[mip + 1], file_height[mip + 1];
+  int fd = -1;
+  void *store = MAP_FAILED;
+  struct stat st;
 
   gchar dbfilename[PATH_MAX] = { 0 };
   if(dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)))
@@ -317,142 +857,81 @@ static int dt_mipmap_cache_deserialize(dt_mipmap_cache_t *cache)
     goto read_finalize;
   }
 
-  f = fopen(dbfilename, "rb");
-  if(!f)
+  fd = open(dbfilename, O_RDONLY);
+  if(fd < 0)
   {
     if(errno == ENOENT)
     {
       fprintf(stderr, "[mipmap_cache] cache is empty, file `%s' doesn't exist\n", dbfilename);
+      return 1;
     }
-    else
-    {
-      fprintf(stderr, "[mipmap_cache] failed to open the cache from `%s'\n", dbfilename);
-    }
+    fprintf(stderr, "[mipmap_cache] failed to open the cache from `%s'\n", dbfilename);
     goto read_finalize;
   }
+  if(fstat(fd, &st) || st.st_size < sizeof(struct dt_mipmap_store_header)) goto read_error;
 
-  // read version info:
+  // private mapping: pages are shared with the page cache and other processes until we write to
+  // them, which only happens for the state of index entries.
+  store = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(store == MAP_FAILED) goto read_error;
+  close(fd);
+  fd = -1;
+
+  // check version and settings:
+  const struct dt_mipmap_store_header *head = (const struct dt_mipmap_store_header *)store;
   const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  int32_t magic_file = 0;
-  rd = fread(&magic_file, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(magic_file == DT_MIPMAP_CACHE_FILE_MAGIC + 22)
+  if(head->magic != magic)
   {
-    // same format, but compression was broken in 22 and below
-  }
-  else if(magic_file != magic)
-  {
-    if(magic_file > DT_MIPMAP_CACHE_FILE_MAGIC && magic_file < magic)
+    if(head->magic > DT_MIPMAP_CACHE_FILE_MAGIC && head->magic < magic)
       fprintf(stderr, "[mipmap_cache] cache version too old, dropping `%s' cache\n", dbfilename);
     else
       fprintf(stderr, "[mipmap_cache] invalid cache file, dropping `%s' cache\n", dbfilename);
     goto read_finalize;
   }
-
-  // also read compression type and yell out on missmatch.
-  int32_t compression = -1;
-  rd = fread(&compression, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(compression != cache->compression_type)
+  if(head->compression_type != cache->compression_type)
   {
     fprintf(stderr, "[mipmap_cache] cache is %s, but settings say we should use %s, dropping `%s' cache\n",
-            compression == 0 ? "uncompressed"
-                             : (compression == 1 ? "low quality compressed" : "high quality compressed"),
+            head->compression_type == 0
+                ? "uncompressed"
+                : (head->compression_type == 1 ? "low quality compressed" : "high quality compressed"),
             cache->compression_type == 0
                 ? "no compression"
                 : (cache->compression_type == 1 ? "low quality compression" : "high quality compression"),
             dbfilename);
     goto read_finalize;
   }
-  if(compression && (magic_file == DT_MIPMAP_CACHE_FILE_MAGIC + 22))
-  {
-    // compression is enabled and we have the affected version. can't read that.
-    fprintf(stderr, "[mipmap_cache] dropping compressed cache v22 to regenerate mips without artifacts.\n");
-    goto read_finalize;
-  }
-
-  for(int i = 0; i <= mip; i++)
+  for(int k = DT_MIPMAP_0; k < DT_MIPMAP_STORE_LEVELS; k++)
   {
-    rd = fread(&file_width[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    rd = fread(&file_height[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    if(file_width[i] != cache->mip[i].max_width || file_height[i] != cache->mip[i].max_height)
+    if(head->max_width[k] != cache->mip[k].max_width || head->max_height[k] != cache->mip[k].max_height)
     {
       fprintf(stderr, "[mipmap_cache] cache settings changed, dropping `%s' cache\n", dbfilename);
       goto read_finalize;
     }
   }
+  if(head->page_size != sysconf(_SC_PAGESIZE)
+     || sizeof(*head) + (uint64_t)head->num_entries * sizeof(struct dt_mipmap_store_entry) > st.st_size)
+    goto read_error;
 
-  if(cache->compression_type)
-    blob = NULL;
-  else
-    blob = malloc(sizeof(uint32_t) * file_width[mip] * file_height[mip]);
-
-  while(!feof(f))
+  // bounds check the index once, so lookups can trust it:
+  const struct dt_mipmap_store_entry *index = (const struct dt_mipmap_store_entry *)(head + 1);
+  for(uint32_t i = 0; i < head->num_entries; i++)
   {
-    dt_mipmap_size_t level = 0;
-    rd = fread(&level, sizeof(dt_mipmap_size_t), 1, f);
-    if(rd != 1 || level > mip) break;
-
-    int32_t key = 0;
-    rd = fread(&key, sizeof(int32_t), 1, f);
-    if(rd != 1) break; // first value is break only, goes to eof.
-    int32_t length = 0;
-    rd = fread(&length, sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-
-    uint8_t *data = (uint8_t *)dt_cache_read_get(&cache->mip[level].cache, key);
-    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)data;
-    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
-    {
-      if(cache->compression_type)
-      {
-        int32_t wd, ht;
-        rd = fread(&wd, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        rd = fread(&ht, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        dsc->width = wd;
-        dsc->height = ht;
-        if(length != compressed_buffer_size(cache->compression_type, wd, ht)) goto read_error;
-        // directly read from disk into cache:
-        rd = fread(data + sizeof(*dsc), 1, length, f);
-        if(rd != length) goto read_error;
-      }
-      else
-      {
-        // jpg too large?
-        if(length > sizeof(uint32_t) * file_width[mip] * file_height[mip]) goto read_error;
-        rd = fread(blob, sizeof(uint8_t), length, f);
-        if(rd != length) goto read_error;
-        // no compression, the image is still compressed on disk, as jpg
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, length, &jpg)
-           || (jpg.width > file_width[level] || jpg.height > file_height[level])
-           || dt_imageio_jpeg_decompress(&jpg, data + sizeof(*dsc)))
-        {
-          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d!\n", get_imgid(key));
-        }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-      }
-      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-      // these come write locked in case idata[3] == 1, so release that!
-      dt_cache_write_release(&cache->mip[level].cache, key);
-    }
-    dt_cache_read_release(&cache->mip[level].cache, key);
+    if(i > 0 && index[i].key <= index[i - 1].key) goto read_error;
+    if(get_size(index[i].key) >= DT_MIPMAP_STORE_LEVELS || index[i].offset % head->page_size
+       || index[i].offset < sizeof(struct dt_mipmap_buffer_dsc) || index[i].offset > st.st_size)
+      goto read_error;
   }
 
-  fclose(f);
-  free(blob);
+  cache->store = (uint8_t *)store;
+  cache->store_size = st.st_size;
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] mapped %u thumbnails from `%s'\n", head->num_entries, dbfilename);
   return 0;
 
 read_error:
   fprintf(stderr, "[mipmap_cache] failed to recover the cache from `%s'\n", dbfilename);
 read_finalize:
-  if(f) fclose(f);
-  free(blob);
+  if(fd >= 0) close(fd);
+  if(store != MAP_FAILED) munmap(store, st.st_size);
   g_unlink(dbfilename);
   return 1;
 }
@@ -480,6 +959,7 @@ int32_t dt_mipmap_cache_allocate(void *data, const uint32_t key, size_t *cost, v
   dsc->height = c->max_height;
   dsc->size = c->buffer_size;
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  dsc->hash = 0;
 
   // fprintf(stderr, "[mipmap cache alloc] slot %d/%d for imgid %d size %d buffer size %d (%p)\n", slot,
   // c->cache.bucket_mask+1, get_imgid(key), get_size(key), c->buffer_size, *buf);
@@ -744,12 +1224,28 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip[DT_MIPMAP_F].size = DT_MIPMAP_F;
   cache->mip[DT_MIPMAP_F].buf = NULL;
 
+  cache->history_hash = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  cache->history_hash_generation = 0;
+  dt_pthread_mutex_init(&cache->history_hash_mutex, NULL);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE,
+                            G_CALLBACK(_history_change_callback), cache);
+
+  cache->store = NULL;
+  cache->store_size = 0;
   dt_mipmap_cache_deserialize(cache);
+  cache->disk_trimming = 0;
+  _disk_init(cache);
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_serialize(cache);
+  _disk_cleanup(cache);
+  if(cache->store) munmap(cache->store, cache->store_size);
+  cache->store = NULL;
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_history_change_callback), cache);
+  g_hash_table_destroy(cache->history_hash);
+  dt_pthread_mutex_destroy(&cache->history_hash_mutex);
   for(int k = 0; k < DT_MIPMAP_F; k++)
   {
     dt_cache_cleanup(&cache->mip[k].cache);
@@ -792,6 +1288,17 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
            100.0f * (float)cache->scratchmem.cache.cost / (float)cache->scratchmem.cache.cost_quota,
            dt_cache_size(&cache->scratchmem.cache), dt_cache_capacity(&cache->scratchmem.cache));
   }
+  if(cache->store)
+  {
+    printf("[mipmap_cache] store maps %u thumbnails (%.2f MB)\n",
+           ((const struct dt_mipmap_store_header *)cache->store)->num_entries,
+           cache->store_size / (1024.0 * 1024.0));
+  }
+  if(cache->disk_backend)
+  {
+    printf("[mipmap_cache] disk fill %.2f/%.2f MB in `%s'\n", _disk_used(cache) / (1024.0 * 1024.0),
+           cache->disk_quota / (1024.0 * 1024.0), cache->cachedir);
+  }
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
   uint64_t sum_standins = 0;
@@ -814,8 +1321,8 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   // dt_cache_print(&cache->mip[DT_MIPMAP_3].cache);
 }
 
-void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const uint32_t imgid,
-                              const dt_mipmap_size_t mip, const dt_mipmap_get_flags_t flags)
+static void _mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const uint32_t imgid,
+                                   const dt_mipmap_size_t mip, const dt_mipmap_get_flags_t flags)
 {
   const uint32_t key = get_key(imgid, mip);
   if(flags == DT_MIPMAP_TESTLOCK)
@@ -832,6 +1339,10 @@ void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf,
       // skip to next 8-byte alignment, for sse buffers.
       buf->buf = (uint8_t *)(dsc + 1);
     }
+    else if(!_store_get(cache, buf, imgid, mip))
+    {
+      // served from the mapped store, nothing to lock.
+    }
     else
     {
       // set to NULL if failed.
@@ -850,6 +1361,8 @@ void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf,
   }
   else if(flags == DT_MIPMAP_BLOCKING)
   {
+    // mapped from the store? then there's no need to take up a slot in the cache.
+    if(!_store_get(cache, buf, imgid, mip)) return;
     // simple case: blocking get
     struct dt_mipmap_buffer_dsc *dsc
         = (struct dt_mipmap_buffer_dsc *)dt_cache_read_get(&cache->mip[mip].cache, key);
@@ -927,6 +1440,10 @@ void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf,
         {
           _init_f((float *)(dsc + 1), &dsc->width, &dsc->height, imgid);
         }
+        else if(!_disk_read(cache, dsc, imgid, mip))
+        {
+          // 8-bit thumb was found in the disk backend, nothing more to do.
+        }
         else
         {
           // 8-bit thumbs, possibly need to be compressed:
@@ -951,6 +1468,8 @@ void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf,
           {
             _init_8((uint8_t *)(dsc + 1), &dsc->width, &dsc->height, imgid, mip);
           }
+          dsc->hash = _history_hash(cache, imgid);
+          _disk_write(cache, dsc, imgid, mip);
         }
         dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
         // drop the write lock
@@ -1007,11 +1526,27 @@ void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf,
   }
 }
 
+void dt_mipmap_cache_read_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const uint32_t imgid,
+                              const dt_mipmap_size_t mip, const dt_mipmap_get_flags_t flags)
+{
+  const double trace_begin = dt_trace_clock();
+  _mipmap_cache_read_get(cache, buf, imgid, mip, flags);
+  // only the blocking ones can take long, they may have to load the image
+  if(dt_trace_enabled && flags == DT_MIPMAP_BLOCKING)
+  {
+    static const char *names[]
+        = { "mipmap 0", "mipmap 1", "mipmap 2", "mipmap 3", "mipmap f", "mipmap full" };
+    dt_trace_complete(DT_TRACE_CACHE, mip < DT_MIPMAP_NONE ? names[mip] : "mipmap", trace_begin);
+  }
+}
+
 void dt_mipmap_cache_write_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf)
 {
   assert(buf->imgid > 0);
   assert(buf->size >= DT_MIPMAP_0);
   assert(buf->size < DT_MIPMAP_NONE);
+  // the mapped store is read only
+  assert(!_store_contains(cache, buf->buf));
   // simple case: blocking write get
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_cache_write_get(
       &cache->mip[buf->size].cache, get_key(buf->imgid, buf->size));
@@ -1026,6 +1561,13 @@ void dt_mipmap_cache_write_get(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf
 void dt_mipmap_cache_read_release(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf)
 {
   if(buf->size == DT_MIPMAP_NONE) return;
+  if(_store_contains(cache, buf->buf))
+  {
+    // not locked in the first place
+    buf->size = DT_MIPMAP_NONE;
+    buf->buf = NULL;
+    return;
+  }
   assert(buf->imgid > 0);
   assert(buf->size >= DT_MIPMAP_0);
   assert(buf->size < DT_MIPMAP_NONE);
@@ -1071,11 +1613,21 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(const dt_mipmap_cache_t *cach
 
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
 {
+  // this is how changes to the history are announced to us:
+  _history_hash_invalidate(cache, imgid);
   // get rid of all ldr thumbnails:
   for(int k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
   {
     const uint32_t key = get_key(imgid, k);
     dt_cache_remove(&cache->mip[k].cache, key);
+    struct dt_mipmap_store_entry *e = _store_find(cache, key);
+    if(e) e->state = DT_MIPMAP_STORE_INVALID;
+    if(cache->disk_backend)
+    {
+      char filename[PATH_MAX] = { 0 };
+      _disk_get_filename(cache, imgid, k, filename, sizeof(filename));
+      _disk_unlink(cache, filename);
+    }
   }
 }
 
@@ -1347,7 +1899,7 @@ void dt_mipmap_cache_compress(dt_mipmap_buffer_t *buf, uint8_t *const scratchmem
     int flags = squish_dxt1;
     // low quality:
     if(darktable.mipmap_cache->compression_type == 1) flags |= squish_colour_range_fit;
-    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, flags);
   }
   else
 #endif
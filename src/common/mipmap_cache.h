@@ -21,6 +21,8 @@
 #include "common/cache.h"
 #include "common/image.h"
 
+#include <limits.h>
+
 
 // sizes stored in the mipmap cache.
 // _4 can be a user-supplied size. down to _0,
@@ -106,6 +108,29 @@ typedef struct dt_mipmap_cache_t
   int compression_type; // 0 - none, 1 - low quality, 2 - slow
   // per-thread cache of uncompressed buffers, in case compression is requested.
   dt_mipmap_cache_one_t scratchmem;
+
+  // thumbnail store of the last session, mapped read-only.
+  // buffers of DT_MIPMAP_0..2 are pointed straight into it.
+  uint8_t *store;
+  size_t store_size;
+
+  // disk backed second tier for the 8-bit thumbnails. every mip level is written
+  // to its own file as soon as it is produced, and read back lazily on a miss.
+  int disk_backend;
+  // per library directory holding one subdirectory per mip level
+  char cachedir[PATH_MAX];
+  // size quota in bytes, and an estimate of what is used so far.
+  int64_t disk_quota;
+  int64_t disk_used;
+  // set while one thread evicts old thumbnails after a write went over the quota
+  int disk_trimming;
+
+  // imgid -> hash of its history, so the disk tier and the store don't hit the database on every
+  // lookup. entries are dropped when the history of an image changes.
+  GHashTable *history_hash;
+  // bumped on every change, so queries that raced with one aren't kept
+  uint64_t history_hash_generation;
+  dt_pthread_mutex_t history_hash_mutex;
 } dt_mipmap_cache_t;
 
 typedef void **dt_mipmap_cache_allocator_t;
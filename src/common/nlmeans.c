@@ -0,0 +1,504 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_UNIT_TEST
+#include "common/darktable.h"
+#include "common/threadpool.h"
+#endif
+#include "common/nlmeans.h"
+#include "common/simd.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <emmintrin.h>
+
+// output pixels per tile. with the search window around it, the input of a tile and the distances of one
+// group of shifts fit into 256k of l2 cache.
+#define DT_NLMEANS_TILE_W 64
+#define DT_NLMEANS_TILE_H 32
+
+struct _nlmeans_kernels_t;
+
+typedef struct _nlmeans_t
+{
+  const float *in;
+  float *out;
+  int width, height;
+  int tiles_x, tiles_y;
+  dt_nlmeans_param_t p;
+  const struct _nlmeans_kernels_t *kernels;
+  int failed; // a thread couldn't allocate its scratch memory, and left its tiles alone
+} _nlmeans_t;
+
+// everything which looks at all the shifts (ki0 + lane, kj) of a group at once, one row at a time
+typedef struct _nlmeans_kernels_t
+{
+  int lanes;
+  // squared differences of the pixels [x0, x1) of row y to those of row y + kj, into D
+  void (*distances)(float *D, const _nlmeans_t *n, const int x0, const int x1, const int y, const int kj,
+                    const int ki0);
+  // weights for the pixels [tx0, tx1) of row j from the sums V over the patch height of the columns
+  // [rx0, rx1), and the weighted neighbours added to the output
+  void (*accumulate)(const _nlmeans_t *n, const float *V, const int rx0, const int rx1, const int tx0,
+                     const int tx1, const int j, const int kj, const int ki0);
+} _nlmeans_kernels_t;
+
+static inline int _clamp(const int i, const int lo, const int hi)
+{
+  return i < lo ? lo : (i > hi ? hi : i);
+}
+
+// fast_mexp2f() of the modules, an approximation of 2^-x for x >= 0
+static inline float _mexp2(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = i1 + x * (i2 - i1);
+  union
+  {
+    float f;
+    uint32_t i;
+  } k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+// pixel x + ki0 + l of row y, or NULL if it's outside of the image or beyond the search window
+static inline const float *_shifted(const _nlmeans_t *n, const int x, const int y, const int ki0, const int l)
+{
+  const int xs = x + ki0 + l;
+  if(xs < 0 || xs >= n->width || ki0 + l > n->p.K) return NULL;
+  return n->in + (size_t)4 * ((size_t)n->width * y + xs);
+}
+
+// plain c, four shifts at a time like the sse code
+static void _distances_plain(float *D, const _nlmeans_t *n, const int x0, const int x1, const int y,
+                             const int kj, const int ki0)
+{
+  const float *row = n->in + (size_t)4 * n->width * y;
+  for(int x = x0; x < x1; x++, D += 4)
+    for(int l = 0; l < 4; l++)
+    {
+      const float *p = _shifted(n, x, y + kj, ki0, l);
+      D[l] = 0.0f;
+      if(!p) continue;
+      for(int c = 0; c < 3; c++) D[l] += n->p.norm2[c] * (row[4 * x + c] - p[c]) * (row[4 * x + c] - p[c]);
+    }
+}
+
+static void _accumulate_plain(const _nlmeans_t *n, const float *V, const int rx0, const int rx1,
+                              const int tx0, const int tx1, const int j, const int kj, const int ki0)
+{
+  const int P = n->p.P;
+  float *out = n->out + (size_t)4 * ((size_t)n->width * j + tx0);
+  int a = rx0, b = rx0;
+  float dist[4] = { 0.0f };
+  for(int i = tx0; i < tx1; i++, out += 4)
+  {
+    const int c = MIN(MAX(i, P), n->width - 1 - P);
+    for(; b < MIN(c + P + 1, rx1); b++)
+      for(int l = 0; l < 4; l++) dist[l] += V[4 * (b - rx0) + l];
+    for(; a < MAX(c - P, rx0); a++)
+      for(int l = 0; l < 4; l++) dist[l] -= V[4 * (a - rx0) + l];
+    for(int l = 0; l < 4; l++)
+    {
+      const float *p = _shifted(n, i, j + kj, ki0, l);
+      if(!p) continue;
+      const float w = _mexp2(MAX(0.0f, dist[l] * n->p.sharpness - n->p.offset));
+      for(int k = 0; k < 3; k++) out[k] += w * p[k];
+      out[3] += w;
+    }
+  }
+}
+
+static inline __m128 _mexp2_sse(const __m128 x)
+{
+  const __m128 i1 = _mm_set1_ps((float)0x3f800000u); // 2^0
+  const __m128 i2 = _mm_set1_ps((float)0x3f000000u); // 2^-1
+  const __m128 k0 = _mm_add_ps(i1, _mm_mul_ps(x, _mm_sub_ps(i2, i1)));
+  const __m128 denormal = _mm_cmplt_ps(k0, _mm_set1_ps((float)0x800000u));
+  return _mm_andnot_ps(denormal, _mm_castsi128_ps(_mm_cvttps_epi32(k0)));
+}
+
+// the pixels x + ki0 + (0..3) of row y, one channel per register. lanes outside of the image or beyond the
+// search window read a pixel at the border instead, and are cleared in valid. always inlined, so the avx2
+// functions get it in their own encoding.
+static inline __attribute__((always_inline)) void _load_sse(const _nlmeans_t *n, const int x, const int y,
+                                                            const int ki0, __m128 *r, __m128 *g, __m128 *b,
+                                                            __m128 *valid)
+{
+  const float *row = n->in + (size_t)4 * n->width * y;
+  const int xs = x + ki0;
+  __m128 p0, p1, p2, p3;
+  if(xs >= 0 && xs + 3 < n->width && ki0 + 3 <= n->p.K)
+  {
+    p0 = _mm_load_ps(row + 4 * xs);
+    p1 = _mm_load_ps(row + 4 * xs + 4);
+    p2 = _mm_load_ps(row + 4 * xs + 8);
+    p3 = _mm_load_ps(row + 4 * xs + 12);
+    *valid = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  }
+  else
+  {
+    const int last = n->width - 1;
+    p0 = _mm_load_ps(row + 4 * _clamp(xs, 0, last));
+    p1 = _mm_load_ps(row + 4 * _clamp(xs + 1, 0, last));
+    p2 = _mm_load_ps(row + 4 * _clamp(xs + 2, 0, last));
+    p3 = _mm_load_ps(row + 4 * _clamp(xs + 3, 0, last));
+    const __m128 l = _mm_add_ps(_mm_set1_ps(xs), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    *valid = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(l, _mm_setzero_ps()), _mm_cmplt_ps(l, _mm_set1_ps(n->width))),
+                        _mm_cmple_ps(l, _mm_set1_ps(x + n->p.K)));
+  }
+  _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+  *r = p0;
+  *g = p1;
+  *b = p2;
+}
+
+static void _distances_sse(float *D, const _nlmeans_t *n, const int x0, const int x1, const int y,
+                           const int kj, const int ki0)
+{
+  const float *row = n->in + (size_t)4 * n->width * y;
+  const __m128 n0 = _mm_set1_ps(n->p.norm2[0]);
+  const __m128 n1 = _mm_set1_ps(n->p.norm2[1]);
+  const __m128 n2 = _mm_set1_ps(n->p.norm2[2]);
+  for(int x = x0; x < x1; x++, D += 4)
+  {
+    __m128 r, g, b, valid;
+    _load_sse(n, x, y + kj, ki0, &r, &g, &b, &valid);
+    const __m128 dr = _mm_sub_ps(_mm_set1_ps(row[4 * x + 0]), r);
+    const __m128 dg = _mm_sub_ps(_mm_set1_ps(row[4 * x + 1]), g);
+    const __m128 db = _mm_sub_ps(_mm_set1_ps(row[4 * x + 2]), b);
+    const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, _mm_mul_ps(dr, dr)),
+                                           _mm_mul_ps(n1, _mm_mul_ps(dg, dg))),
+                                _mm_mul_ps(n2, _mm_mul_ps(db, db)));
+    _mm_store_ps(D, _mm_and_ps(d, valid));
+  }
+}
+
+static void _accumulate_sse(const _nlmeans_t *n, const float *V, const int rx0, const int rx1, const int tx0,
+                            const int tx1, const int j, const int kj, const int ki0)
+{
+  const int P = n->p.P;
+  const __m128 sharpness = _mm_set1_ps(n->p.sharpness);
+  const __m128 offset = _mm_set1_ps(n->p.offset);
+  float *out = n->out + (size_t)4 * ((size_t)n->width * j + tx0);
+  // the patch is moved inside the image at the borders, so the window slides in the middle only
+  int a = rx0, b = rx0;
+  __m128 dist = _mm_setzero_ps();
+  for(int i = tx0; i < tx1; i++, out += 4)
+  {
+    const int c = MIN(MAX(i, P), n->width - 1 - P);
+    for(; b < MIN(c + P + 1, rx1); b++) dist = _mm_add_ps(dist, _mm_load_ps(V + 4 * (b - rx0)));
+    for(; a < MAX(c - P, rx0); a++) dist = _mm_sub_ps(dist, _mm_load_ps(V + 4 * (a - rx0)));
+    __m128 pr, pg, pb, valid;
+    _load_sse(n, i, j + kj, ki0, &pr, &pg, &pb, &valid);
+    const __m128 x = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_mul_ps(dist, sharpness), offset));
+    __m128 w = _mm_and_ps(_mexp2_sse(x), valid);
+    // sum over the lanes: (w r, w g, w b, w)
+    __m128 wr = _mm_mul_ps(w, pr), wg = _mm_mul_ps(w, pg), wb = _mm_mul_ps(w, pb);
+    _MM_TRANSPOSE4_PS(wr, wg, wb, w);
+    _mm_store_ps(out, _mm_add_ps(_mm_load_ps(out), _mm_add_ps(_mm_add_ps(wr, wg), _mm_add_ps(wb, w))));
+  }
+}
+
+#ifdef DT_SIMD_HAVE_AVX2
+// the same with eight shifts at a time
+DT_SIMD_TARGET_AVX2 static inline void _load_avx2(const _nlmeans_t *n, const int x, const int y, const int ki0,
+                                                  __m256 *r, __m256 *g, __m256 *b, __m256 *valid)
+{
+  __m128 r0, g0, b0, v0, r1, g1, b1, v1;
+  _load_sse(n, x, y, ki0, &r0, &g0, &b0, &v0);
+  _load_sse(n, x, y, ki0 + 4, &r1, &g1, &b1, &v1);
+  *r = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1);
+  *g = _mm256_insertf128_ps(_mm256_castps128_ps256(g0), g1, 1);
+  *b = _mm256_insertf128_ps(_mm256_castps128_ps256(b0), b1, 1);
+  *valid = _mm256_insertf128_ps(_mm256_castps128_ps256(v0), v1, 1);
+}
+
+DT_SIMD_TARGET_AVX2 static void _distances_avx2(float *D, const _nlmeans_t *n, const int x0, const int x1,
+                                                const int y, const int kj, const int ki0)
+{
+  const float *row = n->in + (size_t)4 * n->width * y;
+  const __m256 n0 = _mm256_set1_ps(n->p.norm2[0]);
+  const __m256 n1 = _mm256_set1_ps(n->p.norm2[1]);
+  const __m256 n2 = _mm256_set1_ps(n->p.norm2[2]);
+  for(int x = x0; x < x1; x++, D += 8)
+  {
+    __m256 r, g, b, valid;
+    _load_avx2(n, x, y + kj, ki0, &r, &g, &b, &valid);
+    const __m256 dr = _mm256_sub_ps(_mm256_set1_ps(row[4 * x + 0]), r);
+    const __m256 dg = _mm256_sub_ps(_mm256_set1_ps(row[4 * x + 1]), g);
+    const __m256 db = _mm256_sub_ps(_mm256_set1_ps(row[4 * x + 2]), b);
+    const __m256 d0 = _mm256_mul_ps(n0, _mm256_mul_ps(dr, dr));
+    const __m256 d1 = _mm256_fmadd_ps(n1, _mm256_mul_ps(dg, dg), d0);
+    const __m256 d = _mm256_fmadd_ps(n2, _mm256_mul_ps(db, db), d1);
+    _mm256_store_ps(D, _mm256_and_ps(d, valid));
+  }
+}
+
+DT_SIMD_TARGET_AVX2 static inline __m256 _mexp2_avx2(const __m256 x)
+{
+  const __m256 i1 = _mm256_set1_ps((float)0x3f800000u); // 2^0
+  const __m256 i2 = _mm256_set1_ps((float)0x3f000000u); // 2^-1
+  const __m256 k0 = _mm256_fmadd_ps(x, _mm256_sub_ps(i2, i1), i1);
+  const __m256 denormal = _mm256_cmp_ps(k0, _mm256_set1_ps((float)0x800000u), _CMP_LT_OQ);
+  return _mm256_andnot_ps(denormal, _mm256_castsi256_ps(_mm256_cvttps_epi32(k0)));
+}
+
+// the two halves added up
+DT_SIMD_TARGET_AVX2 static inline __m128 _fold_avx2(const __m256 v)
+{
+  return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+DT_SIMD_TARGET_AVX2 static void _accumulate_avx2(const _nlmeans_t *n, const float *V, const int rx0,
+                                                 const int rx1, const int tx0, const int tx1, const int j,
+                                                 const int kj, const int ki0)
+{
+  const int P = n->p.P;
+  const __m256 sharpness = _mm256_set1_ps(n->p.sharpness);
+  const __m256 offset = _mm256_set1_ps(n->p.offset);
+  float *out = n->out + (size_t)4 * ((size_t)n->width * j + tx0);
+  int a = rx0, b = rx0;
+  __m256 dist = _mm256_setzero_ps();
+  for(int i = tx0; i < tx1; i++, out += 4)
+  {
+    const int c = MIN(MAX(i, P), n->width - 1 - P);
+    for(; b < MIN(c + P + 1, rx1); b++) dist = _mm256_add_ps(dist, _mm256_load_ps(V + 8 * (b - rx0)));
+    for(; a < MAX(c - P, rx0); a++) dist = _mm256_sub_ps(dist, _mm256_load_ps(V + 8 * (a - rx0)));
+    __m256 pr, pg, pb, valid;
+    _load_avx2(n, i, j + kj, ki0, &pr, &pg, &pb, &valid);
+    const __m256 x = _mm256_max_ps(_mm256_setzero_ps(), _mm256_fmsub_ps(dist, sharpness, offset));
+    const __m256 w = _mm256_and_ps(_mexp2_avx2(x), valid);
+    __m128 wr = _fold_avx2(_mm256_mul_ps(w, pr));
+    __m128 wg = _fold_avx2(_mm256_mul_ps(w, pg));
+    __m128 wb = _fold_avx2(_mm256_mul_ps(w, pb));
+    __m128 ww = _fold_avx2(w);
+    _MM_TRANSPOSE4_PS(wr, wg, wb, ww);
+    _mm_store_ps(out, _mm_add_ps(_mm_load_ps(out), _mm_add_ps(_mm_add_ps(wr, wg), _mm_add_ps(wb, ww))));
+  }
+}
+#endif
+
+#ifdef DT_SIMD_HAVE_AVX512
+// and sixteen. avx512f has no bit operations on floats, validity is kept in a mask register.
+DT_SIMD_TARGET_AVX512 static inline __m512 _combine_avx512(const __m128 a, const __m128 b, const __m128 c,
+                                                           const __m128 d)
+{
+  const __m512 ab = _mm512_insertf32x4(_mm512_castps128_ps512(a), b, 1);
+  return _mm512_insertf32x4(_mm512_insertf32x4(ab, c, 2), d, 3);
+}
+
+DT_SIMD_TARGET_AVX512 static inline void _load_avx512(const _nlmeans_t *n, const int x, const int y,
+                                                      const int ki0, __m512 *r, __m512 *g, __m512 *b,
+                                                      __mmask16 *valid)
+{
+  __m128 r0, g0, b0, v0, r1, g1, b1, v1, r2, g2, b2, v2, r3, g3, b3, v3;
+  _load_sse(n, x, y, ki0, &r0, &g0, &b0, &v0);
+  _load_sse(n, x, y, ki0 + 4, &r1, &g1, &b1, &v1);
+  _load_sse(n, x, y, ki0 + 8, &r2, &g2, &b2, &v2);
+  _load_sse(n, x, y, ki0 + 12, &r3, &g3, &b3, &v3);
+  *r = _combine_avx512(r0, r1, r2, r3);
+  *g = _combine_avx512(g0, g1, g2, g3);
+  *b = _combine_avx512(b0, b1, b2, b3);
+  *valid = _mm512_test_epi32_mask(_mm512_castps_si512(_combine_avx512(v0, v1, v2, v3)),
+                                  _mm512_set1_epi32(-1));
+}
+
+DT_SIMD_TARGET_AVX512 static void _distances_avx512(float *D, const _nlmeans_t *n, const int x0, const int x1,
+                                                    const int y, const int kj, const int ki0)
+{
+  const float *row = n->in + (size_t)4 * n->width * y;
+  const __m512 n0 = _mm512_set1_ps(n->p.norm2[0]);
+  const __m512 n1 = _mm512_set1_ps(n->p.norm2[1]);
+  const __m512 n2 = _mm512_set1_ps(n->p.norm2[2]);
+  for(int x = x0; x < x1; x++, D += 16)
+  {
+    __m512 r, g, b;
+    __mmask16 valid;
+    _load_avx512(n, x, y + kj, ki0, &r, &g, &b, &valid);
+    const __m512 dr = _mm512_sub_ps(_mm512_set1_ps(row[4 * x + 0]), r);
+    const __m512 dg = _mm512_sub_ps(_mm512_set1_ps(row[4 * x + 1]), g);
+    const __m512 db = _mm512_sub_ps(_mm512_set1_ps(row[4 * x + 2]), b);
+    const __m512 d0 = _mm512_mul_ps(n0, _mm512_mul_ps(dr, dr));
+    const __m512 d1 = _mm512_fmadd_ps(n1, _mm512_mul_ps(dg, dg), d0);
+    const __m512 d = _mm512_fmadd_ps(n2, _mm512_mul_ps(db, db), d1);
+    _mm512_store_ps(D, _mm512_maskz_mov_ps(valid, d));
+  }
+}
+
+// the lanes which would be denormal are left out of the mask
+DT_SIMD_TARGET_AVX512 static inline __m512 _mexp2_avx512(const __m512 x, const __mmask16 valid)
+{
+  const __m512 i1 = _mm512_set1_ps((float)0x3f800000u); // 2^0
+  const __m512 i2 = _mm512_set1_ps((float)0x3f000000u); // 2^-1
+  const __m512 k0 = _mm512_fmadd_ps(x, _mm512_sub_ps(i2, i1), i1);
+  const __mmask16 normal = _mm512_cmp_ps_mask(k0, _mm512_set1_ps((float)0x800000u), _CMP_NLT_UQ);
+  return _mm512_maskz_mov_ps(valid & normal, _mm512_castsi512_ps(_mm512_cvttps_epi32(k0)));
+}
+
+// the four quarters added up
+DT_SIMD_TARGET_AVX512 static inline __m128 _fold_avx512(const __m512 v)
+{
+  return _mm_add_ps(_mm_add_ps(_mm512_castps512_ps128(v), _mm512_extractf32x4_ps(v, 1)),
+                    _mm_add_ps(_mm512_extractf32x4_ps(v, 2), _mm512_extractf32x4_ps(v, 3)));
+}
+
+DT_SIMD_TARGET_AVX512 static void _accumulate_avx512(const _nlmeans_t *n, const float *V, const int rx0,
+                                                     const int rx1, const int tx0, const int tx1, const int j,
+                                                     const int kj, const int ki0)
+{
+  const int P = n->p.P;
+  const __m512 sharpness = _mm512_set1_ps(n->p.sharpness);
+  const __m512 offset = _mm512_set1_ps(n->p.offset);
+  float *out = n->out + (size_t)4 * ((size_t)n->width * j + tx0);
+  int a = rx0, b = rx0;
+  __m512 dist = _mm512_setzero_ps();
+  for(int i = tx0; i < tx1; i++, out += 4)
+  {
+    const int c = MIN(MAX(i, P), n->width - 1 - P);
+    for(; b < MIN(c + P + 1, rx1); b++) dist = _mm512_add_ps(dist, _mm512_load_ps(V + 16 * (b - rx0)));
+    for(; a < MAX(c - P, rx0); a++) dist = _mm512_sub_ps(dist, _mm512_load_ps(V + 16 * (a - rx0)));
+    __m512 pr, pg, pb;
+    __mmask16 valid;
+    _load_avx512(n, i, j + kj, ki0, &pr, &pg, &pb, &valid);
+    const __m512 x = _mm512_max_ps(_mm512_setzero_ps(), _mm512_fmsub_ps(dist, sharpness, offset));
+    const __m512 w = _mexp2_avx512(x, valid);
+    __m128 wr = _fold_avx512(_mm512_mul_ps(w, pr));
+    __m128 wg = _fold_avx512(_mm512_mul_ps(w, pg));
+    __m128 wb = _fold_avx512(_mm512_mul_ps(w, pb));
+    __m128 ww = _fold_avx512(w);
+    _MM_TRANSPOSE4_PS(wr, wg, wb, ww);
+    _mm_store_ps(out, _mm_add_ps(_mm_load_ps(out), _mm_add_ps(_mm_add_ps(wr, wg), _mm_add_ps(wb, ww))));
+  }
+}
+#endif
+
+static const _nlmeans_kernels_t _plain = { 4, _distances_plain, _accumulate_plain };
+static const _nlmeans_kernels_t _sse = { 4, _distances_sse, _accumulate_sse };
+#ifdef DT_SIMD_HAVE_AVX2
+static const _nlmeans_kernels_t _avx2 = { 8, _distances_avx2, _accumulate_avx2 };
+#endif
+#ifdef DT_SIMD_HAVE_AVX512
+static const _nlmeans_kernels_t _avx512 = { 16, _distances_avx512, _accumulate_avx512 };
+#endif
+
+// the ones for the simd level in use, sse until dt_nlmeans_init() knows better
+static const _nlmeans_kernels_t *_kernels = &_sse;
+
+void dt_nlmeans_init()
+{
+  _kernels = (const _nlmeans_kernels_t *)dt_simd_select(&_plain, &_sse, DT_SIMD_AVX2_FN(&_avx2),
+                                                         DT_SIMD_AVX512_FN(&_avx512));
+}
+
+static void _process_tiles(void *data, const size_t begin, const size_t end)
+{
+  _nlmeans_t *n = (_nlmeans_t *)data;
+  const int width = n->width, height = n->height;
+  const int P = n->p.P, K = n->p.K;
+  const int lanes = n->kernels->lanes;
+  // columns of the patches of one tile
+  const int stride = lanes * (DT_NLMEANS_TILE_W + 2 * P + 1);
+  const int rows = DT_NLMEANS_TILE_H + 2 * P;
+  float *D = (float *)dt_alloc_align(64, sizeof(float) * stride * (rows + 1));
+  if(!D)
+  {
+    __sync_fetch_and_or(&n->failed, 1);
+    return;
+  }
+  float *V = D + (size_t)stride * rows;
+
+  for(size_t t = begin; t < end; t++)
+  {
+    const int tx0 = (t % n->tiles_x) * DT_NLMEANS_TILE_W, tx1 = MIN(tx0 + DT_NLMEANS_TILE_W, width);
+    const int ty0 = (t / n->tiles_x) * DT_NLMEANS_TILE_H, ty1 = MIN(ty0 + DT_NLMEANS_TILE_H, height);
+    // all the columns the patches of this tile can touch
+    const int rx0 = MAX(0, MIN(tx0, width - 1 - P) - P);
+    const int rx1 = MIN(width, MAX(tx1 - 1, P) + P + 1);
+    const int rw = lanes * (rx1 - rx0);
+    const int ry0 = ty0 - P, ry1 = ty1 + P;
+
+    for(int j = ty0; j < ty1; j++)
+      memset(n->out + (size_t)4 * ((size_t)width * j + tx0), 0, sizeof(float) * 4 * (tx1 - tx0));
+
+    for(int kj = -K; kj <= K; kj++)
+    {
+      if(ty1 + kj <= 0 || ty0 + kj >= height) continue;
+      for(int ki0 = -K; ki0 <= K; ki0 += lanes)
+      {
+        // squared differences of all pixels under the patches, zero where there is no partner
+        for(int y = ry0; y < ry1; y++)
+        {
+          float *Dy = D + (size_t)stride * (y - ry0);
+          if(y < 0 || y >= height || y + kj < 0 || y + kj >= height)
+            memset(Dy, 0, sizeof(float) * rw);
+          else
+            n->kernels->distances(Dy, n, rx0, rx1, y, kj, ki0);
+        }
+
+        // sums over the patch height, sliding down the tile
+        memset(V, 0, sizeof(float) * rw);
+        for(int y = ry0; y < ty0 + P; y++)
+        {
+          const float *Dy = D + (size_t)stride * (y - ry0);
+          for(int k = 0; k < rw; k++) V[k] += Dy[k];
+        }
+        for(int j = ty0; j < ty1; j++)
+        {
+          const float *add = D + (size_t)stride * (j + P - ry0);
+          for(int k = 0; k < rw; k++) V[k] += add[k];
+
+          if(j + kj >= 0 && j + kj < height) n->kernels->accumulate(n, V, rx0, rx1, tx0, tx1, j, kj, ki0);
+
+          const float *sub = D + (size_t)stride * (j - P - ry0);
+          for(int k = 0; k < rw; k++) V[k] -= sub[k];
+        }
+      }
+    }
+  }
+  dt_free_align(D);
+}
+
+int dt_nlmeans_accumulate(const float *const in, float *const out, const int width, const int height,
+                          const dt_nlmeans_param_t *const param)
+{
+  _nlmeans_t n;
+  n.in = in;
+  n.out = out;
+  n.width = width;
+  n.height = height;
+  n.tiles_x = (width + DT_NLMEANS_TILE_W - 1) / DT_NLMEANS_TILE_W;
+  n.tiles_y = (height + DT_NLMEANS_TILE_H - 1) / DT_NLMEANS_TILE_H;
+  n.p = *param;
+  n.kernels = _kernels;
+  n.failed = 0;
+
+  const size_t tiles = (size_t)n.tiles_x * n.tiles_y;
+  dt_parallel_for(0, tiles, 0, _process_tiles, &n);
+  if(!n.failed) return 0;
+  // short on memory. we don't know which tiles are missing, so do all of them again, with one scratch
+  // buffer instead of one per thread.
+  n.failed = 0;
+  _process_tiles(&n, 0, tiles);
+  return n.failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
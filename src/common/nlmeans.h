@@ -0,0 +1,54 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_NLMEANS_H
+#define DT_COMMON_NLMEANS_H
+
+/**
+ * the patch search of non-local means, shared by the nlmeans and denoiseprofile modules.
+ *
+ * every pixel is compared to the pixels up to K away from it, by the sum of squared differences of the
+ * patches of radius P around them. the neighbours are accumulated with weight 2^-max(0, dist * sharpness -
+ * offset). patches are moved inside the image at the left and right borders, and clipped at the top and
+ * bottom.
+ *
+ * the image is processed in tiles small enough for the cache, and each tile runs through all the shifts
+ * before moving on, several shifts at a time in the lanes of the vector unit.
+ */
+
+typedef struct dt_nlmeans_param_t
+{
+  int P;           // patch radius
+  int K;           // search radius
+  float norm2[3];  // weights of the squared channel differences
+  float sharpness; // scale of the patch distance
+  float offset;    // distances up to offset / sharpness count as equal
+} dt_nlmeans_param_t;
+
+/** picks the code path for the simd level, called once by dt_init() after dt_simd_init(). */
+void dt_nlmeans_init();
+
+/** accumulates the weighted neighbours of every pixel of the 4 channel buffer in into out, with the sum
+ * of the weights in the fourth channel. out is overwritten, normalizing is up to the caller.
+ * returns non-zero if there wasn't enough memory for the scratch buffers, out is incomplete then. */
+int dt_nlmeans_accumulate(const float *const in, float *const out, const int width, const int height,
+                          const dt_nlmeans_param_t *const param);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
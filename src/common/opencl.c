@@ -26,6 +26,7 @@
 #include "common/interpolation.h"
 #include "common/dlopencl.h"
 #include "common/nvidia_gpus.h"
+#include "common/trace.h"
 #include "develop/pixelpipe.h"
 #include "control/conf.h"
 
@@ -1333,9 +1334,13 @@ int dt_opencl_read_host_from_device_raw(const int devid, void *host, void *devic
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Image (from device to host)]");
 
-  return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadImage)(darktable.opencl->dev[devid].cmd_queue,
-                                                                   device, blocking, origin, region, rowpitch,
-                                                                   0, host, 0, NULL, eventp);
+  const double begin = dt_trace_clock();
+  const int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueReadImage)(
+      darktable.opencl->dev[devid].cmd_queue, device, blocking, origin, region, rowpitch, 0, host, 0, NULL,
+      eventp);
+  // non-blocking ones only take as long as it takes to enqueue them
+  dt_trace_complete(DT_TRACE_OPENCL, blocking ? "read image" : "read image (queued)", begin);
+  return err;
 }
 
 int dt_opencl_write_host_to_device(const int devid, void *host, void *device, const int width,
@@ -1378,9 +1383,12 @@ int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Image (from host to device)]");
 
-  return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteImage)(darktable.opencl->dev[devid].cmd_queue,
-                                                                    device, blocking, origin, region,
-                                                                    rowpitch, 0, host, 0, NULL, eventp);
+  const double begin = dt_trace_clock();
+  const int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteImage)(
+      darktable.opencl->dev[devid].cmd_queue, device, blocking, origin, region, rowpitch, 0, host, 0, NULL,
+      eventp);
+  dt_trace_complete(DT_TRACE_OPENCL, blocking ? "write image" : "write image (queued)", begin);
+  return err;
 }
 
 int dt_opencl_enqueue_copy_image(const int devid, cl_mem src, cl_mem dst, size_t *orig_src, size_t *orig_dst,
@@ -1442,8 +1450,11 @@ int dt_opencl_read_buffer_from_device(const int devid, void *host, void *device,
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Buffer (from device to host)]");
 
-  return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadBuffer)(
+  const double begin = dt_trace_clock();
+  const int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueReadBuffer)(
       darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
+  dt_trace_complete(DT_TRACE_OPENCL, blocking ? "read buffer" : "read buffer (queued)", begin);
+  return err;
 }
 
 int dt_opencl_write_buffer_to_device(const int devid, void *host, void *device, const size_t offset,
@@ -1453,8 +1464,11 @@ int dt_opencl_write_buffer_to_device(const int devid, void *host, void *device,
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Buffer (from host to device)]");
 
-  return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteBuffer)(
+  const double begin = dt_trace_clock();
+  const int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteBuffer)(
       darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
+  dt_trace_complete(DT_TRACE_OPENCL, blocking ? "write buffer" : "write buffer (queued)", begin);
+  return err;
 }
 
 
@@ -1493,9 +1507,11 @@ void *dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
     return NULL;
 
   // TODO: if fmt = uint16_t, blow up to 4xuint16_t and copy manually!
+  const double begin = dt_trace_clock();
   cl_mem dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
       darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &fmt, width, height,
       rowpitch, host, &err);
+  dt_trace_complete(DT_TRACE_OPENCL, "copy image to device", begin);
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL,
              "[opencl copy_host_to_device] could not alloc/copy img buffer on device %d: %d\n", devid, err);
@@ -0,0 +1,83 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/simd.h"
+#include "common/cpuid.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+#include <string.h>
+
+static const char *_names[DT_SIMD_LEVELS] = { "scalar", "sse2", "avx2", "avx512" };
+
+// sse2 until we know better, for code running before dt_simd_init()
+static dt_simd_level_t _level = DT_SIMD_SSE2;
+
+void dt_simd_init()
+{
+  dt_simd_level_t level = DT_SIMD_SCALAR;
+#if defined(__i386__) || defined(__x86_64__)
+  const dt_cpu_flags_t flags = dt_detect_cpu_features();
+  if(flags & CPU_FLAG_SSE2) level = DT_SIMD_SSE2;
+#ifdef DT_SIMD_HAVE_AVX2
+  if((flags & CPU_FLAG_AVX2) && (flags & CPU_FLAG_FMA) && (flags & CPU_FLAG_F16C)) level = DT_SIMD_AVX2;
+#endif
+#ifdef DT_SIMD_HAVE_AVX512
+  if(level == DT_SIMD_AVX2 && (flags & CPU_FLAG_AVX512F)) level = DT_SIMD_AVX512;
+#endif
+#endif
+
+  // can only go down from what the machine does, for benchmarks
+  gchar *forced = dt_conf_get_string("simd_level");
+  if(forced && *forced && strcmp(forced, "auto"))
+  {
+    int k = 0;
+    while(k < DT_SIMD_LEVELS && strcmp(forced, _names[k])) k++;
+    if(k == DT_SIMD_LEVELS)
+      fprintf(stderr, "[simd] unknown simd_level `%s', use scalar, sse2, avx2 or avx512\n", forced);
+    else if(k > level)
+      fprintf(stderr, "[simd] this machine can't do %s, using %s\n", forced, _names[level]);
+    else
+      level = k;
+  }
+  g_free(forced);
+
+  _level = level;
+  dt_print(DT_DEBUG_PERF, "[simd] using %s code paths\n", _names[_level]);
+}
+
+dt_simd_level_t dt_simd_level()
+{
+  return _level;
+}
+
+const char *dt_simd_level_name(const dt_simd_level_t level)
+{
+  return level < DT_SIMD_LEVELS ? _names[level] : "unknown";
+}
+
+void *dt_simd_select_impl(void *scalar, void *sse2, void *avx2, void *avx512)
+{
+  if(_level >= DT_SIMD_AVX512 && avx512) return avx512;
+  if(_level >= DT_SIMD_AVX2 && avx2) return avx2;
+  if(_level >= DT_SIMD_SSE2 && sse2) return sse2;
+  return scalar;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
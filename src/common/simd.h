@@ -0,0 +1,83 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_SIMD_H
+#define DT_COMMON_SIMD_H
+
+/**
+ * runtime dispatch between implementations of a hot function for wider vector units.
+ *
+ * darktable is built for sse3, so the avx2 and avx-512 variants are compiled for their instruction set
+ * function by function (DT_SIMD_TARGET_*), and only called if the cpu and the os support them:
+ *
+ *   DT_SIMD_TARGET_AVX2 static void _row_avx2(...) { ... _mm256_fmadd_ps(...) ... }
+ *
+ *   // once, in init_global(), keep the pointer in the global data:
+ *   gd->row = dt_simd_select(_row_plain, _row_sse2, DT_SIMD_AVX2_FN(_row_avx2),
+ *                            DT_SIMD_AVX512_FN(_row_avx512));
+ *
+ * code in common/ and develop/ picks its variants in an init function which dt_init() calls right after
+ * dt_simd_init(), never per call.
+ *
+ * variants which don't exist are passed as NULL, the best one up to the level in use is picked. wrap the
+ * avx2 and avx-512 ones in DT_SIMD_*_FN(), they compile to NULL where the compiler can't build them. the
+ * scalar one is plain c, so simd_level=scalar gives a reference to compare the vector code against.
+ *
+ * the level is picked once at startup, and may be lowered with --conf simd_level=<scalar|sse2|avx2|avx512>
+ * to compare them.
+ */
+
+typedef enum dt_simd_level_t
+{
+  DT_SIMD_SCALAR = 0,
+  DT_SIMD_SSE2,
+  DT_SIMD_AVX2, // with fma and f16c
+  DT_SIMD_AVX512,
+  DT_SIMD_LEVELS
+} dt_simd_level_t;
+
+#if defined(__x86_64__) && (defined(__clang__) ? (__clang_major__ >= 4)                                     \
+                                               : (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+// all intrinsics are declared whatever -m flags there are, functions choose the ones they can use
+#include <immintrin.h>
+#define DT_SIMD_HAVE_AVX2 1
+#define DT_SIMD_HAVE_AVX512 1
+#define DT_SIMD_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define DT_SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,f16c")))
+#define DT_SIMD_AVX2_FN(fn) (fn)
+#define DT_SIMD_AVX512_FN(fn) (fn)
+#else
+#define DT_SIMD_AVX2_FN(fn) NULL
+#define DT_SIMD_AVX512_FN(fn) NULL
+#endif
+
+/** detects the level, reads the override. called once by dt_init(), before the modules are loaded. */
+void dt_simd_init();
+
+/** the level in use. */
+dt_simd_level_t dt_simd_level();
+const char *dt_simd_level_name(const dt_simd_level_t level);
+
+/** the best of the implementations for the level in use. scalar has to be there. */
+void *dt_simd_select_impl(void *scalar, void *sse2, void *avx2, void *avx512);
+#define dt_simd_select(scalar, sse2, avx2, avx512)                                                           \
+  dt_simd_select_impl((void *)(scalar), (void *)(sse2), (void *)(avx2), (void *)(avx512))
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,331 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/threadpool.h"
+#ifndef DT_UNIT_TEST
+#include "common/darktable.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// how many chunks per worker a loop is split into if the caller doesn't say, for load balancing
+#define DT_THREADPOOL_CHUNKS_PER_WORKER 4
+
+// a parallel loop in flight. lives on the stack of the thread which started it.
+typedef struct _loop_t
+{
+  dt_threadpool_range_t fn;
+  void *data;
+  size_t end, grain;
+  size_t next;  // start of the next chunk nobody claimed yet
+  int32_t refs; // helpers queued or working on it
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} _loop_t;
+
+typedef struct _worker_params_t
+{
+  dt_threadpool_t *pool;
+  int32_t id;
+} _worker_params_t;
+
+static __thread int32_t _worker_id = -1;
+
+int32_t dt_threadpool_worker_id()
+{
+  return _worker_id;
+}
+
+static void _deque_init(dt_threadpool_deque_t *d)
+{
+  dt_pthread_mutex_init(&d->mutex, NULL);
+  d->capacity = 16;
+  d->items = (void **)malloc(sizeof(void *) * d->capacity);
+  d->head = d->count = 0;
+}
+
+static void _deque_cleanup(dt_threadpool_deque_t *d)
+{
+  dt_pthread_mutex_destroy(&d->mutex);
+  free(d->items);
+}
+
+// push n references to item to the back. returns how many made it.
+static int _deque_push(dt_threadpool_deque_t *d, void *item, int n)
+{
+  dt_pthread_mutex_lock(&d->mutex);
+  if(d->count + n > d->capacity)
+  {
+    uint32_t capacity = d->capacity;
+    while(d->count + n > capacity) capacity *= 2;
+    void **items = (void **)malloc(sizeof(void *) * capacity);
+    if(!items)
+      n = d->capacity - d->count;
+    else
+    {
+      for(uint32_t k = 0; k < d->count; k++) items[k] = d->items[(d->head + k) % d->capacity];
+      free(d->items);
+      d->items = items;
+      d->head = 0;
+      d->capacity = capacity;
+    }
+  }
+  for(int k = 0; k < n; k++) d->items[(d->head + d->count++) % d->capacity] = item;
+  dt_pthread_mutex_unlock(&d->mutex);
+  return n;
+}
+
+// the owner works on the newest loop, that's the one most likely to still be in cache
+static void *_deque_pop_back(dt_threadpool_deque_t *d)
+{
+  void *item = NULL;
+  dt_pthread_mutex_lock(&d->mutex);
+  if(d->count) item = d->items[(d->head + --d->count) % d->capacity];
+  dt_pthread_mutex_unlock(&d->mutex);
+  return item;
+}
+
+// thieves take the oldest one
+static void *_deque_pop_front(dt_threadpool_deque_t *d)
+{
+  void *item = NULL;
+  // don't wait for busy deques, there are others to steal from
+  if(dt_pthread_mutex_trylock(&d->mutex)) return NULL;
+  if(d->count)
+  {
+    item = d->items[d->head];
+    d->head = (d->head + 1) % d->capacity;
+    d->count--;
+  }
+  dt_pthread_mutex_unlock(&d->mutex);
+  return item;
+}
+
+// removes all references to item, returns how many there were
+static int _deque_remove(dt_threadpool_deque_t *d, void *item)
+{
+  int removed = 0;
+  dt_pthread_mutex_lock(&d->mutex);
+  uint32_t j = 0;
+  for(uint32_t k = 0; k < d->count; k++)
+  {
+    void *it = d->items[(d->head + k) % d->capacity];
+    if(it == item)
+      removed++;
+    else
+      d->items[(d->head + j++) % d->capacity] = it;
+  }
+  d->count = j;
+  dt_pthread_mutex_unlock(&d->mutex);
+  return removed;
+}
+
+static void _loop_run(_loop_t *loop)
+{
+  while(1)
+  {
+    const size_t begin = __sync_fetch_and_add(&loop->next, loop->grain);
+    if(begin >= loop->end) return;
+    loop->fn(loop->data, begin, MIN(begin + loop->grain, loop->end));
+  }
+}
+
+static void _loop_release(_loop_t *loop, const int32_t refs)
+{
+  dt_pthread_mutex_lock(&loop->mutex);
+  loop->refs -= refs;
+  if(loop->refs <= 0) pthread_cond_signal(&loop->cond);
+  dt_pthread_mutex_unlock(&loop->mutex);
+}
+
+// find a loop to help with: our own first, then the others', then the ones from outside.
+static _loop_t *_take(dt_threadpool_t *pool, const int32_t id)
+{
+  _loop_t *loop = (_loop_t *)_deque_pop_back(pool->deques + id);
+  if(loop) return loop;
+  for(int k = 1; k <= pool->num_workers; k++)
+  {
+    loop = (_loop_t *)_deque_pop_front(pool->deques + (id + k) % (pool->num_workers + 1));
+    if(loop)
+    {
+      __sync_fetch_and_add(&pool->steals, 1);
+      return loop;
+    }
+  }
+  return NULL;
+}
+
+static void *_worker(void *ptr)
+{
+  _worker_params_t *params = (_worker_params_t *)ptr;
+  dt_threadpool_t *pool = params->pool;
+  _worker_id = params->id;
+  free(params);
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&pool->mutex);
+    const uint32_t wakeups = pool->wakeups;
+    const int running = pool->running;
+    dt_pthread_mutex_unlock(&pool->mutex);
+    if(!running) break;
+
+    _loop_t *loop = _take(pool, _worker_id);
+    if(loop)
+    {
+      _loop_run(loop);
+      _loop_release(loop, 1);
+      continue;
+    }
+    if(pool->idle && pool->idle(pool->idle_data)) continue;
+
+    // nothing to do. sleep unless someone pushed work in the meantime.
+    dt_pthread_mutex_lock(&pool->mutex);
+    while(pool->running && pool->wakeups == wakeups) dt_pthread_cond_wait(&pool->cond, &pool->mutex);
+    dt_pthread_mutex_unlock(&pool->mutex);
+  }
+  return NULL;
+}
+
+void dt_threadpool_wake(dt_threadpool_t *pool)
+{
+  if(!pool) return;
+  dt_pthread_mutex_lock(&pool->mutex);
+  pool->wakeups++;
+  pthread_cond_broadcast(&pool->cond);
+  dt_pthread_mutex_unlock(&pool->mutex);
+}
+
+dt_threadpool_t *dt_threadpool_create(const int32_t num_workers, dt_threadpool_idle_t idle, void *idle_data)
+{
+  dt_threadpool_t *pool = (dt_threadpool_t *)calloc(1, sizeof(dt_threadpool_t));
+  if(!pool) return NULL;
+  pool->num_workers = MAX(1, num_workers);
+  pool->idle = idle;
+  pool->idle_data = idle_data;
+  pool->running = 1;
+  dt_pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->deques = (dt_threadpool_deque_t *)calloc(pool->num_workers + 1, sizeof(dt_threadpool_deque_t));
+  for(int k = 0; k <= pool->num_workers; k++) _deque_init(pool->deques + k);
+  pool->threads = (pthread_t *)calloc(pool->num_workers, sizeof(pthread_t));
+  for(int k = 0; k < pool->num_workers; k++)
+  {
+    _worker_params_t *params = (_worker_params_t *)malloc(sizeof(_worker_params_t));
+    params->pool = pool;
+    params->id = k;
+    pthread_create(pool->threads + k, NULL, _worker, params);
+  }
+  return pool;
+}
+
+void dt_threadpool_destroy(dt_threadpool_t *pool)
+{
+  if(!pool) return;
+  dt_pthread_mutex_lock(&pool->mutex);
+  pool->running = 0;
+  pthread_cond_broadcast(&pool->cond);
+  dt_pthread_mutex_unlock(&pool->mutex);
+  for(int k = 0; k < pool->num_workers; k++) pthread_join(pool->threads[k], NULL);
+  for(int k = 0; k <= pool->num_workers; k++) _deque_cleanup(pool->deques + k);
+  dt_pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->deques);
+  free(pool->threads);
+  free(pool);
+}
+
+void dt_threadpool_parallel_for(dt_threadpool_t *pool, const size_t begin, const size_t end, size_t grain,
+                                dt_threadpool_range_t fn, void *data)
+{
+  if(end <= begin) return;
+  const size_t n = end - begin;
+  if(!grain)
+  {
+    const size_t chunks = (size_t)(pool ? pool->num_workers : 1) * DT_THREADPOOL_CHUNKS_PER_WORKER;
+    grain = MAX(1, (n + chunks - 1) / chunks);
+  }
+  const size_t chunks = (n + grain - 1) / grain;
+  if(!pool || chunks <= 1 || !pool->running)
+  {
+    fn(data, begin, end);
+    return;
+  }
+
+  _loop_t loop;
+  loop.fn = fn;
+  loop.data = data;
+  loop.end = end;
+  loop.grain = grain;
+  loop.next = begin;
+  dt_pthread_mutex_init(&loop.mutex, NULL);
+  pthread_cond_init(&loop.cond, NULL);
+  __sync_fetch_and_add(&pool->loops, 1);
+
+  // one helper per remaining chunk, but no more than there are other workers
+  const int32_t id = dt_threadpool_worker_id();
+  dt_threadpool_deque_t *deque = pool->deques + (id >= 0 ? id : pool->num_workers);
+  const int helpers = MIN(chunks - 1, (size_t)(pool->num_workers - (id >= 0)));
+  // helpers may be done before we get to count them, so the references have to be there first
+  loop.refs = MAX(helpers, 0);
+  if(loop.refs > 0)
+  {
+    const int pushed = _deque_push(deque, &loop, helpers);
+    if(pushed < helpers) _loop_release(&loop, helpers - pushed);
+    dt_threadpool_wake(pool);
+  }
+
+  _loop_run(&loop);
+
+  // everything is claimed now. take back the references nobody picked up, and wait for the
+  // helpers still working on their last chunk.
+  const int32_t unused = _deque_remove(deque, &loop);
+  dt_pthread_mutex_lock(&loop.mutex);
+  loop.refs -= unused;
+  while(loop.refs > 0) dt_pthread_cond_wait(&loop.cond, &loop.mutex);
+  dt_pthread_mutex_unlock(&loop.mutex);
+  dt_pthread_mutex_destroy(&loop.mutex);
+  pthread_cond_destroy(&loop.cond);
+}
+
+#ifndef DT_UNIT_TEST
+void dt_parallel_for(const size_t begin, const size_t end, const size_t grain, dt_threadpool_range_t fn,
+                     void *data)
+{
+  if(darktable.threadpool)
+  {
+    dt_threadpool_parallel_for(darktable.threadpool, begin, end, grain, fn, data);
+    return;
+  }
+  if(end <= begin) return;
+  const size_t step = grain ? grain : MAX(1, (end - begin) / (DT_THREADPOOL_CHUNKS_PER_WORKER
+                                                                * darktable.num_openmp_threads));
+  const int64_t chunks = (end - begin + step - 1) / step;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) shared(fn, data)
+#endif
+  for(int64_t k = 0; k < chunks; k++) fn(data, begin + k * step, MIN(begin + (k + 1) * step, end));
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
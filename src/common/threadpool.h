@@ -0,0 +1,95 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_THREADPOOL_H
+#define DT_COMMON_THREADPOOL_H
+
+#include "common/dtpthread.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * work stealing thread pool, one worker per core.
+ *
+ * parallel loops are split into chunks which are claimed one by one. a thread entering a
+ * loop pushes it onto its own deque (threads outside of the pool share one) and starts working
+ * on it. idle workers take from the back of their own deque and steal from the front of the
+ * others'. the thread which started a loop always finishes it, even if no one helps, so loops
+ * can be nested and called from anywhere.
+ *
+ * if there is nothing to steal, workers call the idle callback, which is how the job system
+ * runs its jobs on the same threads.
+ */
+
+// processes the items [begin, end) of a parallel loop
+typedef void (*dt_threadpool_range_t)(void *data, const size_t begin, const size_t end);
+// runs one piece of other work and returns non-zero, or returns 0 if there was none.
+typedef int (*dt_threadpool_idle_t)(void *data);
+
+typedef struct dt_threadpool_deque_t
+{
+  dt_pthread_mutex_t mutex;
+  void **items; // ring buffer
+  uint32_t head, count, capacity;
+} dt_threadpool_deque_t;
+
+typedef struct dt_threadpool_t
+{
+  int32_t num_workers;
+  pthread_t *threads;
+  // one per worker, the last one is shared by all threads outside the pool
+  dt_threadpool_deque_t *deques;
+  dt_threadpool_idle_t idle;
+  void *idle_data;
+  // sleeping workers
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t wakeups;
+  int32_t running;
+  // statistics
+  long int loops, steals;
+} dt_threadpool_t;
+
+/** starts num_workers threads. idle may be NULL. */
+dt_threadpool_t *dt_threadpool_create(const int32_t num_workers, dt_threadpool_idle_t idle, void *idle_data);
+
+/** stops and joins all workers. loops still running finish in the threads which started them. */
+void dt_threadpool_destroy(dt_threadpool_t *pool);
+
+/** wakes up sleeping workers, to call the idle callback again. */
+void dt_threadpool_wake(dt_threadpool_t *pool);
+
+/** index of the calling worker, or -1 if called from a thread outside of the pool. */
+int32_t dt_threadpool_worker_id();
+
+/** calls fn for all items in [begin, end), in chunks of grain items (0 picks a size), and returns
+  * when all of them are done. */
+void dt_threadpool_parallel_for(dt_threadpool_t *pool, const size_t begin, const size_t end, size_t grain,
+                                dt_threadpool_range_t fn, void *data);
+
+#ifndef DT_UNIT_TEST
+/** the same on darktable's pool. without one (darktable-cli) this falls back to openmp. */
+void dt_parallel_for(const size_t begin, const size_t end, const size_t grain, dt_threadpool_range_t fn,
+                     void *data);
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,277 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/trace.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/threadpool.h"
+#include "control/conf.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// events per thread, a power of two. 4.7MB per running thread which recorded something.
+#define DT_TRACE_EVENTS (1 << 16)
+#define DT_TRACE_NAME_LEN 40
+// ring buffers of threads which ended, kept for the next ones
+#define DT_TRACE_SPARES 4
+
+typedef struct _trace_event_t
+{
+  double ts, dur; // microseconds since dt_trace_init()
+  const char *category;
+  char name[DT_TRACE_NAME_LEN];
+  char phase;
+} _trace_event_t;
+
+typedef struct _trace_buffer_t
+{
+  struct _trace_buffer_t *next;
+  int32_t tid, worker;
+  // only ever incremented by the owning thread, events up to head - 1 are complete
+  uint64_t head;
+  _trace_event_t events[];
+} _trace_buffer_t;
+
+int dt_trace_enabled = 0;
+
+static double _epoch = 0.0;
+static int32_t _threads = 0;
+// guards the lists, recording into a buffer takes no lock
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+// the buffers of all threads which recorded something, new ones go to the front
+static _trace_buffer_t *_buffers = NULL;
+static _trace_buffer_t *_spares = NULL;
+static int _spare_cnt = 0;
+// runs _thread_exit() when a thread with a buffer ends
+static pthread_key_t _key;
+static __thread _trace_buffer_t *_buffer = NULL;
+
+double dt_trace_now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec * 1e-3 - _epoch;
+}
+
+static _trace_buffer_t *_get_buffer()
+{
+  if(_buffer) return _buffer;
+  pthread_mutex_lock(&_lock);
+  _trace_buffer_t *buf = _spares;
+  if(buf)
+  {
+    _spares = buf->next;
+    _spare_cnt--;
+  }
+  pthread_mutex_unlock(&_lock);
+  if(!buf)
+    buf = (_trace_buffer_t *)malloc(sizeof(_trace_buffer_t) + sizeof(_trace_event_t) * DT_TRACE_EVENTS);
+  if(!buf) return NULL;
+  buf->tid = __sync_add_and_fetch(&_threads, 1);
+  buf->worker = dt_threadpool_worker_id();
+  buf->head = 0;
+  pthread_mutex_lock(&_lock);
+  buf->next = _buffers;
+  _buffers = buf;
+  pthread_mutex_unlock(&_lock);
+  _buffer = buf;
+  pthread_setspecific(_key, buf);
+  return buf;
+}
+
+// the thread owning buf ends: its events move to a buffer of their own size, so they still get
+// written, and the ring buffer is kept for the next thread or freed.
+static void _thread_exit(void *data)
+{
+  _trace_buffer_t *buf = (_trace_buffer_t *)data;
+  const uint64_t head = buf->head;
+  const uint64_t begin = head > DT_TRACE_EVENTS ? head - DT_TRACE_EVENTS : 0;
+  _trace_buffer_t *done
+      = (_trace_buffer_t *)malloc(sizeof(_trace_buffer_t) + sizeof(_trace_event_t) * (head - begin));
+  _buffer = NULL;
+  // out of memory, keep the events where they are
+  if(!done) return;
+  done->tid = buf->tid;
+  done->worker = buf->worker;
+  done->head = head - begin;
+  for(uint64_t k = begin; k < head; k++) done->events[k - begin] = buf->events[k & (DT_TRACE_EVENTS - 1)];
+
+  pthread_mutex_lock(&_lock);
+  _trace_buffer_t **prev = &_buffers;
+  while(*prev != buf) prev = &(*prev)->next;
+  done->next = buf->next;
+  *prev = done;
+  if(_spare_cnt < DT_TRACE_SPARES)
+  {
+    buf->next = _spares;
+    _spares = buf;
+    _spare_cnt++;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&_lock);
+  free(buf);
+}
+
+static void _record(const char *category, const char *name, const char phase, const double ts,
+                    const double dur)
+{
+  _trace_buffer_t *buf = _get_buffer();
+  if(!buf) return;
+  _trace_event_t *ev = buf->events + (buf->head & (DT_TRACE_EVENTS - 1));
+  ev->ts = ts;
+  ev->dur = dur;
+  ev->category = category;
+  ev->phase = phase;
+  g_strlcpy(ev->name, name ? name : "", sizeof(ev->name));
+  // a full barrier both ways: this event is complete before head says so, and the next one, which may
+  // overwrite the oldest, starts after. dt_trace_write() relies on both.
+  __sync_fetch_and_add(&buf->head, 1);
+}
+
+void dt_trace_event(const char *category, const char *name, const char phase)
+{
+  if(!dt_trace_enabled) return;
+  _record(category, name, phase, dt_trace_now(), 0.0);
+}
+
+void dt_trace_complete(const char *category, const char *name, const double begin)
+{
+  if(!dt_trace_enabled) return;
+  const double now = dt_trace_now();
+  _record(category, name, 'X', begin, now - begin);
+}
+
+static void _write_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for(; *s; s++)
+  {
+    if(*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if((unsigned char)*s < 0x20)
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+int dt_trace_write(const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[trace] could not write `%s'\n", filename);
+    return 1;
+  }
+  const int pid = getpid();
+  uint64_t cnt = 0;
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"darktable\"}}", pid);
+  // threads ending meanwhile wait, so their buffers aren't recycled under us
+  pthread_mutex_lock(&_lock);
+  for(_trace_buffer_t *buf = _buffers; buf; buf = buf->next)
+  {
+    char thread[32];
+    if(buf->worker >= 0)
+      snprintf(thread, sizeof(thread), "worker %d", buf->worker);
+    else
+      snprintf(thread, sizeof(thread), "thread %d", buf->tid);
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            pid, buf->tid, thread);
+
+    // the oldest events may have been overwritten. viewers ignore ends without a begin.
+    const uint64_t head = __sync_fetch_and_add(&buf->head, 0);
+    const uint64_t begin = head > DT_TRACE_EVENTS ? head - DT_TRACE_EVENTS : 0;
+    for(uint64_t k = begin; k < head; k++)
+    {
+      // the thread keeps recording while we write. once it came around the ring to this slot, the copy
+      // may be half of the old and half of the new event, so it's dropped.
+      _trace_event_t ev = buf->events[k & (DT_TRACE_EVENTS - 1)];
+      if(k + DT_TRACE_EVENTS <= __sync_fetch_and_add(&buf->head, 0)) continue;
+      fprintf(f, ",\n{\"name\":");
+      _write_string(f, ev.name);
+      fprintf(f, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,", ev.category, ev.phase, ev.ts);
+      if(ev.phase == 'X') fprintf(f, "\"dur\":%.3f,", ev.dur);
+      fprintf(f, "\"pid\":%d,\"tid\":%d}", pid, buf->tid);
+      cnt++;
+    }
+  }
+  pthread_mutex_unlock(&_lock);
+  fprintf(f, "\n]}\n");
+  const int err = ferror(f);
+  fclose(f);
+  if(err)
+  {
+    fprintf(stderr, "[trace] could not write `%s'\n", filename);
+    return 1;
+  }
+  fprintf(stderr, "[trace] wrote %" PRIu64 " events of %d threads to `%s'\n", cnt, _threads, filename);
+  return 0;
+}
+
+void dt_trace_init()
+{
+  if(!(darktable.unmuted & DT_DEBUG_TRACE)) return;
+  _epoch = 0.0;
+  _epoch = dt_trace_now();
+  if(pthread_key_create(&_key, _thread_exit)) return;
+  dt_trace_enabled = 1;
+}
+
+void dt_trace_cleanup()
+{
+  if(!dt_trace_enabled) return;
+  dt_trace_enabled = 0;
+
+  gchar *filename = dt_conf_get_string("trace_file");
+  if(!filename || !*filename)
+  {
+    char cachedir[PATH_MAX] = { 0 };
+    dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+    g_free(filename);
+    filename = g_strdup_printf("%s/darktable-trace-%d.json", cachedir, (int)getpid());
+  }
+  dt_trace_write(filename);
+  g_free(filename);
+
+  // all workers are gone by now, nobody records into these anymore. threads ending later leave their
+  // buffer alone.
+  pthread_key_delete(_key);
+  pthread_mutex_lock(&_lock);
+  _trace_buffer_t *lists[2] = { _buffers, _spares };
+  _buffers = _spares = NULL;
+  _spare_cnt = 0;
+  pthread_mutex_unlock(&_lock);
+  for(int k = 0; k < 2; k++)
+    while(lists[k])
+    {
+      _trace_buffer_t *next = lists[k]->next;
+      free(lists[k]);
+      lists[k] = next;
+    }
+  _buffer = NULL;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,76 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_TRACE_H
+#define DT_COMMON_TRACE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * runtime tracing, enabled with -d trace.
+ *
+ * every thread records begin/end events into a ring buffer of its own, so recording takes no
+ * locks and costs one branch when tracing is off. when a buffer is full the oldest events are
+ * overwritten. when a thread ends, its events are kept and its buffer goes to the next thread.
+ * on shutdown (or whenever dt_trace_write() is called) the events of all threads are written out
+ * as chrome trace-event json, which chrome://tracing, perfetto or speedscope show as flame graphs,
+ * one row per thread.
+ *
+ * categories have to be string literals, names are copied and may be truncated.
+ */
+
+#define DT_TRACE_PIPE "pixelpipe"
+#define DT_TRACE_TILING "tiling"
+#define DT_TRACE_OPENCL "opencl"
+#define DT_TRACE_CACHE "cache"
+#define DT_TRACE_JOB "job"
+
+extern int dt_trace_enabled;
+
+/** allocates nothing yet, buffers are created by the threads on their first event. */
+void dt_trace_init();
+/** writes the trace to the file given by conf trace_file, or into the cache directory, and frees it. */
+void dt_trace_cleanup();
+/** writes everything recorded so far. returns 0 on success. */
+int dt_trace_write(const char *filename);
+
+/** microseconds on the clock used for all events. */
+double dt_trace_now();
+/** the same, but doesn't bother to read the clock if nothing is recorded. */
+#define dt_trace_clock() (dt_trace_enabled ? dt_trace_now() : 0.0)
+
+void dt_trace_event(const char *category, const char *name, const char phase);
+/** an event which already ended, for things which only know their name at the end. */
+void dt_trace_complete(const char *category, const char *name, const double begin);
+
+#define dt_trace_begin(category, name)                                                                       \
+  do                                                                                                         \
+  {                                                                                                          \
+    if(dt_trace_enabled) dt_trace_event(category, name, 'B');                                                \
+  } while(0)
+
+#define dt_trace_end(category, name)                                                                         \
+  do                                                                                                         \
+  {                                                                                                          \
+    if(dt_trace_enabled) dt_trace_event(category, name, 'E');                                                \
+  } while(0)
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
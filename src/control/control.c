@@ -28,6 +28,7 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/debug.h"
+#include "common/threadpool.h"
 #include "bauhaus/bauhaus.h"
 #include "views/view.h"
 #include "gui/gtk.h"
@@ -397,13 +398,13 @@ void dt_control_shutdown(dt_control_t *s)
   pthread_join(s->kick_on_workers_thread, NULL);
 
   gdk_threads_leave();
-  int k;
-  for(k = 0; k < s->num_threads; k++)
-    // pthread_kill(s->thread[k], 9);
-    pthread_join(s->thread[k], NULL);
-  for(k = 0; k < DT_CTL_WORKER_RESERVED; k++)
+  for(int k = 0; k < DT_CTL_WORKER_RESERVED; k++)
     // pthread_kill(s->thread_res[k], 9);
     pthread_join(s->thread_res[k], NULL);
+  // the pool goes last, jobs still running finish their loops on their own.
+  dt_threadpool_t *pool = darktable.threadpool;
+  darktable.threadpool = NULL;
+  dt_threadpool_destroy(pool);
 
 
   gdk_threads_enter();
@@ -207,11 +207,16 @@ typedef struct dt_control_t
   int32_t running;
   dt_pthread_mutex_t queue_mutex, cond_mutex, run_mutex;
   pthread_cond_t cond;
-  int32_t num_threads;
-  pthread_t *thread, kick_on_workers_thread;
+  // jobs running at the same time, on darktable.threadpool
+  int32_t num_threads, running_jobs;
+  // which of the num_threads job ids are taken, see dt_control_get_threadid()
+  uint32_t job_slots;
+  pthread_t kick_on_workers_thread;
 
   GList *queues[DT_JOB_QUEUE_MAX];
   size_t queue_length[DT_JOB_QUEUE_MAX];
+  // dropped from the full foreground queue, disposed once the queue_mutex is released
+  GList *discarded;
 
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
   uint8_t new_res[DT_CTL_WORKER_RESERVED];
@@ -232,6 +237,8 @@ typedef struct dt_control_t
       void (*cancellable)(dt_lib_module_t *self, struct dt_lib_backgroundjob_element_t *instance,
                           dt_progress_t *progress);
       void (*updated)(dt_lib_module_t *self, struct dt_lib_backgroundjob_element_t *instance, double value);
+      void (*details)(dt_lib_module_t *self, struct dt_lib_backgroundjob_element_t *instance,
+                      const gchar *details);
     } proxy;
 
   } progress_system;
@@ -20,6 +20,8 @@
 */
 
 #include "control/jobs.h"
+#include "common/threadpool.h"
+#include "common/trace.h"
 #include "control/control.h"
 
 #define DT_CONTROL_FG_PRIORITY 4
@@ -49,6 +51,13 @@ typedef struct _dt_job_t
   dt_job_queue_t queue;
 
   dt_job_state_change_callback state_changed_cb;
+  dt_job_cleanup_callback params_cleanup;
+  int executed;
+
+  // the dependency graph, protected by control->queue_mutex
+  GList *dependencies; // unfinished jobs we wait for
+  GList *dependents;   // jobs waiting for us
+  int waiting;         // added to a queue, but held back until the dependencies are done
 
   char description[DT_CONTROL_DESCRIPTION_LEN];
 } _dt_job_t;
@@ -98,6 +107,12 @@ void *dt_control_job_get_params(const _dt_job_t *job)
   return job->params;
 }
 
+void dt_control_job_set_params_cleanup(_dt_job_t *job, dt_job_cleanup_callback cleanup)
+{
+  if(!job || dt_control_job_get_state(job) != DT_JOB_STATE_INITIALIZED) return;
+  job->params_cleanup = cleanup;
+}
+
 dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg, ...)
 {
   _dt_job_t *job = (_dt_job_t *)calloc(1, sizeof(_dt_job_t));
@@ -115,9 +130,35 @@ dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg
   return job;
 }
 
+// removes the job from the dependency graph, needs the queue_mutex
+static void dt_control_job_unlink_locked(_dt_job_t *job)
+{
+  for(GList *l = job->dependencies; l; l = g_list_next(l))
+  {
+    _dt_job_t *other = (_dt_job_t *)l->data;
+    other->dependents = g_list_remove(other->dependents, job);
+  }
+  for(GList *l = job->dependents; l; l = g_list_next(l))
+  {
+    _dt_job_t *other = (_dt_job_t *)l->data;
+    other->dependencies = g_list_remove(other->dependencies, job);
+  }
+  g_list_free(job->dependencies);
+  g_list_free(job->dependents);
+  job->dependencies = job->dependents = NULL;
+}
+
 void dt_control_job_dispose(_dt_job_t *job)
 {
   if(!job) return;
+  if(job->dependencies || job->dependents)
+  {
+    // never made it into a queue, don't leave dangling edges behind
+    dt_pthread_mutex_lock(&darktable.control->queue_mutex);
+    dt_control_job_unlink_locked(job);
+    dt_pthread_mutex_unlock(&darktable.control->queue_mutex);
+  }
+  if(!job->executed && job->params_cleanup) job->params_cleanup(job->params);
   dt_control_job_set_state(job, DT_JOB_STATE_DISPOSED);
   dt_pthread_mutex_destroy(&job->state_mutex);
   dt_pthread_mutex_destroy(&job->wait_mutex);
@@ -139,9 +180,69 @@ static void dt_control_job_print(_dt_job_t *job)
   dt_print(DT_DEBUG_CONTROL, "%s | queue: %d | priority: %d", job->description, job->queue, job->priority);
 }
 
+// cancels job and everything depending on it. needs the queue_mutex.
+static void dt_control_job_cancel_locked(_dt_job_t *job)
+{
+  GList *todo = g_list_prepend(NULL, job);
+  while(todo)
+  {
+    _dt_job_t *j = (_dt_job_t *)todo->data;
+    todo = g_list_delete_link(todo, todo);
+    const dt_job_state_t state = dt_control_job_get_state(j);
+    if(state != DT_JOB_STATE_INITIALIZED && state != DT_JOB_STATE_QUEUED && state != DT_JOB_STATE_RUNNING)
+      continue;
+    dt_control_job_set_state(j, DT_JOB_STATE_CANCELLED);
+    for(GList *l = j->dependents; l; l = g_list_next(l)) todo = g_list_prepend(todo, l->data);
+  }
+}
+
 void dt_control_job_cancel(_dt_job_t *job)
 {
-  dt_control_job_set_state(job, DT_JOB_STATE_CANCELLED);
+  if(!job) return;
+  dt_pthread_mutex_lock(&darktable.control->queue_mutex);
+  dt_control_job_cancel_locked(job);
+  dt_pthread_mutex_unlock(&darktable.control->queue_mutex);
+}
+
+// non-zero if dependency already waits for job, directly or through others. needs the queue_mutex.
+static int dt_control_job_reaches_locked(_dt_job_t *job, _dt_job_t *dependency)
+{
+  // new jobs get added after what they depend on, so the jobs waiting for them are few
+  GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GList *todo = g_list_prepend(NULL, job);
+  int found = 0;
+  while(todo && !found)
+  {
+    _dt_job_t *j = (_dt_job_t *)todo->data;
+    todo = g_list_delete_link(todo, todo);
+    if(g_hash_table_lookup(seen, j)) continue;
+    g_hash_table_insert(seen, j, j);
+    found = j == dependency;
+    for(GList *l = j->dependents; l; l = g_list_next(l)) todo = g_list_prepend(todo, l->data);
+  }
+  g_list_free(todo);
+  g_hash_table_destroy(seen);
+  return found;
+}
+
+int dt_control_job_add_dependency(_dt_job_t *job, _dt_job_t *dependency)
+{
+  if(!job || !dependency || job == dependency) return 1;
+  dt_control_t *control = darktable.control;
+  dt_pthread_mutex_lock(&control->queue_mutex);
+  const dt_job_state_t state = dt_control_job_get_state(dependency);
+  // an edge to a job already in a queue would order nothing, one closing a cycle would hold both forever
+  if(dt_control_job_get_state(job) != DT_JOB_STATE_INITIALIZED
+     || (state != DT_JOB_STATE_INITIALIZED && state != DT_JOB_STATE_QUEUED)
+     || dt_control_job_reaches_locked(job, dependency))
+  {
+    dt_pthread_mutex_unlock(&control->queue_mutex);
+    return 1;
+  }
+  job->dependencies = g_list_prepend(job->dependencies, dependency);
+  dependency->dependents = g_list_prepend(dependency->dependents, job);
+  dt_pthread_mutex_unlock(&control->queue_mutex);
+  return 0;
 }
 
 void dt_control_job_wait(_dt_job_t *job)
@@ -157,6 +258,10 @@ void dt_control_job_wait(_dt_job_t *job)
   }
 }
 
+static void dt_control_job_resolve_locked(dt_control_t *control, _dt_job_t *job, const int failed);
+static void dt_control_job_resolve(dt_control_t *control, _dt_job_t *job, const int failed);
+static void dt_control_dispose_discarded(dt_control_t *control);
+
 static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
 {
   if(((unsigned int)res) >= DT_CTL_WORKER_RESERVED) return -1;
@@ -183,14 +288,25 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
     dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    job->executed = 1;
+    dt_trace_begin(DT_TRACE_JOB, job->description);
     job->result = job->execute(job);
+    dt_trace_end(DT_TRACE_JOB, job->description);
+    // a job cancelled while it ran didn't deliver what its dependents wait for
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) job->result = -1;
 
     dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
     dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
     dt_control_job_print(job);
     dt_print(DT_DEBUG_CONTROL, "\n");
   }
+  else if(job->params_cleanup)
+  {
+    job->params_cleanup(job->params);
+    job->params_cleanup = NULL;
+  }
   dt_pthread_mutex_unlock(&job->wait_mutex);
+  dt_control_job_resolve(control, job, !job->executed || job->result != 0);
   dt_control_job_dispose(job);
   return 0;
 }
@@ -253,12 +369,37 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
   return job;
 }
 
+static __thread int threadid = -1;
+
+// jobs get one of num_threads ids while they run, whichever worker they are on.
+static int32_t _job_slot_acquire(dt_control_t *control)
+{
+  while(1)
+  {
+    const uint32_t slots = control->job_slots;
+    const int32_t slot = __builtin_ctz(~slots);
+    if(__sync_bool_compare_and_swap(&control->job_slots, slots, slots | (1u << slot))) return slot;
+  }
+}
+
+static void _job_slot_release(dt_control_t *control, const int32_t slot)
+{
+  __sync_fetch_and_and(&control->job_slots, ~(1u << slot));
+}
+
 static int32_t dt_control_run_job(dt_control_t *control)
 {
   _dt_job_t *job = dt_control_schedule_job(control);
 
   if(!job) return -1;
 
+  threadid = _job_slot_acquire(control);
+#ifdef _OPENMP
+  // share the cores with the other jobs running right now, instead of each of them
+  // starting a full team on top of the pool.
+  omp_set_num_threads(MAX(1, darktable.num_openmp_threads / MAX(1, control->running_jobs)));
+#endif
+
   /* change state to running */
   dt_pthread_mutex_lock(&job->wait_mutex);
   if(dt_control_job_get_state(job) == DT_JOB_STATE_QUEUED)
@@ -271,7 +412,12 @@ static int32_t dt_control_run_job(dt_control_t *control)
     dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    job->executed = 1;
+    dt_trace_begin(DT_TRACE_JOB, job->description);
     job->result = job->execute(job);
+    dt_trace_end(DT_TRACE_JOB, job->description);
+    // a job cancelled while it ran didn't deliver what its dependents wait for
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) job->result = -1;
 
     dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
 
@@ -280,14 +426,41 @@ static int32_t dt_control_run_job(dt_control_t *control)
     dt_control_job_print(job);
     dt_print(DT_DEBUG_CONTROL, "\n");
   }
+  else if(job->params_cleanup)
+  {
+    // skipped. clean up before the dependents get to run, they may rely on it.
+    job->params_cleanup(job->params);
+    job->params_cleanup = NULL;
+  }
 
-  /* free job */
+  /* free job, after starting whatever waited for it */
   dt_pthread_mutex_unlock(&job->wait_mutex);
+  dt_control_job_resolve(control, job, !job->executed || job->result != 0);
   dt_control_job_dispose(job);
 
+  _job_slot_release(control, threadid);
+  threadid = -1;
   return 0;
 }
 
+// called by idle workers of the pool
+static int dt_control_idle(void *data)
+{
+  dt_control_t *control = (dt_control_t *)data;
+  if(!dt_control_running()) return 0;
+  // the workers which don't get to run a job are left for the loops inside of the others.
+  if(__sync_add_and_fetch(&control->running_jobs, 1) > control->num_threads)
+  {
+    __sync_fetch_and_sub(&control->running_jobs, 1);
+    return 0;
+  }
+  const int ran = dt_control_run_job(control) == 0;
+  __sync_fetch_and_sub(&control->running_jobs, 1);
+  // there is room for another one now
+  if(ran) dt_threadpool_wake(darktable.threadpool);
+  return ran;
+}
+
 int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t res)
 {
   if(((unsigned int)res) >= DT_CTL_WORKER_RESERVED || !job)
@@ -303,6 +476,8 @@ int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t re
   if(control->job_res[res])
   {
     dt_control_job_set_state(control->job_res[res], DT_JOB_STATE_DISCARDED);
+    dt_control_job_resolve_locked(control, control->job_res[res], 1);
+    dt_control_job_unlink_locked(control->job_res[res]);
     dt_control_job_dispose(control->job_res[res]);
   }
 
@@ -315,6 +490,7 @@ int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t re
   control->new_res[res] = 1;
 
   dt_pthread_mutex_unlock(&control->queue_mutex);
+  dt_control_dispose_discarded(control);
 
   dt_pthread_mutex_lock(&control->cond_mutex);
   pthread_cond_broadcast(&control->cond);
@@ -323,18 +499,10 @@ int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t re
   return 0;
 }
 
-int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t *job)
+// puts a job into its queue, needs the queue_mutex.
+static void dt_control_job_enqueue_locked(dt_control_t *control, _dt_job_t *job)
 {
-  if(((unsigned int)queue_id) >= DT_JOB_QUEUE_MAX || !job)
-  {
-    dt_control_job_dispose(job);
-    return 1;
-  }
-
-  job->queue = queue_id;
-
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
+  const dt_job_queue_t queue_id = job->queue;
   GList **queue = &control->queues[queue_id];
   size_t length = control->queue_length[queue_id];
 
@@ -342,16 +510,19 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
+  // don't let anything overwrite a cancellation which happened while the job was waiting
+  if(dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED) dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+
   if(queue_id == DT_JOB_QUEUE_SYSTEM_FG)
   {
     // this is a stack with limited size and bubble up and all that stuff
     job->priority = DT_CONTROL_FG_PRIORITY;
 
-    // if the job is already in the queue -> move it to the top
-    for(GList *iter = *queue; iter; iter = g_list_next(iter))
+    // if the job is already in the queue -> move it to the top. jobs in a graph are never merged.
+    for(GList *iter = *queue; iter && !job->dependents; iter = g_list_next(iter))
     {
       _dt_job_t *other_job = (_dt_job_t *)iter->data;
-      if(dt_control_job_equal(job, other_job))
+      if(!other_job->dependents && dt_control_job_equal(job, other_job))
       {
         dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
         dt_control_job_print(job);
@@ -374,9 +545,14 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     if(length > DT_CONTROL_MAX_JOBS)
     {
       GList *last = g_list_last(*queue);
-      dt_control_job_set_state((_dt_job_t *)last->data, DT_JOB_STATE_DISCARDED);
+      _dt_job_t *discarded = (_dt_job_t *)last->data;
+      dt_control_job_set_state(discarded, DT_JOB_STATE_DISCARDED);
       *queue = g_list_delete_link(*queue, last);
       length--;
+      // whatever waits for it won't get it
+      dt_control_job_resolve_locked(control, discarded, 1);
+      // its cleanup may take locks of its own, see dt_control_dispose_discarded()
+      control->discarded = g_list_prepend(control->discarded, discarded);
     }
 
     control->queue_length[queue_id] = length;
@@ -391,19 +567,80 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     *queue = g_list_append(*queue, job);
     control->queue_length[queue_id]++;
   }
-  dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+}
+
+// the job is done, one way or the other: release the ones waiting for it. needs the queue_mutex.
+static void dt_control_job_resolve_locked(dt_control_t *control, _dt_job_t *job, const int failed)
+{
+  GList *dependents = job->dependents;
+  job->dependents = NULL;
+  for(GList *l = dependents; l; l = g_list_next(l))
+  {
+    _dt_job_t *dependent = (_dt_job_t *)l->data;
+    dependent->dependencies = g_list_remove(dependent->dependencies, job);
+    if(failed) dt_control_job_cancel_locked(dependent);
+    // cancelled ones go through the queue as well, to get disposed and to release their own dependents.
+    if(dependent->waiting && !dependent->dependencies)
+    {
+      dependent->waiting = 0;
+      dt_control_job_enqueue_locked(control, dependent);
+    }
+  }
+  g_list_free(dependents);
+}
+
+// disposes the jobs dt_control_job_enqueue_locked() dropped, call it without the queue_mutex.
+static void dt_control_dispose_discarded(dt_control_t *control)
+{
+  dt_pthread_mutex_lock(&control->queue_mutex);
+  GList *discarded = control->discarded;
+  control->discarded = NULL;
   dt_pthread_mutex_unlock(&control->queue_mutex);
+  for(GList *l = discarded; l; l = g_list_next(l)) dt_control_job_dispose((_dt_job_t *)l->data);
+  g_list_free(discarded);
+}
+
+static void dt_control_job_resolve(dt_control_t *control, _dt_job_t *job, const int failed)
+{
+  dt_pthread_mutex_lock(&control->queue_mutex);
+  const int released = job->dependents != NULL;
+  dt_control_job_resolve_locked(control, job, failed);
+  dt_pthread_mutex_unlock(&control->queue_mutex);
+  if(!released) return;
+  dt_control_dispose_discarded(control);
+  dt_threadpool_wake(darktable.threadpool);
+}
+
+int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t *job)
+{
+  if(((unsigned int)queue_id) >= DT_JOB_QUEUE_MAX || !job)
+  {
+    dt_control_job_dispose(job);
+    return 1;
+  }
+
+  job->queue = queue_id;
+
+  dt_pthread_mutex_lock(&control->queue_mutex);
+  if(job->dependencies)
+  {
+    // held back until everything it depends on is done, see dt_control_job_resolve_locked()
+    if(dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+      dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    job->waiting = 1;
+    dt_pthread_mutex_unlock(&control->queue_mutex);
+    return 0;
+  }
+  dt_control_job_enqueue_locked(control, job);
+  dt_pthread_mutex_unlock(&control->queue_mutex);
+  dt_control_dispose_discarded(control);
 
   // notify workers
-  dt_pthread_mutex_lock(&control->cond_mutex);
-  pthread_cond_broadcast(&control->cond);
-  dt_pthread_mutex_unlock(&control->cond_mutex);
+  dt_threadpool_wake(darktable.threadpool);
 
   return 0;
 }
 
-static __thread int threadid = -1;
-
 int32_t dt_control_get_threadid()
 {
   if(threadid > -1) return threadid;
@@ -431,11 +668,15 @@ static void *dt_control_work_res(void *ptr)
     // dt_print(DT_DEBUG_CONTROL, "[control_work] %d\n", threadid);
     if(dt_control_run_job_res(s, threadid) < 0)
     {
-      // wait for a new job.
+      // wait for a new job. dt_control_add_job_res() broadcasts with cond_mutex held after it set new_res,
+      // so checking that under cond_mutex doesn't miss it, and nothing has to kick us now and then.
       int old;
       pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old);
       dt_pthread_mutex_lock(&s->cond_mutex);
-      dt_pthread_cond_wait(&s->cond, &s->cond_mutex);
+      dt_pthread_mutex_lock(&s->queue_mutex);
+      const int pending = s->new_res[threadid];
+      dt_pthread_mutex_unlock(&s->queue_mutex);
+      if(!pending && dt_control_running()) dt_pthread_cond_wait(&s->cond, &s->cond_mutex);
       dt_pthread_mutex_unlock(&s->cond_mutex);
       pthread_setcancelstate(old, NULL);
     }
@@ -449,33 +690,7 @@ static void *dt_control_worker_kicker(void *ptr)
   while(dt_control_running())
   {
     sleep(2);
-    dt_pthread_mutex_lock(&control->cond_mutex);
-    pthread_cond_broadcast(&control->cond);
-    dt_pthread_mutex_unlock(&control->cond_mutex);
-  }
-  return NULL;
-}
-
-static void *dt_control_work(void *ptr)
-{
-#ifdef _OPENMP // need to do this in every thread
-  omp_set_num_threads(darktable.num_openmp_threads);
-#endif
-  worker_thread_parameters_t *params = (worker_thread_parameters_t *)ptr;
-  dt_control_t *control = params->self;
-  threadid = params->threadid;
-  free(params);
-  // int32_t threadid = dt_control_get_threadid();
-  while(dt_control_running())
-  {
-    // dt_print(DT_DEBUG_CONTROL, "[control_work] %d\n", threadid);
-    if(dt_control_run_job(control) < 0)
-    {
-      // wait for a new job.
-      dt_pthread_mutex_lock(&control->cond_mutex);
-      dt_pthread_cond_wait(&control->cond, &control->cond_mutex);
-      dt_pthread_mutex_unlock(&control->cond_mutex);
-    }
+    dt_threadpool_wake(darktable.threadpool);
   }
   return NULL;
 }
@@ -483,20 +698,18 @@ static void *dt_control_work(void *ptr)
 // moved out of control.c to be able to make some helper functions static
 void dt_control_jobs_init(dt_control_t *control)
 {
-  // start threads
+  // start threads. there is one worker per core, worker_threads of them may run jobs at the same time,
+  // the others help with the parallel loops inside of them.
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
-  control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
+  control->running_jobs = 0;
+  control->job_slots = 0;
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
-  for(int k = 0; k < control->num_threads; k++)
-  {
-    worker_thread_parameters_t *params
-        = (worker_thread_parameters_t *)calloc(1, sizeof(worker_thread_parameters_t));
-    params->self = control;
-    params->threadid = k;
-    pthread_create(&control->thread[k], NULL, dt_control_work, params);
-  }
+  const int workers = MAX(dt_get_num_threads(), control->num_threads);
+  darktable.threadpool = dt_threadpool_create(workers, dt_control_idle, control);
+  dt_print(DT_DEBUG_CONTROL, "[control_jobs_init] %d workers, up to %d jobs at a time\n", workers,
+           control->num_threads);
 
   /* create queue kicker thread */
   pthread_create(&control->kick_on_workers_thread, NULL, dt_control_worker_kicker, control);
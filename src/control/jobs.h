@@ -54,6 +54,7 @@ typedef struct _dt_job_t dt_job_t;
 
 typedef int32_t (*dt_job_execute_callback)(dt_job_t *);
 typedef void (*dt_job_state_change_callback)(dt_job_t *, dt_job_state_t state);
+typedef void (*dt_job_cleanup_callback)(void *params);
 
 /** create a new initialized job */
 dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg, ...);
@@ -61,14 +62,22 @@ dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg
 void dt_control_job_dispose(dt_job_t *job);
 /** setup a state callback for job. */
 void dt_control_job_set_state_callback(dt_job_t *job, dt_job_state_change_callback cb);
-/** cancel a job, running or in queue. */
+/** cancel a job, running or in queue. all jobs depending on it are cancelled as well. */
 void dt_control_job_cancel(dt_job_t *job);
+/** job will not be started before dependency has finished. if dependency gets cancelled or discarded, or
+ * returns non-zero, job is cancelled as well. this way jobs can be chained, fanned out and joined again.
+ * job must not have been added to a queue yet, dependency must not have started yet, and the edge must not
+ * close a cycle. returns 0 on success. */
+int dt_control_job_add_dependency(dt_job_t *job, dt_job_t *dependency);
 dt_job_state_t dt_control_job_get_state(dt_job_t *job);
 /** wait for a job to finish execution. */
 void dt_control_job_wait(dt_job_t *job);
 /** accessors for internal fields */
 void dt_control_job_set_params(dt_job_t *job, void *params);
 void *dt_control_job_get_params(const dt_job_t *job);
+/** cleanup is called with the params instead of the execute callback if the job never gets to run,
+ * for example because it was cancelled while waiting in the queue, or discarded. */
+void dt_control_job_set_params_cleanup(dt_job_t *job, dt_job_cleanup_callback cleanup);
 
 struct dt_control_t;
 void dt_control_jobs_init(struct dt_control_t *control);
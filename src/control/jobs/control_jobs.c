@@ -29,6 +29,7 @@
 #include "common/imageio_module.h"
 #include "common/debug.h"
 #include "common/tags.h"
+#include "common/threadpool.h"
 #include "common/debug.h"
 #include "common/gpx.h"
 #include "control/conf.h"
@@ -39,6 +40,10 @@
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <pthread.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #ifndef __WIN32__
 #include <glob.h>
 #endif
@@ -883,12 +888,155 @@ static int32_t dt_control_local_copy_images_job_run(dt_job_t *job)
   return 0;
 }
 
-static int32_t dt_control_export_job_run(dt_job_t *job)
+// state shared by the threads of an export
+typedef struct _export_t
 {
-  int imgid = -1;
-  dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
-  dt_control_export_t *settings = (dt_control_export_t *)params->data;
-  GList *t = params->index;
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  uint32_t w, h;
+  guint tagid, etagid;
+  dt_progress_t *progress;
+  dt_imageio_export_stages_t stages;
+  int32_t omp_threads; // per worker, for the openmp loops inside the pixelpipe
+  // protected by mutex:
+  dt_pthread_mutex_t mutex;
+  GList *t;
+  guint total, done, failed;
+} _export_t;
+
+// every worker takes the next image and carries it through all the stages. the stage limits make sure
+// they spread out over the stages instead of all of them developing at the same time.
+static void *_export_worker(void *data)
+{
+  _export_t *e = (_export_t *)data;
+  dt_control_export_t *settings = e->settings;
+  dt_control_t *control = darktable.control;
+#ifdef _OPENMP
+  // the thread goes back to the pool afterwards
+  const int omp_threads = omp_get_max_threads();
+  omp_set_num_threads(e->omp_threads);
+#endif
+  dt_imageio_export_stages_attach(&e->stages);
+
+  // get a thread-safe fdata struct (one jpeg struct per thread etc):
+  dt_imageio_module_data_t *fdata = e->mformat->get_params(e->mformat);
+  fdata->max_width = settings->max_width;
+  fdata->max_height = settings->max_height;
+  fdata->max_width = (e->w != 0 && fdata->max_width > e->w) ? e->w : fdata->max_width;
+  fdata->max_height = (e->h != 0 && fdata->max_height > e->h) ? e->h : fdata->max_height;
+  g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
+  fdata->style_append = settings->style_append;
+
+  while(dt_control_job_get_state(e->job) != DT_JOB_STATE_CANCELLED)
+  {
+    dt_pthread_mutex_lock(&e->mutex);
+    if(!e->t)
+    {
+      dt_pthread_mutex_unlock(&e->mutex);
+      break;
+    }
+    const int imgid = GPOINTER_TO_INT(e->t->data);
+    e->t = g_list_delete_link(e->t, e->t);
+    const guint num = e->total - g_list_length(e->t);
+    dt_pthread_mutex_unlock(&e->mutex);
+
+    // remove 'changed' tag from image
+    dt_tag_detach(e->tagid, imgid);
+    // make sure the 'exported' tag is set on the image
+    dt_tag_attach(e->etagid, imgid);
+    // check if image still exists:
+    char imgfilename[PATH_MAX] = { 0 };
+    int err = 1;
+    const dt_image_t *image = dt_image_cache_read_get(darktable.image_cache, (int32_t)imgid);
+    if(image)
+    {
+      gboolean from_cache = TRUE;
+      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
+      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+      {
+        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+        fprintf(stderr, "image `%s' is currently unavailable", imgfilename);
+        // dt_image_remove(imgid);
+        dt_image_cache_read_release(darktable.image_cache, image);
+        err = 1;
+      }
+      else
+      {
+        dt_image_cache_read_release(darktable.image_cache, image);
+        dt_imageio_export_stage_enter(DT_IMAGEIO_STAGE_STORE);
+        err = e->mstorage->store(e->mstorage, e->sdata, imgid, e->mformat, fdata, num, e->total,
+                                 settings->high_quality);
+        dt_imageio_export_stage_leave(DT_IMAGEIO_STAGE_STORE);
+        // a storage failing usually fails for all images (disk full, no connection). without a job
+        // (darktable-cli) there is nobody to tell, so keep going and only count them.
+        if(err) dt_control_job_cancel(e->job);
+      }
+    }
+
+    dt_pthread_mutex_lock(&e->mutex);
+    const guint done = ++e->done;
+    if(err) e->failed++;
+    dt_pthread_mutex_unlock(&e->mutex);
+    if(e->progress)
+    {
+      char details[256];
+      dt_imageio_export_stages_describe(&e->stages, details, sizeof(details));
+      dt_control_progress_set_progress(control, e->progress, MIN(1.0, done / (double)e->total));
+      dt_control_progress_set_details(control, e->progress, details);
+    }
+  }
+
+  dt_imageio_export_stages_attach(NULL);
+  e->mformat->free_params(e->mformat, fdata);
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads);
+#endif
+  return NULL;
+}
+
+static void _export_worker_range(void *data, const size_t begin, const size_t end)
+{
+  for(size_t k = begin; k < end; k++) _export_worker(data);
+}
+
+// every image in development may use host_memory_limit in its modules, on top of its input and its output.
+// the developed ones only keep their output while they are encoded, and one more input is loaded ahead.
+// don't develop more images at a time than what fits into half the memory, the rest is darktable's.
+static int _export_parallel(GList *imgs, const uint32_t max_width, const uint32_t max_height)
+{
+  const int parallel = MAX(1, MIN(dt_conf_get_int("parallel_export"), 8));
+  const size_t memory = dt_get_total_memory() * 1024 / 2;
+  if(parallel == 1 || !memory) return 1;
+
+  size_t input = 0, output = 0;
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, GPOINTER_TO_INT(l->data));
+    if(!img) continue;
+    const size_t pixels = (size_t)img->width * img->height;
+    dt_image_cache_read_release(darktable.image_cache, img);
+    input = MAX(input, pixels);
+    output = MAX(output, max_width && max_height ? MIN(pixels, (size_t)max_width * max_height) : pixels);
+  }
+  // full buffers are 4 floats per pixel at most, and so are the outputs before they are converted
+  input *= 4 * sizeof(float);
+  output *= 4 * sizeof(float);
+  const int limit = dt_conf_get_int("host_memory_limit");
+  const size_t pipe = (limit ? (size_t)limit : 1024) << 20;
+  const size_t fit = memory > input ? (memory - input) / (pipe + input + 2 * output) : 0;
+  const int develop = fit < (size_t)parallel ? MAX(1, (int)fit) : parallel;
+  if(develop < parallel)
+    dt_print(DT_DEBUG_PERF, "[export] only %d of %d images are developed at a time, to fit into memory\n",
+             develop, parallel);
+  return develop;
+}
+
+int dt_control_export_images(GList *imgid_list, dt_control_export_t *settings, dt_job_t *job)
+{
+  GList *t = imgid_list;
   dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(settings->format_index);
   g_assert(mformat);
   dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(settings->storage_index);
@@ -921,113 +1069,89 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   }
   const guint total = g_list_length(t);
   dt_control_log(ngettext("exporting %d image..", "exporting %d images..", total), total);
-  char message[512] = { 0 };
-  snprintf(message, sizeof(message), ngettext("exporting %d image to %s", "exporting %d images to %s", total),
-           total, mstorage->name(mstorage));
 
   dt_control_t *control = darktable.control;
 
   /* create a cancellable bgjob ui template */
-  dt_progress_t *progress = dt_control_progress_create(control, TRUE, message);
-  dt_control_progress_attach_job(control, progress, job);
+  dt_progress_t *progress = NULL;
+  if(job)
+  {
+    char message[512] = { 0 };
+    snprintf(message, sizeof(message),
+             ngettext("exporting %d image to %s", "exporting %d images to %s", total), total,
+             mstorage->name(mstorage));
+    progress = dt_control_progress_create(control, TRUE, message);
+    dt_control_progress_attach_job(control, progress, job);
+  }
 
-  double fraction = 0;
-#ifdef _OPENMP
-  // limit this to num threads = num full buffers - 1 (keep one for darkroom mode)
-  // use min of user request and mipmap cache entries
-  const int full_entries = dt_conf_get_int("parallel_export");
-  // GCC won't accept that this variable is used in a macro, considers
-  // it set but not used, which makes for instance Fedora break.
-  const __attribute__((__unused__)) int num_threads = MAX(1, MIN(full_entries, 8));
-#if !defined(__SUNOS__) && !defined(__NetBSD__) && !defined(__WIN32__)
-#pragma omp parallel default(none) private(imgid)                                                            \
-    shared(control, fraction, w, h, stderr, mformat, mstorage, t, sdata, job, progress, darktable, settings) \
-        num_threads(num_threads) if(num_threads > 1)
-#else
-#pragma omp parallel private(imgid) shared(control, fraction, w, h, mformat, mstorage, t, sdata, job,        \
-                                           progress, darktable,                                              \
-                                           settings) num_threads(num_threads) if(num_threads > 1)
-#endif
+  _export_t e = { 0 };
+  e.job = job;
+  e.settings = settings;
+  e.mformat = mformat;
+  e.mstorage = mstorage;
+  e.sdata = sdata;
+  e.w = w;
+  e.h = h;
+  e.progress = progress;
+  e.t = t;
+  e.total = total;
+  dt_pthread_mutex_init(&e.mutex, NULL);
+  // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
+  // sensible assumption?
+  dt_tag_new("darktable|changed", &e.tagid);
+  dt_tag_new("darktable|exported", &e.etagid);
+
+  // the pixelpipes need the memory: as many as the user allows (num full buffers - 1, keep one for darkroom
+  // mode) and the memory holds. one image gets loaded ahead of them, and as many as they are can be encoded
+  // and stored at the same time, so that the pipes are always fed.
+  // store() runs around all of that, for storages sharing state between the images (uploads into one
+  // album, one connection) that makes it one image at a time.
+  const int parallel = mstorage->parallel(mstorage);
+  const int develop = parallel ? _export_parallel(t, w, h) : 1;
+  const int workers = parallel ? MIN(1 + 2 * develop, MAX(1, total)) : 1;
+  dt_imageio_export_stages_init(&e.stages, 1, develop, develop, parallel ? 0 : 1);
+  e.omp_threads = MAX(1, darktable.num_openmp_threads / develop);
+
+  if(darktable.threadpool)
   {
-#endif
-    // get a thread-safe fdata struct (one jpeg struct per thread etc):
-    dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
-    fdata->max_width = settings->max_width;
-    fdata->max_height = settings->max_height;
-    fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-    fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-    g_strlcpy(fdata->style, settings->style, sizeof(fdata->style));
-    fdata->style_append = settings->style_append;
-    guint num = 0;
-    // Invariant: the tagid for 'darktable|changed' will not change while this function runs. Is this a
-    // sensible assumption?
-    guint tagid = 0, etagid = 0;
-    dt_tag_new("darktable|changed", &tagid);
-    dt_tag_new("darktable|exported", &etagid);
-
-    while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
-    {
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-      {
-        if(!t)
-          imgid = 0;
-        else
-        {
-          imgid = GPOINTER_TO_INT(t->data);
-          t = g_list_delete_link(t, t);
-          num = total - g_list_length(t);
-        }
-      }
-      // remove 'changed' tag from image
-      dt_tag_detach(tagid, imgid);
-      // make sure the 'exported' tag is set on the image
-      dt_tag_attach(etagid, imgid);
-      // check if image still exists:
-      char imgfilename[PATH_MAX] = { 0 };
-      const dt_image_t *image = dt_image_cache_read_get(darktable.image_cache, (int32_t)imgid);
-      if(image)
-      {
-        gboolean from_cache = TRUE;
-        dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
-        if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-        {
-          dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-          fprintf(stderr, "image `%s' is currently unavailable", imgfilename);
-          // dt_image_remove(imgid);
-          dt_image_cache_read_release(darktable.image_cache, image);
-        }
-        else
-        {
-          dt_image_cache_read_release(darktable.image_cache, image);
-          if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality) != 0)
-            dt_control_job_cancel(job);
-        }
-      }
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-      {
-        fraction += 1.0 / total;
-        if(fraction > 1.0) fraction = 1.0;
-        dt_control_progress_set_progress(control, progress, fraction);
-      }
-    }
-#ifdef _OPENMP
-#pragma omp barrier
-#pragma omp master
-#endif
-    {
-      dt_control_progress_destroy(control, progress);
-      if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
-      mstorage->free_params(mstorage, sdata);
-    }
-    // all threads free their fdata
-    mformat->free_params(mformat, fdata);
-#ifdef _OPENMP
+    // the workers run on the shared pool, next to the jobs and the loops inside the pipes. when the pool
+    // is busy fewer of them run side by side, at worst this thread takes all images through alone.
+    dt_parallel_for(0, workers, 1, _export_worker_range, &e);
   }
-#endif
+  else
+  {
+    // darktable-cli has no pool, and openmp would run the loops inside the pipes serially in its threads.
+    pthread_t *threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    int started = 0;
+    for(int k = 1; k < workers; k++)
+      if(!pthread_create(threads + started, NULL, _export_worker, &e)) started++;
+    _export_worker(&e);
+    for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+    free(threads);
+  }
+
+  dt_print(DT_DEBUG_PERF, "[export] %d images with %d workers, %.3fs\n", e.done, workers,
+           dt_get_wtime() - e.stages.start);
+  dt_imageio_export_stages_cleanup(&e.stages);
+  dt_pthread_mutex_destroy(&e.mutex);
+  g_list_free(e.t);
+
+  if(progress) dt_control_progress_destroy(control, progress);
+  if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
+  // images which never got their turn because the export was cancelled
+  return e.failed + (e.total - e.done);
+}
+
+static int32_t dt_control_export_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
+  dt_control_export_t *settings = (dt_control_export_t *)params->data;
+  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(settings->storage_index);
+  g_assert(mstorage);
+
+  dt_control_export_images(params->index, settings, job);
+
+  mstorage->free_params(mstorage, settings->sdata);
   g_free(params->data);
   free(params);
   return 0;
@@ -54,6 +54,11 @@ void dt_control_set_local_copy_images();
 void dt_control_reset_local_copy_images();
 void dt_control_export(GList *imgid_list, int max_width, int max_height, int format_index, int storage_index,
                        gboolean high_quality, char *style, gboolean style_append);
+/** runs an export right away in the calling thread, with as many helpers as parallel_export allows. job is
+ * NULL if there is no job system (darktable-cli): there is no progress then, and a failing image doesn't
+ * cancel the others. consumes imgid_list, settings and its sdata stay with the caller. returns the number
+ * of images which were not exported. */
+int dt_control_export_images(GList *imgid_list, dt_control_export_t *settings, dt_job_t *job);
 void dt_control_merge_hdr();
 
 void dt_control_seed_denoise();
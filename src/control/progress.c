@@ -180,6 +180,15 @@ void dt_control_progress_set_progress(dt_control_t *control, dt_progress_t *prog
 #endif
 }
 
+void dt_control_progress_set_details(dt_control_t *control, dt_progress_t *progress, const gchar *details)
+{
+  // tell the gui, nothing else cares
+  dt_pthread_mutex_lock(&control->progress_system.mutex);
+  if(control->progress_system.proxy.module != NULL && control->progress_system.proxy.details != NULL)
+    control->progress_system.proxy.details(control->progress_system.proxy.module, progress->gui_data, details);
+  dt_pthread_mutex_unlock(&control->progress_system.mutex);
+}
+
 double dt_control_progress_get_progress(dt_progress_t *progress)
 {
   dt_pthread_mutex_lock(&progress->mutex);
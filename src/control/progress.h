@@ -52,6 +52,9 @@ void dt_control_progress_set_progress(struct dt_control_t *control, dt_progress_
 /** return the last set progress value. */
 double dt_control_progress_get_progress(dt_progress_t *progress);
 
+/** show a second line of text below the message, for example statistics about a running job. */
+void dt_control_progress_set_details(struct dt_control_t *control, dt_progress_t *progress, const gchar *details);
+
 /** get the message passed during construction. */
 const gchar *dt_control_progress_get_message(dt_progress_t *progress);
 
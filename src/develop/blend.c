@@ -21,8 +21,11 @@
 #include "develop/tiling.h"
 #include "develop/masks.h"
 #include "common/gaussian.h"
+#include "common/simd.h"
 #include "blend.h"
 
+#include <xmmintrin.h>
+
 #define CLAMP_RANGE(x, y, z) (CLAMP(x, y, z))
 
 typedef struct _blend_buffer_desc_t
@@ -530,6 +533,159 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   }
 }
 
+/* the normal blends are by far the most used ones. on four channel rgb and Lab buffers they are a plain
+   b = a + (b - a) * opacity per pixel, clamped or not, with the opacity into the alpha channel. the Lab
+   scaling is linear, so it can be left out and the range scaled instead. everything else goes to the
+   plain versions above. */
+static inline int _blend_normal_vectorize(const _blend_buffer_desc_t *bd, const int flag)
+{
+  return bd->ch == 4 && (bd->cst == iop_cs_rgb || (bd->cst == iop_cs_Lab && flag == 0));
+}
+
+static inline void _blend_normal_range(const _blend_buffer_desc_t *bd, float *min, float *max)
+{
+  _blend_colorspace_channel_range(bd->cst, min, max);
+  if(bd->cst == iop_cs_Lab)
+  {
+    _blend_Lab_rescale(min, min);
+    _blend_Lab_rescale(max, max);
+  }
+}
+
+static inline void _blend_normal_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                      const float *mask, const int bounded)
+{
+  float min[4], max[4];
+  _blend_normal_range(bd, min, max);
+  const __m128 vmin = _mm_loadu_ps(min), vmax = _mm_loadu_ps(max);
+  for(size_t i = 0, j = 0; j < bd->stride; i++, j += 4)
+  {
+    const __m128 va = _mm_loadu_ps(a + j);
+    const __m128 vb = _mm_loadu_ps(b + j);
+    const __m128 vo = _mm_set1_ps(mask[i]);
+    const __m128 vr = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vo));
+    _mm_storeu_ps(b + j, bounded ? _mm_min_ps(_mm_max_ps(vr, vmin), vmax) : vr);
+    b[j + 3] = mask[i];
+  }
+}
+
+static void _blend_normal_bounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                       const float *mask, int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_sse2(bd, a, b, mask, 1);
+  else
+    _blend_normal_bounded(bd, a, b, mask, flag);
+}
+
+static void _blend_normal_unbounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                         const float *mask, int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_sse2(bd, a, b, mask, 0);
+  else
+    _blend_normal_unbounded(bd, a, b, mask, flag);
+}
+
+#ifdef DT_SIMD_HAVE_AVX2
+/* two pixels at a time, the opacity goes into the alpha channels with a blend */
+DT_SIMD_TARGET_AVX2 static inline void _blend_normal_avx2(const _blend_buffer_desc_t *bd, const float *a,
+                                                          float *b, const float *mask, const int bounded)
+{
+  float min[4], max[4];
+  _blend_normal_range(bd, min, max);
+  const __m256 vmin = _mm256_broadcast_ps((const __m128 *)min);
+  const __m256 vmax = _mm256_broadcast_ps((const __m128 *)max);
+  const size_t pixels = bd->stride / 4;
+  size_t i = 0;
+  for(; i + 2 <= pixels; i += 2)
+  {
+    const __m256 va = _mm256_loadu_ps(a + 4 * i);
+    const __m256 vb = _mm256_loadu_ps(b + 4 * i);
+    const __m256 vo = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(mask[i])),
+                                           _mm_set1_ps(mask[i + 1]), 1);
+    const __m256 vr = _mm256_fmadd_ps(_mm256_sub_ps(vb, va), vo, va);
+    const __m256 vc = bounded ? _mm256_min_ps(_mm256_max_ps(vr, vmin), vmax) : vr;
+    _mm256_storeu_ps(b + 4 * i, _mm256_blend_ps(vc, vo, 0x88));
+  }
+  if(i < pixels)
+  {
+    const _blend_buffer_desc_t last = { .cst = bd->cst, .stride = 4, .ch = 4, .bch = bd->bch };
+    _blend_normal_sse2(&last, a + 4 * i, b + 4 * i, mask + i, bounded);
+  }
+}
+
+DT_SIMD_TARGET_AVX2 static void _blend_normal_bounded_avx2(const _blend_buffer_desc_t *bd, const float *a,
+                                                           float *b, const float *mask, int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_avx2(bd, a, b, mask, 1);
+  else
+    _blend_normal_bounded(bd, a, b, mask, flag);
+}
+
+DT_SIMD_TARGET_AVX2 static void _blend_normal_unbounded_avx2(const _blend_buffer_desc_t *bd, const float *a,
+                                                             float *b, const float *mask, int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_avx2(bd, a, b, mask, 0);
+  else
+    _blend_normal_unbounded(bd, a, b, mask, flag);
+}
+#endif
+
+#ifdef DT_SIMD_HAVE_AVX512
+/* four pixels at a time, each opacity spread over its pixel with a permute */
+DT_SIMD_TARGET_AVX512 static inline void _blend_normal_avx512(const _blend_buffer_desc_t *bd, const float *a,
+                                                              float *b, const float *mask, const int bounded)
+{
+  float min[4], max[4];
+  _blend_normal_range(bd, min, max);
+  const __m512 vmin = _mm512_broadcast_f32x4(_mm_loadu_ps(min));
+  const __m512 vmax = _mm512_broadcast_f32x4(_mm_loadu_ps(max));
+  const __m512i spread = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+  const size_t pixels = bd->stride / 4;
+  size_t i = 0;
+  for(; i + 4 <= pixels; i += 4)
+  {
+    const __m512 va = _mm512_loadu_ps(a + 4 * i);
+    const __m512 vb = _mm512_loadu_ps(b + 4 * i);
+    const __m512 vo = _mm512_permutexvar_ps(spread, _mm512_castps128_ps512(_mm_loadu_ps(mask + i)));
+    const __m512 vr = _mm512_fmadd_ps(_mm512_sub_ps(vb, va), vo, va);
+    const __m512 vc = bounded ? _mm512_min_ps(_mm512_max_ps(vr, vmin), vmax) : vr;
+    _mm512_storeu_ps(b + 4 * i, _mm512_mask_blend_ps(0x8888, vc, vo));
+  }
+  if(i < pixels)
+  {
+    const _blend_buffer_desc_t last = { .cst = bd->cst, .stride = 4 * (pixels - i), .ch = 4, .bch = bd->bch };
+    _blend_normal_sse2(&last, a + 4 * i, b + 4 * i, mask + i, bounded);
+  }
+}
+
+DT_SIMD_TARGET_AVX512 static void _blend_normal_bounded_avx512(const _blend_buffer_desc_t *bd, const float *a,
+                                                               float *b, const float *mask, int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_avx512(bd, a, b, mask, 1);
+  else
+    _blend_normal_bounded(bd, a, b, mask, flag);
+}
+
+DT_SIMD_TARGET_AVX512 static void _blend_normal_unbounded_avx512(const _blend_buffer_desc_t *bd,
+                                                                 const float *a, float *b, const float *mask,
+                                                                 int flag)
+{
+  if(_blend_normal_vectorize(bd, flag))
+    _blend_normal_avx512(bd, a, b, mask, 0);
+  else
+    _blend_normal_unbounded(bd, a, b, mask, flag);
+}
+#endif
+
+/* the normal blends for the simd level in use, picked once by dt_develop_blend_init() */
+static _blend_row_func *_blend_normal_bounded_simd = _blend_normal_bounded_sse2;
+static _blend_row_func *_blend_normal_unbounded_simd = _blend_normal_unbounded_sse2;
+
 /* lighten */
 static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                            int flag)
@@ -2527,7 +2683,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       break;
     case DEVELOP_BLEND_NORMAL:
     case DEVELOP_BLEND_BOUNDED:
-      blend = _blend_normal_bounded;
+      blend = _blend_normal_bounded_simd;
       break;
     case DEVELOP_BLEND_COLORADJUST:
       blend = _blend_coloradjust;
@@ -2549,7 +2705,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     case DEVELOP_BLEND_NORMAL2:
     case DEVELOP_BLEND_UNBOUNDED:
     default:
-      blend = _blend_normal_unbounded;
+      blend = _blend_normal_unbounded_simd;
       break;
   }
 
@@ -3024,6 +3180,13 @@ error:
 /** global init of blendops */
 void dt_develop_blend_init(dt_blendop_t *gd)
 {
+  _blend_normal_bounded_simd = (_blend_row_func *)dt_simd_select(
+      _blend_normal_bounded, _blend_normal_bounded_sse2, DT_SIMD_AVX2_FN(_blend_normal_bounded_avx2),
+      DT_SIMD_AVX512_FN(_blend_normal_bounded_avx512));
+  _blend_normal_unbounded_simd = (_blend_row_func *)dt_simd_select(
+      _blend_normal_unbounded, _blend_normal_unbounded_sse2, DT_SIMD_AVX2_FN(_blend_normal_unbounded_avx2),
+      DT_SIMD_AVX512_FN(_blend_normal_unbounded_avx512));
+
 #ifdef HAVE_OPENCL
   const int program = 3; // blendop.cl, from programs.conf
   gd->kernel_blendop_mask_Lab = dt_opencl_create_kernel(program, "blendop_mask_Lab");
@@ -1226,7 +1226,8 @@ void dt_dev_get_history_item_label(dt_dev_history_item_t *hist, char *label, con
 
 int dt_dev_is_current_image(dt_develop_t *dev, uint32_t imgid)
 {
-  return (dev->image_storage.id == imgid) ? 1 : 0;
+  // darktable-cli has no develop
+  return (dev && dev->image_storage.id == imgid) ? 1 : 0;
 }
 
 gboolean dt_dev_exposure_hooks_available(dt_develop_t *dev)
@@ -21,6 +21,7 @@
 #include "common/opencl.h"
 #include "common/dtpthread.h"
 #include "common/debug.h"
+#include "common/hash.h"
 #include "common/interpolation.h"
 #include "bauhaus/bauhaus.h"
 #include "control/control.h"
@@ -1322,8 +1323,7 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
                           dt_develop_blend_params_t *blendop_params, dt_dev_pixelpipe_t *pipe,
                           dt_dev_pixelpipe_iop_t *piece)
 {
-  uint64_t hash = 5381;
-  piece->hash = 0;
+  piece->hash = (dt_hash_t){ 0, 0 };
   if(piece->enabled)
   {
     /* construct module params data for hash calc */
@@ -1350,12 +1350,11 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
     // assume process_cl is ready, commit_params can overwrite this.
     if(module->process_cl) piece->process_cl_ready = 1;
     module->commit_params(module, params, pipe, piece);
-    for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ str[i];
-    piece->hash = hash;
+    piece->hash = dt_hash(dt_hash_seed(5381), str, length);
 
     free(str);
   }
-  // printf("commit params hash += module %s: %lu, enabled = %d\n", piece->module->op, piece->hash,
+  // printf("commit params hash += module %s: %lu, enabled = %d\n", piece->module->op, piece->hash.h1,
   // piece->enabled);
 }
 
@@ -84,7 +84,11 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_PREVIEW_NON_OPENCL
   = 1 << 8, // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK = 1 << 9, // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS = 1 << 10,        // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_POINTWISE
+  = 1 << 11, // Output pixels only depend on the input pixel at the same place, process() can run on row bands
+  IOP_FLAGS_TILING_REENTRANT
+  = 1 << 12 // process() only reads piece and pipe and writes its output, so tiles can run side by side
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -17,39 +17,101 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/half.h"
+#include "common/trace.h"
+#ifndef DT_UNIT_TEST
+#include "common/file_location.h"
+#include "control/conf.h"
+#include "control/jobs.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
+#include "version.h"
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#endif
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
+#define DT_PIXELPIPE_CACHE_DISK_MAGIC 0xD7CA0000
+#define DT_PIXELPIPE_CACHE_DISK_VERSION 1
 
-// TODO: make cache global (needs to be thread safe then)
-// plan:
-// - look at mipmap_cache.c, for the full buffer allocs
-// - do that, but for `large' and `regular' buffers (full + export/dr mode), so 2 caches
-//   (in fact, maybe 3, one for preview pipes?)
-// - have at most 3 read locks all the time per pipe, get them at create time
-//   ping, pong, and priority buffer (focused plugin)
-// - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
+// header of the files of the disk tier, followed by length bytes of half floats,
+// deflated if compressed is set.
+typedef struct dt_dev_pixelpipe_cache_disk_header_t
+{
+  int32_t magic;
+  int32_t compressed;
+  dt_hash_t hash;
+  // hash of the darktable version, modules may compute different things in other releases
+  dt_hash_t version;
+  uint64_t size; // bytes of the float buffer
+  uint64_t length;
+  float processed_maximum[3];
+} __attribute__((packed)) dt_dev_pixelpipe_cache_disk_header_t;
 
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+// per line flags
+typedef enum dt_dev_pixelpipe_cache_flags_t
 {
-  cache->entries = entries;
-  cache->data = (void **)calloc(entries, sizeof(void *));
-  cache->size = (size_t *)calloc(entries, sizeof(size_t));
-  cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
-  for(int k = 0; k < entries; k++)
+  DT_DEV_PIXELPIPE_CACHE_FLOAT = 1 << 0, // holds floats
+  DT_DEV_PIXELPIPE_CACHE_HALF = 1 << 1   // currently stored as half floats, in half the size
+} dt_dev_pixelpipe_cache_flags_t;
+
+#ifndef DT_UNIT_TEST
+// bytes written to disk by all pipes this session, to know whether trimming is needed on cleanup
+static int64_t _disk_written = 0;
+#endif
+
+
+// for the hash table index
+static guint _key_hash(gconstpointer key)
+{
+  return (guint)((const dt_hash_t *)key)->h1;
+}
+
+static gboolean _key_equal(gconstpointer a, gconstpointer b)
+{
+  return dt_hash_equal(*(const dt_hash_t *)a, *(const dt_hash_t *)b);
+}
+
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit)
+{
+  // only grow beyond the preallocated lines if there is budget for it
+  const int lines = memory_limit > entries * size ? MAX(entries, DT_DEV_PIXELPIPE_CACHE_MAX_LINES) : entries;
+  cache->entries = lines;
+  cache->data = (void **)calloc(lines, sizeof(void *));
+  cache->size = (size_t *)calloc(lines, sizeof(size_t));
+  cache->hash = (dt_hash_t *)calloc(lines, sizeof(dt_hash_t));
+  cache->used = (uint64_t *)calloc(lines, sizeof(uint64_t));
+  cache->flags = (int32_t *)calloc(lines, sizeof(int32_t));
+  cache->index = g_hash_table_new(_key_hash, _key_equal);
+  cache->clock = 0;
+  cache->last = -1;
+  cache->pinned = -1;
+  cache->memory = 0;
+  cache->memory_limit = MAX(memory_limit, entries * size);
+  // with only the lines for input and output there is nothing to keep around
+  cache->fp16 = lines > 2 && dt_conf_get_bool("pixelpipe_cache_fp16");
+  for(int k = 0; k < lines; k++)
+  {
+    cache->hash[k] = dt_hash_invalid;
+    cache->used[k] = 0;
+  }
+  for(int k = 0; size && k < entries; k++)
   {
     cache->data[k] = (void *)dt_alloc_align(16, size);
     if(!cache->data[k]) goto alloc_memory_fail;
     cache->size[k] = size;
+    cache->memory += size;
 #ifdef _DEBUG
     memset(cache->data[k], 0x5d, size);
 #endif
-    cache->hash[k] = -1;
-    cache->used[k] = 0;
   }
-  cache->queries = cache->misses = 0;
+  memset(&cache->stats, 0, sizeof(cache->stats));
+  cache->disk = 0;
+  cache->disk_modules = NULL;
   return 1;
 
 alloc_memory_fail:
@@ -62,10 +124,16 @@ alloc_memory_fail:
   free(cache->size);
   free(cache->hash);
   free(cache->used);
+  free(cache->flags);
+  g_hash_table_destroy(cache->index);
 
   return 0;
 }
 
+#ifndef DT_UNIT_TEST
+static void _disk_trim(const int64_t quota);
+#endif
+
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
@@ -73,115 +141,311 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->flags);
+  g_hash_table_destroy(cache->index);
+#ifndef DT_UNIT_TEST
+  if(cache->disk && __sync_fetch_and_and(&_disk_written, 0) > 0)
+    _disk_trim(dt_conf_get_int64("pixelpipe_disk_cache_size"));
+#endif
+  g_strfreev(cache->disk_modules);
+}
+
+#ifndef DT_UNIT_TEST
+// start of the hash chains of a pipe. buffers on disk outlive the session, so this also has to tell
+// apart images which got the same id in another database, and inputs of different sizes.
+static dt_hash_t _pipe_seed(const dt_dev_pixelpipe_t *pipe)
+{
+  const int32_t input[4] = { pipe->image.film_id, pipe->type, pipe->iwidth, pipe->iheight };
+  const dt_hash_t hash = dt_hash(dt_hash_seed(pipe->image.id), input, sizeof(input));
+  return dt_hash(hash, pipe->image.filename, strlen(pipe->image.filename));
 }
 
-uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
+void dt_dev_pixelpipe_cache_chain_hashes(dt_dev_pixelpipe_t *pipe)
 {
-  // bernstein hash (djb2)
-  uint64_t hash = 5381 + imgid;
-  // go through all modules up to module and compute a weird hash using the operation and params.
-  GList *pieces = pipe->nodes;
-  for(int k = 0; k < module && pieces; k++)
+  dt_hash_t hash = _pipe_seed(pipe);
+  // go through all modules and chain the hash of each with its params and the color picker.
+  for(GList *pieces = pipe->nodes; pieces; pieces = g_list_next(pieces))
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
     dt_develop_t *dev = piece->module->dev;
     if(!(dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags())))
     {
-      hash = ((hash << 5) + hash) ^ piece->hash;
+      const int version = piece->module->version();
+      hash = dt_hash(hash, &version, sizeof(version));
+      hash = dt_hash(hash, &piece->hash, sizeof(piece->hash));
       if(piece->module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
       {
         if(darktable.lib->proxy.colorpicker.size)
-        {
-          const char *str = (const char *)piece->module->color_picker_box;
-          for(size_t i = 0; i < sizeof(float) * 4; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
+          hash = dt_hash(hash, piece->module->color_picker_box, sizeof(float) * 4);
         else
-        {
-          const char *str = (const char *)piece->module->color_picker_point;
-          for(size_t i = 0; i < sizeof(float) * 2; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
+          hash = dt_hash(hash, piece->module->color_picker_point, sizeof(float) * 2);
       }
     }
-    pieces = g_list_next(pieces);
+    piece->chain_hash = hash;
   }
+}
+
+dt_hash_t dt_dev_pixelpipe_cache_key(const dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_t *piece,
+                                     const dt_iop_roi_t *roi)
+{
   // also add scale, x and y:
-  const char *str = (const char *)roi;
-  for(size_t i = 0; i < sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
-  return hash;
+  return dt_hash(piece ? piece->chain_hash : _pipe_seed(pipe), roi, sizeof(dt_iop_roi_t));
+}
+#endif
+
+// returns the line holding the given hash, or -1.
+static int _lookup(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash)
+{
+  return GPOINTER_TO_INT(g_hash_table_lookup(cache->index, &hash)) - 1;
+}
+
+static void _set_hash(dt_dev_pixelpipe_cache_t *cache, const int k, const dt_hash_t hash)
+{
+  // the keys point into the hash array, so they have to go before they change.
+  if(dt_hash_is_valid(cache->hash[k])) g_hash_table_remove(cache->index, cache->hash + k);
+  cache->hash[k] = hash;
+  if(dt_hash_is_valid(hash)) g_hash_table_insert(cache->index, cache->hash + k, GINT_TO_POINTER(k + 1));
 }
 
-int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+// bytes actually allocated for a line, size is what it holds when converted back to floats
+static size_t _bytes(const dt_dev_pixelpipe_cache_t *cache, const int k)
 {
-  // search for hash in cache
-  for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
+  return (cache->flags[k] & DT_DEV_PIXELPIPE_CACHE_HALF) ? cache->size[k] / 2 : cache->size[k];
+}
+
+static void _free_line(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(dt_hash_is_valid(cache->hash[k])) dt_cache_stats_eviction(&cache->stats);
+  _set_hash(cache, k, dt_hash_invalid);
+  dt_free_align(cache->data[k]);
+  cache->data[k] = NULL;
+  cache->memory -= _bytes(cache, k);
+  cache->size[k] = 0;
+  cache->used[k] = 0;
+  cache->flags[k] = 0;
+}
+
+// converts a float line to half floats in a buffer of half the size. returns 0 on success.
+static int _demote(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  uint16_t *half = (uint16_t *)dt_alloc_align(16, cache->size[k] / 2);
+  if(!half) return 1;
+  dt_float_to_half_buf(half, (const float *)cache->data[k], cache->size[k] / sizeof(float));
+  dt_free_align(cache->data[k]);
+  cache->data[k] = half;
+  cache->memory -= cache->size[k] / 2;
+  cache->flags[k] |= DT_DEV_PIXELPIPE_CACHE_HALF;
   return 0;
 }
 
-int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
+// and back, the line is about to be used. returns 0 on success.
+static int _promote(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  float *data = (float *)dt_alloc_align(16, cache->size[k]);
+  if(!data) return 1;
+  dt_half_to_float_buf(data, (const uint16_t *)cache->data[k], cache->size[k] / sizeof(float));
+  dt_free_align(cache->data[k]);
+  cache->data[k] = data;
+  cache->memory += cache->size[k] / 2;
+  cache->flags[k] &= ~DT_DEV_PIXELPIPE_CACHE_HALF;
+  return 0;
+}
+
+// converts the least recently used float line to half floats, except for the given and the pinned ones.
+// returns 0 if there was one.
+static int _demote_lru(dt_dev_pixelpipe_cache_t *cache, const int keep0, const int keep1)
+{
+  if(!cache->fp16) return 1;
+  int lru = -1;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(k == keep0 || k == keep1 || k == cache->pinned || !cache->data[k] || !dt_hash_is_valid(cache->hash[k])
+       || (cache->flags[k] & (DT_DEV_PIXELPIPE_CACHE_FLOAT | DT_DEV_PIXELPIPE_CACHE_HALF))
+              != DT_DEV_PIXELPIPE_CACHE_FLOAT)
+      continue;
+    if(lru < 0 || cache->used[k] < cache->used[lru]) lru = k;
+  }
+  return lru < 0 || _demote(cache, lru);
+}
+
+// least recently used line holding a buffer, except for the ones given and the pinned one.
+static int _lru_line(const dt_dev_pixelpipe_cache_t *cache, const int keep0, const int keep1)
+{
+  int lru = -1;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(k == keep0 || k == keep1 || k == cache->pinned || !cache->data[k]) continue;
+    if(lru < 0 || cache->used[k] < cache->used[lru]) lru = k;
+  }
+  return lru;
+}
+
+// frees memory until size more bytes fit into the budget: older float lines are halved first, then the
+// least recently used ones go.
+static void _make_room(dt_dev_pixelpipe_cache_t *cache, const size_t size, const int keep0, const int keep1)
+{
+  int lru;
+  while(cache->memory + size > cache->memory_limit && _demote_lru(cache, keep0, keep1) == 0)
+    ;
+  while(cache->memory + size > cache->memory_limit && (lru = _lru_line(cache, keep0, keep1)) >= 0)
+    _free_line(cache, lru);
+}
+
+// finds a line to hold a new buffer of the given size
+static int _find_line(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  // 1) an invalidated buffer which is large enough
+  int line = -1;
+  for(int k = 0; k < cache->entries; k++)
+    if(k != cache->last && k != cache->pinned && cache->data[k] && !dt_hash_is_valid(cache->hash[k])
+       && cache->size[k] >= size
+       && (line < 0 || cache->size[k] < cache->size[line]))
+      line = k;
+  if(line >= 0) return line;
+  // 2) an empty line, if there is budget for another buffer. halving older lines may make some.
+  while(cache->memory + size > cache->memory_limit && _demote_lru(cache, cache->last, -1) == 0)
+    ;
+  if(cache->memory + size <= cache->memory_limit)
+    for(int k = 0; k < cache->entries; k++)
+      if(!cache->data[k]) return k;
+  // 3) the least recently used line, but never the input of the module asking
+  line = _lru_line(cache, cache->last, -1);
+  if(line >= 0) return line;
+  // only the input is left. if there is another line, use it anyways.
+  for(int k = 0; k < cache->entries; k++)
+    if(k != cache->last && k != cache->pinned) return k;
+  return -1;
+}
+
+int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash)
+{
+  return _lookup(cache, hash) >= 0;
+}
+
+int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash,
                                          const size_t size, void **data)
 {
   return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, -cache->entries);
 }
 
-int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
+int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const size_t size,
                                void **data)
 {
   return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, 0);
 }
 
-int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
+int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash,
                                         const size_t size, void **data, int weight)
 {
-  cache->queries++;
+  const double trace_begin = dt_trace_clock();
+  // a negative weight makes the line look younger by as many accesses.
+  cache->clock++;
+  const uint64_t stamp = cache->clock > (uint64_t)MAX(weight, 0) ? cache->clock - weight : 0;
   *data = NULL;
-  int max_used = -1, max = 0;
-  size_t sz = 0;
-  for(int k = 0; k < cache->entries; k++)
+
+  int line = _lookup(cache, hash);
+  if(line >= 0 && (cache->flags[line] & DT_DEV_PIXELPIPE_CACHE_HALF))
   {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
+    // make room for the floats. if that fails, it's a miss and the line gets reused.
+    _make_room(cache, cache->size[line] / 2, cache->last, line);
+    if(_promote(cache, line))
     {
-      max_used = cache->used[k];
-      max = k;
+      _set_hash(cache, line, dt_hash_invalid);
+      line = -1;
     }
-    cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
+  }
+  if(line >= 0 && line == cache->pinned && cache->size[line] < size)
+  {
+    // the gui is still reading it, so it can't grow. another line will hold this hash.
+    _set_hash(cache, line, dt_hash_invalid);
+    line = -1;
+  }
+  if(line >= 0 && cache->size[line] >= size)
+  {
+    *data = cache->data[line];
+    cache->used[line] = stamp;
+    cache->last = line;
+    dt_cache_stats_hit(&cache->stats);
+    dt_trace_complete(DT_TRACE_CACHE, "pixelpipe hit", trace_begin);
+    return 0;
+  }
+
+  dt_cache_stats_miss(&cache->stats);
+  const double t0 = dt_cache_stats_time();
+  // reuse the line if the hash was found but the buffer is too small, so we never hold it twice.
+  if(line < 0)
+  {
+    line = _find_line(cache, size);
+    if(line < 0)
     {
-      *data = cache->data[k];
-      sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
+      fprintf(stderr, "[pixelpipe_cache_get] no cache lines!\n");
+      dt_trace_complete(DT_TRACE_CACHE, "pixelpipe miss", trace_begin);
+      return 1;
     }
+    if(cache->data[line] && dt_hash_is_valid(cache->hash[line])) dt_cache_stats_eviction(&cache->stats);
   }
-
-  if(!*data || sz < size)
+  _set_hash(cache, line, dt_hash_invalid);
+  if(cache->size[line] < size || (cache->flags[line] & DT_DEV_PIXELPIPE_CACHE_HALF))
   {
-    // kill LRU entry
-    // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
+    dt_free_align(cache->data[line]);
+    cache->memory -= _bytes(cache, line);
+    cache->flags[line] = 0;
+    // make room until the new buffer fits
+    _make_room(cache, size, cache->last, line);
+    // printf("[pixelpipe_cache_get] hash not found, allocating slot %d/%d age %d\n", line, cache->entries,
     // weight);
-    if(cache->size[max] < size)
+    cache->data[line] = (void *)dt_alloc_align(16, size);
+    cache->size[line] = cache->data[line] ? size : 0;
+    cache->memory += cache->size[line];
+    if(!cache->data[line])
     {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(16, size);
-      cache->size[max] = size;
+      fprintf(stderr, "[pixelpipe_cache_get] could not allocate %zu bytes!\n", size);
+      cache->used[line] = 0;
+      dt_trace_complete(DT_TRACE_CACHE, "pixelpipe miss", trace_begin);
+      return 1;
     }
-    *data = cache->data[max];
-    cache->hash[max] = hash;
-    cache->used[max] = weight;
-    cache->misses++;
-    return 1;
   }
-  else
-    return 0;
+  *data = cache->data[line];
+  _set_hash(cache, line, hash);
+  // whoever fills it tells us what it is
+  cache->flags[line] = 0;
+  cache->used[line] = stamp;
+  cache->last = line;
+  dt_cache_stats_alloc(&cache->stats, t0);
+  dt_trace_complete(DT_TRACE_CACHE, "pixelpipe miss", trace_begin);
+  return 1;
 }
 
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
+  g_hash_table_remove_all(cache->index);
   for(int k = 0; k < cache->entries; k++)
   {
-    cache->hash[k] = -1;
+    cache->hash[k] = dt_hash_invalid;
     cache->used[k] = 0;
   }
+  cache->last = -1;
+}
+
+int dt_dev_pixelpipe_cache_resize(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  int failed = 0;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(k == cache->pinned || (cache->data[k] && cache->size[k] == size)) continue;
+    _free_line(cache, k);
+    cache->data[k] = dt_alloc_align(16, size);
+    if(!cache->data[k])
+    {
+      failed++;
+      continue;
+    }
+    cache->size[k] = size;
+    cache->memory += size;
+  }
+  cache->memory_limit = MAX(cache->memory_limit, cache->entries * size);
+  cache->last = -1;
+  return failed;
 }
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
@@ -190,31 +454,323 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
   {
     if(cache->data[k] == data)
     {
-      cache->used[k] = -cache->entries;
+      cache->used[k] = cache->clock + cache->entries;
     }
   }
 }
 
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  cache->pinned = -1;
+  for(int k = 0; k < cache->entries; k++)
+    if(data && cache->data[k] == data) cache->pinned = k;
+}
+
+void dt_dev_pixelpipe_cache_mark_float(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) cache->flags[k] |= DT_DEV_PIXELPIPE_CACHE_FLOAT;
+}
+
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
   for(int k = 0; k < cache->entries; k++)
   {
     if(cache->data[k] == data)
     {
-      cache->hash[k] = -1;
+      _set_hash(cache, k, dt_hash_invalid);
+      // first to be reused
+      cache->used[k] = 0;
+    }
+  }
+}
+
+size_t dt_dev_pixelpipe_cache_resident(const dt_dev_pixelpipe_cache_t *cache)
+{
+  return cache->memory;
+}
+
+#ifndef DT_UNIT_TEST
+static void _disk_dirname(char *dirname, size_t size)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(dirname, size, "%s/pixelpipe", cachedir);
+}
+
+static void _disk_filename(const dt_hash_t hash, char *filename, size_t size)
+{
+  char dirname[PATH_MAX] = { 0 };
+  _disk_dirname(dirname, sizeof(dirname));
+  snprintf(filename, size, "%s/%016" PRIx64 "%016" PRIx64 ".pp", dirname, hash.h1, hash.h2);
+}
+
+static dt_hash_t _disk_version()
+{
+  return dt_hash(dt_hash_seed(DT_PIXELPIPE_CACHE_DISK_VERSION), PACKAGE_VERSION, strlen(PACKAGE_VERSION));
+}
+
+// runs all of the input through the (de)compressor. returns the number of bytes written,
+// or 0 if that failed or did not fit into out.
+static size_t _disk_convert(GConverter *converter, const void *in, const size_t in_size, void *out,
+                            const size_t out_size)
+{
+  size_t in_done = 0, out_done = 0;
+  while(1)
+  {
+    gsize bytes_read = 0, bytes_written = 0;
+    const GConverterResult res = g_converter_convert(
+        converter, (const char *)in + in_done, in_size - in_done, (char *)out + out_done, out_size - out_done,
+        G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, NULL);
+    in_done += bytes_read;
+    out_done += bytes_written;
+    if(res == G_CONVERTER_FINISHED) return out_done;
+    if(res == G_CONVERTER_ERROR) return 0;
+  }
+}
+
+typedef struct _disk_entry_t
+{
+  time_t mtime;
+  int64_t size;
+  gchar *filename;
+} _disk_entry_t;
+
+static gint _disk_entry_cmp(gconstpointer a, gconstpointer b)
+{
+  const _disk_entry_t *ea = (const _disk_entry_t *)a;
+  const _disk_entry_t *eb = (const _disk_entry_t *)b;
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+static void _disk_entry_free(gpointer data)
+{
+  _disk_entry_t *e = (_disk_entry_t *)data;
+  g_free(e->filename);
+  free(e);
+}
+
+// evict the least recently used buffers until the directory fits the quota.
+static void _disk_trim(const int64_t quota)
+{
+  char dirname[PATH_MAX] = { 0 };
+  _disk_dirname(dirname, sizeof(dirname));
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  if(!dir) return;
+  GList *entries = NULL;
+  int64_t used = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
+  {
+    if(!g_str_has_suffix(name, ".pp")) continue;
+    gchar *filename = g_build_filename(dirname, name, NULL);
+    struct stat st;
+    if(stat(filename, &st) || !S_ISREG(st.st_mode))
+    {
+      g_free(filename);
+      continue;
     }
+    _disk_entry_t *e = (_disk_entry_t *)malloc(sizeof(_disk_entry_t));
+    e->mtime = st.st_mtime;
+    e->size = st.st_size;
+    e->filename = filename;
+    entries = g_list_prepend(entries, e);
+    used += st.st_size;
   }
+  g_dir_close(dir);
+
+  if(used > quota)
+  {
+    // leave some headroom, so we don't have to do this again on the next shutdown.
+    const int64_t target = quota - quota / 10;
+    entries = g_list_sort(entries, _disk_entry_cmp);
+    for(GList *l = entries; l && used > target; l = g_list_next(l))
+    {
+      _disk_entry_t *e = (_disk_entry_t *)l->data;
+      if(!g_unlink(e->filename)) used -= e->size;
+    }
+    dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache] trimmed disk cache `%s' to %.2f MB\n", dirname,
+             used / (1024.0 * 1024.0));
+  }
+  g_list_free_full(entries, _disk_entry_free);
 }
 
+void dt_dev_pixelpipe_cache_disk_init(dt_dev_pixelpipe_cache_t *cache)
+{
+  cache->disk = 0;
+  if(!dt_conf_get_bool("pixelpipe_disk_cache") || dt_conf_get_int64("pixelpipe_disk_cache_size") <= 0) return;
+  char dirname[PATH_MAX] = { 0 };
+  _disk_dirname(dirname, sizeof(dirname));
+  if(g_mkdir_with_parents(dirname, 0750) == -1)
+  {
+    fprintf(stderr, "[pixelpipe_cache] could not create directory `%s', disabling disk cache\n", dirname);
+    return;
+  }
+  gchar *modules = dt_conf_get_string("pixelpipe_disk_cache_modules");
+  g_strfreev(cache->disk_modules);
+  cache->disk_modules = g_strsplit(modules ? modules : "", ",", -1);
+  g_free(modules);
+  for(gchar **m = cache->disk_modules; *m; m++) g_strstrip(*m);
+  cache->disk = 1;
+}
+
+int dt_dev_pixelpipe_cache_disk_wanted(const dt_dev_pixelpipe_cache_t *cache, const char *op)
+{
+  if(!cache->disk) return 0;
+  for(gchar **m = cache->disk_modules; *m; m++)
+    if(!strcmp(*m, op)) return 1;
+  return 0;
+}
+
+int dt_dev_pixelpipe_cache_disk_get(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const size_t size,
+                                    void **data, float *processed_maximum)
+{
+  *data = NULL;
+  if(!cache->disk) return 1;
+  const double trace_begin = dt_trace_clock();
+  char filename[PATH_MAX] = { 0 };
+  _disk_filename(hash, filename, sizeof(filename));
+  gchar *contents = NULL;
+  gsize length = 0;
+  if(!g_file_get_contents(filename, &contents, &length, NULL))
+  {
+    dt_trace_complete(DT_TRACE_CACHE, "disk miss", trace_begin);
+    return 1;
+  }
+
+  const dt_dev_pixelpipe_cache_disk_header_t *head = (const dt_dev_pixelpipe_cache_disk_header_t *)contents;
+  const size_t n = size / sizeof(float);
+  uint16_t *half = NULL;
+  if(length < sizeof(*head) || head->magic != DT_PIXELPIPE_CACHE_DISK_MAGIC + DT_PIXELPIPE_CACHE_DISK_VERSION
+     || !dt_hash_equal(head->hash, hash) || !dt_hash_equal(head->version, _disk_version())
+     || head->size != size || head->length != length - sizeof(*head))
+    goto stale;
+
+  (void)dt_dev_pixelpipe_cache_get(cache, hash, size, data);
+  if(!*data) goto error;
+  if(head->compressed)
+  {
+    half = (uint16_t *)malloc(n * sizeof(uint16_t));
+    if(!half) goto error;
+    GConverter *decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    const size_t decompressed = _disk_convert(decompressor, head + 1, head->length, half, n * sizeof(uint16_t));
+    g_object_unref(decompressor);
+    if(decompressed != n * sizeof(uint16_t)) goto stale;
+    dt_half_to_float_buf((float *)*data, half, n);
+  }
+  else
+  {
+    if(head->length != n * sizeof(uint16_t)) goto stale;
+    dt_half_to_float_buf((float *)*data, (const uint16_t *)(head + 1), n);
+  }
+  for(int k = 0; k < 3; k++) processed_maximum[k] = head->processed_maximum[k];
+  dt_dev_pixelpipe_cache_mark_float(cache, *data);
+  free(half);
+  g_free(contents);
+  // trimming goes by modification time, so mark it as recently used
+  g_utime(filename, NULL);
+  dt_trace_complete(DT_TRACE_CACHE, "disk hit", trace_begin);
+  return 0;
+
+stale:
+  // outdated or broken, will be computed and written anew.
+  dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache] dropping stale buffer `%s'\n", filename);
+  g_unlink(filename);
+error:
+  if(*data) dt_dev_pixelpipe_cache_invalidate(cache, *data);
+  *data = NULL;
+  free(half);
+  g_free(contents);
+  dt_trace_complete(DT_TRACE_CACHE, "disk miss", trace_begin);
+  return 1;
+}
+
+typedef struct _disk_job_t
+{
+  dt_dev_pixelpipe_cache_disk_header_t head;
+  uint16_t half[];
+} _disk_job_t;
+
+static int32_t _disk_write_job_run(dt_job_t *job)
+{
+  _disk_job_t *params = (_disk_job_t *)dt_control_job_get_params(job);
+  const size_t length = params->head.size / sizeof(float) * sizeof(uint16_t);
+  dt_dev_pixelpipe_cache_disk_header_t *head
+      = (dt_dev_pixelpipe_cache_disk_header_t *)malloc(sizeof(*head) + length);
+  if(!head) goto error;
+  *head = params->head;
+  // fastest deflate level, most of the gain comes from the halves anyways. if that doesn't make it
+  // any smaller, store them as they are.
+  GConverter *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+  head->length = _disk_convert(compressor, params->half, length, head + 1, length);
+  g_object_unref(compressor);
+  head->compressed = head->length > 0;
+  if(!head->compressed)
+  {
+    memcpy(head + 1, params->half, length);
+    head->length = length;
+  }
+
+  char filename[PATH_MAX] = { 0 };
+  _disk_filename(head->hash, filename, sizeof(filename));
+  if(g_file_set_contents(filename, (const gchar *)head, sizeof(*head) + head->length, NULL))
+    __sync_fetch_and_add(&_disk_written, (int64_t)(sizeof(*head) + head->length));
+  else
+    dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache] could not write `%s'\n", filename);
+
+error:
+  free(head);
+  free(params);
+  return 0;
+}
+
+void dt_dev_pixelpipe_cache_disk_put(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const void *data,
+                                     const size_t size, const float *processed_maximum)
+{
+  if(!cache->disk) return;
+  char filename[PATH_MAX] = { 0 };
+  _disk_filename(hash, filename, sizeof(filename));
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+
+  // the pipe will overwrite the buffer soon, so convert it now.
+  const size_t n = size / sizeof(float);
+  _disk_job_t *params = (_disk_job_t *)malloc(sizeof(_disk_job_t) + n * sizeof(uint16_t));
+  if(!params) return;
+  params->head.magic = DT_PIXELPIPE_CACHE_DISK_MAGIC + DT_PIXELPIPE_CACHE_DISK_VERSION;
+  params->head.compressed = 0;
+  params->head.hash = hash;
+  params->head.version = _disk_version();
+  params->head.size = size;
+  params->head.length = 0;
+  for(int k = 0; k < 3; k++) params->head.processed_maximum[k] = processed_maximum[k];
+  dt_float_to_half_buf(params->half, (const float *)data, n);
+
+  dt_job_t *job = dt_control_job_create(&_disk_write_job_run, "write pixelpipe cache");
+  if(!job)
+  {
+    free(params);
+    return;
+  }
+  dt_control_job_set_params(job, params);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+#endif
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
   {
+    if(!cache->data[k]) continue;
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
+    printf("used %" PRIu64 " by %016" PRIx64 "%016" PRIx64 " (%.2f MB%s)", cache->used[k],
+           cache->hash[k].h1, cache->hash[k].h2, _bytes(cache, k) / (1024.0 * 1024.0),
+           (cache->flags[k] & DT_DEV_PIXELPIPE_CACHE_HALF) ? ", half" : "");
     printf("\n");
   }
-  printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
+  printf("cache memory %.2f/%.2f MB\n", cache->memory / (1024.0 * 1024.0),
+         cache->memory_limit / (1024.0 * 1024.0));
+  printf("cache hit rate so far: %.3f\n",
+         cache->stats.hits / (float)(cache->stats.hits + cache->stats.misses));
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
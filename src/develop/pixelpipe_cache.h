@@ -18,61 +18,133 @@
 #ifndef DT_PIXELPIPE_CACHE_H
 #define DT_PIXELPIPE_CACHE_H
 
+#include "common/cache_stats.h"
+#include "common/hash.h"
+
+#include <glib.h>
 #include <inttypes.h>
+#include <stddef.h>
+
+// upper bound on the number of cache lines of one pipe
+#define DT_DEV_PIXELPIPE_CACHE_MAX_LINES 64
+
 /**
- * implements a simple pixel cache suitable for caching float images
+ * implements a pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ * cache lines are of variable size and looked up through a hash table, the
+ * total size of all lines is limited by a memory budget. if there is no space
+ * left, the least recently used lines are freed.
+ * the pipe using this cache has to serialise access (busy_mutex).
  */
 struct dt_dev_pixelpipe_t;
 typedef struct dt_dev_pixelpipe_cache_t
 {
-  int32_t entries;
+  int32_t entries; // number of cache lines, some of them may not hold a buffer
   void **data;
   size_t *size;
-  uint64_t *hash;
-  int32_t *used;
+  dt_hash_t *hash;
+  uint64_t *used; // time stamp of the last access, for lru
+  int32_t *flags; // what the line holds, see dt_dev_pixelpipe_cache_mark_float()
+  // maps hash -> line index + 1
+  GHashTable *index;
+  // clock ticking with every access
+  uint64_t clock;
+  // line returned last, i.e. the input of the module asking next
+  int32_t last;
+  // line the gui is drawing from (pipe->backbuf), its buffer is neither freed nor written to
+  int32_t pinned;
+  // bytes allocated for all lines, and the budget for that
+  size_t memory;
+  size_t memory_limit;
+  // store float lines nobody is using right now as half floats, instead of evicting them
+  int fp16;
 #ifdef HAVE_OPENCL
   void **gpu_mem;
 #endif
-  // profiling:
-  uint64_t queries;
-  uint64_t misses;
+  // profiling, see common/cache_stats.h:
+  dt_cache_stats_t stats;
+  // optional disk tier for the outputs of a few expensive modules, see dt_dev_pixelpipe_cache_disk_init()
+  int disk;
+  gchar **disk_modules;
 } dt_dev_pixelpipe_cache_t;
 
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+  these are allocated up front, unless size is 0. if memory_limit is larger than that, more lines will be
+  allocated on demand as long as their sizes sum up to less than memory_limit bytes.
   \param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 struct dt_iop_roi_t;
-/** creates a hopefully unique hash from the complete module stack up to the module-th. */
-uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
-                                     struct dt_dev_pixelpipe_t *pipe, int module);
+struct dt_dev_pixelpipe_iop_t;
+/** updates the chained hashes of all pieces of the pipe, from the image id, the parameters of each
+  * piece and its predecessor. has to be called before processing, with the busy_mutex held. */
+void dt_dev_pixelpipe_cache_chain_hashes(struct dt_dev_pixelpipe_t *pipe);
+
+/** returns the key for the output of the given piece (or the input, if NULL) at the given region
+  * of interest, in O(1). needs dt_dev_pixelpipe_cache_chain_hashes() first. */
+dt_hash_t dt_dev_pixelpipe_cache_key(const struct dt_dev_pixelpipe_t *pipe,
+                                     const struct dt_dev_pixelpipe_iop_t *piece,
+                                     const struct dt_iop_roi_t *roi);
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
-  * cache line, the least recently used cache line will be cleared and an empty buffer is returned
-  * together with a non-zero return value. */
-int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
+  * cache line, the least recently used cache lines will be cleared to make room for the requested size,
+  * and an empty buffer is returned together with a non-zero return value.
+  * the most recently used line (the input of the module asking) and the pinned one are never evicted. */
+int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const size_t size,
                                void **data);
-int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
+int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash,
                                          const size_t size, void **data);
-int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
+int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash,
                                         const size_t size, void **data, int weight);
 
 /** test availability of a cache line without destroying another, if it is not found. */
-int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
+int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash);
 
 /** invalidates all cachelines. */
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 
+/** replaces the buffers of all lines, also of the ones without, by empty ones of the given size, for a
+  * pipe which will only ask for that much from now on. meant for caches of a fixed number of lines.
+  * returns the number of lines it could not allocate. */
+int dt_dev_pixelpipe_cache_resize(dt_dev_pixelpipe_cache_t *cache, const size_t size);
+
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** keeps the line holding data as it is until the next call, because another thread reads it
+  * (pipe->backbuf). NULL releases it. */
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data);
+
+/** tells the cache that the line holds floats, so it may store it as half floats while it isn't used
+  * (pixelpipe_cache_fp16). it is converted back on the next hit. */
+void dt_dev_pixelpipe_cache_mark_float(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** total size of all cache lines, in bytes. */
+size_t dt_dev_pixelpipe_cache_resident(const dt_dev_pixelpipe_cache_t *cache);
+
+/** enables the disk tier if pixelpipe_disk_cache is set. the outputs of the modules listed in
+  * pixelpipe_disk_cache_modules are then kept as compressed half floats in the user cache directory,
+  * so they survive switching images and restarts. only for the darkroom pipes. */
+void dt_dev_pixelpipe_cache_disk_init(dt_dev_pixelpipe_cache_t *cache);
+
+/** returns non-zero if the output of the given operation goes to disk. */
+int dt_dev_pixelpipe_cache_disk_wanted(const dt_dev_pixelpipe_cache_t *cache, const char *op);
+
+/** looks for the float buffer of the given hash and size on disk. on success, returns 0 and data points
+  * to a cache line holding the buffer, as if it came from dt_dev_pixelpipe_cache_get(). */
+int dt_dev_pixelpipe_cache_disk_get(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const size_t size,
+                                    void **data, float *processed_maximum);
+
+/** writes a float buffer to disk. the buffer is converted right away, compressing and writing happens
+  * in a background job. */
+void dt_dev_pixelpipe_cache_disk_put(dt_dev_pixelpipe_cache_t *cache, const dt_hash_t hash, const void *data,
+                                     const size_t size, const float *processed_maximum);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
@@ -20,6 +20,7 @@
 #include "develop/blend.h"
 #include "develop/tiling.h"
 #include "gui/gtk.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "common/opencl.h"
@@ -29,6 +30,7 @@
 #include "iop/colorout.h"
 #include "common/colorspaces.h"
 #include "common/histogram.h"
+#include "common/trace.h"
 
 #include <assert.h>
 #include <string.h>
@@ -78,45 +80,82 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
-int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels)
+// records what ran on this pipe since begin, with the pipe type in the name so the
+// darkroom and export pipes can be told apart in the trace
+static void _pixelpipe_trace(const dt_dev_pixelpipe_t *pipe, const char *what, const double begin)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  if(!dt_trace_enabled) return;
+  char name[64];
+  snprintf(name, sizeof(name), "%s [%s]", what, _pipe_type_to_str(pipe->type));
+  dt_trace_complete(DT_TRACE_PIPE, name, begin);
+}
+
+// export and thumbnail pipes alive at the moment. they share the host memory for tiling.
+static int _offscreen_pipes = 0;
+
+static int _offscreen(const int res)
+{
+  if(res) __sync_fetch_and_add(&_offscreen_pipes, 1);
+  return res;
+}
+
+int dt_dev_pixelpipe_offscreen_count()
+{
+  return MAX(1, __sync_fetch_and_add(&_offscreen_pipes, 0));
+}
+
+int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int levels)
+{
+  // the two lines get their buffers from dt_dev_pixelpipe_alloc_export(), once it's known how much they hold.
+  int res = dt_dev_pixelpipe_init_cached(pipe, 0, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_EXPORT;
   pipe->levels = levels;
-  return res;
+  return _offscreen(res);
+}
+
+int dt_dev_pixelpipe_alloc_export(dt_dev_pixelpipe_t *pipe, const int band_height)
+{
+  // a band of the input is all the modules will ask for when streaming, the ones which look around the
+  // band get theirs a bit larger on first use.
+  pipe->backbuf_size = 4 * sizeof(float) * pipe->iwidth * (band_height ? band_height : pipe->iheight);
+  return !dt_dev_pixelpipe_cache_resize(&pipe->cache, pipe->backbuf_size);
 }
 
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
-  return res;
+  return _offscreen(res);
 }
 
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
-  return res;
+  return _offscreen(res);
 }
 
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   int res = dt_dev_pixelpipe_init_cached(
-      pipe, 4 * sizeof(float) * darktable.thumbnail_width * darktable.thumbnail_height, 5);
+      pipe, 4 * sizeof(float) * darktable.thumbnail_width * darktable.thumbnail_height, 5,
+      dt_conf_get_int64("pixelpipe_cache_memory"));
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
+  if(res) dt_dev_pixelpipe_cache_disk_init(&(pipe->cache));
   return res;
 }
 
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
   int res = dt_dev_pixelpipe_init_cached(
-      pipe, 4 * sizeof(float) * darktable.thumbnail_width * darktable.thumbnail_height, 5);
+      pipe, 4 * sizeof(float) * darktable.thumbnail_width * darktable.thumbnail_height, 5,
+      dt_conf_get_int64("pixelpipe_cache_memory"));
   pipe->type = DT_DEV_PIXELPIPE_FULL;
+  if(res) dt_dev_pixelpipe_cache_disk_init(&(pipe->cache));
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -124,13 +163,15 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size, memory_limit)) return 0;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
+  pipe->bands = 0;
+  pipe->band_expanding = NULL;
   pipe->mask_display = 0;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
@@ -160,6 +201,8 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
+  if(pipe->type == DT_DEV_PIXELPIPE_EXPORT || pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+    __sync_fetch_and_sub(&_offscreen_pipes, 1);
 }
 
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
@@ -209,8 +252,9 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->module = module;
       piece->pipe = pipe;
       piece->data = NULL;
-      piece->hash = 0;
+      piece->hash = piece->chain_hash = (dt_hash_t){ 0, 0 };
       piece->process_cl_ready = 0;
+      piece->process_time = 0.0;
       dt_iop_init_pipe(piece->module, pipe, piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -246,7 +290,7 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   while(nodes)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-    piece->hash = 0;
+    piece->hash = (dt_hash_t){ 0, 0 };
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
                          pipe, piece);
@@ -678,6 +722,266 @@ static void pixelpipe_picker_cl(int devid, dt_iop_module_t *module, cl_mem img,
 #endif
 
 
+// longest run of point-wise modules done in one pass
+#define DT_PIXELPIPE_FUSE_MAX 16
+// size of a row band per thread, small enough for the band to stay in cache from one module to the next
+#define DT_PIXELPIPE_FUSE_BAND_BYTES (256 << 10)
+
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, int *out_bpp, const dt_iop_roi_t *roi_out,
+                                        GList *modules, GList *pieces, int pos);
+
+// process_rec passes these through to their input
+static int _pixelpipe_skip_piece(dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  return !piece->enabled
+         || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags());
+}
+
+// can this piece be run on row bands, as part of a fused run? anything which needs the whole
+// buffer at once (blending, histograms, the color picker) rules it out.
+static int _pixelpipe_fusable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                              dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out)
+{
+  if(!(module->flags() & IOP_FLAGS_POINTWISE)) return 0;
+  if(get_output_bpp(module, pipe, piece, dev) != 4 * sizeof(float)) return 0;
+  const dt_develop_blend_params_t *d = (dt_develop_blend_params_t *)piece->blendop_data;
+  if(d && (d->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if((dev->gui_attached || !(module->request_histogram & DT_REQUEST_ONLY_IN_GUI))
+     && (module->request_histogram_source & pipe->type) && (module->request_histogram & DT_REQUEST_ON))
+    return 0;
+  // the focused module picks colors and has its input reweighted in the cache
+  if(module == dev->gui_module) return 0;
+  // the output is supposed to go to disk, so it needs a buffer of its own
+  if(dt_dev_pixelpipe_cache_disk_wanted(&(pipe->cache), module->op)) return 0;
+  dt_iop_roi_t roi_in;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  return roi_in.x == roi_out->x && roi_in.y == roi_out->y && roi_in.width == roi_out->width
+         && roi_in.height == roi_out->height && roi_in.scale == roi_out->scale;
+}
+
+// runs the point-wise modules ending at the given one in a single pass over row bands, so the
+// intermediate results never leave the cache. only the output of the last module ends up in the
+// pixelpipe cache. returns -1 if there is no run of at least two modules here, otherwise like process_rec.
+static int _pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                    const dt_iop_roi_t *roi_out, const dt_hash_t hash, const size_t bufsize,
+                                    GList *modules, GList *pieces, int pos)
+{
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return -1;
+#endif
+  if(pipe->mask_display) return -1;
+
+  dt_iop_module_t *chain[DT_PIXELPIPE_FUSE_MAX];
+  dt_dev_pixelpipe_iop_t *chain_pieces[DT_PIXELPIPE_FUSE_MAX];
+  int cnt = 0;
+  GList *first_module = modules, *first_piece = pieces;
+  int first_pos = pos;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  // walk upstream for as long as there are point-wise modules. a cached output ends the run,
+  // there is no need to compute that one again.
+  GList *m = modules, *p = pieces;
+  for(int m_pos = pos; m && cnt < DT_PIXELPIPE_FUSE_MAX;
+      m = g_list_previous(m), p = g_list_previous(p), m_pos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(_pixelpipe_skip_piece(dev, module, piece)) continue;
+    if(!_pixelpipe_fusable(pipe, dev, module, piece, roi_out)) break;
+    if(cnt
+       && dt_dev_pixelpipe_cache_available(&(pipe->cache), dt_dev_pixelpipe_cache_key(pipe, piece, roi_out)))
+      break;
+    chain[cnt] = module;
+    chain_pieces[cnt] = piece;
+    cnt++;
+    first_module = m;
+    first_piece = p;
+    first_pos = m_pos;
+  }
+  // the input of the run has to be floats, too
+  m = g_list_previous(first_module);
+  p = g_list_previous(first_piece);
+  while(m && _pixelpipe_skip_piece(dev, (dt_iop_module_t *)m->data, (dt_dev_pixelpipe_iop_t *)p->data))
+  {
+    m = g_list_previous(m);
+    p = g_list_previous(p);
+  }
+  const int in_bpp = get_output_bpp(m ? (dt_iop_module_t *)m->data : NULL, pipe,
+                                    p ? (dt_dev_pixelpipe_iop_t *)p->data : NULL, dev);
+  if(cnt < 2 || in_bpp != 4 * sizeof(float))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return -1;
+  }
+
+  // every thread gets a few rows of each band. the modules' own loops are scheduled statically, so
+  // a thread keeps working on the same rows from one module to the next.
+  const size_t row = (size_t)4 * roi_out->width;
+  const int threads = dt_get_num_threads();
+  const int band = MIN(roi_out->height,
+                       MAX(threads, DT_PIXELPIPE_FUSE_BAND_BYTES * (size_t)threads / (sizeof(float) * row)));
+  float *scratch[2];
+  scratch[0] = dt_alloc_align(64, sizeof(float) * row * band);
+  scratch[1] = dt_alloc_align(64, sizeof(float) * row * band);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(!scratch[0] || !scratch[1])
+  {
+    if(scratch[0]) dt_free_align(scratch[0]);
+    if(scratch[1]) dt_free_align(scratch[1]);
+    return -1;
+  }
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &bpp, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos - 1))
+  {
+    dt_free_align(scratch[0]);
+    dt_free_align(scratch[1]);
+    return 1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    dt_free_align(scratch[0]);
+    dt_free_align(scratch[1]);
+    return 1;
+  }
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+  dt_dev_pixelpipe_cache_mark_float(&(pipe->cache), *output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  const double trace_begin = dt_trace_clock();
+  for(int y = 0; y < roi_out->height && !pipe->shutdown; y += band)
+  {
+    dt_iop_roi_t roi = *roi_out;
+    roi.y += y;
+    roi.height = MIN(band, roi_out->height - y);
+    void *in = (float *)input + row * y;
+    for(int k = cnt - 1; k >= 0; k--)
+    {
+      void *out = k ? (void *)scratch[k & 1] : (void *)((float *)*output + row * y);
+      const double begin = dt_get_wtime();
+      chain[k]->process(chain[k], chain_pieces[k], in, out, &roi, &roi);
+      chain_pieces[k]->process_time += dt_get_wtime() - begin;
+      in = out;
+    }
+  }
+  dt_free_align(scratch[0]);
+  dt_free_align(scratch[1]);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  // point-wise modules leave the processed maximum alone
+  for(int k = 0; k < cnt; k++)
+    for(int c = 0; c < 3; c++) chain_pieces[k]->processed_maximum[c] = pipe->processed_maximum[c];
+
+  gchar *first_label = dt_history_item_get_name(chain[cnt - 1]);
+  gchar *last_label = dt_history_item_get_name(chain[0]);
+  dt_show_times(&start, "[dev_pixelpipe]", "processed %d modules `%s' to `%s' fused on CPU [%s]", cnt,
+                first_label, last_label, _pipe_type_to_str(pipe->type));
+  if(dt_trace_enabled)
+  {
+    char what[64];
+    snprintf(what, sizeof(what), "%s..%s", chain[cnt - 1]->op, chain[0]->op);
+    _pixelpipe_trace(pipe, what, trace_begin);
+  }
+  g_free(first_label);
+  g_free(last_label);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+
+// in bands, a module which looks at neighbouring pixels computes the rows around the band as well, which
+// are cut off afterwards. this way the band edges are no image edges to it. the rows it needs from its
+// input for that are then found by modify_roi_in() as usual. returns -1 if nothing needs to be added.
+static int _pixelpipe_process_band_overlap(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                           void **cl_mem_output, int *out_bpp, const dt_iop_roi_t *roi_out,
+                                           GList *modules, GList *pieces, int pos)
+{
+  dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+  // this is the call for the wider band
+  if(pipe->band_expanding == piece)
+  {
+    pipe->band_expanding = NULL;
+    return -1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  dt_iop_roi_t roi_in;
+  dt_develop_tiling_t tiling = { 0 };
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  module->tiling_callback(module, piece, &roi_in, roi_out, &tiling);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(!tiling.overlap) return -1;
+
+  const int full_height = piece->buf_out.height * roi_out->scale + .5f;
+  const int end = roi_out->y + roi_out->height;
+  dt_iop_roi_t roi_ext = *roi_out;
+  roi_ext.y = MIN(roi_out->y, MAX(0, roi_out->y - (int)tiling.overlap));
+  roi_ext.height = MAX(end, MIN(full_height, end + (int)tiling.overlap)) - roi_ext.y;
+  if(roi_ext.y == roi_out->y && roi_ext.height == roi_out->height) return -1;
+
+  void *ext = NULL;
+  void *cl_mem_ext = NULL;
+  int bpp;
+  pipe->band_expanding = piece;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &ext, &cl_mem_ext, &bpp, &roi_ext, modules, pieces, pos))
+    return 1;
+  *out_bpp = bpp;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+#ifdef HAVE_OPENCL
+  if(cl_mem_ext != NULL)
+  {
+    cl_int err
+        = dt_opencl_copy_device_to_host(pipe->devid, ext, cl_mem_ext, roi_ext.width, roi_ext.height, bpp);
+    dt_opencl_release_mem_object(cl_mem_ext);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't copy back band of module %s\n", module->op);
+      pipe->opencl_error = 1;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+  }
+#endif
+  // the wider buffer was the last one handed out, so the cache won't give it to us again here
+  const size_t stride = (size_t)bpp * roi_out->width;
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), dt_dev_pixelpipe_cache_key(pipe, piece, roi_out),
+                                   stride * roi_out->height, output);
+  memcpy(*output, (char *)ext + stride * (roi_out->y - roi_ext.y), stride * roi_out->height);
+  if(bpp == 4 * sizeof(float)) dt_dev_pixelpipe_cache_mark_float(&(pipe->cache), *output);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, int *out_bpp, const dt_iop_roi_t *roi_out,
@@ -701,6 +1005,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                           g_list_previous(modules), g_list_previous(pieces), pos - 1);
   }
 
+  if(modules && pipe->bands)
+  {
+    const int res = _pixelpipe_process_band_overlap(pipe, dev, output, cl_mem_output, out_bpp, roi_out,
+                                                    modules, pieces, pos);
+    if(res >= 0) return res;
+  }
+
   const int bpp = get_output_bpp(module, pipe, piece, dev);
   *out_bpp = bpp;
   const size_t bufsize = (size_t)bpp * roi_out->width * roi_out->height;
@@ -712,7 +1023,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     return 1;
   }
-  uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
+  const dt_hash_t hash = dt_dev_pixelpipe_cache_key(pipe, piece, roi_out);
   if(dt_dev_pixelpipe_cache_available(&(pipe->cache), hash))
   {
     // if(module) printf("found valid buf pos %d in cache for module %s %s %lu\n", pos, module->op, pipe ==
@@ -728,8 +1039,15 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     // go to post-collect directly:
     goto post_process_collect_info;
   }
-  else
+  // not in memory, but maybe still on disk from an earlier session:
+  if(module && bpp == 4 * sizeof(float) && dt_dev_pixelpipe_cache_disk_wanted(&(pipe->cache), module->op)
+     && !dt_dev_pixelpipe_cache_disk_get(&(pipe->cache), hash, bufsize, output, piece->processed_maximum))
+  {
+    for(int k = 0; k < 3; k++) pipe->processed_maximum[k] = piece->processed_maximum[k];
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    goto post_process_collect_info;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
   // 2) if history changed or exit event, abort processing?
   // preview pipe: abort on all but zoom events (same buffer anyways)
@@ -741,6 +1059,14 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
 
   // 3) input -> output
+  // runs of point-wise modules are done in one pass
+  if(modules)
+  {
+    const int fused
+        = _pixelpipe_process_fused(pipe, dev, output, roi_out, hash, bufsize, modules, pieces, pos);
+    if(fused > 0) return 1;
+    if(fused == 0) goto post_process_collect_info;
+  }
   if(!modules)
   {
     // 3a) import input array with given scale and roi
@@ -752,6 +1078,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
     dt_times_t start;
     dt_get_times(&start);
+    const double trace_begin = dt_trace_clock();
     if(!dt_dev_pixelpipe_uses_downsampled_input(pipe)) // we're looking for the full buffer
     {
       if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width
@@ -761,7 +1088,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
       else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output))
       {
-        memset(*output, 0, pipe->backbuf_size);
+        memset(*output, 0, bufsize);
         if(roi_in.scale == 1.0f)
         {
           // fast branch for 1:1 pixel copies.
@@ -811,6 +1138,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
     }
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    _pixelpipe_trace(pipe, "input", trace_begin);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
@@ -845,6 +1173,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output);
     else
       (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+    if(bpp == 4 * sizeof(float)) dt_dev_pixelpipe_cache_mark_float(&(pipe->cache), *output);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
 // if(module) printf("reserving new buf in cache for module %s %s: %ld buf %p\n", module->op, pipe ==
@@ -900,6 +1229,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     dt_times_t start;
     dt_get_times(&start);
+    const double trace_begin = dt_trace_clock();
 
     dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
 
@@ -1729,8 +2059,19 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             : pixelpipe_flow & PIXELPIPE_FLOW_BLENDED_ON_CPU ? "CPU" : "",
         _pipe_type_to_str(pipe->type));
     g_free(module_label);
+    piece->process_time += dt_get_wtime() - start.clock;
+    _pixelpipe_trace(pipe, module->op, trace_begin);
     // in case we get this buffer from the cache, also get the processed max:
     for(int k = 0; k < 3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
+    // keep expensive results for the next time this image is opened. skip the buffer if the history
+    // changed while we were processing, it might not belong to the hash any more.
+    if(bpp == 4 * sizeof(float) && pipe->changed == DT_DEV_PIPE_UNCHANGED
+       && dt_dev_pixelpipe_cache_disk_wanted(&(pipe->cache), module->op)
+#ifdef HAVE_OPENCL
+       && *cl_mem_output == NULL
+#endif
+       )
+      dt_dev_pixelpipe_cache_disk_put(&(pipe->cache), hash, *output, bufsize, piece->processed_maximum);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
     {
@@ -2152,10 +2493,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 }
 
 
-int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
-                                      int height, float scale)
+static dt_dev_pixelpipe_iop_t *_pixelpipe_gamma(dt_dev_pixelpipe_t *pipe)
 {
-  // temporarily disable gamma mapping.
   GList *gammap = g_list_last(pipe->nodes);
   dt_dev_pixelpipe_iop_t *gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
   while(strcmp(gamma->module->op, "gamma"))
@@ -2165,12 +2504,84 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *de
     if(!gammap) break;
     gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
   }
+  return gamma;
+}
+
+int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
+                                      int height, float scale)
+{
+  // temporarily disable gamma mapping.
+  dt_dev_pixelpipe_iop_t *gamma = _pixelpipe_gamma(pipe);
   if(gamma) gamma->enabled = 0;
   int ret = dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
   if(gamma) gamma->enabled = 1;
   return ret;
 }
 
+int dt_dev_pixelpipe_band_height(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int height)
+{
+  const int band_height = dt_conf_get_int("export_band_height");
+  if(band_height <= 0 || pipe->type != DT_DEV_PIXELPIPE_EXPORT) return 0;
+  int overlap = 0;
+  GList *modules = dev->iop;
+  GList *pieces = pipe->nodes;
+  for(; modules && pieces; modules = g_list_next(modules), pieces = g_list_next(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(_pixelpipe_skip_piece(dev, module, piece)) continue;
+    // modules have to cope with tiles, gamma just converts the pixels.
+    if(!(module->flags() & IOP_FLAGS_ALLOW_TILING) && strcmp(module->op, "gamma")) return 0;
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, &piece->buf_in, &piece->buf_out, &tiling);
+    overlap += tiling.overlap;
+  }
+  // the rows computed again for each band should only be a small part of it
+  const int band = MAX(band_height, 4 * overlap);
+  return band < height ? band : 0;
+}
+
+int dt_dev_pixelpipe_process_bands(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *output,
+                                   const int no_gamma, int x, int y, int width, int height, float scale,
+                                   const int band_height)
+{
+  dt_dev_pixelpipe_iop_t *gamma = no_gamma ? _pixelpipe_gamma(pipe) : NULL;
+  if(gamma) gamma->enabled = 0;
+
+  // the format of the output is the one of the last module
+  int bpp = get_output_bpp(NULL, pipe, NULL, dev);
+  GList *modules = g_list_last(dev->iop);
+  GList *pieces = g_list_last(pipe->nodes);
+  for(; modules && pieces; modules = g_list_previous(modules), pieces = g_list_previous(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(_pixelpipe_skip_piece(dev, module, piece)) continue;
+    bpp = get_output_bpp(module, pipe, piece, dev);
+    break;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+  const double trace_begin = dt_trace_clock();
+  pipe->bands = 1;
+  int ret = 0;
+  int cnt = 0;
+  for(int b = 0; b < height && !ret; b += band_height, cnt++)
+  {
+    const int rows = MIN(band_height, height - b);
+    ret = dt_dev_pixelpipe_process(pipe, dev, x, y + b, width, rows, scale);
+    if(!ret) memcpy((uint8_t *)output + (size_t)bpp * width * b, pipe->backbuf, (size_t)bpp * width * rows);
+  }
+  pipe->bands = 0;
+  pipe->band_expanding = NULL;
+  if(gamma) gamma->enabled = 1;
+  dt_show_times(&start, "[dev_pixelpipe]", "processed %d bands of %d rows [%s]", cnt, band_height,
+                _pipe_type_to_str(pipe->type));
+  _pixelpipe_trace(pipe, "bands", trace_begin);
+  return ret;
+}
+
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op)
 {
   GList *nodes = g_list_last(pipe->nodes);
@@ -2254,6 +2665,7 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
+  const double trace_begin = dt_trace_clock();
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_enabled(); // update enabled flag from preferences
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
@@ -2289,6 +2701,11 @@ restart:
   if(pipe->cache_obsolete) dt_dev_pixelpipe_cache_flush(&(pipe->cache));
   pipe->cache_obsolete = 0;
 
+  // keys of all cache lines for this run
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  dt_dev_pixelpipe_cache_chain_hashes(pipe);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
   // mask display off as a starting point
   pipe->mask_display = 0;
 
@@ -2346,19 +2763,24 @@ restart:
   if(err)
   {
     pipe->processing = 0;
+    _pixelpipe_trace(pipe, "process (failed)", trace_begin);
     return 1;
   }
 
   // terminate
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
-  pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
+  pipe->backbuf_hash = dt_hash_fold(dt_dev_pixelpipe_cache_key(pipe, NULL, &roi));
   pipe->backbuf = buf;
+  // the gui draws from it while the next run goes on, so its cache line must stay where it is.
+  if(pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW))
+    dt_dev_pixelpipe_cache_pin(&pipe->cache, buf);
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
   // printf("pixelpipe homebrew process end\n");
   pipe->processing = 0;
+  _pixelpipe_trace(pipe, "process", trace_begin);
   return 0;
 }
 
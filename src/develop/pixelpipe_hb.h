@@ -49,13 +49,15 @@ typedef struct dt_dev_pixelpipe_iop_t
   int enabled;         // used to disable parts of the pipe for export, independent on module itself.
   float iscale;        // input actually just downscaled buffer? iscale*iwidth = actual width
   int iwidth, iheight; // width and height of input buffer
-  uint64_t hash;       // hash of params and enabled.
+  dt_hash_t hash;      // hash of params and enabled.
+  dt_hash_t chain_hash; // hash of this and all pieces before, see dt_dev_pixelpipe_cache_chain_hashes()
   int bpc;             // bits per channel, 32 means float
   int colors;          // how many colors per pixel
   dt_iop_roi_t buf_in,
       buf_out;                // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   float processed_maximum[3]; // sensor saturation after this iop, used internally for caching
+  double process_time;        // seconds spent processing this piece, summed up over all runs of the pipe
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -110,6 +112,10 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_error;
   // running in a tiling context?
   int tiling;
+  // processing one band of rows of the output? see dt_dev_pixelpipe_process_bands()
+  int bands;
+  // piece currently computing rows around the band, which will be cut off afterwards
+  dt_dev_pixelpipe_iop_t *band_expanding;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // input data based on this timestamp:
@@ -130,15 +136,22 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe);
 // inits the preview pixelpipe with plain passthrough input/output and empty input and default caching
 // settings.
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe);
-// inits the pixelpipe with settings optimized for full-image export (no history stack cache)
-int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels);
+// inits the pixelpipe with settings optimized for full-image export (no history stack cache). its cache
+// lines are allocated by dt_dev_pixelpipe_alloc_export().
+int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int levels);
+// allocates the cache lines of an export pipe for bands of band_height rows, or the whole input for 0.
+// call it after dt_dev_pixelpipe_set_input(), before processing. returns 0 if there is not enough memory.
+int dt_dev_pixelpipe_alloc_export(dt_dev_pixelpipe_t *pipe, const int band_height);
 // inits the pixelpipe with settings optimized for thumbnail export (no history stack cache)
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
+// number of export and thumbnail pipes alive right now, at least one.
+int dt_dev_pixelpipe_offscreen_count();
 // inits all but the pixel caches, so you can't actually process an image (just get dimensions and
 // distortions)
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
-// inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// inits the pixelpipe with given cacheline size and number of entries, which may grow
+// to use up to memory_limit bytes (0 for just the given entries).
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit);
 // constructs a new input gegl_buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -171,6 +184,14 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
+// height of the bands dt_dev_pixelpipe_process_bands() should use for an output of the given height, or 0
+// if the pipe can't be processed in bands (disabled, or a module needs to see the whole image).
+int dt_dev_pixelpipe_band_height(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int height);
+// process region of interest in bands of rows, into output (width * height pixels of the pipe's output
+// format). peak memory of the pipe only depends on the band height. returns 1 if pipe was altered.
+int dt_dev_pixelpipe_process_bands(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, void *output,
+                                   const int no_gamma, int x, int y, int width, int height, float scale,
+                                   const int band_height);
 
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
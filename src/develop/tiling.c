@@ -21,14 +21,20 @@
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
 #include "common/opencl.h"
+#include "common/threadpool.h"
+#include "common/trace.h"
 #include "control/control.h"
 
+#include <float.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h>
 #include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define CLAMPI(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 
@@ -92,6 +98,146 @@ void _print_roi(const dt_iop_roi_t *roi, const char *label)
 }
 
 
+/* the tiling planner remembers two things for the whole session: how long modules take for a tile, to
+   choose tile shapes, and which output roi fits an input roi, which is expensive to search for modules
+   distorting the image. */
+
+/* slots for the timings of that many modules */
+#define COST_SLOTS 64
+/* slots for that many roi fits */
+#define FIT_SLOTS 256
+/* what a tile costs on top of its pixels as long as a module has not been measured, in pixels */
+#define TILE_OVERHEAD 16384.0
+
+typedef struct _tiling_cost_t
+{
+  dt_dev_operation_t op;
+  /* sums for a least squares fit of seconds = per_pixel * pixels + per_tile */
+  double n, p, t, pp, pt;
+} _tiling_cost_t;
+
+typedef struct _tiling_fit_t
+{
+  dt_hash_t key;
+  dt_iop_roi_t oroi;
+  int valid;
+} _tiling_fit_t;
+
+static _tiling_cost_t _costs[COST_SLOTS];
+static _tiling_fit_t _fits[FIT_SLOTS];
+static pthread_mutex_t _planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// one event per tile. on the gpu this is only the time to enqueue it.
+static void _tiling_trace(const struct dt_iop_module_t *self, const char *device, const double begin)
+{
+  if(!dt_trace_enabled) return;
+  char name[64];
+  snprintf(name, sizeof(name), "tile %s on %s", self->op, device);
+  dt_trace_complete(DT_TRACE_TILING, name, begin);
+}
+
+static void _cost_record(const char *op, const double pixels, const double seconds)
+{
+  _tiling_cost_t *c = _costs + g_str_hash(op) % COST_SLOTS;
+  pthread_mutex_lock(&_planner_mutex);
+  if(strcmp(c->op, op))
+  {
+    memset(c, 0, sizeof(*c));
+    g_strlcpy(c->op, op, sizeof(c->op));
+  }
+  c->n += 1.0;
+  c->p += pixels;
+  c->t += seconds;
+  c->pp += pixels * pixels;
+  c->pt += pixels * seconds;
+  pthread_mutex_unlock(&_planner_mutex);
+}
+
+/* the cost model of a module: seconds per pixel and per tile. only the ratio matters for planning, so a
+   module which has never been measured gets a made up one. */
+static void _cost_get(const char *op, double *per_pixel, double *per_tile)
+{
+  *per_pixel = 1.0;
+  *per_tile = TILE_OVERHEAD;
+  const _tiling_cost_t *c = _costs + g_str_hash(op) % COST_SLOTS;
+  pthread_mutex_lock(&_planner_mutex);
+  if(!strcmp(c->op, op) && c->n > 0.0 && c->p > 0.0)
+  {
+    const double det = c->n * c->pp - c->p * c->p;
+    const double a = det > 0.0 ? (c->n * c->pt - c->p * c->t) / det : 0.0;
+    const double b = (c->t - a * c->p) / c->n;
+    if(a > 0.0 && b >= 0.0)
+    {
+      *per_pixel = a;
+      *per_tile = b;
+    }
+    else
+    {
+      // all tiles had about the same size, or the timings are too noisy to tell
+      *per_pixel = c->t / c->p;
+      *per_tile = *per_pixel * TILE_OVERHEAD;
+    }
+  }
+  pthread_mutex_unlock(&_planner_mutex);
+}
+
+/* choose width and height of tiles (overlap included) for a region of full_wd x full_ht pixels, with no
+   more than max_area pixels per tile, such that the predicted time for all tiles is shortest. more tiles
+   mean more overlap computed twice and more overhead per tile, and the cost model weighs the two. */
+static void _plan_tiles(const char *op, const int full_wd, const int full_ht, const float max_area,
+                        const int overlap, const int xyalign, int *width, int *height)
+{
+  double per_pixel, per_tile;
+  _cost_get(op, &per_pixel, &per_tile);
+  const int max_tiles = dt_conf_get_int("maximum_number_tiles");
+
+  double best = DBL_MAX;
+  int last_ht = -1;
+  for(int ty = 1; ty <= full_ht; ty++)
+  {
+    const int ht
+        = ty == 1 ? full_ht : _min(_align_up((full_ht + ty - 1) / ty + 2 * overlap, xyalign), full_ht);
+    if(ht == last_ht) continue;
+    last_ht = ht;
+    if(ht <= 2 * overlap) break;
+    const int tiles_y = ht < full_ht ? (full_ht + ht - 2 * overlap - 1) / (ht - 2 * overlap) : 1;
+
+    const float max_wd = max_area / ht;
+    int wd, tiles_x;
+    if(max_wd >= full_wd)
+    {
+      wd = full_wd;
+      tiles_x = 1;
+    }
+    else
+    {
+      wd = _align_down((int)max_wd, xyalign);
+      if(wd <= 2 * overlap) continue;
+      tiles_x = (full_wd + wd - 2 * overlap - 1) / (wd - 2 * overlap);
+    }
+    if(tiles_x * tiles_y > max_tiles) continue;
+
+    // every inner tile border is computed twice, overlap wide on both sides
+    const double pixels = ((double)full_wd + 2.0 * overlap * (tiles_x - 1))
+                          * ((double)full_ht + 2.0 * overlap * (tiles_y - 1));
+    const double cost = per_pixel * pixels + per_tile * tiles_x * tiles_y;
+    if(cost < best)
+    {
+      best = cost;
+      *width = wd;
+      *height = ht;
+    }
+    // more rows of tiles won't make them any wider
+    if(tiles_x == 1 && ty > 1) break;
+  }
+  if(best == DBL_MAX)
+  {
+    // nothing fits the constraints, let the caller find out about the number of tiles
+    *width = *height = _max(_align_down((int)sqrtf(max_area), xyalign), xyalign);
+  }
+}
+
+
 #if 0
 static void
 _nm_constraints(double x[], int n)
@@ -579,13 +725,181 @@ static int _fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_
 }
 
 
+/* the same, but remembers the result for the module, its parameters, the image and the rois. for modules
+   which need the simplex search the fit is often more expensive than processing a tile. */
+static int _fit_output_to_input_roi_cached(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                           const dt_iop_roi_t *iroi, dt_iop_roi_t *oroi, int delta, int iter)
+{
+  const int32_t imgid = piece->pipe->image.id;
+  dt_hash_t key = dt_hash(piece->hash, self->op, strlen(self->op));
+  key = dt_hash(key, &imgid, sizeof(imgid));
+  key = dt_hash(key, &piece->buf_in, sizeof(piece->buf_in));
+  key = dt_hash(key, iroi, sizeof(*iroi));
+  key = dt_hash(key, oroi, sizeof(*oroi));
+  key = dt_hash(key, &delta, sizeof(delta));
+
+  _tiling_fit_t *f = _fits + dt_hash_fold(key) % FIT_SLOTS;
+  pthread_mutex_lock(&_planner_mutex);
+  if(f->valid && dt_hash_equal(f->key, key))
+  {
+    *oroi = f->oroi;
+    pthread_mutex_unlock(&_planner_mutex);
+    return TRUE;
+  }
+  pthread_mutex_unlock(&_planner_mutex);
+
+  const int fit = _fit_output_to_input_roi(self, piece, iroi, oroi, delta, iter);
+  if(fit)
+  {
+    pthread_mutex_lock(&_planner_mutex);
+    f->key = key;
+    f->oroi = *oroi;
+    f->valid = 1;
+    pthread_mutex_unlock(&_planner_mutex);
+  }
+  return fit;
+}
+
+
+/* tiles of _default_process_tiling_ptp() in flight. each lane works on every lanes-th tile with buffers of
+   its own. lanes side by side share the piece and the pipe, which only modules flagged as
+   IOP_FLAGS_TILING_REENTRANT allow: their process() reads those and writes nothing but its output. */
+typedef struct _ptp_tiles_t
+{
+  struct dt_iop_module_t *self;
+  struct dt_dev_pixelpipe_iop_t *piece;
+  void *ivoid, *ovoid;
+  const dt_iop_roi_t *roi_in, *roi_out;
+  int in_bpp, out_bpp, ipitch, opitch;
+  int width, height, overlap, tile_wd, tile_ht, tiles_x, tiles_y;
+  int lanes, omp_threads;
+  void **input, **output;
+  float processed_maximum_saved[3];
+  float *processed_maximum; // 3 per lane, after its last tile
+  int warned;               // a lane found the module changing the pipe
+} _ptp_tiles_t;
+
+static void _ptp_tile(_ptp_tiles_t *t, const int lane, const size_t tx, const size_t ty, const int first)
+{
+  struct dt_iop_module_t *self = t->self;
+  struct dt_dev_pixelpipe_iop_t *piece = t->piece;
+  void *input = t->input[lane];
+  void *output = t->output[lane];
+  const dt_iop_roi_t *roi_in = t->roi_in;
+  const dt_iop_roi_t *roi_out = t->roi_out;
+  const int overlap = t->overlap;
+  const int in_bpp = t->in_bpp, out_bpp = t->out_bpp;
+  const int ipitch = t->ipitch, opitch = t->opitch;
+  void *ivoid = t->ivoid, *ovoid = t->ovoid;
+
+  size_t wd = tx * t->tile_wd + t->width > roi_in->width ? roi_in->width - tx * t->tile_wd : t->width;
+  size_t ht = ty * t->tile_ht + t->height > roi_in->height ? roi_in->height - ty * t->tile_ht : t->height;
+
+  /* no need to process end-tiles that are smaller than overlap */
+  if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) return;
+
+  /* origin and region of effective part of tile, which we want to store later */
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { wd, ht, 1 };
+
+  /* roi_in and roi_out for process_cl on subbuffer */
+  dt_iop_roi_t iroi = { roi_in->x + tx * t->tile_wd, roi_in->y + ty * t->tile_ht, wd, ht, roi_in->scale };
+  dt_iop_roi_t oroi = { roi_out->x + tx * t->tile_wd, roi_out->y + ty * t->tile_ht, wd, ht, roi_out->scale };
+
+  /* offsets of tile into ivoid and ovoid */
+  size_t ioffs = (ty * t->tile_ht) * ipitch + (tx * t->tile_wd) * in_bpp;
+  size_t ooffs = (ty * t->tile_ht) * opitch + (tx * t->tile_wd) * out_bpp;
+
+
+  dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%d, %d) with %d x %d at origin [%d, %d]\n", tx,
+           ty, wd, ht, tx * t->tile_wd, ty * t->tile_ht);
+
+/* prepare input tile buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(input, ivoid, ioffs, wd, ht) firstprivate(in_bpp, ipitch) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < ht; j++)
+    memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
+
+  /* take original processed_maximum as starting point. with several lanes it's left alone anyways. */
+  if(t->lanes == 1)
+    for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = t->processed_maximum_saved[k];
+
+  /* call process() of module */
+  const double start = dt_get_wtime();
+  const double trace_begin = dt_trace_clock();
+  self->process(self, piece, input, output, &iroi, &oroi);
+  _cost_record(self->op, (double)wd * ht, dt_get_wtime() - start);
+  _tiling_trace(self, "CPU", trace_begin);
+
+  /* aggregate resulting processed_maximum */
+  /* TODO: check if there really can be differences between tiles and take
+           appropriate action (calculate minimum, maximum, average, ...?) */
+  float *processed_maximum_new = t->processed_maximum + 3 * lane;
+  for(int k = 0; k < 3; k++)
+  {
+    if(!first && fabs(processed_maximum_new[k] - piece->pipe->processed_maximum[k]) > 1.0e-6f)
+      dt_print(DT_DEBUG_DEV,
+               "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
+               self->op);
+    processed_maximum_new[k] = piece->pipe->processed_maximum[k];
+  }
+  if(t->lanes > 1 && memcmp(processed_maximum_new, t->processed_maximum_saved, sizeof(float) * 3)
+     && __sync_bool_compare_and_swap(&t->warned, 0, 1))
+    dt_print(DT_DEBUG_DEV,
+             "[default_process_tiling_ptp] module '%s' is flagged reentrant, but changes the pipe\n",
+             self->op);
+
+  /* correct origin and region of tile for overlap.
+     make sure that we only copy back the "good" part. */
+  if(tx > 0)
+  {
+    origin[0] += overlap;
+    region[0] -= overlap;
+    ooffs += overlap * out_bpp;
+  }
+  if(ty > 0)
+  {
+    origin[1] += overlap;
+    region[1] -= overlap;
+    ooffs += overlap * opitch;
+  }
+
+/* copy "good" part of tile to output buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(ovoid, ooffs, output, origin, region, wd) \
+  firstprivate(out_bpp, opitch) schedule(static)
+#endif
+  for(size_t j = 0; j < region[1]; j++)
+    memcpy((char *)ovoid + ooffs + j * opitch, (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp,
+           (size_t)region[0] * out_bpp);
+}
+
+static void _ptp_lanes(void *data, const size_t begin, const size_t end)
+{
+  _ptp_tiles_t *t = (_ptp_tiles_t *)data;
+  for(size_t lane = begin; lane < end; lane++)
+  {
+#ifdef _OPENMP
+    const int omp_threads = omp_get_max_threads();
+    omp_set_num_threads(t->omp_threads);
+#endif
+    int first = 1;
+    for(int k = lane; k < t->tiles_x * t->tiles_y; k += t->lanes, first = 0)
+      _ptp_tile(t, lane, k / t->tiles_y, k % t->tiles_y, first);
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads);
+#endif
+  }
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                         void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in,
                                         const dt_iop_roi_t *roi_out, const int in_bpp)
 {
-  void *input = NULL;
-  void *output = NULL;
+  _ptp_tiles_t t = { 0 };
 
   const int out_bpp = self->output_bpp(self, piece->pipe, piece);
   const int ipitch = roi_in->width * in_bpp;
@@ -623,36 +937,6 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   singlebuffer = fmax(available / factor, singlebuffer);
 
-  int width = roi_in->width;
-  int height = roi_in->height;
-
-  /* shrink tile size in case it would exceed singlebuffer size */
-  if((float)width * height * max_bpp * maxbuf > singlebuffer)
-  {
-    const float scale = singlebuffer / ((float)width * height * max_bpp * maxbuf);
-
-    /* TODO: can we make this more efficient to minimize total overlap between tiles? */
-    if(width < height && scale >= 0.333f)
-    {
-      height = floorf(height * scale);
-    }
-    else if(height <= width && scale >= 0.333f)
-    {
-      width = floorf(width * scale);
-    }
-    else
-    {
-      width = floorf(width * sqrt(scale));
-      height = floorf(height * sqrt(scale));
-    }
-  }
-
-  /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
-  {
-    width = height = floorf(sqrtf((float)width * height));
-  }
-
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
      Modules will report alignment requirements via xalign and yalign within tiling_callback().
      Typical use case is demosaic where Bayer pattern requires alignment to a multiple of 2 in x and y
@@ -664,14 +948,21 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
 
   assert(xyalign != 0);
 
+  /* make sure that overlap follows alignment rules by making it wider when needed */
+  const int overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign
+                                                    : tiling.overlap;
+
+  /* pick the tile shape with the least predicted time among all which fit into singlebuffer */
+  int width = roi_in->width;
+  int height = roi_in->height;
+  if((float)width * height * max_bpp * maxbuf > singlebuffer)
+    _plan_tiles(self->op, roi_in->width, roi_in->height, singlebuffer / ((float)max_bpp * maxbuf), overlap,
+                xyalign, &width, &height);
+
   /* properly align tile width and height by making them smaller if needed */
   if(width < roi_in->width) width = (width / xyalign) * xyalign;
   if(height < roi_in->height) height = (height / xyalign) * xyalign;
 
-  /* also make sure that overlap follows alignment rules by making it wider when needed */
-  const int overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign
-                                                    : tiling.overlap;
-
   /* calculate effective tile size */
   const int tile_wd = width - 2 * overlap > 0 ? width - 2 * overlap : 1;
   const int tile_ht = height - 2 * overlap > 0 ? height - 2 * overlap : 1;
@@ -689,120 +980,99 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
     goto error;
   }
 
+  /* work on several tiles at once if the module allows it and there is memory for it. only off-screen
+     pipes, the darkroom keeps its threads. all export and thumbnail pipes alive share the budget for this,
+     or parallel exports would each take all of it. */
+  const float lane_memory = factor * width * height * max_bpp + tiling.overhead;
+  int lanes = 1;
+  if((piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT || piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+     && (self->flags() & IOP_FLAGS_TILING_REENTRANT))
+  {
+    const float shared = available / dt_dev_pixelpipe_offscreen_count();
+    const int fit = fminf(shared / lane_memory, 1024.0f);
+    lanes = _max(1, _min(_min(dt_get_num_threads(), tiles_x * tiles_y), fit));
+  }
 
   dt_print(DT_DEBUG_DEV,
            "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n",
            self->op, roi_in->width, roi_in->height);
   dt_print(DT_DEBUG_DEV,
-           "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n",
-           tiles_x, tiles_y, width, height, overlap);
-
-  /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
-  if(input == NULL)
-  {
-    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
-             self->op);
-    goto error;
-  }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
-  if(output == NULL)
+           "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d, %d at a "
+           "time\n",
+           tiles_x, tiles_y, width, height, overlap, lanes);
+
+  t.self = self;
+  t.piece = piece;
+  t.ivoid = ivoid;
+  t.ovoid = ovoid;
+  t.roi_in = roi_in;
+  t.roi_out = roi_out;
+  t.in_bpp = in_bpp;
+  t.out_bpp = out_bpp;
+  t.ipitch = ipitch;
+  t.opitch = opitch;
+  t.width = width;
+  t.height = height;
+  t.overlap = overlap;
+  t.tile_wd = tile_wd;
+  t.tile_ht = tile_ht;
+  t.tiles_x = tiles_x;
+  t.tiles_y = tiles_y;
+  t.lanes = lanes;
+
+  /* reserve input and output buffers for tiles. if there is not enough memory for all lanes, go with
+     the ones we got, only the first one is a must. */
+  t.input = (void **)calloc(lanes, sizeof(void *));
+  t.output = (void **)calloc(lanes, sizeof(void *));
+  t.processed_maximum = (float *)calloc(3 * lanes, sizeof(float));
+  if(!t.input || !t.output || !t.processed_maximum) goto error;
+  for(int k = 0; k < lanes; k++)
   {
-    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
-             self->op);
-    goto error;
+    t.input[k] = dt_alloc_align(64, (size_t)width * height * in_bpp);
+    t.output[k] = t.input[k] ? dt_alloc_align(64, (size_t)width * height * out_bpp) : NULL;
+    if(t.output[k] == NULL)
+    {
+      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc %s buffer %d for module '%s'\n",
+               t.input[k] ? "output" : "input", k, self->op);
+      if(k == 0) goto error;
+      dt_free_align(t.input[k]);
+      t.input[k] = NULL;
+      lanes = k;
+      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] only %d tiles at a time\n", lanes);
+    }
   }
+  t.lanes = lanes;
+  t.omp_threads = _max(1, dt_get_num_threads() / lanes);
 
   /* store processed_maximum to be re-used and aggregated */
-  float processed_maximum_saved[3];
-  float processed_maximum_new[3] = { 1.0f };
-  for(int k = 0; k < 3; k++) processed_maximum_saved[k] = piece->pipe->processed_maximum[k];
-
+  for(int k = 0; k < 3; k++) t.processed_maximum_saved[k] = piece->pipe->processed_maximum[k];
 
   /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
-    for(size_t ty = 0; ty < tiles_y; ty++)
-    {
-      piece->pipe->tiling = 1;
-
-      size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-      size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
-
-      /* no need to process end-tiles that are smaller than overlap */
-      if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) continue;
-
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
-
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
-
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
-
-
-      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%d, %d) with %d x %d at origin [%d, %d]\n",
-               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
-
-/* prepare input tile buffer */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input, width, ivoid, ioffs, wd, ht) schedule(static)
-#endif
-      for(size_t j = 0; j < ht; j++)
-        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
-
-      /* take original processed_maximum as starting point */
-      for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
-
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k = 0; k < 3; k++)
-      {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->processed_maximum[k]) > 1.0e-6f)
-          dt_print(
-              DT_DEBUG_DEV,
-              "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
-              self->op);
-        processed_maximum_new[k] = piece->pipe->processed_maximum[k];
-      }
-
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap * opitch;
-      }
-
-/* copy "good" part of tile to output buffer */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(ovoid, ooffs, output, width, origin, region,                   \
-                                              wd) schedule(static)
-#endif
-      for(size_t j = 0; j < region[1]; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
-    }
+  piece->pipe->tiling = 1;
+  if(lanes > 1)
+    dt_parallel_for(0, lanes, 1, _ptp_lanes, &t);
+  else
+    _ptp_lanes(&t, 0, 1);
 
   /* copy back final processed_maximum */
-  for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = processed_maximum_new[k];
+  for(int k = 0; k < 3; k++)
+  {
+    for(int l = 1; l < lanes; l++)
+      if(fabs(t.processed_maximum[k] - t.processed_maximum[3 * l + k]) > 1.0e-6f)
+        dt_print(DT_DEBUG_DEV,
+                 "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n",
+                 k, self->op);
+    piece->pipe->processed_maximum[k] = t.processed_maximum[k];
+  }
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  for(int k = 0; k < lanes; k++)
+  {
+    if(t.input[k] != NULL) dt_free_align(t.input[k]);
+    if(t.output[k] != NULL) dt_free_align(t.output[k]);
+  }
+  free(t.input);
+  free(t.output);
+  free(t.processed_maximum);
   piece->pipe->tiling = 0;
   return;
 
@@ -811,8 +1081,14 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  for(int k = 0; k < t.lanes; k++)
+  {
+    if(t.input && t.input[k] != NULL) dt_free_align(t.input[k]);
+    if(t.output && t.output[k] != NULL) dt_free_align(t.output[k]);
+  }
+  free(t.input);
+  free(t.output);
+  free(t.processed_maximum);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -1025,7 +1301,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
       //_print_roi(&oroi_full, "tile oroi_full before optimization");
 
       /* try to find a matching oroi_full */
-      if(!_fit_output_to_input_roi(self, piece, &iroi_full, &oroi_full, delta, 10))
+      if(!_fit_output_to_input_roi_cached(self, piece, &iroi_full, &oroi_full, delta, 10))
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] can not handle requested roi's. tiling for "
                                "module '%s' not possible.\n",
@@ -1098,7 +1374,9 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
       for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process() of module */
+      const double trace_begin = dt_trace_clock();
       self->process(self, piece, input, output, &iroi_full, &oroi_full);
+      _tiling_trace(self, "CPU", trace_begin);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -1419,7 +1697,9 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
       for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process_cl of module */
+      const double trace_begin = dt_trace_clock();
       if(!self->process_cl(self, piece, input, output, &iroi, &oroi)) goto error;
+      _tiling_trace(self, "GPU", trace_begin);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -1780,7 +2060,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
       //_print_roi(&oroi_full, "tile oroi_full before optimization");
 
       /* try to find a matching oroi_full */
-      if(!_fit_output_to_input_roi(self, piece, &iroi_full, &oroi_full, delta, 10))
+      if(!_fit_output_to_input_roi_cached(self, piece, &iroi_full, &oroi_full, delta, 10))
       {
         dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] can not handle requested roi's. tiling "
                                   "for module '%s' not possible.\n",
@@ -1870,7 +2150,9 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
       for(int k = 0; k < 3; k++) piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process_cl of module */
+      const double trace_begin = dt_trace_clock();
       if(!self->process_cl(self, piece, input, output, &iroi_full, &oroi_full)) goto error;
+      _tiling_trace(self, "GPU", trace_begin);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -143,7 +143,8 @@ void CompressImage( u8 const* rgba, const int width, const int height, void* blo
 
 	// loop over blocks
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba)
+#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba) \
+  firstprivate(width, height, bytesPerBlock, flags)
 #endif
 	for( int y = 0; y < height; y += 4 )
 	{
@@ -201,7 +202,8 @@ void DecompressImage( u8* rgba, const int width, const int height, void const* b
 
 	// loop over blocks
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba)
+#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba) \
+  firstprivate(width, height, bytesPerBlock, flags)
 #endif
 	for( int y = 0; y < height; y += 4 )
 	{
@@ -272,6 +272,9 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
           seq++;
         } while(g_file_test(filename, G_FILE_TEST_EXISTS));
       }
+      // take the name before leaving the lock, so the next image being stored doesn't pick it as well
+      FILE *f = fail ? NULL : g_fopen(filename, "wb");
+      if(f) fclose(f);
     }
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
@@ -292,6 +295,12 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   return 0;
 }
 
+// store() only keeps the name and sequence number under the lock, the images are exported side by side
+int parallel(dt_imageio_module_storage_t *self)
+{
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_disk_t) - sizeof(void *);
@@ -498,6 +498,12 @@ void finalize_store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t
   fclose(f);
 }
 
+// store() only keeps the name and sequence number under the lock, the images are exported side by side
+int parallel(dt_imageio_module_storage_t *self)
+{
+  return 1;
+}
+
 size_t params_size(dt_imageio_module_storage_t *self)
 {
   return sizeof(dt_imageio_gallery_t) - 2 * sizeof(void *) - DT_MAX_PATH_FOR_PARAMS;
@@ -48,6 +48,10 @@ DAMAGE.
  * The key for each point is its spatial location in the (d+1)-    *
  * dimensional space.                                              *
  *                                                                 *
+ * Open addressing with linear probing. The entries hold the key   *
+ * next to the value index and are 16 byte aligned, so a probe     *
+ * touches one cache line and the keys can be compared in place.   *
+ *                                                                 *
  *******************************************************************/
 template <int KD, int VD> class HashTablePermutohedral
 {
@@ -75,13 +79,13 @@ public:
   }
 
   // Returns the number of vectors stored.
-  int size()
+  int size() const
   {
     return filled;
   }
 
   // Returns a pointer to the keys array.
-  const short *getKeys()
+  const short *getKeys() const
   {
     return keys;
   }
@@ -92,7 +96,7 @@ public:
     return values;
   }
 
-  /* Returns the index into the hash table for a given key.
+  /* Returns the index into the values array for a given key.
    *     key: a pointer to the position vector.
    *       h: hash of the position vector.
    *  create: a flag specifying whether an entry should be created,
@@ -100,6 +104,7 @@ public:
    */
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
+    if(!create) return findOffset(key, h);
 
     // Double hash table size if necessary
     if(filled >= (capacity / 2) - 1)
@@ -108,30 +113,39 @@ public:
     }
 
     // Find the entry with the given key
+    h &= capacity_bits;
     while(1)
     {
-      Entry e = entries[h];
+      Entry &e = entries[h];
       // check if the cell is empty
-      if(e.keyIdx == -1)
+      if(e.valueIdx == -1)
       {
-        if(!create) return -1; // Return not found.
         // need to create an entry. Store the given key.
-        for(int i = 0; i < KD; i++) keys[filled * KD + i] = key[i];
-        e.keyIdx = filled * KD;
+        for(int i = 0; i < KD; i++) e.key[i] = keys[filled * KD + i] = key[i];
         e.valueIdx = filled * VD;
-        entries[h] = e;
         filled++;
         return e.valueIdx;
       }
 
       // check if the cell has a matching key
-      bool match = true;
-      for(int i = 0; i < KD && match; i++) match = keys[e.keyIdx + i] == key[i];
-      if(match) return e.valueIdx;
+      if(match(e.key, key)) return e.valueIdx;
 
       // increment the bucket with wraparound
-      h++;
-      if(h == capacity) h = 0;
+      h = (h + 1) & capacity_bits;
+    }
+  }
+
+  /* Same as lookupOffset without creating entries, returns -1 if the key isn't there.
+   * The table isn't changed, so threads may do this concurrently. */
+  int findOffset(const short *key, size_t h) const
+  {
+    h &= capacity_bits;
+    while(1)
+    {
+      const Entry &e = entries[h];
+      if(e.valueIdx == -1) return -1;
+      if(match(e.key, key)) return e.valueIdx;
+      h = (h + 1) & capacity_bits;
     }
   }
 
@@ -141,16 +155,16 @@ public:
    */
   float *lookup(const short *k, bool create = true)
   {
-    size_t h = hash(k) & capacity_bits;
-    int offset = lookupOffset(k, h, create);
+    int offset = lookupOffset(k, hash(k), create);
     if(offset < 0)
       return NULL;
     else
       return values + offset;
   };
 
-  /* Hash function used in this implementation. A simple base conversion. */
-  size_t hash(const short *key)
+  /* Hash function used in this implementation. A simple base conversion,
+   * with the high bits folded into the low ones which pick the bucket. */
+  static size_t hash(const short *key)
   {
     size_t k = 0;
     for(int i = 0; i < KD; i++)
@@ -158,10 +172,17 @@ public:
       k += key[i];
       k *= 2531011;
     }
-    return k;
+    return k ^ (k >> 16);
   }
 
 private:
+  static bool match(const short *a, const short *b)
+  {
+    bool match = true;
+    for(int i = 0; i < KD; i++) match &= a[i] == b[i];
+    return match;
+  }
+
   /* Grows the size of the hash table */
   void grow()
   {
@@ -187,13 +208,9 @@ private:
     // Migrate the table of indices.
     for(size_t i = 0; i < oldCapacity; i++)
     {
-      if(entries[i].keyIdx == -1) continue;
-      size_t h = hash(keys + entries[i].keyIdx) & capacity_bits;
-      while(newEntries[h].keyIdx != -1)
-      {
-        h++;
-        if(h == capacity) h = 0;
-      }
+      if(entries[i].valueIdx == -1) continue;
+      size_t h = hash(entries[i].key) & capacity_bits;
+      while(newEntries[h].valueIdx != -1) h = (h + 1) & capacity_bits;
       newEntries[h] = entries[i];
     }
     delete[] entries;
@@ -201,12 +218,12 @@ private:
   }
 
   // Private struct for the hash table entries.
-  struct Entry
+  struct __attribute__((aligned(16))) Entry
   {
-    Entry() : keyIdx(-1), valueIdx(-1)
+    Entry() : valueIdx(-1)
     {
     }
-    int keyIdx;
+    short key[KD];
     int valueIdx;
   };
 
@@ -273,6 +290,15 @@ public:
     scaleFactor = scaleFactorTmp;
 
     hashTables = new HashTablePermutohedral<D, VD>[nThreads];
+
+    // until the threads are merged, the lattice is the first table
+    shards = hashTables;
+    nShards = 1;
+    shardBase = new int[1];
+    shardBase[0] = 0;
+    keys = NULL;
+    values = NULL;
+    nVertices = 0;
   }
 
 
@@ -281,6 +307,13 @@ public:
     delete[] scaleFactor;
     delete[] replay;
     delete[] canonical;
+    if(shards != hashTables)
+    {
+      delete[] shards;
+      delete[] keys;
+      delete[] values;
+    }
+    delete[] shardBase;
     delete[] hashTables;
   }
 
@@ -309,8 +342,11 @@ public:
     for(int i = 0; i <= D; i++)
     {
       float v = elevated[i] * scale;
-      float up = ceilf(v) * (D + 1);
-      float down = floorf(v) * (D + 1);
+      // floorf() and ceilf() are library calls without sse4.1
+      int fl = (int)v;
+      fl -= v < fl;
+      float up = (fl + (v > fl)) * (D + 1);
+      float down = fl * (D + 1);
 
       if(up - elevated[i] < elevated[i] - down)
         greedy[i] = up;
@@ -323,13 +359,20 @@ public:
 
     // rank differential to find the permutation between this simplex and the canonical one.
     // (See pg. 3-4 in paper.)
-    memset(rank, 0, sizeof rank);
+    // without branches, the comparisons are as good as random on noisy images.
+    float differential[D + 1];
+    for(int i = 0; i <= D; i++)
+    {
+      differential[i] = elevated[i] - greedy[i];
+      rank[i] = 0;
+    }
     for(int i = 0; i < D; i++)
       for(int j = i + 1; j <= D; j++)
-        if(elevated[i] - greedy[i] < elevated[j] - greedy[j])
-          rank[i]++;
-        else
-          rank[j]++;
+      {
+        const int smaller = differential[i] < differential[j];
+        rank[i] += smaller;
+        rank[j] += 1 - smaller;
+      }
 
     if(sum > 0)
     {
@@ -391,33 +434,95 @@ public:
     }
   }
 
-  /* Merge the multiple threads' hash tables into the totals. */
+  /* Merge the multiple threads' hash tables into the totals.
+   *
+   * The keys are spread over one shard per thread by their hash, and the threads merge a shard each, so no
+   * two of them ever touch the same table. The shards are then laid out one after the other as the
+   * vertices of the lattice. */
   void merge_splat_threads(void)
   {
-    if(nThreads <= 1) return;
+    if(nThreads <= 1)
+    {
+      values = hashTables[0].getValues();
+      keys = hashTables[0].getKeys();
+      nVertices = hashTables[0].size();
+      return;
+    }
+
+    nShards = nThreads < 256 ? nThreads : 256;
+    shards = new HashTablePermutohedral<D, VD>[nShards];
+    delete[] shardBase;
+    shardBase = new int[nShards + 1];
 
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int *offset_remap[nThreads];
-    for(int i = 1; i < nThreads; i++)
+    // the shard of every vertex of every thread, and its index in there
+    unsigned char *shard[nThreads];
+    int *remap[nThreads];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) shared(shard, remap)
+#endif
+    for(int t = 0; t < nThreads; t++)
     {
-      const short *oldKeys = hashTables[i].getKeys();
-      const float *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
+      const short *oldKeys = hashTables[t].getKeys();
+      const int filled = hashTables[t].size();
+      shard[t] = new unsigned char[filled];
+      remap[t] = new int[filled];
       for(int j = 0; j < filled; j++)
+        shard[t][j] = shardOf(HashTablePermutohedral<D, VD>::hash(oldKeys + j * D));
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) shared(shard, remap)
+#endif
+    for(int s = 0; s < nShards; s++)
+      for(int t = 0; t < nThreads; t++)
       {
-        float *val = hashTables[0].lookup(oldKeys + j * D, true);
-        const float *oldVal = oldVals + j * VD;
-        for(int k = 0; k < VD; k++) val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
+        const short *oldKeys = hashTables[t].getKeys();
+        const float *oldVals = hashTables[t].getValues();
+        const int filled = hashTables[t].size();
+        for(int j = 0; j < filled; j++)
+        {
+          if(shard[t][j] != s) continue;
+          float *val = shards[s].lookup(oldKeys + j * D, true);
+          const float *oldVal = oldVals + j * VD;
+          for(int k = 0; k < VD; k++) val[k] += oldVal[k];
+          remap[t][j] = (val - shards[s].getValues()) / VD;
+        }
       }
+
+    shardBase[0] = 0;
+    for(int s = 0; s < nShards; s++) shardBase[s + 1] = shardBase[s] + shards[s].size();
+    nVertices = shardBase[nShards];
+
+    // lay out the shards one after the other
+    float *newValues = new float[VD * nVertices];
+    short *newKeys = new short[D * nVertices];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) shared(newValues, newKeys)
+#endif
+    for(int s = 0; s < nShards; s++)
+    {
+      memcpy(newValues + VD * shardBase[s], shards[s].getValues(), sizeof(float) * VD * shards[s].size());
+      memcpy(newKeys + D * shardBase[s], shards[s].getKeys(), sizeof(short) * D * shards[s].size());
     }
+    values = newValues;
+    keys = newKeys;
 
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    for(int i = 0; i < nData * (D + 1); i++)
-      if(replay[i].table > 0) replay[i].offset = offset_remap[replay[i].table][replay[i].offset / VD];
+/* Rewrite the offsets in the replay structure from the above generated table. */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(shard, remap)
+#endif
+    for(size_t i = 0; i < nData * (D + 1); i++)
+    {
+      const int t = replay[i].table, j = replay[i].offset / VD;
+      replay[i].offset = (shardBase[shard[t][j]] + remap[t][j]) * VD;
+      replay[i].table = 0;
+    }
 
-    for(int i = 1; i < nThreads; i++) delete[] offset_remap[i];
+    for(int t = 0; t < nThreads; t++)
+    {
+      delete[] shard[t];
+      delete[] remap[t];
+    }
   }
 
   /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
@@ -426,7 +531,7 @@ public:
    */
   void slice(float *col, size_t replay_index)
   {
-    float *base = hashTables[0].getValues();
+    const float *base = values;
     for(int j = 0; j < VD; j++) col[j] = 0;
     for(int i = 0; i <= D; i++)
     {
@@ -442,8 +547,8 @@ public:
   void blur()
   {
     // Prepare arrays
-    float *newValue = new float[VD * hashTables[0].size()];
-    float *oldValue = hashTables[0].getValues();
+    float *newValue = new float[VD * nVertices];
+    float *oldValue = values;
     float *hashTableBase = oldValue;
 
     float zero[VD];
@@ -453,12 +558,12 @@ public:
     for(int j = 0; j <= D; j++)
     {
 #ifdef _OPENMP
-#pragma omp parallel for shared(j, oldValue, newValue, hashTableBase, zero)
+#pragma omp parallel for schedule(static) shared(j, oldValue, newValue, zero)
 #endif
       // For each vertex in the lattice,
-      for(int i = 0; i < hashTables[0].size(); i++) // blur point i in dimension j
+      for(int i = 0; i < nVertices; i++) // blur point i in dimension j
       {
-        const short *key = hashTables[0].getKeys() + i * (D); // keys to current vertex
+        const short *key = keys + i * (D); // keys to current vertex
         short neighbor1[D + 1];
         short neighbor2[D + 1];
         for(int k = 0; k < D; k++)
@@ -469,22 +574,14 @@ public:
         neighbor1[j] = key[j] - D;
         neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
 
-        float *oldVal = oldValue + i * VD;
+        const float *oldVal = oldValue + i * VD;
         float *newVal = newValue + i * VD;
 
-        float *vm1, *vp1;
-
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        if(vm1)
-          vm1 = vm1 - hashTableBase + oldValue;
-        else
-          vm1 = zero;
-
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        if(vp1)
-          vp1 = vp1 - hashTableBase + oldValue;
-        else
-          vp1 = zero;
+        // look up the neighbors
+        const int m1 = vertex(neighbor1);
+        const int p1 = vertex(neighbor2);
+        const float *vm1 = m1 < 0 ? zero : oldValue + m1 * VD;
+        const float *vp1 = p1 < 0 ? zero : oldValue + p1 * VD;
 
         // Mix values of the three vertices
         for(int k = 0; k < VD; k++) newVal[k] = (0.25f * vm1[k] + 0.5f * oldVal[k] + 0.25f * vp1[k]);
@@ -498,7 +595,7 @@ public:
     // depending where we ended up, we may have to copy data
     if(oldValue != hashTableBase)
     {
-      memcpy(hashTableBase, oldValue, hashTables[0].size() * VD * sizeof(float));
+      memcpy(hashTableBase, oldValue, nVertices * VD * sizeof(float));
       delete[] oldValue;
     }
     else
@@ -508,7 +605,22 @@ public:
   }
 
 private:
-  int nData;
+  /* the shard of a key, from the bits of the hash the buckets don't use */
+  int shardOf(size_t h) const
+  {
+    return (int)((((unsigned long long)h * 0x9e3779b97f4a7c15ull) >> 40) % nShards);
+  }
+
+  /* the vertex with the given key, or -1 */
+  int vertex(const short *key) const
+  {
+    const size_t h = HashTablePermutohedral<D, VD>::hash(key);
+    const int s = nShards > 1 ? shardOf(h) : 0;
+    const int offset = shards[s].findOffset(key, h);
+    return offset < 0 ? -1 : shardBase[s] + offset / VD;
+  }
+
+  size_t nData;
   int nThreads;
   const float *scaleFactor;
   const int *canonical;
@@ -522,6 +634,14 @@ private:
   } *replay;
 
   HashTablePermutohedral<D, VD> *hashTables;
+
+  // the lattice after merging: the vertices of all shards one after the other
+  HashTablePermutohedral<D, VD> *shards;
+  int nShards;
+  int *shardBase;
+  const short *keys;
+  float *values;
+  int nVertices;
 };
 
 #endif
@@ -135,7 +135,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     tmp[k] = (float *)malloc((size_t)sizeof(float) * wd * ht);
   }
 
-  for(int level = 1; level < numl_cap; level++) dt_iop_equalizer_wtf(out, tmp, level, width, height);
+  int err = 0;
+  for(int level = 1; level < numl_cap && !err; level++)
+    err = dt_iop_equalizer_wtf(out, tmp, level, width, height);
 
 #if 0
   // printf("transformed\n");
@@ -171,7 +173,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 #endif
   // printf("histogrammed\n");
 
-  for(int l = 1; l < numl_cap; l++)
+  for(int l = 1; l < numl_cap && !err; l++)
   {
     const float lv = (lm - l1) * (l - 1) / (float)(numl_cap - 1) + l1; // appr level in real image.
     const float band = CLAMP((1.0 - lv / d->num_levels), 0, 1.0);
@@ -181,13 +183,22 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
       const float coeff = 2 * dt_draw_curve_calc_value(d->curve[ch == 0 ? 0 : 1], band);
       const int step = 1 << l;
 #if 1 // scale coefficients
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out) firstprivate(ch, coeff, step, chs, width, height) \
+  schedule(static)
+#endif
       for(int j = 0; j < height; j += step)
         for(int i = step / 2; i < width; i += step) out[(size_t)chs * width * j + chs * i + ch] *= coeff;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(out) firstprivate(ch, coeff, step, chs, width, height) \
+  schedule(static)
+#endif
       for(int j = step / 2; j < height; j += step)
+      {
         for(int i = 0; i < width; i += step) out[(size_t)chs * width * j + chs * i + ch] *= coeff;
-      for(int j = step / 2; j < height; j += step)
         for(int i = step / 2; i < width; i += step)
           out[(size_t)chs * width * j + chs * i + ch] *= coeff * coeff;
+      }
 #else // soft-thresholding (shrinkage)
 #define wshrink                                                                                              \
   (copysignf(fmaxf(0.0f, fabsf(out[(size_t)chs * width * j + chs * i + ch]) - (1.0 - coeff)),                \
@@ -203,7 +214,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     }
   }
   // printf("applied\n");
-  for(int level = numl_cap - 1; level > 0; level--) dt_iop_equalizer_iwtf(out, tmp, level, width, height);
+  for(int level = numl_cap - 1; level > 0 && !err; level--)
+    err = dt_iop_equalizer_iwtf(out, tmp, level, width, height);
+  // out of memory half way, pass the image through unchanged
+  if(err) memcpy(out, in, (size_t)chs * sizeof(float) * width * height);
 
   for(int k = 1; k < numl_cap; k++) free(tmp[k]);
   free(tmp);
@@ -25,12 +25,27 @@
 // std cdf(2,2) wavelet:
 // #define gweight(i, j, ii, jj) (wd ? 1.0 : 1.0) //1.0
 #define gbuf(BUF, A, B) ((BUF)[4 * ((size_t)width * ((B)) + ((A))) + ch])
+// weights of a block of columns, side by side
+#define gtmp(I, J) (tmp[(size_t)DT_IOP_EQUALIZER_COLS * (J) + (I)-i0])
+#define DT_IOP_EQUALIZER_COLS 16
 
 
-void dt_iop_equalizer_wtf(float *buf, float **weight_a, const int l, const int width, const int height)
+// the column weights of one block, per thread. returns NULL if that fails.
+static inline float *dt_iop_equalizer_scratch(const int height)
+{
+  float *scratch = dt_alloc_align(64, (size_t)sizeof(float) * DT_IOP_EQUALIZER_COLS * height
+                                          * dt_get_num_threads());
+  if(!scratch) fprintf(stderr, "[equalizer] failed to allocate the wavelet buffers!\n");
+  return scratch;
+}
+
+// both return non-zero, with buf left as it was, if they run out of memory.
+int dt_iop_equalizer_wtf(float *buf, float **weight_a, const int l, const int width, const int height)
 {
   const int wd = (int)(1 + (width >> (l - 1))), ht = (int)(1 + (height >> (l - 1)));
   int ch = 0;
+  float *const scratch = dt_iop_equalizer_scratch(height);
+  if(!scratch) return 1;
   // store weights for luma channel only, chroma uses same basis.
   memset(weight_a[l], 0, (size_t)sizeof(float) * wd * ht);
   for(int j = 0; j < ht - 1; j++)
@@ -40,7 +55,8 @@ void dt_iop_equalizer_wtf(float *buf, float **weight_a, const int l, const int w
   const int st = step / 2;
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(weight_a, buf) private(ch) schedule(static)
+#pragma omp parallel for default(none) shared(weight_a, buf) private(ch) \
+  firstprivate(l, wd, width, height, step, st) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
@@ -65,67 +81,91 @@ void dt_iop_equalizer_wtf(float *buf, float **weight_a, const int l, const int w
     if(i < width)
       for(ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i - st, j) * .5f;
   }
+  const int blocks = (width + DT_IOP_EQUALIZER_COLS - 1) / DT_IOP_EQUALIZER_COLS;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(weight_a, buf) private(ch) schedule(static)
+#pragma omp parallel for default(none) shared(weight_a, buf) \
+  firstprivate(scratch, l, wd, width, height, step, st, blocks) schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int b = 0; b < blocks; b++)
   {
-    // cols
+    // cols, a block of them at a time, so every row is one run through memory instead of a pixel per row
+    const int i0 = b * DT_IOP_EQUALIZER_COLS, i1 = MIN(i0 + DT_IOP_EQUALIZER_COLS, width);
     // precompute weights:
-    float tmp[height];
-    for(int j = 0; j < height - st; j += st) tmp[j] = gweight(i, j, i, j + st);
+    float *const tmp = scratch + (size_t)DT_IOP_EQUALIZER_COLS * height * dt_get_thread_num();
+    for(int j = 0; j < height - st; j += st)
+      for(int i = i0; i < i1; i++) gtmp(i, j) = gweight(i, j, i, j + st);
     int j = st;
     // predict, get detail
     for(; j < height - st; j += step)
-      for(ch = 0; ch < 3; ch++)
-        gbuf(buf, i, j) -= (tmp[j - st] * gbuf(buf, i, j - st) + tmp[j] * gbuf(buf, i, j + st))
-                           / (tmp[j - st] + tmp[j]);
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++)
+          gbuf(buf, i, j) -= (gtmp(i, j - st) * gbuf(buf, i, j - st) + gtmp(i, j) * gbuf(buf, i, j + st))
+                             / (gtmp(i, j - st) + gtmp(i, j));
     if(j < height)
-      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) -= gbuf(buf, i, j - st);
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) -= gbuf(buf, i, j - st);
     // update
-    for(ch = 0; ch < 3; ch++) gbuf(buf, i, 0) += gbuf(buf, i, st) * 0.5;
+    for(int i = i0; i < i1; i++)
+      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, 0) += gbuf(buf, i, st) * 0.5;
     for(j = step; j < height - st; j += step)
-      for(ch = 0; ch < 3; ch++)
-        gbuf(buf, i, j) += (tmp[j - st] * gbuf(buf, i, j - st) + tmp[j] * gbuf(buf, i, j + st))
-                           / (2.0 * (tmp[j - st] + tmp[j]));
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++)
+          gbuf(buf, i, j) += (gtmp(i, j - st) * gbuf(buf, i, j - st) + gtmp(i, j) * gbuf(buf, i, j + st))
+                             / (2.0 * (gtmp(i, j - st) + gtmp(i, j)));
     if(j < height)
-      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st) * .5f;
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st) * .5f;
   }
+  dt_free_align(scratch);
+  return 0;
 }
 
-void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, const int width, const int height)
+int dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, const int width, const int height)
 {
   const int step = 1 << l;
   const int st = step / 2;
   const int wd = (int)(1 + (width >> (l - 1)));
+  float *const scratch = dt_iop_equalizer_scratch(height);
+  if(!scratch) return 1;
 
+  const int blocks = (width + DT_IOP_EQUALIZER_COLS - 1) / DT_IOP_EQUALIZER_COLS;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(weight_a, buf) schedule(static)
+#pragma omp parallel for default(none) shared(weight_a, buf) \
+  firstprivate(scratch, l, wd, width, height, step, st, blocks) schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int b = 0; b < blocks; b++)
   {
-    // cols
-    float tmp[height];
+    // cols, a block at a time as above
+    const int i0 = b * DT_IOP_EQUALIZER_COLS, i1 = MIN(i0 + DT_IOP_EQUALIZER_COLS, width);
+    float *const tmp = scratch + (size_t)DT_IOP_EQUALIZER_COLS * height * dt_get_thread_num();
     int j;
-    for(j = 0; j < height - st; j += st) tmp[j] = gweight(i, j, i, j + st);
+    for(j = 0; j < height - st; j += st)
+      for(int i = i0; i < i1; i++) gtmp(i, j) = gweight(i, j, i, j + st);
     // update coarse
-    for(int ch = 0; ch < 3; ch++) gbuf(buf, i, 0) -= gbuf(buf, i, st) * 0.5f;
+    for(int i = i0; i < i1; i++)
+      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, 0) -= gbuf(buf, i, st) * 0.5f;
     for(j = step; j < height - st; j += step)
-      for(int ch = 0; ch < 3; ch++)
-        gbuf(buf, i, j) -= (tmp[j - st] * gbuf(buf, i, j - st) + tmp[j] * gbuf(buf, i, j + st))
-                           / (2.0 * (tmp[j - st] + tmp[j]));
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++)
+          gbuf(buf, i, j) -= (gtmp(i, j - st) * gbuf(buf, i, j - st) + gtmp(i, j) * gbuf(buf, i, j + st))
+                             / (2.0 * (gtmp(i, j - st) + gtmp(i, j)));
     if(j < height)
-      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) -= gbuf(buf, i, j - st) * .5f;
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) -= gbuf(buf, i, j - st) * .5f;
     // predict
     for(j = st; j < height - st; j += step)
-      for(int ch = 0; ch < 3; ch++)
-        gbuf(buf, i, j) += (tmp[j - st] * gbuf(buf, i, j - st) + tmp[j] * gbuf(buf, i, j + st))
-                           / (tmp[j - st] + tmp[j]);
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++)
+          gbuf(buf, i, j) += (gtmp(i, j - st) * gbuf(buf, i, j - st) + gtmp(i, j) * gbuf(buf, i, j + st))
+                             / (gtmp(i, j - st) + gtmp(i, j));
     if(j < height)
-      for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st);
+      for(int i = i0; i < i1; i++)
+        for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st);
   }
+  dt_free_align(scratch);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(weight_a, buf) schedule(static)
+#pragma omp parallel for default(none) shared(weight_a, buf) firstprivate(l, wd, width, height, step, st) \
+  schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
@@ -149,9 +189,12 @@ void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, const int
     if(i < width)
       for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i - st, j);
   }
+  return 0;
 }
 
 #undef gbuf
+#undef gtmp
+#undef DT_IOP_EQUALIZER_COLS
 #undef gweight
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
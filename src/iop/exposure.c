@@ -41,6 +41,7 @@
 #include "bauhaus/bauhaus.h"
 #include "develop/pixelpipe.h"
 #include "common/histogram.h"
+#include "common/threadpool.h"
 
 #define exposure2white(x) exp2f(-(x))
 #define white2exposure(x) -dt_log2f(fmaxf(0.001, x))
@@ -345,6 +346,28 @@ error:
 }
 #endif
 
+typedef struct dt_iop_exposure_rows_t
+{
+  const float *in;
+  float *out;
+  size_t width;
+  float black, scale;
+} dt_iop_exposure_rows_t;
+
+static void process_rows(void *data, const size_t begin, const size_t end)
+{
+  const dt_iop_exposure_rows_t *r = (const dt_iop_exposure_rows_t *)data;
+  const __m128 blackv = _mm_set1_ps(r->black);
+  const __m128 scalev = _mm_set1_ps(r->scale);
+  for(size_t k = begin; k < end; k++)
+  {
+    const float *in = r->in + 4 * k * r->width;
+    float *out = r->out + 4 * k * r->width;
+    for(size_t j = 0; j < r->width; j++, in += 4, out += 4)
+      _mm_store_ps(out, (_mm_load_ps(in) - blackv) * scalev);
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -358,20 +381,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
   const float black = d->black;
   const float white = exposure2white(d->exposure);
-  const int ch = piece->colors;
   const float scale = 1.0 / (white - black);
-  const __m128 blackv = _mm_set1_ps(black);
-  const __m128 scalev = _mm_set1_ps(scale);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(roi_out, i, o) schedule(static)
-#endif
-  for(int k = 0; k < roi_out->height; k++)
-  {
-    const float *in = ((float *)i) + (size_t)ch * k * roi_out->width;
-    float *out = ((float *)o) + (size_t)ch * k * roi_out->width;
-    for(int j = 0; j < roi_out->width; j++, in += 4, out += 4)
-      _mm_store_ps(out, (_mm_load_ps(in) - blackv) * scalev);
-  }
+  // point-wise and cheap, runs on the shared pool so it doesn't add threads on top of running jobs.
+  dt_iop_exposure_rows_t rows = { (const float *)i, (float *)o, roi_out->width, black, scale };
+  dt_parallel_for(0, roi_out->height, 0, process_rows, &rows);
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
 
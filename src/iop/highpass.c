@@ -81,7 +81,8 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING
+         | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_REENTRANT;
 }
 
 int groups()
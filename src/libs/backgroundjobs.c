@@ -33,7 +33,7 @@ DT_MODULE(1)
 
 typedef struct dt_lib_backgroundjob_element_t
 {
-  GtkWidget *widget, *progressbar, *hbox;
+  GtkWidget *widget, *progressbar, *hbox, *vbox, *details;
 } dt_lib_backgroundjob_element_t;
 
 /* proxy functions */
@@ -43,6 +43,8 @@ static void _lib_backgroundjobs_cancellable(dt_lib_module_t *self, dt_lib_backgr
                                             dt_progress_t *progress);
 static void _lib_backgroundjobs_updated(dt_lib_module_t *self, dt_lib_backgroundjob_element_t *instance,
                                         double value);
+static void _lib_backgroundjobs_details(dt_lib_module_t *self, dt_lib_backgroundjob_element_t *instance,
+                                        const gchar *details);
 
 
 const char *name()
@@ -85,6 +87,7 @@ void gui_init(dt_lib_module_t *self)
   darktable.control->progress_system.proxy.destroyed = _lib_backgroundjobs_destroyed;
   darktable.control->progress_system.proxy.cancellable = _lib_backgroundjobs_cancellable;
   darktable.control->progress_system.proxy.updated = _lib_backgroundjobs_updated;
+  darktable.control->progress_system.proxy.details = _lib_backgroundjobs_details;
 
   // iterate over darktable.control->progress_system.list and add everything that is already there and update
   // its gui_data!
@@ -114,6 +117,7 @@ void gui_cleanup(dt_lib_module_t *self)
   darktable.control->progress_system.proxy.destroyed = NULL;
   darktable.control->progress_system.proxy.cancellable = NULL;
   darktable.control->progress_system.proxy.updated = NULL;
+  darktable.control->progress_system.proxy.details = NULL;
   dt_pthread_mutex_unlock(&darktable.control->progress_system.mutex);
 }
 
@@ -134,6 +138,7 @@ static void *_lib_backgroundjobs_added(dt_lib_module_t *self, gboolean has_progr
   /* initialize the ui elements for job */
   gtk_widget_set_name(GTK_WIDGET(instance->widget), "background_job_eventbox");
   GtkBox *vbox = GTK_BOX(gtk_vbox_new(FALSE, 0));
+  instance->vbox = GTK_WIDGET(vbox);
   instance->hbox = gtk_hbox_new(FALSE, 0);
   gtk_container_set_border_width(GTK_CONTAINER(vbox), 2);
   gtk_container_add(GTK_CONTAINER(instance->widget), GTK_WIDGET(vbox));
@@ -219,6 +224,26 @@ static void _lib_backgroundjobs_updated(dt_lib_module_t *self, dt_lib_background
   if(i_own_lock) dt_control_gdk_unlock();
 }
 
+static void _lib_backgroundjobs_details(dt_lib_module_t *self, dt_lib_backgroundjob_element_t *instance,
+                                        const gchar *details)
+{
+  // second line of text, only added once someone has something to say
+  if(!darktable.control->running) return;
+  gboolean i_own_lock = dt_control_gdk_lock();
+
+  if(!instance->details)
+  {
+    instance->details = gtk_label_new(NULL);
+    gtk_misc_set_alignment(GTK_MISC(instance->details), 0.0, 0.5);
+    gtk_label_set_ellipsize(GTK_LABEL(instance->details), PANGO_ELLIPSIZE_END);
+    gtk_box_pack_start(GTK_BOX(instance->vbox), instance->details, TRUE, TRUE, 0);
+    gtk_widget_show(instance->details);
+  }
+  gtk_label_set_text(GTK_LABEL(instance->details), details);
+
+  if(i_own_lock) dt_control_gdk_unlock();
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,73 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2026 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/lua.h"
+#include "lua/cache.h"
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+
+static void push_number_field(lua_State *L, const char *name, lua_Number value)
+{
+  lua_pushnumber(L, value);
+  lua_setfield(L, -2, name);
+}
+
+// returns a table indexed by cache name, each entry holding the counters of that cache.
+static int cache_stats(lua_State *L)
+{
+  dt_cache_stats_report_t reports[DT_CACHE_STATS_MAX_REPORTS];
+  const int cnt = dt_cache_stats_collect(reports, DT_CACHE_STATS_MAX_REPORTS);
+  lua_newtable(L);
+  for(int k = 0; k < cnt; k++)
+  {
+    const dt_cache_stats_t *s = &reports[k].stats;
+    lua_newtable(L);
+    push_number_field(L, "hits", s->hits);
+    push_number_field(L, "misses", s->misses);
+    push_number_field(L, "evictions", s->evictions);
+    push_number_field(L, "resident", reports[k].resident);
+    push_number_field(L, "quota", reports[k].quota);
+    push_number_field(L, "entries", reports[k].entries);
+    push_number_field(L, "lock_wait", s->lock_wait_us * 1e-6);
+    // alloc_histogram[i] counts allocations which took less than 2^(i-1) microseconds
+    lua_newtable(L);
+    for(int i = 0; i < DT_CACHE_STATS_BINS; i++)
+    {
+      lua_pushnumber(L, s->alloc_hist[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "alloc_histogram");
+    lua_setfield(L, -2, reports[k].name);
+  }
+  return 1;
+}
+
+int dt_lua_init_cache(lua_State *L)
+{
+  dt_lua_push_darktable_lib(L);
+
+  lua_pushstring(L, "cache_stats");
+  lua_pushcfunction(L, &cache_stats);
+  lua_settable(L, -3);
+
+  lua_pop(L, 1);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
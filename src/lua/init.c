@@ -17,6 +17,7 @@
  */
 #include "lua/lua.h"
 #include "lua/init.h"
+#include "lua/cache.h"
 #include "lua/call.h"
 #include "lua/configuration.h"
 #include "lua/database.h"
@@ -127,7 +128,8 @@ static lua_CFunction init_funcs[]
     = { dt_lua_init_glist,         dt_lua_init_image,       dt_lua_init_styles,   dt_lua_init_print,
         dt_lua_init_configuration, dt_lua_init_preferences, dt_lua_init_database, dt_lua_init_gui,
         dt_lua_init_luastorages,   dt_lua_init_tags,        dt_lua_init_film,     dt_lua_init_call,
-        dt_lua_init_view,          dt_lua_init_events,      dt_lua_init_init,     NULL };
+        dt_lua_init_view,          dt_lua_init_events,      dt_lua_init_init,     dt_lua_init_cache,
+        NULL };
 
 
 void dt_lua_init(lua_State *L, const char *lua_command)
@@ -305,6 +305,12 @@ static int version_wrapper()
   return 0;
 }
 
+// the lua callbacks share one state, store one image after the other
+static int parallel_wrapper(struct dt_imageio_module_storage_t *self)
+{
+  return 0;
+}
+
 static dt_imageio_module_storage_t ref_storage = {
   .plugin_name = { 0 },
   .module = NULL,
@@ -326,6 +332,7 @@ static dt_imageio_module_storage_t ref_storage = {
   .free_params = free_params_wrapper,
   .set_params = set_params_wrapper,
   .export_dispatched = empty_wrapper,
+  .parallel = parallel_wrapper,
   .parameter_lua_type = LUAA_INVALID_TYPE,
   .version = version_wrapper,
 
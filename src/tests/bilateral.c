@@ -0,0 +1,168 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// unit test for the bilateral grid: compares the banded splat, the blur and the sse slice to a plain
+// implementation of the same filter, with the grid in floats and in half floats.
+#include "harness.h"
+
+// keep control/conf.h and its glib out
+#define DT_USER_CONFIG_H
+
+#define CLAMPS(A, L, H) ((A) > (L) ? ((A) < (H) ? (A) : (H)) : (L))
+
+typedef char gchar;
+#define g_free(p) free(p)
+
+static const char *precision = "float";
+static int threads = 1;
+
+static gchar *dt_conf_get_string(const char *name)
+{
+  return strcmp(name, "bilateral_grid") ? NULL : strdup(precision);
+}
+
+static int dt_get_num_threads()
+{
+  return threads;
+}
+
+#include "common/bilateral.h"
+
+// weight of corner k of a grid cell, from the position inside it
+static float tent(const int k, const float xf, const float yf, const float zf)
+{
+  return ((k & 1) ? xf : 1.0f - xf) * ((k & 2) ? yf : 1.0f - yf) * ((k & 4) ? zf : 1.0f - zf);
+}
+
+// the filter written down as it is defined: tent splat, 5 tap convolutions with zeros outside the grid,
+// trilinear slice.
+static void reference(const dt_bilateral_t *const g, const float *const in, float *out, const float detail)
+{
+  const int sx = g->size_x, sy = g->size_y, sz = g->size_z;
+  const size_t size = (size_t)sx * sy * sz;
+  float *grid = calloc(size, sizeof(float)), *tmp = calloc(size, sizeof(float));
+  const float norm = 100.0f / (g->sigma_s * g->sigma_s);
+  for(int j = 0; j < g->height; j++)
+    for(int i = 0; i < g->width; i++)
+    {
+      float x, y, z;
+      image_to_grid(g, i, j, in[4 * ((size_t)g->width * j + i)], &x, &y, &z);
+      const int xi = MIN((int)x, sx - 2), yi = MIN((int)y, sy - 2), zi = MIN((int)z, sz - 2);
+      for(int k = 0; k < 8; k++)
+      {
+        const int dx = k & 1, dy = (k >> 1) & 1, dz = (k >> 2) & 1;
+        grid[(xi + dx) + (size_t)sx * ((yi + dy) + (size_t)sy * (zi + dz))]
+            += tent(k, x - xi, y - yi, z - zi) * norm;
+      }
+    }
+  const float gauss[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+  const float deriv[5] = { -2.0f / 16.0f, -4.0f / 16.0f, 0.0f, 4.0f / 16.0f, 2.0f / 16.0f };
+  const int dim[3] = { sx, sy, sz };
+  const size_t stride[3] = { 1, sx, (size_t)sx * sy };
+  for(int d = 0; d < 3; d++)
+  {
+    const float *w = d == 2 ? deriv : gauss;
+    for(int z = 0; z < sz; z++)
+      for(int y = 0; y < sy; y++)
+        for(int x = 0; x < sx; x++)
+        {
+          const int c[3] = { x, y, z };
+          const size_t idx = x + stride[1] * y + stride[2] * z;
+          float sum = 0.0f;
+          for(int t = -2; t <= 2; t++)
+            if(c[d] + t >= 0 && c[d] + t < dim[d]) sum += w[t + 2] * grid[idx + t * (ptrdiff_t)stride[d]];
+          tmp[idx] = sum;
+        }
+    memcpy(grid, tmp, size * sizeof(float));
+  }
+  for(int j = 0; j < g->height; j++)
+    for(int i = 0; i < g->width; i++)
+    {
+      const size_t index = 4 * ((size_t)g->width * j + i);
+      float x, y, z;
+      image_to_grid(g, i, j, in[index], &x, &y, &z);
+      const int xi = MIN((int)x, sx - 2), yi = MIN((int)y, sy - 2), zi = MIN((int)z, sz - 2);
+      float L = 0.0f;
+      for(int k = 0; k < 8; k++)
+      {
+        const int dx = k & 1, dy = (k >> 1) & 1, dz = (k >> 2) & 1;
+        L += grid[(xi + dx) + (size_t)sx * ((yi + dy) + (size_t)sy * (zi + dz))]
+             * tent(k, x - xi, y - yi, z - zi);
+      }
+      out[index] = MAX(0.0f, in[index] - detail * g->sigma_r * 0.04f * L);
+      for(int c = 1; c < 4; c++) out[index + c] = in[index + c];
+    }
+  free(grid);
+  free(tmp);
+}
+
+static int run(const int width, const int height, const float sigma_s, const float sigma_r, const float detail)
+{
+  const size_t size = sizeof(float) * 4 * width * height;
+  const size_t n = (size_t)4 * width * height;
+  float *in = test_image(width, height, 0.5f);
+  float *ref = dt_alloc_align(64, size), *out = dt_alloc_align(64, size);
+
+  precision = "float";
+  dt_bilateral_t *g = dt_bilateral_init(width, height, sigma_s, sigma_r);
+  double t = now();
+  reference(g, in, ref, detail);
+  const double t_ref = now() - t;
+  dt_bilateral_free(g);
+
+  int fail = 0;
+  for(int mode = 0; mode < 4; mode++)
+  {
+    precision = mode & 1 ? "half" : "float";
+    threads = mode & 2 ? 5 : 1;
+    t = now();
+    g = dt_bilateral_init(width, height, sigma_s, sigma_r);
+    dt_bilateral_splat(g, in);
+    dt_bilateral_blur(g);
+    dt_bilateral_slice(g, in, out, detail);
+    const double t_out = now() - t;
+    float err = compare(out, ref, n);
+    // the other slice adds onto what's in out already
+    memcpy(out, in, size);
+    dt_bilateral_slice_to_output(g, in, out, detail);
+    for(size_t k = 0; k < n; k += 4) err = fmaxf(err, fabsf(out[k] - ref[k]));
+    dt_bilateral_free(g);
+    fprintf(stderr, "%4dx%-4d sigma %g %g %s %d bands", width, height, sigma_s, sigma_r, precision, threads);
+    fail |= report(err, mode & 1 ? 0.02f : 1e-3f, t_out, t_ref);
+  }
+  free(in);
+  free(ref);
+  free(out);
+  return fail;
+}
+
+int main(void)
+{
+  int fail = 0;
+  fail |= run(300, 200, 8.0f, 10.0f, -1.0f);
+  fail |= run(37, 21, 3.0f, 5.0f, 1.0f);
+  fail |= run(17, 3, 1.0f, 20.0f, -0.5f);
+  fail |= run(1000, 700, 20.0f, 8.0f, -1.0f);
+  fprintf(stderr, fail ? "failed\n" : "ok\n");
+  exit(fail);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -18,8 +18,10 @@
 
 
 #define DT_UNIT_TEST
+#define _DEFAULT_SOURCE // for usleep()
 // define dt alloc, so we don't need to include the rest of dt:
 #define dt_alloc_align(A, B) malloc(B)
+#define dt_free_align(A) free(A)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 // unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it.
@@ -33,7 +35,7 @@
 #include <omp.h>
 #endif
 
-int32_t alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
+int32_t alloc_dummy(void *data, const uint32_t key, size_t *cost, void **buf)
 {
   *cost = 1; // also the default
   *buf = (void *)(long int)key;
@@ -73,12 +75,10 @@ int main(int argc, char *arg[])
   fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
 
   const int size = dt_cache_size(&cache);
-  const int lru_cnt = lru_check_consistency(&cache);
-  const int lru_cnt_r = lru_check_consistency_reverse(&cache);
-  // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-  assert(size == lru_cnt);
-  assert(lru_cnt_r == lru_cnt);
-  fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+  const int hash_cnt = hash_check_consistency(&cache);
+  // fprintf(stderr, "hash lists contain %d/%d entries\n", hash_cnt, size);
+  assert(size == hash_cnt);
+  fprintf(stderr, "[passed] cache consistency after removals, have %d entries left.\n", size);
 
   dt_cache_cleanup(&cache);
 
@@ -116,12 +116,10 @@ int main(int argc, char *arg[])
     fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
 
     const int size = dt_cache_size(&cache2);
-    const int lru_cnt = lru_check_consistency(&cache2);
-    const int lru_cnt_r = lru_check_consistency_reverse(&cache2);
-    // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-    assert(size == lru_cnt);
-    assert(lru_cnt_r == lru_cnt);
-    fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+    const int hash_cnt = hash_check_consistency(&cache2);
+    // fprintf(stderr, "hash lists contain %d/%d entries\n", hash_cnt, size);
+    assert(size == hash_cnt);
+    fprintf(stderr, "[passed] cache consistency after removals, have %d entries left.\n", size);
     dt_cache_cleanup(&cache2);
   }
 
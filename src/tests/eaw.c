@@ -0,0 +1,175 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// unit test for the shared edge-avoiding wavelets: compares one scale to the clamped 5x5 loop of the
+// equalizer and denoiseprofile modules, and checks that the in place pyramid gives back its input.
+#include "harness.h"
+
+#include "common/eaw.h"
+#include "common/eaw.c"
+
+static float fast_expf(const float x)
+{
+  union
+  {
+    float f;
+    int32_t i;
+  } k;
+  const float f = (float)0x3f800000u + x * (float)0x00adf880u;
+  k.i = (int32_t)nearbyintf(f);
+  if(k.i < 0) k.i = 0;
+  return k.f;
+}
+
+static float fast_mexp2f(const float x)
+{
+  const float k0 = (float)0x3f800000u + x * ((float)0x3f000000u - (float)0x3f800000u);
+  union
+  {
+    float f;
+    uint32_t i;
+  } k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+// the loop of the modules before, without the sse parts
+static void reference(float *coarse, float *detail, const float *in, const int scale,
+                      const dt_eaw_weight_t weight, const float sharpen, const int width, const int height)
+{
+  static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+  const int mult = 1 << scale;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      const float *px = in + 4 * ((size_t)width * j + i);
+      float sum[4] = { 0.0f }, wgt[4] = { 0.0f };
+      for(int jj = 0; jj < 5; jj++)
+        for(int ii = 0; ii < 5; ii++)
+        {
+          const int x = MIN(MAX(i + mult * (ii - 2), 0), width - 1);
+          const int y = MIN(MAX(j + mult * (jj - 2), 0), height - 1);
+          const float *px2 = in + 4 * ((size_t)width * y + x);
+          float d[4], w[4];
+          for(int c = 0; c < 4; c++) d[c] = (px[c] - px2[c]) * (px[c] - px2[c]);
+          if(weight == DT_EAW_WEIGHT_ATROUS)
+          {
+            w[0] = fast_expf(-sharpen * d[0]);
+            w[1] = w[2] = fast_expf(-sharpen * (d[1] + d[2]));
+            w[3] = 1.0f;
+          }
+          else
+            w[0] = w[1] = w[2] = w[3] = fast_mexp2f(MAX(0, (d[0] + d[1] + d[2]) * sharpen * 0.02f - 9.0f));
+          for(int c = 0; c < 4; c++)
+          {
+            sum[c] += filter[ii] * filter[jj] * w[c] * px2[c];
+            wgt[c] += filter[ii] * filter[jj] * w[c];
+          }
+        }
+      for(int c = 0; c < 4; c++)
+      {
+        coarse[4 * ((size_t)width * j + i) + c] = sum[c] / wgt[c];
+        detail[4 * ((size_t)width * j + i) + c] = px[c] - sum[c] / wgt[c];
+      }
+    }
+}
+
+static int run(const int width, const int height, const int scale, const dt_eaw_weight_t weight,
+               const float sharpen)
+{
+  const size_t size = sizeof(float) * 4 * width * height;
+  const size_t n = (size_t)4 * width * height;
+  float *in = test_image(width, height, 0.5f);
+  float *ref_c = dt_alloc_align(64, size), *ref_d = dt_alloc_align(64, size);
+  float *coarse = dt_alloc_align(64, size), *detail = dt_alloc_align(64, size);
+
+  double t = now();
+  reference(ref_c, ref_d, in, scale, weight, sharpen, width, height);
+  const double t_ref = now() - t;
+  int fail = 0;
+  for(level = 0; level <= max_level(); level++)
+  {
+    dt_eaw_init();
+    t = now();
+    dt_eaw_decompose(coarse, detail, in, scale, weight, sharpen, width, height);
+    const double t_out = now() - t;
+    float err = fmaxf(compare(ref_c, coarse, n), compare(ref_d, detail, n));
+    // in place
+    memcpy(detail, in, size);
+    dt_eaw_decompose(coarse, detail, detail, scale, weight, sharpen, width, height);
+    err = fmaxf(err, compare(ref_d, detail, n));
+    fprintf(stderr, "%4dx%-4d scale %d %s %s", width, height, scale,
+            weight == DT_EAW_WEIGHT_ATROUS ? "atrous " : "denoise", level_name());
+    fail |= report(err, 1e-3f, t_out, t_ref);
+  }
+  free(in);
+  free(ref_c);
+  free(ref_d);
+  free(coarse);
+  free(detail);
+  return fail;
+}
+
+// the pyramid as in the header, without thresholds it has to give back the input
+static int pyramid(const int width, const int height, const int scales, const dt_eaw_weight_t weight)
+{
+  const size_t size = sizeof(float) * 4 * width * height;
+  float *in = test_image(width, height, 0.5f);
+  float *out = dt_alloc_align(64, size);
+  float *buf[8];
+  for(int s = 1; s <= scales; s++) buf[s] = dt_alloc_align(64, size);
+  const float thrs[4] = { 0.0f }, boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  int fail = 0;
+  for(level = 0; level <= max_level(); level++)
+  {
+    dt_eaw_init();
+    dt_eaw_decompose(buf[1], out, in, 0, weight, 0.1f, width, height);
+    for(int s = 1; s < scales; s++)
+      dt_eaw_decompose(buf[s + 1], buf[s], buf[s], s, weight, 0.1f, width, height);
+    for(int s = scales - 1; s > 0; s--)
+      dt_eaw_synthesize(buf[s], buf[s + 1], buf[s], thrs, boost, width, height);
+    dt_eaw_synthesize(out, buf[1], out, thrs, boost, width, height);
+    const float err = compare(in, out, (size_t)4 * width * height);
+    fprintf(stderr, "%4dx%-4d pyramid of %d %s: max error %g\n", width, height, scales, level_name(), err);
+    if(!(err < 1e-3f)) fail = 1;
+  }
+  free(in);
+  free(out);
+  for(int s = 1; s <= scales; s++) free(buf[s]);
+  return fail;
+}
+
+int main(void)
+{
+  int fail = 0;
+  fail |= run(300, 200, 0, DT_EAW_WEIGHT_ATROUS, 0.01f);
+  fail |= run(300, 200, 2, DT_EAW_WEIGHT_ATROUS, 0.001f);
+  fail |= run(37, 21, 3, DT_EAW_WEIGHT_ATROUS, 0.01f);
+  fail |= run(300, 200, 1, DT_EAW_WEIGHT_DENOISE, 0.05f);
+  fail |= run(23, 40, 4, DT_EAW_WEIGHT_DENOISE, 0.2f);
+  fail |= run(1000, 700, 1, DT_EAW_WEIGHT_ATROUS, 0.01f);
+  fail |= pyramid(300, 200, 5, DT_EAW_WEIGHT_ATROUS);
+  fail |= pyramid(61, 33, 4, DT_EAW_WEIGHT_DENOISE);
+  fprintf(stderr, fail ? "failed\n" : "ok\n");
+  exit(fail);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
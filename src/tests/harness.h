@@ -0,0 +1,151 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// shared by the unit tests of the pixel kernels in common/: stand-ins for the bits of darktable they need,
+// a test image, timing and the report. include it first, the kernel sources after it.
+#ifndef DT_TESTS_HARNESS_H
+#define DT_TESTS_HARNESS_H
+
+#define DT_UNIT_TEST
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// DT_SIMD_*, the tests go through the levels they have variants for
+static int level = 3;
+
+void *dt_simd_select_impl(void *scalar, void *sse2, void *avx2, void *avx512)
+{
+  if(level >= 3 && avx512) return avx512;
+  if(level >= 2 && avx2) return avx2;
+  if(level >= 1 && sse2) return sse2;
+  return scalar;
+}
+
+static inline const char *level_name()
+{
+  static const char *names[4] = { "scalar", "sse   ", "avx2  ", "avx512" };
+  return names[level];
+}
+
+// the highest level this machine runs
+static inline int max_level()
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) return 3;
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return 2;
+  return 1;
+}
+
+// the next this many allocations fail, to test running short on memory
+static int alloc_failures = 0;
+
+static inline void *dt_alloc_align(size_t alignment, size_t size)
+{
+  if(__sync_fetch_and_sub(&alloc_failures, 1) > 0) return NULL;
+  __sync_fetch_and_add(&alloc_failures, 1);
+  void *p = NULL;
+  return posix_memalign(&p, alignment, size) ? NULL : p;
+}
+#define dt_free_align(p) free(p)
+
+typedef void (*dt_threadpool_range_t)(void *data, const size_t begin, const size_t end);
+
+typedef struct _parallel_for_t
+{
+  dt_threadpool_range_t fn;
+  void *data;
+  size_t next, end;
+} _parallel_for_t;
+
+static inline void *_parallel_for_worker(void *arg)
+{
+  _parallel_for_t *p = (_parallel_for_t *)arg;
+  size_t k;
+  // uneven chunks, to see that tiles don't depend on each other
+  while((k = __sync_fetch_and_add(&p->next, 3)) < p->end) p->fn(p->data, k, MIN(k + 3, p->end));
+  return NULL;
+}
+
+// the chunks run on threads of their own, so tiles racing on the same memory show up as errors
+static inline void dt_parallel_for(const size_t begin, const size_t end, const size_t grain,
+                                   dt_threadpool_range_t fn, void *data)
+{
+  (void)grain;
+  _parallel_for_t p = { fn, data, begin, end };
+  pthread_t threads[4];
+  int started = 0;
+  for(int k = 0; k < 4; k++)
+    if(!pthread_create(threads + started, NULL, _parallel_for_worker, &p)) started++;
+  _parallel_for_worker(&p);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+}
+
+static inline double now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// smooth gradients with noise, values around those of Lab
+static inline float *test_image(const int width, const int height, const float alpha)
+{
+  float *in = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  srand(width + height);
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *px = in + 4 * ((size_t)width * j + i);
+      px[0] = 50.0f + 40.0f * sinf(i * 0.05f) * cosf(j * 0.03f) + 4.0f * (rand() / (float)RAND_MAX - 0.5f);
+      px[1] = 20.0f * sinf(j * 0.02f) + 8.0f * (rand() / (float)RAND_MAX - 0.5f);
+      px[2] = -10.0f + 8.0f * (rand() / (float)RAND_MAX - 0.5f);
+      px[3] = alpha;
+    }
+  return in;
+}
+
+// largest difference of the first n floats
+static inline float compare(const float *a, const float *b, const size_t n)
+{
+  float err = 0.0f;
+  for(size_t k = 0; k < n; k++) err = fmaxf(err, fabsf(a[k] - b[k]));
+  return err;
+}
+
+// ends the line about a run, returns 1 if it failed
+static inline int report(const float err, const float tolerance, const double t_out, const double t_ref)
+{
+  fprintf(stderr, ": max error %g, %.3fs instead of %.3fs\n", err, t_out, t_ref);
+  return !(err < tolerance);
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
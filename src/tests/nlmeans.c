@@ -0,0 +1,168 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// unit test for the cache blocked nlmeans: compares it to the sliding window over the whole image, one shift
+// after the other, which the modules used before.
+#include "harness.h"
+
+#include "common/nlmeans.h"
+#include "common/nlmeans.c"
+
+static float fast_mexp2f(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = i1 + x * (i2 - i1);
+  union
+  {
+    float f;
+    uint32_t i;
+  } k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+// the loop of the modules before, without the sse parts
+static void reference(const float *in, float *out, const int width, const int height,
+                      const dt_nlmeans_param_t *p)
+{
+  const int P = p->P, K = p->K;
+  float *S = calloc(width, sizeof(float));
+  memset(out, 0, sizeof(float) * 4 * width * height);
+  for(int kj = -K; kj <= K; kj++)
+    for(int ki = -K; ki <= K; ki++)
+    {
+      int inited_slide = 0;
+      for(int j = 0; j < height; j++)
+      {
+        if(j + kj < 0 || j + kj >= height) continue;
+        const float *ins = in + 4 * ((size_t)width * (j + kj) + ki);
+        float *o = out + 4 * (size_t)width * j;
+        const int Pm = MIN(MIN(P, j + kj), j);
+        const int PM = MIN(MIN(P, height - 1 - j - kj), height - 1 - j);
+        if(!inited_slide)
+        {
+          memset(S, 0, sizeof(float) * width);
+          for(int jj = -Pm; jj <= PM; jj++)
+            for(int i = MAX(0, -ki); i < width + MIN(0, -ki); i++)
+            {
+              const float *a = in + 4 * ((size_t)width * (j + jj) + i);
+              const float *b = in + 4 * ((size_t)width * (j + jj + kj) + i + ki);
+              for(int c = 0; c < 3; c++) S[i] += (a[c] - b[c]) * (a[c] - b[c]) * p->norm2[c];
+            }
+          if(Pm == P && PM == P) inited_slide = 1;
+        }
+        float *s = S;
+        float slide = 0.0f;
+        for(int i = 0; i < 2 * P + 1; i++) slide += s[i];
+        for(int i = 0; i < width; i++, s++, ins += 4, o += 4)
+        {
+          if(i - P > 0 && i + P < width) slide += s[P] - s[-P - 1];
+          if(i + ki >= 0 && i + ki < width)
+          {
+            const float w = fast_mexp2f(fmaxf(0.0f, slide * p->sharpness - p->offset));
+            for(int c = 0; c < 3; c++) o[c] += ins[c] * w;
+            o[3] += w;
+          }
+        }
+        if(inited_slide && j + P + 1 + MAX(0, kj) < height)
+        {
+          for(int i = MAX(0, -ki); i < width + MIN(0, -ki); i++)
+          {
+            const float *a = in + 4 * ((size_t)width * (j + P + 1) + i);
+            const float *b = in + 4 * ((size_t)width * (j + P + 1 + kj) + i + ki);
+            const float *am = in + 4 * ((size_t)width * (j - P) + i);
+            const float *bm = in + 4 * ((size_t)width * (j - P + kj) + i + ki);
+            for(int c = 0; c < 3; c++)
+              S[i] += ((a[c] - b[c]) * (a[c] - b[c]) - (am[c] - bm[c]) * (am[c] - bm[c])) * p->norm2[c];
+          }
+        }
+        else
+          inited_slide = 0;
+      }
+    }
+  free(S);
+}
+
+// largest difference of the normalized pixels
+static float compare_normalized(const float *a, const float *b, const int width, const int height)
+{
+  float err = 0.0f;
+  for(size_t k = 0; k < (size_t)width * height; k++)
+    for(int c = 0; c < 3; c++)
+      err = fmaxf(err, fabsf(a[4 * k + c] / a[4 * k + 3] - b[4 * k + c] / b[4 * k + 3]));
+  return err;
+}
+
+static int run(const int width, const int height, const dt_nlmeans_param_t *p)
+{
+  float *in = test_image(width, height, 0.0f);
+  float *ref = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+
+  double t = now();
+  reference(in, ref, width, height, p);
+  const double t_ref = now() - t;
+  int fail = 0;
+  for(level = 0; level <= max_level(); level++)
+  {
+    dt_nlmeans_init();
+    memset(out, 0x55, sizeof(float) * 4 * width * height);
+    t = now();
+    fail |= dt_nlmeans_accumulate(in, out, width, height, p);
+    const double t_out = now() - t;
+    fprintf(stderr, "%4dx%-4d P %d K %d %s", width, height, p->P, p->K, level_name());
+    fail |= report(compare_normalized(ref, out, width, height), 1e-2f, t_out, t_ref);
+  }
+  // threads which can't get their scratch memory leave their tiles to the one retrying
+  memset(out, 0x55, sizeof(float) * 4 * width * height);
+  alloc_failures = 1;
+  t = now();
+  fail |= dt_nlmeans_accumulate(in, out, width, height, p);
+  const double t_out = now() - t;
+  alloc_failures = 0;
+  fprintf(stderr, "%4dx%-4d P %d K %d short on memory", width, height, p->P, p->K);
+  fail |= report(compare_normalized(ref, out, width, height), 1e-2f, t_out, t_ref);
+  free(in);
+  free(ref);
+  free(out);
+  return fail;
+}
+
+int main(void)
+{
+  const float nL = 1.0f / 120.0f, nC = 1.0f / 512.0f;
+  // as in the nlmeans module
+  const dt_nlmeans_param_t nlmeans = { 2, 7, { nL * nL, nC * nC, nC * nC }, 3000.0f / 51.0f, 0.0f };
+  // as in denoiseprofile
+  const dt_nlmeans_param_t profile = { 1, 7, { 1.0f, 1.0f, 1.0f }, 0.015f / 3.0f, 2.0f };
+  const dt_nlmeans_param_t small = { 0, 2, { 1.0f, 1.0f, 1.0f }, 0.05f, 2.0f };
+  int fail = 0;
+  fail |= run(300, 200, &nlmeans);
+  fail |= run(67, 35, &nlmeans);
+  fail |= run(300, 200, &profile);
+  fail |= run(20, 20, &small);
+  fail |= run(1000, 700, &nlmeans);
+  fprintf(stderr, fail ? "failed\n" : "ok\n");
+  exit(fail);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
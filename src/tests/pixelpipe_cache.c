@@ -0,0 +1,222 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// define dt alloc, so we don't need to include the rest of dt:
+#define dt_alloc_align(A, B) malloc(B)
+#define dt_free_align(A) free(A)
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+// the bits of darktable the cache calls:
+static int fp16 = 0;
+int dt_conf_get_bool(const char *name)
+{
+  return fp16;
+}
+int dt_trace_enabled = 0;
+double dt_trace_now()
+{
+  return 0.0;
+}
+void dt_trace_complete(const char *category, const char *name, const double begin)
+{
+}
+// f16c wherever the machine has it
+void *dt_simd_select_impl(void *scalar, void *sse2, void *avx2, void *avx512)
+{
+  __builtin_cpu_init();
+  return avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c") ? avx2 : scalar;
+}
+
+// unit test for the memory budget of the pixelpipe cache, and the line the gui is drawing from.
+#include "common/half.c"
+#include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_cache.c"
+
+#define LINE (4 * sizeof(float) * 64 * 64)
+
+static dt_hash_t key(const uint64_t k)
+{
+  return dt_hash_seed(k);
+}
+
+// plays one run of a pipe with a few modules. returns the output, as pipe->backbuf would hold it.
+static void *run(dt_dev_pixelpipe_cache_t *cache, const uint64_t first, const int modules, const size_t size)
+{
+  void *buf = NULL;
+  for(int m = 0; m < modules; m++)
+  {
+    if(dt_dev_pixelpipe_cache_get(cache, key(first + m), size, &buf)) memset(buf, m, size);
+    dt_dev_pixelpipe_cache_mark_float(cache, buf);
+  }
+  return buf;
+}
+
+static void check_backbuf(const dt_dev_pixelpipe_cache_t *cache, const void *backbuf,
+                          const unsigned char *copy, const size_t size)
+{
+  int found = 0;
+  for(int k = 0; k < cache->entries; k++) found |= cache->data[k] == backbuf;
+  assert(found);
+  assert(cache->memory <= cache->memory_limit);
+  assert(!memcmp(backbuf, copy, size));
+}
+
+static void evict_with_backbuf()
+{
+  dt_dev_pixelpipe_cache_t cache;
+  // room for ten lines, five of them allocated up front
+  assert(dt_dev_pixelpipe_cache_init(&cache, 5, LINE, 10 * LINE));
+  void *backbuf = run(&cache, 100, 4, LINE);
+  dt_dev_pixelpipe_cache_pin(&cache, backbuf);
+  unsigned char *copy = (unsigned char *)malloc(LINE);
+  memcpy(copy, backbuf, LINE);
+
+  // the next runs need more than the budget, all other lines get freed or reallocated on the way.
+  for(int r = 1; r < 20; r++)
+  {
+    run(&cache, 1000 * r, 6, (1 + r % 3) * LINE);
+    check_backbuf(&cache, backbuf, copy, LINE);
+  }
+  // asking for the hash of the backbuf in a larger size must not grow that line.
+  void *buf = NULL;
+  assert(dt_dev_pixelpipe_cache_get(&cache, key(103), 2 * LINE, &buf));
+  assert(buf != backbuf);
+  check_backbuf(&cache, backbuf, copy, LINE);
+  // flushing only invalidates, the line still can't be reused.
+  dt_dev_pixelpipe_cache_flush(&cache);
+  run(&cache, 50000, 8, LINE);
+  check_backbuf(&cache, backbuf, copy, LINE);
+  printf("[passed] evicting under budget while the backbuf is held\n");
+
+  // once it is released, it goes like any other.
+  dt_dev_pixelpipe_cache_pin(&cache, NULL);
+  int gone = 0;
+  for(int r = 1; r < 20 && !gone; r++)
+  {
+    run(&cache, 60000 + 1000 * r, 6, 3 * LINE);
+    gone = 1;
+    for(int k = 0; k < cache.entries; k++)
+      if(cache.data[k] == backbuf && cache.size[k] == LINE && !memcmp(backbuf, copy, LINE)) gone = 0;
+  }
+  assert(gone);
+  printf("[passed] released backbuf is evicted\n");
+  free(copy);
+  dt_dev_pixelpipe_cache_cleanup(&cache);
+}
+
+static void demote_with_backbuf()
+{
+  dt_dev_pixelpipe_cache_t cache;
+  fp16 = 1;
+  assert(dt_dev_pixelpipe_cache_init(&cache, 5, LINE, 10 * LINE));
+  assert(cache.fp16);
+  void *backbuf = run(&cache, 100, 4, LINE);
+  dt_dev_pixelpipe_cache_pin(&cache, backbuf);
+  unsigned char *copy = (unsigned char *)malloc(LINE);
+  memcpy(copy, backbuf, LINE);
+
+  // halving the other float lines makes room first, the backbuf has to stay floats in the same buffer.
+  int demoted = 0;
+  for(int r = 1; r < 20; r++)
+  {
+    run(&cache, 1000 * r, 6, (1 + r % 3) * LINE);
+    check_backbuf(&cache, backbuf, copy, LINE);
+    for(int k = 0; k < cache.entries; k++)
+    {
+      if(cache.data[k] == backbuf) assert(!(cache.flags[k] & DT_DEV_PIXELPIPE_CACHE_HALF));
+      demoted |= (cache.flags[k] & DT_DEV_PIXELPIPE_CACHE_HALF) != 0;
+    }
+  }
+  assert(demoted);
+  printf("[passed] demoting to half floats while the backbuf is held\n");
+  free(copy);
+  dt_dev_pixelpipe_cache_cleanup(&cache);
+  fp16 = 0;
+}
+
+static void resize_for_bands()
+{
+  dt_dev_pixelpipe_cache_t cache;
+  // as an export pipe: two lines for the whole image
+  assert(dt_dev_pixelpipe_cache_init(&cache, 2, 16 * LINE, 0));
+  run(&cache, 100, 4, 16 * LINE);
+  assert(!dt_dev_pixelpipe_cache_resize(&cache, LINE));
+  assert(dt_dev_pixelpipe_cache_resident(&cache) == 2 * LINE);
+  assert(!dt_dev_pixelpipe_cache_available(&cache, key(103)));
+  // bands fit without growing the lines
+  for(int b = 0; b < 16; b++) run(&cache, 1000 * b, 4, LINE);
+  assert(dt_dev_pixelpipe_cache_resident(&cache) == 2 * LINE);
+  printf("[passed] shrinking the lines to bands\n");
+  dt_dev_pixelpipe_cache_cleanup(&cache);
+
+  // as the export pipe now: no buffers until it's known how large they have to be
+  assert(dt_dev_pixelpipe_cache_init(&cache, 2, 0, 0));
+  assert(dt_dev_pixelpipe_cache_resident(&cache) == 0);
+  assert(!dt_dev_pixelpipe_cache_resize(&cache, LINE));
+  assert(dt_dev_pixelpipe_cache_resident(&cache) == 2 * LINE);
+  for(int b = 0; b < 16; b++) run(&cache, 1000 * b, 4, LINE);
+  assert(dt_dev_pixelpipe_cache_resident(&cache) == 2 * LINE);
+  printf("[passed] allocating the lines for bands\n");
+  dt_dev_pixelpipe_cache_cleanup(&cache);
+}
+
+// the plain conversion rounds like f16c: halves survive the round trip, the floats in between go to the
+// nearest half, ties to even.
+static void half_rounding()
+{
+  dt_half_init();
+  const size_t n = 3 * 0x10000;
+  float *in = (float *)malloc(n * sizeof(float));
+  uint16_t *out = (uint16_t *)malloc(n * sizeof(uint16_t));
+  for(uint32_t h = 0; h < 0x10000; h++)
+  {
+    const float f = dt_half_to_float(h), next = dt_half_to_float(h + 1);
+    if((h & 0x7c00) != 0x7c00) assert(dt_float_to_half(f) == h);
+    in[3 * h] = f;
+    // halfway to the next one up, and a bit above
+    in[3 * h + 1] = (h & 0x7fff) < 0x7bff ? 0.5f * (f + next) : f;
+    in[3 * h + 2] = (h & 0x7fff) < 0x7bff ? 0.5f * (f + next) + (next - f) / 1024.0f : f;
+  }
+  dt_float_to_half_buf(out, in, n);
+  for(size_t k = 0; k < n; k++)
+    if(!isnan(in[k])) assert(out[k] == dt_float_to_half(in[k]));
+  printf("[passed] rounding to half floats\n");
+  free(in);
+  free(out);
+}
+
+int main(int argc, char *arg[])
+{
+  half_rounding();
+  evict_with_backbuf();
+  demote_with_backbuf();
+  resize_for_bands();
+  exit(0);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
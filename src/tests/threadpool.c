@@ -0,0 +1,98 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+#define _DEFAULT_SOURCE // for usleep()
+
+// unit test for the work stealing thread pool: nested loops, and idle work calling loops itself.
+#include "common/threadpool.h"
+#include "common/threadpool.c"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+
+static dt_threadpool_t *pool;
+static long int outer_done = 0;
+static int32_t jobs = 0;
+
+static void sum_range(void *data, const size_t begin, const size_t end)
+{
+  long int sum = 0;
+  for(size_t k = begin; k < end; k++) sum += k;
+  __sync_fetch_and_add((long int *)data, sum);
+}
+
+static void nested_range(void *data, const size_t begin, const size_t end)
+{
+  for(size_t k = begin; k < end; k++)
+  {
+    long int sum = 0;
+    dt_threadpool_parallel_for(pool, 0, 1000, 7, sum_range, &sum);
+    assert(sum == 999 * 1000 / 2);
+    __sync_fetch_and_add(&outer_done, 1);
+  }
+}
+
+// plays the job system: long running work with loops inside
+static int idle_job(void *data)
+{
+  if(__sync_fetch_and_sub(&jobs, 1) <= 0)
+  {
+    __sync_fetch_and_add(&jobs, 1);
+    return 0;
+  }
+  long int sum = 0;
+  dt_threadpool_parallel_for(pool, 0, 100000, 0, sum_range, &sum);
+  assert(sum == 99999l * 100000 / 2);
+  return 1;
+}
+
+int main(int argc, char *arg[])
+{
+  pool = dt_threadpool_create(8, idle_job, NULL);
+
+  for(int r = 0; r < 200; r++)
+  {
+    outer_done = 0;
+    dt_threadpool_parallel_for(pool, 0, 100, 0, nested_range, NULL);
+    assert(outer_done == 100);
+  }
+  fprintf(stderr, "[passed] nested loops\n");
+
+  __sync_fetch_and_add(&jobs, 50);
+  dt_threadpool_wake(pool);
+  for(int r = 0; r < 200; r++)
+  {
+    long int sum = 0, expected = 0;
+    dt_threadpool_parallel_for(pool, 5, 100005, 0, sum_range, &sum);
+    for(long int k = 5; k < 100005; k++) expected += k;
+    assert(sum == expected);
+  }
+  while(__sync_fetch_and_add(&jobs, 0) > 0) usleep(1000);
+  fprintf(stderr, "[passed] loops from outside while workers run jobs, %ld loops %ld steals\n", pool->loops,
+          pool->steals);
+
+  dt_threadpool_destroy(pool);
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
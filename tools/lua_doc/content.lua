@@ -86,6 +86,10 @@ darktable.print:add_parameter("message","string",[[The string to display which s
 darktable.print_error:set_text([[This function will print its parameter if the Lua logdomain is activated. Start darktable with the "-d lua" command line option to enable the Lua logdomain.]])
 darktable.print_error:add_parameter("message","string",[[The string to display.]])
 
+darktable.cache_stats:set_text([[Returns a table of statistics about the caches of darktable, indexed by the name of the cache (such as "image", "mipmap i2" or "pixelpipe full").]]..para()..
+[[Each entry holds the number of hits, misses and evictions, resident and quota (in bytes, or buffers for the float mipmaps), the number of entries, lock_wait (seconds spent waiting for locks) and alloc_histogram, where the i-th element counts allocations which took less than 2^(i-1) microseconds.]])
+darktable.cache_stats:add_return("table",[[The statistics of all caches.]])
+
 darktable.register_event:set_text([[This function registers a callback to be called when a given event happens.]]..para()..
 [[Events are documented ]]..node_to_string(events,[[in the event section.]]))
 darktable.register_event:add_parameter("event_type","string",[[The name of the event to register to.]])